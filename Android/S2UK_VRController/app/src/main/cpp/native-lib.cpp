@@ -1,9 +1,16 @@
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <cmath>
 #include <jni.h>
 
+#include "Base64.h"
+#include "PacketSchema.h"
+
 constexpr float JOYSTICK_DEADZONE = 0.27f;
 
 float floatRound(
@@ -40,6 +47,29 @@ static void readSVec2(JNIEnv* env, jobject vec2Obj, float &outx, float &outy) {
     env->DeleteLocalRef(cls);
 }
 
+// Kotlin Quaternion (w, x, y, z). False if there is none.
+static bool readQuaternion(JNIEnv* env, jobject quatObj, float &outw, float &outx, float &outy, float &outz) {
+    if (quatObj == nullptr) return false;
+
+    jclass cls = env->GetObjectClass(quatObj);
+    if (cls == nullptr) return false;
+
+    jfieldID fw = env->GetFieldID(cls, "w", "F");
+    jfieldID fx = env->GetFieldID(cls, "x", "F");
+    jfieldID fy = env->GetFieldID(cls, "y", "F");
+    jfieldID fz = env->GetFieldID(cls, "z", "F");
+    const bool ok = fw && fx && fy && fz;
+    if (ok) {
+        outw = env->GetFloatField(quatObj, fw);
+        outx = env->GetFloatField(quatObj, fx);
+        outy = env->GetFloatField(quatObj, fy);
+        outz = env->GetFloatField(quatObj, fz);
+    }
+
+    env->DeleteLocalRef(cls);
+    return ok;
+}
+
 void readSVec3(JNIEnv* env, jobject vec3Obj, float &outx, float &outy, float &outz) {
     outx = outy = outz = 0.0f;
     if (vec3Obj == nullptr) return;
@@ -61,164 +91,24 @@ void readSVec3(JNIEnv* env, jobject vec3Obj, float &outx, float &outy, float &ou
 }
 
 static std::string base64_encode(const std::string &in) {
-    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    std::string out;
-    out.reserve(((in.size() + 2) / 3) * 4);
-    size_t i = 0;
-    while (i + 2 < in.size()) {
-        unsigned a = static_cast<unsigned char>(in[i++]);
-        unsigned b = static_cast<unsigned char>(in[i++]);
-        unsigned c = static_cast<unsigned char>(in[i++]);
-        out.push_back(table[(a >> 2) & 0x3F]);
-        out.push_back(table[((a & 0x3) << 4) | (b >> 4)]);
-        out.push_back(table[((b & 0xF) << 2) | (c >> 6)]);
-        out.push_back(table[c & 0x3F]);
-    }
-    size_t rem = in.size() - i;
-    if (rem == 1) {
-        unsigned a = static_cast<unsigned char>(in[i]);
-        out.push_back(table[(a >> 2) & 0x3F]);
-        out.push_back(table[((a & 0x3) << 4)]);
-        out.push_back('=');
-        out.push_back('=');
-    } else if (rem == 2) {
-        unsigned a = static_cast<unsigned char>(in[i]);
-        unsigned b = static_cast<unsigned char>(in[i+1]);
-        out.push_back(table[(a >> 2) & 0x3F]);
-        out.push_back(table[((a & 0x3) << 4) | (b >> 4)]);
-        out.push_back(table[((b & 0xF) << 2)]);
-        out.push_back('=');
-    }
+    std::string out(s2uk_base64::encodedSize(in.size()), '\0');
+    s2uk_base64::encode(reinterpret_cast<const uint8_t*>(in.data()), in.size(), out.data());
     return out;
 }
 
-static bool isBase64(const std::string& s) {
-    static const std::string table =
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
+// Empty if the input is not base64 at all, throws std::invalid_argument on bad padding.
+static std::vector<uint8_t> base64_decode(const std::string& inputData) {
+    std::vector<uint8_t> out(s2uk_base64::maxDecodedSize(inputData.size()));
     size_t len = 0;
-    for (unsigned char c : s) {
-        if (std::isspace(c)) continue;
-        if (table.find(c) != std::string::npos) {
-            ++len;
-            continue;
-        }
-        if (c == '=') {
-            ++len;
-            continue;
-        }
-        return false;
+    switch (s2uk_base64::decode(inputData.data(), inputData.size(), out.data(), out.size(), len)) {
+        case s2uk_base64::Status::Ok:
+            out.resize(len);
+            return out;
+        case s2uk_base64::Status::BadPadding:
+            throw std::invalid_argument("invalid b64 padding");
+        default:
+            return {};
     }
-
-    return (len % 4 == 0);
-}
-
-static std::vector<uint8_t> base64_decode(std::string& inputData) {
-    if (!isBase64(inputData)) {
-        return {};
-    }
-
-    static const std::array<int8_t, 256> rev = []() {
-        std::array<int8_t, 256> arr;
-        arr.fill(-1);
-        const std::string table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-        for (size_t i = 0; i < table.size(); ++i) arr[static_cast<unsigned char>(table[i])] = static_cast<int8_t>(i);
-        arr[static_cast<unsigned char>('=')] = -2;
-        return arr;
-    }();
-
-    std::vector<uint8_t> out;
-    out.reserve((inputData.size() * 3) / 4);
-
-    int q[4];
-    int qPos = 0;
-
-    auto flush_quad = [&]() {
-        int v0 = q[0], v1 = q[1], v2 = q[2], v3 = q[3];
-
-        if (v0 < 0 || v1 < 0) throw std::invalid_argument("invalid b64 input");
-
-        if (v2 == -2 && v3 == -2) {
-            // 1 byte output "xx=="
-            uint8_t b0 = static_cast<uint8_t>((v0 << 2) | (v1 >> 4));
-            out.push_back(b0);
-        }
-        else if (v3 == -2) {
-            // 2 byte output "xxx="
-            if (v2 < 0) throw std::invalid_argument("invalid b64 padding");
-            uint8_t b0 = static_cast<uint8_t>((v0 << 2) | (v1 >> 4));
-            uint8_t b1 = static_cast<uint8_t>((v1 & 0xF) << 4 | (v2 >> 2));
-            out.push_back(b0);
-            out.push_back(b1);
-        }
-        else {
-            // no padding, 3 bytes v2 & v3 >= 0
-            if (v2 < 0 || v3 < 0) throw std::invalid_argument("invalid b64 input");
-
-            uint8_t b0 = static_cast<uint8_t>((v0 << 2) | (v1 >> 4));
-            uint8_t b1 = static_cast<uint8_t>((v1 & 0xF) << 4 | (v2 >> 2));
-            uint8_t b2 = static_cast<uint8_t>((v2 & 0x3) << 6 | v3);
-            out.push_back(b0);
-            out.push_back(b1);
-            out.push_back(b2);
-        }
-    };
-
-    for (size_t i = 0; i < inputData.size(); ++i) {
-        unsigned char c = static_cast<unsigned char>(inputData[i]);
-        if (std::isspace(c)) continue;
-
-        int8_t val = rev[c];
-        if (val == -1) throw std::invalid_argument("invalid b64 char");
-
-        q[qPos++] = val;
-        if (qPos == 4) {
-            if (q[2] == -2 && q[3] != -2) throw std::invalid_argument("invalid b64 padding");
-            flush_quad();
-            qPos = 0;
-        }
-    }
-
-    if (qPos != 0) {
-        throw std::invalid_argument("truncated b64 wrong padding");
-    }
-
-    return out;
-}
-
-static uint64_t zigzag64(int64_t v) {
-    // ZigZag: map signed -> unsigned
-    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
-}
-
-static int64_t zigzag64Decode(uint64_t z) {
-    // s = (z >> 1) ^ - (int64_t)(z & 1)
-    return static_cast<int64_t>((z >> 1) ^ (~(z & 1) + 1)); // (z >> 1) ^ -static_cast<int64_t>(z & 1)
-}
-
-static void appendVarUint64(std::string &out, uint64_t value) {
-    while (value >= 0x80) {
-        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
-        value >>= 7;
-    }
-    out.push_back(static_cast<char>(value));
-}
-
-static std::optional<std::pair<uint64_t, size_t>> readVarUint64(const uint8_t* data, size_t len) {
-    uint64_t result = 0;
-    int shift = 0;
-    size_t i = 0;
-    while (i < len && shift <= 63) {
-        uint8_t byte = data[i++];
-        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
-        if ((byte & 0x80) == 0) {
-            return std::make_pair(result, i);
-        }
-        shift += 7;
-    }
-
-    return std::nullopt;
 }
 
 static std::string jstringToStdString(JNIEnv* env, jstring jstr) {
@@ -237,67 +127,25 @@ struct DecompressResult {
     float durationSeconds = 0.0f;
 };
 
-DecompressResult decompressResponseData(const std::string& base64Input) {
-    DecompressResult res;
-    auto base64Input_ = base64Input;
+DecompressResult decompressResponseData(const std::vector<uint8_t>& buf);
 
-    std::vector<uint8_t> buf = base64_decode(base64Input_);
-    if (buf.empty()) {
-        res.ok = false;
-        return res;
+DecompressResult decompressResponseData(const std::string& base64Input) {
+    try {
+        return decompressResponseData(base64_decode(base64Input));
+    } catch (const std::invalid_argument&) {
+        return {};
     }
+}
 
-    if (buf.size() < 1) {
-        res.ok = false;
-        return res;
-    }
+DecompressResult decompressResponseData(const std::vector<uint8_t>& buf) {
+    DecompressResult res;
+    s2uk_packet::HapticPacket packet;
+    if (s2uk_packet::decode(buf.data(), buf.size(), packet) != s2uk_packet::Status::Ok) return res;
 
-    size_t offset = 0;
-    uint8_t flags = buf[offset++];
-    res.leftController = (flags & (1 << 0)) != 0;
-
-    // (amp, freq, duration)
-    const size_t remaining = buf.size() - offset;
-    const uint8_t* pdata = buf.data() + offset;
-    size_t used = 0;
-
-    // amplitude
-    auto ampPair = readVarUint64(pdata, remaining);
-    if (!ampPair.has_value()) { res.ok = false; return res; }
-    uint64_t ampZig = ampPair->first;
-    used = ampPair->second;
-    offset += used;
-    pdata += used;
-
-    // frequency
-    size_t remain2 = buf.size() - offset;
-    auto freqPair = readVarUint64(pdata, remain2);
-    if (!freqPair.has_value()) { res.ok = false; return res; }
-    uint64_t freqZig = freqPair->first;
-    used = freqPair->second;
-    offset += used;
-    pdata += used;
-
-    // duration
-    size_t remain3 = buf.size() - offset;
-    auto durPair = readVarUint64(pdata, remain3);
-    if (!durPair.has_value()) { res.ok = false; return res; }
-    uint64_t durZig = durPair->first;
-    used = durPair->second;
-    offset += used;
-
-    // ZigZag decode
-    int64_t ampInt = zigzag64Decode(ampZig);
-    int64_t freqInt = zigzag64Decode(freqZig);
-    int64_t durInt = zigzag64Decode(durZig);
-
-    // Scale down values from original
-    // ampInt = round(amplitude * 1000.0f)
-    // freqInt = round(frequency * 100.0f)
-    // durInt = round(duration * 1000.0f)
-    res.amplitude = static_cast<float>(static_cast<double>(ampInt) / 1000.0);
-    res.frequency = static_cast<float>(static_cast<double>(freqInt) / 100.0);
-    res.durationSeconds  = static_cast<float>(static_cast<double>(durInt) / 1000.0);
+    res.leftController = (packet.flags & s2uk_packet::kFlagLeft) != 0;
+    res.amplitude = static_cast<float>(s2uk_packet::dequantize(packet.amplitude, s2uk_packet::kAmplitudeScale));
+    res.frequency = static_cast<float>(s2uk_packet::dequantize(packet.frequency, s2uk_packet::kFrequencyScale));
+    res.durationSeconds = static_cast<float>(s2uk_packet::dequantize(packet.duration, s2uk_packet::kDurationScale));
 
     // clamp the min value or else you will read zero (required in some scenarios, because of openvr api)
     if (res.durationSeconds <= 0.0f) res.durationSeconds = 0.005f;
@@ -347,6 +195,111 @@ Java_org_s2uk_vrcontroller_MainActivity_decompressInboundPacket(JNIEnv *env, job
     return createInboundDecompressResults(env, res);
 }
 
+extern "C"
+JNIEXPORT jobject JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_decompressInboundPacketRaw(JNIEnv *env, jobject /*thiz*/,
+                                                                   jbyteArray in_data) {
+    DecompressResult res;
+    if (in_data != nullptr) {
+        const jsize len = env->GetArrayLength(in_data);
+        std::vector<uint8_t> buf(static_cast<size_t>(len));
+        env->GetByteArrayRegion(in_data, 0, len, reinterpret_cast<jbyte*>(buf.data()));
+        res = decompressResponseData(buf);
+    }
+
+    if (!res.ok) {
+        return createInboundDecompressResults(env, DecompressResult{});
+    }
+
+    return createInboundDecompressResults(env, res);
+}
+
+// Haptic envelopes from the driver (its HapticEnvelope.h) as one Android waveform: the points
+// back to back, each with the amplitude scaling and on/off cycles generateVibration gives a
+// single pulse, but at the envelope's own durations so the gaps between pulses stay as sent.
+constexpr size_t MAX_WAVEFORM_STEPS = 256; // past this a point plays as one constant step
+
+struct HapticWaveform {
+    bool ok = false;
+    bool leftController = false;
+    std::vector<jlong> timings;
+    std::vector<jint> amplitudes;
+};
+
+static jint waveformAmplitude(int64_t amplitude) {
+    if (amplitude <= 0) return 0; // a pause
+    float amp = static_cast<float>(s2uk_packet::dequantize(amplitude, s2uk_packet::kAmplitudeScale));
+    amp = std::clamp(amp, 0.0f, 1.0f);
+    return std::clamp(static_cast<jint>(amp * 500.0f), 1, 100); // same as MainActivity.generateVibration
+}
+
+HapticWaveform decodeHapticEnvelope(const uint8_t* data, size_t len) {
+    HapticWaveform res;
+    s2uk_packet::HapticEnvelopePacket packet;
+    if (s2uk_packet::decode(data, len, packet) != s2uk_packet::Status::Ok) return res;
+
+    auto step = [&](jlong ms, jint amplitude) {
+        res.timings.push_back(ms);
+        res.amplitudes.push_back(amplitude);
+    };
+    for (size_t i = 0; i < packet.count; ++i) {
+        const s2uk_packet::HapticEnvelopePacket::Point& p = packet.points[i];
+        const int64_t durationMs = p.duration * 1000 / s2uk_packet::kDurationScale;
+        if (durationMs <= 0) continue;
+
+        const jint amplitude = waveformAmplitude(p.amplitude);
+        const float frequency = static_cast<float>(s2uk_packet::dequantize(p.frequency, s2uk_packet::kFrequencyScale));
+        int64_t played = 0;
+        if (amplitude > 0 && frequency > 0.0f) {
+            const float periodMs = 1000.0f / frequency;
+            const auto half = static_cast<int64_t>(periodMs / 2.0f);
+            const auto cycles = static_cast<int64_t>(static_cast<float>(durationMs) / periodMs);
+            if (half > 0 && cycles > 0 && res.timings.size() + 2 * static_cast<size_t>(cycles) <= MAX_WAVEFORM_STEPS) {
+                for (int64_t c = 0; c < cycles; ++c) {
+                    step(half, amplitude);
+                    step(half, 0);
+                }
+                played = cycles * 2 * half;
+            }
+        }
+        // What the cycles leave of the point is off, so the next one starts on time.
+        if (played < durationMs) step(durationMs - played, played > 0 ? 0 : amplitude);
+    }
+
+    res.leftController = (packet.flags & s2uk_packet::kFlagLeft) != 0;
+    res.ok = !res.timings.empty();
+    return res;
+}
+
+extern "C"
+JNIEXPORT jobject JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_decodeHapticEnvelope(JNIEnv *env, jobject /*thiz*/,
+                                                              jbyteArray in_data) {
+    if (in_data == nullptr) return nullptr;
+    const jsize len = env->GetArrayLength(in_data);
+    std::vector<uint8_t> buf(static_cast<size_t>(len));
+    env->GetByteArrayRegion(in_data, 0, len, reinterpret_cast<jbyte*>(buf.data()));
+    const HapticWaveform res = decodeHapticEnvelope(buf.data(), buf.size());
+
+    jclass cls = env->FindClass("org/s2uk/vrcontroller/HapticWaveform");
+    if (cls == nullptr) { env->ExceptionClear(); return nullptr; }
+    jmethodID ctor = env->GetMethodID(cls, "<init>", "(ZZ[J[I)V");
+    if (ctor == nullptr) { env->ExceptionClear(); return nullptr; }
+
+    const auto steps = static_cast<jsize>(res.timings.size());
+    jlongArray timings = env->NewLongArray(steps);
+    jintArray amplitudes = env->NewIntArray(steps);
+    if (timings == nullptr || amplitudes == nullptr) return nullptr;
+    env->SetLongArrayRegion(timings, 0, steps, res.timings.data());
+    env->SetIntArrayRegion(amplitudes, 0, steps, res.amplitudes.data());
+
+    jobject obj = env->NewObject(cls, ctor, res.ok ? JNI_TRUE : JNI_FALSE,
+                                 res.leftController ? JNI_TRUE : JNI_FALSE, timings, amplitudes);
+    env->DeleteLocalRef(timings);
+    env->DeleteLocalRef(amplitudes);
+    return obj;
+}
+
 extern "C"
 JNIEXPORT jobject JNICALL
 Java_org_s2uk_vrcontroller_MainActivity_joyConvertToVec2(
@@ -395,6 +348,182 @@ Java_org_s2uk_vrcontroller_MainActivity_isJoyInDZ(JNIEnv *env, jobject /*thiz*/,
     float magnitude = std::hypot(x,y);
     return magnitude <= JOYSTICK_DEADZONE;
 }
+
+// Packet codecs and orientations as the Java side passes them (TCP_CODEC_*, TCP_ORIENTATION_*).
+// The packets themselves are described in PacketSchema.h, shared with the driver.
+constexpr int WIRE_CODEC_VARINT = 0;
+constexpr int WIRE_CODEC_FIXED = 1;
+constexpr int WIRE_CODEC_DELTA = 2;
+constexpr int WIRE_ORIENTATION_EULER = 0;
+constexpr int WIRE_ORIENTATION_QUAT = 1;
+static_assert(WIRE_CODEC_VARINT == static_cast<int>(s2uk_packet::Codec::Varint) &&
+              WIRE_CODEC_FIXED == static_cast<int>(s2uk_packet::Codec::Fixed) &&
+              WIRE_CODEC_DELTA == static_cast<int>(s2uk_packet::Codec::Delta), "codec ids drifted from PacketSchema.h");
+static_assert(WIRE_ORIENTATION_EULER == static_cast<int>(s2uk_packet::Orientation::Euler) &&
+              WIRE_ORIENTATION_QUAT == static_cast<int>(s2uk_packet::Orientation::Quaternion), "orientation ids drifted from PacketSchema.h");
+
+// Drivers that answer the hello (TCP_CLIENT_HELLO_MSG) may pick another codec and scales;
+// everything else decodes with the defaults.
+static std::atomic<int> wireCodec{WIRE_CODEC_VARINT};
+static std::atomic<int> wireOrientation{WIRE_ORIENTATION_EULER};
+static std::atomic<uint32_t> wireGyroScale{s2uk_packet::kDefaultGyroScale};
+static std::atomic<uint32_t> wireJoyScale{s2uk_packet::kDefaultJoyScale};
+static std::atomic<bool> wireImuBatch{false};
+
+// The delta codec's keyframes and their ids. Starts over with every welcome, like the
+// driver's side of the stream. UI thread only, like the sends.
+static s2uk_packet::DeltaEncoder deltaStream;
+
+static s2uk_packet::Codec currentCodec() {
+    switch (wireCodec.load(std::memory_order_relaxed)) {
+        case WIRE_CODEC_FIXED: return s2uk_packet::Codec::Fixed;
+        case WIRE_CODEC_DELTA: return s2uk_packet::Codec::Delta;
+        default: return s2uk_packet::Codec::Varint;
+    }
+}
+
+// q is MainActivity's corrected orientation (RotationUtils' ZYX convention). The driver's
+// axes are a plain relabelling of those: (w, y, -z, -x), the same rotation its Euler path
+// builds from the angles, without any trig.
+static void packSmallestThree(float qw, float qx, float qy, float qz, uint8_t out[s2uk_packet::kSmallestThreeBytes]) {
+    const double c[4] = {qw, qy, -qz, -qx};
+    s2uk_packet::packSmallestThree(c, out);
+}
+
+// Sensor samples for the IMU batch after each state (s2uk_packet::ImuBatch), kept as they came
+// and quantized when they go out, with whatever format is in use then. UI thread only, like
+// the sensor events and the sends.
+struct PendingImuSample {
+    int64_t timeUs = 0;
+    float gx = 0.0f, gy = 0.0f, gz = 0.0f;
+    float qw = 1.0f, qx = 0.0f, qy = 0.0f, qz = 0.0f;
+    bool hasQuat = false;
+};
+constexpr size_t IMU_RING_SIZE = 32;
+static PendingImuSample imuRing[IMU_RING_SIZE];
+static size_t imuRingHead = 0;    // samples ever added
+static int64_t lastBatchedUs = 0; // newest sample sent so far
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_addImuSample(JNIEnv *env, jobject /*thiz*/,
+                                                     jobject gyro_angle, jobject orientation, jlong sample_time_us) {
+    PendingImuSample& s = imuRing[imuRingHead % IMU_RING_SIZE];
+    s.timeUs = static_cast<int64_t>(sample_time_us);
+    readSVec3(env, gyro_angle, s.gx, s.gy, s.gz);
+    s.hasQuat = readQuaternion(env, orientation, s.qw, s.qx, s.qy, s.qz);
+    ++imuRingHead;
+}
+
+// The samples between the last state and this one (up to kMaxImuSamples of the newest),
+// oldest first, in packet's orientation and scale.
+static s2uk_packet::ImuBatch takeImuBatch(const s2uk_packet::ControllerPacket& packet, uint32_t gyroScale) {
+    s2uk_packet::ImuBatch batch;
+    const int64_t packetUs = static_cast<int64_t>(packet.senderTimeUs);
+    const bool quat = (packet.flags & s2uk_packet::kFlagQuaternion) != 0;
+    const PendingImuSample* picked[s2uk_packet::kMaxImuSamples];
+    size_t n = 0;
+    for (size_t i = 0; i < IMU_RING_SIZE && i < imuRingHead && n < s2uk_packet::kMaxImuSamples; ++i) {
+        const PendingImuSample& s = imuRing[(imuRingHead - 1 - i) % IMU_RING_SIZE];
+        if (s.timeUs <= lastBatchedUs) break;
+        if (s.timeUs >= packetUs || packetUs - s.timeUs > static_cast<int64_t>(UINT32_MAX)) continue;
+        if (quat && !s.hasQuat) continue;
+        picked[n++] = &s;
+    }
+    lastBatchedUs = std::max<int64_t>(lastBatchedUs, packetUs);
+
+    for (size_t i = 0; i < n; ++i) {
+        const PendingImuSample& s = *picked[n - 1 - i];
+        s2uk_packet::ImuSample& out = batch.samples[batch.count++];
+        out.ageUs = static_cast<uint32_t>(packetUs - s.timeUs);
+        if (quat) {
+            packSmallestThree(s.qw, s.qx, s.qy, s.qz, out.quat);
+        } else {
+            out.gyro[0] = s2uk_packet::quantize(s.gx, gyroScale);
+            out.gyro[1] = s2uk_packet::quantize(s.gy, gyroScale);
+            out.gyro[2] = s2uk_packet::quantize(s.gz, gyroScale);
+        }
+    }
+    return batch;
+}
+
+// Raw controller packet, shared by the text (base64) and binary framing paths.
+static std::string encodeControllerState(JNIEnv *env,
+                                         jboolean left_controller,
+                                         jint trigger_state,
+                                         jint grip_state,
+                                         jboolean btn_system_or_menu_state,
+                                         jboolean btn_a_or_x_state,
+                                         jboolean btn_b_or_y_state,
+                                         jobject gyro_angle,
+                                         jobject orientation,
+                                         jobject joy_data,
+                                         jint joy_state,
+                                         jboolean joy_in_dz,
+                                         jfloat controller_battery_percentage,
+                                         jboolean controller_battery_plugged,
+                                         jlong sample_time_us) {
+    // Convert JNI classes to cpp
+    float gx=0.0f, gy=0.0f, gz=0.0f;
+    readSVec3(env, gyro_angle, gx, gy, gz);
+
+    float jx=0.0f, jy=0.0f;
+    readSVec2(env, joy_data, jx, jy);
+
+    s2uk_packet::ControllerPacket packet;
+
+    float qw=1.0f, qx=0.0f, qy=0.0f, qz=0.0f;
+    const bool sendQuat = wireOrientation.load(std::memory_order_relaxed) == WIRE_ORIENTATION_QUAT &&
+                          readQuaternion(env, orientation, qw, qx, qy, qz);
+    if (sendQuat) packSmallestThree(qw, qx, qy, qz, packet.quat);
+
+    const uint32_t gyroScale = wireGyroScale.load(std::memory_order_relaxed);
+    const uint32_t joyScale  = wireJoyScale.load(std::memory_order_relaxed);
+
+    if (left_controller)            packet.flags |= s2uk_packet::kFlagLeft;
+    if (btn_system_or_menu_state)   packet.flags |= s2uk_packet::kFlagSystemOrMenu;
+    if (btn_a_or_x_state)           packet.flags |= s2uk_packet::kFlagAOrX;
+    if (btn_b_or_y_state)           packet.flags |= s2uk_packet::kFlagBOrY;
+    if (controller_battery_plugged) packet.flags |= s2uk_packet::kFlagBatteryPlugged;
+    if (joy_in_dz)                  packet.flags |= s2uk_packet::kFlagJoyInDZ;
+    if (sendQuat)                   packet.flags |= s2uk_packet::kFlagQuaternion;
+
+    // trigger, grip and joy_state are 0..2 each
+    packet.modes = static_cast<uint8_t>(s2uk_packet::kModeTrigger.put(trigger_state) |
+                                        s2uk_packet::kModeGrip.put(grip_state) |
+                                        s2uk_packet::kModeJoy.put(joy_state));
+
+    // battery percentage (clamp 0..100), the caller passes 0.0..1.0
+    const long batteryPercentage = std::lround(controller_battery_percentage * 100.0f);
+    packet.battery = static_cast<uint8_t>(std::clamp<long>(batteryPercentage, 0, s2uk_packet::kMaxBattery));
+
+    if (!sendQuat) {
+        packet.gyro[0] = s2uk_packet::quantize(gx, gyroScale);
+        packet.gyro[1] = s2uk_packet::quantize(gy, gyroScale);
+        packet.gyro[2] = s2uk_packet::quantize(gz, gyroScale);
+    }
+    packet.joy[0] = s2uk_packet::quantize(jx, joyScale);
+    packet.joy[1] = s2uk_packet::quantize(jy, joyScale);
+
+    // sensor event time (SystemClock.elapsedRealtimeNanos() base, in us). The driver maps it
+    // onto its own clock via the ping/pong exchange; older drivers ignore it.
+    packet.senderTimeUs = sample_time_us > 0 ? static_cast<uint64_t>(sample_time_us) : 0;
+
+    uint8_t buf[s2uk_packet::kMaxPacketSize + s2uk_packet::kMaxImuBatchSize];
+    const s2uk_packet::Codec codec = currentCodec();
+    size_t len = codec == s2uk_packet::Codec::Delta
+            ? s2uk_packet::encode(packet, deltaStream, buf)
+            : s2uk_packet::encode(packet, codec, buf);
+
+    // The batch goes after the packet, as much of it as keeps the whole under a UDP entry's
+    // u8 length. Only agreed with binary framing, so never in the base64 path.
+    if (wireImuBatch.load(std::memory_order_relaxed) && packet.senderTimeUs != 0) {
+        const s2uk_packet::ImuBatch batch = takeImuBatch(packet, gyroScale);
+        len += s2uk_packet::encode(packet, batch, buf + len, UINT8_MAX - len);
+    }
+    return std::string(reinterpret_cast<const char*>(buf), len);
+}
+
 extern "C"
 JNIEXPORT jstring JNICALL
 Java_org_s2uk_vrcontroller_MainActivity_compressDataBeforeSending(JNIEnv *env, jobject /*thiz*/,
@@ -405,62 +534,209 @@ Java_org_s2uk_vrcontroller_MainActivity_compressDataBeforeSending(JNIEnv *env, j
                                                                  jboolean btn_a_or_x_state,
                                                                  jboolean btn_b_or_y_state,
                                                                  jobject gyro_angle,
+                                                                 jobject orientation,
                                                                  jobject joy_data,
                                                                  jint joy_state,
                                                                  jboolean joy_in_dz,
                                                                  jfloat controller_battery_percentage,
-                                                                 jboolean controller_battery_plugged) {
-    // Convert JNI classes to cpp
-    float gx=0.0f, gy=0.0f, gz=0.0f;
-    readSVec3(env, gyro_angle, gx, gy, gz);
+                                                                 jboolean controller_battery_plugged,
+                                                                 jlong sample_time_us) {
+    std::string buf = encodeControllerState(env, left_controller, trigger_state, grip_state,
+                                            btn_system_or_menu_state, btn_a_or_x_state, btn_b_or_y_state,
+                                            gyro_angle, orientation, joy_data, joy_state, joy_in_dz,
+                                            controller_battery_percentage, controller_battery_plugged,
+                                            sample_time_us);
 
-    float jx=0.0f, jy=0.0f;
-    readSVec2(env, joy_data, jx, jy);
+    std::string b64 = base64_encode(buf);
 
-    const double gyroScale = 1000.0;
-    const double joyScale  = 100000.0;
-
-    std::string buf;
-    buf.reserve(64);
-
-    uint8_t flags = 0;
-    if (left_controller)          flags |= (1 << 0); // bit0
-    if (btn_system_or_menu_state) flags |= (1 << 1); // bit1
-    if (btn_a_or_x_state)         flags |= (1 << 2); // bit2
-    if (btn_b_or_y_state)         flags |= (1 << 3); // bit3
-    if (controller_battery_plugged) flags |= (1 << 4); // bit4
-    if (joy_in_dz)                flags |= (1 << 5); // bit5
-    buf.push_back(static_cast<char>(flags));
-
-    // bits0-1 trigger, bits2-3 grip, bits4-5 joy_state (each 0..2)
-    uint8_t modes = static_cast<uint8_t>((trigger_state & 0x3) | ((grip_state & 0x3) << 2) | ((joy_state & 0x3) << 4));
-    buf.push_back(static_cast<char>(modes));
-
-    // battery percentage (clamp 0..100) - 1 byte
-    int batteryPercentage = static_cast<int>(std::lround(controller_battery_percentage * 100.0f)); // if caller passed 0.0..1.0
-    if (batteryPercentage < 0) batteryPercentage = 0;
-    if (batteryPercentage > 100) batteryPercentage = 100;
-    buf.push_back(static_cast<char>(static_cast<uint8_t>(batteryPercentage)));
-
-    // pack gyro: gx, gy, gz => int64 -> ZigZag -> varUint64
-    {
-        int64_t gxi = static_cast<int64_t>(std::llround(gx * gyroScale));
-        int64_t gyi = static_cast<int64_t>(std::llround(gy * gyroScale));
-        int64_t gzi = static_cast<int64_t>(std::llround(gz * gyroScale));
-        appendVarUint64(buf, zigzag64(gxi));
-        appendVarUint64(buf, zigzag64(gyi));
-        appendVarUint64(buf, zigzag64(gzi));
-    }
+    return env->NewStringUTF(b64.c_str());
+}
+
+extern "C"
+JNIEXPORT jbyteArray JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_compressDataBeforeSendingRaw(JNIEnv *env, jobject /*thiz*/,
+                                                                    jboolean left_controller,
+                                                                    jint trigger_state,
+                                                                    jint grip_state,
+                                                                    jboolean btn_system_or_menu_state,
+                                                                    jboolean btn_a_or_x_state,
+                                                                    jboolean btn_b_or_y_state,
+                                                                    jobject gyro_angle,
+                                                                    jobject orientation,
+                                                                    jobject joy_data,
+                                                                    jint joy_state,
+                                                                    jboolean joy_in_dz,
+                                                                    jfloat controller_battery_percentage,
+                                                                    jboolean controller_battery_plugged,
+                                                                    jlong sample_time_us) {
+    std::string buf = encodeControllerState(env, left_controller, trigger_state, grip_state,
+                                            btn_system_or_menu_state, btn_a_or_x_state, btn_b_or_y_state,
+                                            gyro_angle, orientation, joy_data, joy_state, joy_in_dz,
+                                            controller_battery_percentage, controller_battery_plugged,
+                                            sample_time_us);
+
+    jbyteArray out = env->NewByteArray(static_cast<jsize>(buf.size()));
+    if (out == nullptr) return nullptr;
+    env->SetByteArrayRegion(out, 0, static_cast<jsize>(buf.size()), reinterpret_cast<const jbyte*>(buf.data()));
+    return out;
+}
+
+// Send pacing. The driver tells each phone how many states per second it wants for its hand
+// (TCP_FRAME_SEND_RATE); until it does, the phone keeps the fixed cadence it always had.
+// Sends sit on a fixed grid so the average rate is exact even though the Java timer only
+// has millisecond resolution.
+constexpr int64_t DEFAULT_SEND_INTERVAL_US = 11000; // the old 11 ms update loop
+constexpr uint64_t MIN_SEND_RATE_HZ = 1;
+constexpr uint64_t MAX_SEND_RATE_HZ = 250; // TCP_CLIENT_MAX_SEND_RATE, advertised in the hello
+
+static std::atomic<int64_t> sendIntervalUs{DEFAULT_SEND_INTERVAL_US};
+static int64_t nextSendUs = 0; // UI thread only
+
+// Payload: s2uk_packet::SendRatePacket.
+// Returns the new rate, or 0 if the frame is for the other hand or malformed.
+extern "C"
+JNIEXPORT jint JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_applySendRate(JNIEnv *env, jobject /*thiz*/,
+                                                      jbyteArray payload, jboolean left_controller) {
+    if (payload == nullptr) return 0;
+    const jsize len = env->GetArrayLength(payload);
+    std::vector<uint8_t> buf(static_cast<size_t>(len));
+    env->GetByteArrayRegion(payload, 0, len, reinterpret_cast<jbyte*>(buf.data()));
+
+    s2uk_packet::SendRatePacket rate;
+    if (s2uk_packet::decode(buf.data(), buf.size(), rate) != s2uk_packet::Status::Ok) return 0;
+
+    const bool left = (rate.flags & s2uk_packet::kFlagLeft) != 0;
+    if (left != static_cast<bool>(left_controller)) return 0;
+    if (rate.hz < MIN_SEND_RATE_HZ || rate.hz > MAX_SEND_RATE_HZ) return 0;
+
+    sendIntervalUs.store(static_cast<int64_t>(1000000 / rate.hz), std::memory_order_relaxed);
+    return static_cast<jint>(rate.hz);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_resetSendRate(JNIEnv * /*env*/, jobject /*thiz*/) {
+    sendIntervalUs.store(DEFAULT_SEND_INTERVAL_US, std::memory_order_relaxed);
+    wireCodec.store(WIRE_CODEC_VARINT, std::memory_order_relaxed);
+    wireOrientation.store(WIRE_ORIENTATION_EULER, std::memory_order_relaxed);
+    wireGyroScale.store(s2uk_packet::kDefaultGyroScale, std::memory_order_relaxed);
+    wireJoyScale.store(s2uk_packet::kDefaultJoyScale, std::memory_order_relaxed);
+    wireImuBatch.store(false, std::memory_order_relaxed);
+    deltaStream = {};
+    lastBatchedUs = 0;
+    nextSendUs = 0;
+}
 
-    // pack joystick: jx, jy
-    {
-        int64_t jxi = static_cast<int64_t>(std::llround(jx * joyScale));
-        int64_t jyi = static_cast<int64_t>(std::llround(jy * joyScale));
-        appendVarUint64(buf, zigzag64(jxi));
-        appendVarUint64(buf, zigzag64(jyi));
+// What the driver's welcome settled on: packet codec, orientation and scales, the rate to
+// start at and whether IMU batches follow the packets. Out of range values keep what we have.
+extern "C"
+JNIEXPORT void JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_applyWireFormat(JNIEnv * /*env*/, jobject /*thiz*/,
+                                                        jint codec, jint orientation, jint gyro_scale, jint joy_scale, jint rate_hz,
+                                                        jboolean imu_batch) {
+    if (codec == WIRE_CODEC_VARINT || codec == WIRE_CODEC_FIXED || codec == WIRE_CODEC_DELTA) wireCodec.store(codec, std::memory_order_relaxed);
+    deltaStream = {}; // the driver dropped our keyframes with the login
+    if (orientation == WIRE_ORIENTATION_EULER || orientation == WIRE_ORIENTATION_QUAT) wireOrientation.store(orientation, std::memory_order_relaxed);
+    if (gyro_scale > 0) wireGyroScale.store(static_cast<uint32_t>(gyro_scale), std::memory_order_relaxed);
+    if (joy_scale > 0) wireJoyScale.store(static_cast<uint32_t>(joy_scale), std::memory_order_relaxed);
+    if (rate_hz >= static_cast<jint>(MIN_SEND_RATE_HZ) && rate_hz <= static_cast<jint>(MAX_SEND_RATE_HZ)) {
+        sendIntervalUs.store(static_cast<int64_t>(1000000 / rate_hz), std::memory_order_relaxed);
     }
+    wireImuBatch.store(imu_batch == JNI_TRUE, std::memory_order_relaxed);
+    lastBatchedUs = 0;
+}
 
-    std::string b64 = base64_encode(buf);
+// DebugReceiver.fromBytes: a controller packet decoded the way the driver decodes it, with the
+// wire format in use. The orientation is in the driver's axes. False if the packet is malformed,
+// or a delta whose keyframe this decoder hasn't seen.
+static s2uk_packet::DeltaDecoder debugDeltaStream[2];
 
-    return env->NewStringUTF(b64.c_str());
-}
\ No newline at end of file
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_org_s2uk_vrcontroller_DebugReceiver_decodePacket(JNIEnv *env, jclass /*clazz*/,
+                                                      jbyteArray in_data, jobject out) {
+    if (in_data == nullptr || out == nullptr) return JNI_FALSE;
+    const jsize len = env->GetArrayLength(in_data);
+    std::vector<uint8_t> buf(static_cast<size_t>(len));
+    env->GetByteArrayRegion(in_data, 0, len, reinterpret_cast<jbyte*>(buf.data()));
+
+    // The IMU batch after the packet isn't shown, only stepped over.
+    size_t packetLen = buf.size();
+    if (wireImuBatch.load(std::memory_order_relaxed) &&
+        s2uk_packet::splitImuBatch(buf.data(), buf.size(), packetLen) != s2uk_packet::Status::Ok) return JNI_FALSE;
+
+    s2uk_packet::ControllerPacket packet;
+    const s2uk_packet::Codec codec = currentCodec();
+    const s2uk_packet::Status status = codec == s2uk_packet::Codec::Delta && packetLen > 0
+            ? s2uk_packet::decode(buf.data(), packetLen, debugDeltaStream[(buf[0] & s2uk_packet::kDeltaLeft) ? 1 : 0], packet)
+            : s2uk_packet::decode(buf.data(), packetLen, codec, packet);
+    if (status != s2uk_packet::Status::Ok) return JNI_FALSE;
+
+    jclass cls = env->GetObjectClass(out);
+    if (cls == nullptr) return JNI_FALSE;
+    const auto setBool = [&](const char* name, bool v) { env->SetBooleanField(out, env->GetFieldID(cls, name, "Z"), v ? JNI_TRUE : JNI_FALSE); };
+    const auto setInt = [&](const char* name, int v) { env->SetIntField(out, env->GetFieldID(cls, name, "I"), v); };
+    const auto setDouble = [&](const char* name, double v) { env->SetDoubleField(out, env->GetFieldID(cls, name, "D"), v); };
+
+    setBool("leftController", (packet.flags & s2uk_packet::kFlagLeft) != 0);
+    setBool("btnSystemOrMenu", (packet.flags & s2uk_packet::kFlagSystemOrMenu) != 0);
+    setBool("btnAorX", (packet.flags & s2uk_packet::kFlagAOrX) != 0);
+    setBool("btnBorY", (packet.flags & s2uk_packet::kFlagBOrY) != 0);
+    setBool("batteryPlugged", (packet.flags & s2uk_packet::kFlagBatteryPlugged) != 0);
+    setBool("joyInDZ", (packet.flags & s2uk_packet::kFlagJoyInDZ) != 0);
+    setInt("triggerState", s2uk_packet::kModeTrigger.get(packet.modes));
+    setInt("gripState", s2uk_packet::kModeGrip.get(packet.modes));
+    setInt("joyState", s2uk_packet::kModeJoy.get(packet.modes));
+    env->SetFloatField(out, env->GetFieldID(cls, "batteryPercent", "F"), static_cast<float>(packet.battery) / 100.0f);
+
+    const uint32_t gyroScale = wireGyroScale.load(std::memory_order_relaxed);
+    const uint32_t joyScale = wireJoyScale.load(std::memory_order_relaxed);
+    const bool quat = (packet.flags & s2uk_packet::kFlagQuaternion) != 0;
+    double q[4] = {1.0, 0.0, 0.0, 0.0};
+    if (quat) s2uk_packet::unpackSmallestThree(packet.quat, q);
+    setBool("hasOrientation", quat);
+    setDouble("qw", q[0]);
+    setDouble("qx", q[1]);
+    setDouble("qy", q[2]);
+    setDouble("qz", q[3]);
+    setDouble("gx", quat ? 0.0 : s2uk_packet::dequantize(packet.gyro[0], gyroScale));
+    setDouble("gy", quat ? 0.0 : s2uk_packet::dequantize(packet.gyro[1], gyroScale));
+    setDouble("gz", quat ? 0.0 : s2uk_packet::dequantize(packet.gyro[2], gyroScale));
+    setDouble("jx", s2uk_packet::dequantize(packet.joy[0], joyScale));
+    setDouble("jy", s2uk_packet::dequantize(packet.joy[1], joyScale));
+    env->SetLongField(out, env->GetFieldID(cls, "senderTimeUs", "J"), static_cast<jlong>(packet.senderTimeUs));
+
+    env->DeleteLocalRef(cls);
+    return JNI_TRUE;
+}
+
+// True if a state is due at now_us; the grid moves on by one interval.
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_sendDue(JNIEnv * /*env*/, jobject /*thiz*/, jlong now_us) {
+    const int64_t interval = sendIntervalUs.load(std::memory_order_relaxed);
+    const int64_t now = static_cast<int64_t>(now_us);
+
+    // First send, or more than an interval behind (app paused, main thread stalled):
+    // start the grid over instead of bursting to catch up.
+    if (nextSendUs == 0 || now - nextSendUs > interval) {
+        nextSendUs = now + interval;
+        return JNI_TRUE;
+    }
+    if (now >= nextSendUs) {
+        nextSendUs += interval;
+        return JNI_TRUE;
+    }
+    // The rate went up since the last send: don't sit out the old, longer interval.
+    if (nextSendUs - now > interval) nextSendUs = now + interval;
+    return JNI_FALSE;
+}
+
+// Microseconds until the next state is due (0 if it already is).
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_org_s2uk_vrcontroller_MainActivity_sendWaitUs(JNIEnv * /*env*/, jobject /*thiz*/, jlong now_us) {
+    const int64_t wait = nextSendUs - static_cast<int64_t>(now_us);
+    return static_cast<jlong>(wait > 0 ? wait : 0);
+}
@@ -17,6 +17,11 @@ public class DebugReceiver {
         public double gx, gy, gz;
         public double jx, jy;
 
+        // Set instead of gx, gy, gz when the packet carries a quaternion (driver axes).
+        public boolean hasOrientation;
+        public double qw = 1.0, qx, qy, qz;
+        public long senderTimeUs;
+
         @Override
         public String toString() {
             return "DecodedPacket{" +
@@ -32,12 +37,16 @@ public class DebugReceiver {
                     ", batteryPercent=" + batteryPercent +
                     ", gx=" + gx + ", gy=" + gy + ", gz=" + gz +
                     ", jx=" + jx + ", jy=" + jy +
+                    ", hasOrientation=" + hasOrientation +
+                    ", qw=" + qw + ", qx=" + qx + ", qy=" + qy + ", qz=" + qz +
+                    ", senderTimeUs=" + senderTimeUs +
                     '}';
         }
     }
 
-    private static final double GYRO_SCALE = 1000.0;
-    private static final double JOY_SCALE  = 100000.0;
+    static {
+        System.loadLibrary("vr-controller-cpp");
+    }
 
     public static DecodedPacket fromBase64(String b64) {
         byte[] raw;
@@ -45,70 +54,18 @@ public class DebugReceiver {
         return fromBytes(raw);
     }
 
+    // Decoded natively with the packet schema the driver uses (PacketSchema.h) and the wire
+    // format negotiated with it, so this always reads what the phone actually sends.
     public static DecodedPacket fromBytes(byte[] buf) {
         if (buf == null || buf.length < 3) {
             throw new IllegalArgumentException("packet too short");
         }
-        int pos = 0;
-        int flags = buf[pos++] & 0xFF;
-        int modes = buf[pos++] & 0xFF;
-        int bat   = buf[pos++] & 0xFF;
-
         DecodedPacket out = new DecodedPacket();
-
-        out.leftController = (flags & (1 << 0)) != 0;
-        out.btnSystemOrMenu = (flags & (1 << 1)) != 0;
-        out.btnAorX = (flags & (1 << 2)) != 0;
-        out.btnBorY = (flags & (1 << 3)) != 0;
-        out.batteryPlugged = (flags & (1 << 4)) != 0;
-        out.joyInDZ = (flags & (1 << 5)) != 0;
-
-        out.triggerState = (modes) & 0x3;
-        out.gripState = (modes >> 2) & 0x3;
-        out.joyState = (modes >> 4) & 0x3;
-        out.batteryPercent = (float)bat / 100.0f;
-
-        // Now read 5 varints: gx, gy, gz, jx, jy
-        int[] newPos = new int[] { pos };
-        long zz;
-
-        zz = readVarUint64(buf, newPos);
-        out.gx = (double) zigzagDecode(zz) / GYRO_SCALE;
-
-        zz = readVarUint64(buf, newPos);
-        out.gy = (double) zigzagDecode(zz) / GYRO_SCALE;
-
-        zz = readVarUint64(buf, newPos);
-        out.gz = (double) zigzagDecode(zz) / GYRO_SCALE;
-
-        zz = readVarUint64(buf, newPos);
-        out.jx = (double) zigzagDecode(zz) / JOY_SCALE;
-
-        zz = readVarUint64(buf, newPos);
-        out.jy = (double) zigzagDecode(zz) / JOY_SCALE;
-
-        return out;
-    }
-
-    private static long readVarUint64(byte[] buf, int[] pos) {
-        int p = pos[0];
-        long result = 0L;
-        int shift = 0;
-        while (p < buf.length) {
-            int b = buf[p++] & 0xFF;
-            result |= (long)(b & 0x7F) << shift;
-            if ((b & 0x80) == 0) {
-                pos[0] = p;
-                return result;
-            }
-            shift += 7;
-            if (shift >= 64) throw new IllegalArgumentException("varint overflow");
+        if (!decodePacket(buf, out)) {
+            throw new IllegalArgumentException("malformed packet");
         }
-        throw new IllegalArgumentException("varint truncated");
+        return out;
     }
 
-    private static long zigzagDecode(long zz) {
-        // (zz >>> 1) ^ -(zz & 1)
-        return (zz >>> 1) ^ -(zz & 1L);
-    }
-}
\ No newline at end of file
+    private static native boolean decodePacket(byte[] buf, DecodedPacket out);
+}
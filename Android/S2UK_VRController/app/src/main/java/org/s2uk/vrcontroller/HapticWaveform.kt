@@ -0,0 +1,12 @@
+package org.s2uk.vrcontroller
+
+// A driver haptic envelope as VibrationEffect.createWaveform arguments, see native-lib.cpp.
+data class HapticWaveform(@JvmField var status: Boolean,
+                          @JvmField var leftController: Boolean,
+                          @JvmField val timings: LongArray,
+                          @JvmField val amplitudes: IntArray) {
+    fun status() = status
+    fun leftController() = leftController
+    fun timings() = timings
+    fun amplitudes() = amplitudes
+}
@@ -24,6 +24,7 @@ import android.net.Uri;
 import android.os.Bundle;
 import android.os.Handler;
 import android.os.Looper;
+import android.os.SystemClock;
 import android.os.VibrationEffect;
 import android.os.Vibrator;
 import android.os.VibratorManager;
@@ -51,6 +52,7 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
 
     // Pairing data
     private TcpClient tcpClient;
+    private TcpClient.WireFormat appliedWireFormat = null; // last welcome handed to the native encoder
     private String serverIP = "0.0.0.0";
     private String debugTCPConnectionStatus = "";
     private String tcpCompressedPacket = "";
@@ -60,14 +62,19 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
     private final Handler mainUpdateHandler = new Handler(Looper.getMainLooper());
     private final long UPDATE_INTERVAL_MS = 11; // ~90 FPS
     private final long HAPTIC_UPDATE_INTERVAL_MS = 1; // ~1000 FPS
+    private static final int SENSOR_PERIOD_GAME_US = 20000; // what SENSOR_DELAY_GAME asks for
+    private int sensorPeriodUs = SENSOR_PERIOD_GAME_US; // shortened when the driver's send rate needs faster samples
+    private boolean imuBatch = false; // the driver takes IMU batches: sample as fast as the sensor goes
 
     // Sensor data
     private SensorManager sensorManager;
     private Sensor gyroSensor;
     private SVec3 gyroAngle = new SVec3(0,0,0); // NOTE: Data format is (yaw, pitch, roll)
     private SVec3 gyroAngleRaw = new SVec3(0,0,0); // in Radians!
+    private long gyroSampleTimeUs = 0; // SensorEvent.timestamp of gyroAngle (elapsedRealtimeNanos base), in us
     private SVec3 gyroOffset = new SVec3(0,0,0); // in Radians!
     private SVec3 finalGyroAngle = new SVec3(0,0,0); // this gets sent to the server
+    private Quaternion finalOrientation = new Quaternion(1f, 0f, 0f, 0f); // the same rotation, sent instead when the driver takes quaternions
 
     private final SVec3 leftControllerAngleCorrection = new SVec3(270f, -180f, 90f);
     private final SVec3 rightControllerAngleCorrection = new SVec3(90f, 0f, 90f);
@@ -218,6 +225,8 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
                                 }
 
                                 inMessages = new ServerMessages();
+                                resetSendRate(); // a new driver may not send rates at all
+                                imuBatch = false;
                                 tcpClient = new TcpClient(
                                         serverIP,
                                         getApplicationContext(),
@@ -228,6 +237,7 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
                                         status -> {
                                             debugTCPConnectionStatus = status;
                                         });
+                                tcpClient.setDeviceRole(isLeftController);
                                 new Thread(tcpClient::run, "TcpClientThread").start();
                             }
 
@@ -299,6 +309,20 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
         }
     };
 
+    // States go out on their own timer, paced by the native layer at the rate the driver asks for.
+    private final Runnable sendRunnable = new Runnable() {
+        @Override
+        public void run() {
+            applyWireFormat();
+            applySendRates();
+            long nowUs = SystemClock.elapsedRealtimeNanos() / 1000L;
+            if (sendDue(nowUs)) {
+                sendState();
+            }
+            mainUpdateHandler.postDelayed(this, Math.max(1L, (sendWaitUs(nowUs) + 999L) / 1000L));
+        }
+    };
+
     @Override
     protected void onResume() {
         super.onResume();
@@ -306,9 +330,10 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
         bMonitor.startMonitoring(this);
         mainUpdateHandler.post(updateRunnable);
         mainUpdateHandler.post(hapticRunnable);
+        mainUpdateHandler.post(sendRunnable);
 
         if (gyroSensor != null) {
-            sensorManager.registerListener((SensorEventListener) this, gyroSensor, SensorManager.SENSOR_DELAY_GAME);
+            sensorManager.registerListener((SensorEventListener) this, gyroSensor, sensorPeriodUs);
         }
     }
 
@@ -318,6 +343,7 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
         bMonitor.stopMonitoring(this);
         mainUpdateHandler.removeCallbacks(updateRunnable);
         mainUpdateHandler.removeCallbacks(hapticRunnable);
+        mainUpdateHandler.removeCallbacks(sendRunnable);
 
         sensorManager.unregisterListener((SensorEventListener) this);
     }
@@ -356,6 +382,13 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
                     : (float) Math.toDegrees(yawRad)+180f; // hack, but it at least seems to works
             gyroAngle.y = (float) Math.toDegrees(pitchRad*-1);
             gyroAngle.z = (float) Math.toDegrees(rollRad);
+            gyroSampleTimeUs = event.timestamp / 1000L;
+
+            // Every sample goes to the driver, in the batch after the next state.
+            if (imuBatch) {
+                updateFinalGyroAngle();
+                addImuSample(finalGyroAngle, finalOrientation, gyroSampleTimeUs);
+            }
         }
     }
 
@@ -368,11 +401,7 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
     private void update() {
         // Log.wtf("UpdateLoop", MessageFormat.format("DEBUG:\nTrigger:{0}; Grip:{1}", triggerState, gripState));
 
-        if (isLeftController) {
-            finalGyroAngle = RotationUtils.INSTANCE.rotateEuler(gyroAngle, leftControllerAngleCorrection);
-        } else {
-            finalGyroAngle = RotationUtils.INSTANCE.rotateEuler(gyroAngle, rightControllerAngleCorrection);
-        }
+        updateFinalGyroAngle();
 
         //Debug Status info
         debugConnectionStatusView.setText(
@@ -386,18 +415,6 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
                 controllerBatteryPercentage, controllerBatteryPlugged));
 
 
-        // Send data to the server
-        if (tcpClient != null && tcpClient.isRunning()) {
-            if (System.currentTimeMillis() - tcpClient.gotConnectedTime() >= TCP_Constants.TCP_CLIENT_FIRST_PACKET_DELAY) {
-                tcpCompressedPacket = compressDataBeforeSending(
-                        isLeftController, triggerState, gripState, btnSystemOrMenuState,
-                        btnA_or_X_State, btnB_or_Y_State,
-                        finalGyroAngle,
-                        joyData, joyState, joyInDZ, controllerBatteryPercentage, controllerBatteryPlugged);
-                new Thread(() -> tcpClient.sendMessage(tcpCompressedPacket)).start();
-            }
-        }
-
         // String compressedData = compressDataBeforeSending(isLeftController, triggerState, gripState, btnSystemOrMenuState,
         //         btnA_or_X_State, btnB_or_Y_State, gyroAngle, joyData, joyState, joyInDZ,
         //         controllerBatteryPercentage, controllerBatteryPlugged);
@@ -405,13 +422,100 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
         // Log.d("UpdateLoop", MessageFormat.format("Compressed Data:{0}\nDecodedData:{1}", compressedData, decodedData));
     }
 
+    private void updateFinalGyroAngle() {
+        // RotationUtils.rotateEuler, keeping the quaternion it goes through
+        SVec3 correction = isLeftController ? leftControllerAngleCorrection : rightControllerAngleCorrection;
+        finalOrientation = RotationUtils.INSTANCE.eulerToQuaternion(gyroAngle)
+                .times(RotationUtils.INSTANCE.eulerToQuaternion(correction));
+        finalGyroAngle = RotationUtils.INSTANCE.quaternionToEuler(finalOrientation);
+    }
+
+    private void sendState() {
+        // Send data to the server
+        if (tcpClient != null && tcpClient.isRunning()) {
+            updateFinalGyroAngle();
+            if (tcpClient.readyToSend()) {
+                if (tcpClient.isBinaryFraming()) {
+                    byte[] packet = compressDataBeforeSendingRaw(
+                            isLeftController, triggerState, gripState, btnSystemOrMenuState,
+                            btnA_or_X_State, btnB_or_Y_State,
+                            finalGyroAngle, finalOrientation,
+                            joyData, joyState, joyInDZ, controllerBatteryPercentage, controllerBatteryPlugged,
+                            gyroSampleTimeUs);
+                    tcpClient.sendState(isLeftController, packet);
+                } else {
+                    tcpCompressedPacket = compressDataBeforeSending(
+                            isLeftController, triggerState, gripState, btnSystemOrMenuState,
+                            btnA_or_X_State, btnB_or_Y_State,
+                            finalGyroAngle, finalOrientation,
+                            joyData, joyState, joyInDZ, controllerBatteryPercentage, controllerBatteryPlugged,
+                            gyroSampleTimeUs);
+                    new Thread(() -> tcpClient.sendMessage(tcpCompressedPacket)).start();
+                }
+            }
+        }
+    }
+
+    // Codec, orientation, scales and start rate from the driver's welcome, once per connection.
+    private void applyWireFormat() {
+        TcpClient client = tcpClient;
+        TcpClient.WireFormat format = client != null ? client.getWireFormat() : null;
+        if (format == null || format == appliedWireFormat) return;
+        appliedWireFormat = format;
+        int codec = "fixed".equals(format.codec) ? TCP_Constants.TCP_CODEC_FIXED
+                : "delta".equals(format.codec) ? TCP_Constants.TCP_CODEC_DELTA : TCP_Constants.TCP_CODEC_VARINT;
+        int orientation = "quat".equals(format.orientation) ? TCP_Constants.TCP_ORIENTATION_QUAT : TCP_Constants.TCP_ORIENTATION_EULER;
+        imuBatch = "batch".equals(format.imu);
+        applyWireFormat(codec, orientation, format.gyroScale, format.joyScale, format.rateHz, imuBatch);
+        if (imuBatch) setSensorPeriod(SensorManager.SENSOR_DELAY_FASTEST);
+    }
+
+    // Rate frames from the driver, one per hand; the native layer keeps ours.
+    private void applySendRates() {
+        ServerMessages messages = inMessages;
+        if (messages == null) return;
+        byte[] rate;
+        while ((rate = messages.readRate()) != null) {
+            int hz = applySendRate(rate, isLeftController);
+            if (hz <= 0) continue;
+
+            // Sampling slower than we send would just repeat stale angles. With IMU batches
+            // the sensor already runs flat out.
+            if (!imuBatch) setSensorPeriod(Math.min(SENSOR_PERIOD_GAME_US, 1_000_000 / hz));
+        }
+    }
+
+    private void setSensorPeriod(int periodUs) {
+        if (periodUs == sensorPeriodUs || gyroSensor == null) return;
+        sensorPeriodUs = periodUs;
+        sensorManager.unregisterListener((SensorEventListener) this);
+        sensorManager.registerListener((SensorEventListener) this, gyroSensor, sensorPeriodUs);
+    }
+
     private void hapticUpdate() {
-        // Reply to incoming data
-        if (inMessages != null && inMessages.size() != 0) {
-            InboundDecompressResults decompressResults = decompressInboundPacket(inMessages.readLast());
-            Log.i("InboundMessagesResult", MessageFormat.format("Messages to process left: {0}", inMessages.size()));
+        // Envelopes replace each other on the vibrator, so of those that piled up only the
+        // newest one for our hand is worth starting.
+        if (inMessages != null) {
+            HapticWaveform waveform = null;
+            byte[] envelope;
+            while ((envelope = inMessages.readEnvelope()) != null) {
+                HapticWaveform decoded = decodeHapticEnvelope(envelope);
+                if (decoded != null && decoded.status && decoded.leftController == isLeftController) {
+                    waveform = decoded;
+                }
+            }
+            if (waveform != null) playWaveform(waveform);
+        }
 
-            if(decompressResults.leftController == isLeftController) {
+        // Reply to incoming data
+        if (inMessages != null && (inMessages.size() != 0 || inMessages.rawSize() != 0)) {
+            InboundDecompressResults decompressResults = (inMessages.rawSize() != 0)
+                    ? decompressInboundPacketRaw(inMessages.readLastRaw())
+                    : decompressInboundPacket(inMessages.readLast());
+            Log.i("InboundMessagesResult", MessageFormat.format("Messages to process left: {0}",
+                    inMessages.size() + inMessages.rawSize()));
+
+            if(decompressResults.status && decompressResults.leftController == isLeftController) {
                 generateVibration(decompressResults);
             }
 
@@ -613,6 +717,16 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
         }
     }
 
+    private void playWaveform(HapticWaveform waveform) {
+        VibratorManager vibratorManager = (VibratorManager) getSystemService(Context.VIBRATOR_MANAGER_SERVICE);
+        Vibrator vibrator = vibratorManager != null ? vibratorManager.getDefaultVibrator() : null;
+
+        if (vibrator != null) {
+            VibrationEffect effect = VibrationEffect.createWaveform(waveform.timings, waveform.amplitudes, -1);
+            vibrator.vibrate(effect);
+        }
+    }
+
     View.OnTouchListener btnSystemOrMenuListener = new View.OnTouchListener() {
         @Override
         @SuppressLint("ClickableViewAccessibility")
@@ -793,10 +907,24 @@ public class MainActivity extends AppCompatActivity implements SensorEventListen
     }
 
     public native String compressDataBeforeSending(boolean leftController, int triggerState, int gripState, boolean btnSystemOrMenuState,
-                                                 boolean btnA_or_XState, boolean btnB_or_YState, SVec3 gyroAngle,
+                                                 boolean btnA_or_XState, boolean btnB_or_YState, SVec3 gyroAngle, Quaternion orientation,
                                                  SVec2 joyData, int joyState, boolean joyInDZ,
-                                                 float controllerBatteryPercentage, boolean controllerBatteryPlugged);
+                                                 float controllerBatteryPercentage, boolean controllerBatteryPlugged,
+                                                 long sampleTimeUs);
+    public native byte[] compressDataBeforeSendingRaw(boolean leftController, int triggerState, int gripState, boolean btnSystemOrMenuState,
+                                                     boolean btnA_or_XState, boolean btnB_or_YState, SVec3 gyroAngle, Quaternion orientation,
+                                                     SVec2 joyData, int joyState, boolean joyInDZ,
+                                                     float controllerBatteryPercentage, boolean controllerBatteryPlugged,
+                                                     long sampleTimeUs);
     public native InboundDecompressResults decompressInboundPacket(String inDataB64);
+    public native InboundDecompressResults decompressInboundPacketRaw(byte[] inData);
+    public native HapticWaveform decodeHapticEnvelope(byte[] inData);
     public native SVec2 joyConvertToVec2(int angle, int strength);
     public native boolean isJoyInDZ(SVec2 joyData);
+    public native int applySendRate(byte[] payload, boolean leftController);
+    public native void resetSendRate();
+    public native void applyWireFormat(int codec, int orientation, int gyroScale, int joyScale, int rateHz, boolean imuBatch);
+    public native void addImuSample(SVec3 gyroAngle, Quaternion orientation, long sampleTimeUs);
+    public native boolean sendDue(long nowUs);
+    public native long sendWaitUs(long nowUs);
 }
\ No newline at end of file
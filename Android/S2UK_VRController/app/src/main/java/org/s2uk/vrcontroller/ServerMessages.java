@@ -5,19 +5,52 @@ import java.util.concurrent.LinkedBlockingDeque;
 
 public class ServerMessages {
     private final BlockingDeque<String> queue = new LinkedBlockingDeque<>();
+    private final BlockingDeque<byte[]> rawQueue = new LinkedBlockingDeque<>(); // binary framing payloads
+    private final BlockingDeque<byte[]> rateQueue = new LinkedBlockingDeque<>(); // TCP_FRAME_SEND_RATE payloads
+    private final BlockingDeque<byte[]> envelopeQueue = new LinkedBlockingDeque<>(); // TCP_FRAME_HAPTIC_ENVELOPE payloads
 
     public void enqueue(String message) {
         if (message != null) {
             queue.addLast(message);
         }
     }
+    public void enqueueRaw(byte[] payload) {
+        if (payload != null) {
+            rawQueue.addLast(payload);
+        }
+    }
+    public void enqueueRate(byte[] payload) {
+        if (payload != null) {
+            rateQueue.addLast(payload);
+        }
+    }
+    public byte[] readRate() {
+        return rateQueue.pollFirst();
+    }
+    public void enqueueEnvelope(byte[] payload) {
+        if (payload != null) {
+            envelopeQueue.addLast(payload);
+        }
+    }
+    public byte[] readEnvelope() {
+        return envelopeQueue.pollFirst();
+    }
     public String readLast() {
         return queue.pollFirst();
     }
+    public byte[] readLastRaw() {
+        return rawQueue.pollFirst();
+    }
     public int size() {
         return queue.size();
     }
+    public int rawSize() {
+        return rawQueue.size();
+    }
     public void clear() {
         queue.clear();
+        rawQueue.clear();
+        rateQueue.clear();
+        envelopeQueue.clear();
     }
 }
@@ -3,6 +3,49 @@ package org.s2uk.vrcontroller;
 public class TCP_Constants {
     public static final String TCP_CLIENT_CLOSED_CONNECTION = "s2uk_connection_closed";
     public static final String TCP_CLIENT_LOGIN_MSG = "s2uk_connection_init";
+    public static final String TCP_CLIENT_LOGIN_MSG_BINARY = "s2uk_connection_init_bin";
+    // Versioned login (driver Handshake.h), the fixed strings above are the fallback for older drivers
+    public static final String TCP_CLIENT_HELLO_MSG = "s2uk_hello";
+    public static final String TCP_CLIENT_WELCOME_MSG = "s2uk_welcome";
+    public static final String TCP_CLIENT_RESUME_MSG = "s2uk_resume"; // in place of the hello, with the token of a SESSION frame
+    public static final String TCP_CLIENT_RESUME_UNKNOWN_MSG = "s2uk_resume_unknown"; // the driver has no such session, send the hello
+    public static final int TCP_PROTOCOL_VERSION = 1;
+    public static final String TCP_CLIENT_CODECS = "delta,fixed,varint"; // in order of preference
+    public static final int TCP_CODEC_VARINT = 0; // native WIRE_CODEC_*
+    public static final int TCP_CODEC_FIXED = 1;
+    public static final int TCP_CODEC_DELTA = 2;
+    public static final String TCP_CLIENT_ORIENTATIONS = "quat,euler"; // in order of preference
+    public static final int TCP_ORIENTATION_EULER = 0; // native WIRE_ORIENTATION_*
+    public static final int TCP_ORIENTATION_QUAT = 1;
+    public static final String TCP_CLIENT_HAPTICS = "envelope,pulse"; // in order of preference
+    public static final String TCP_CLIENT_IMU = "batch"; // sensor samples between states, after each packet
+    public static final int TCP_CLIENT_GYRO_SCALE = 1000;
+    public static final int TCP_CLIENT_JOY_SCALE = 100000;
+    public static final int TCP_CLIENT_MAX_SEND_RATE = 250; // states per second, native MAX_SEND_RATE_HZ
     public static final int TCP_CLIENT_CONNECTION_TIMEOUT = 5000;
     public static final long TCP_CLIENT_FIRST_PACKET_DELAY = 5000L;
+
+    // Binary framing (driver FrameParser.h): u16 LE payload length | u8 type | payload
+    public static final boolean TCP_CLIENT_BINARY_FRAMING = true;
+    public static final int TCP_FRAME_HEADER_SIZE = 3;
+    public static final int TCP_FRAME_MAX_PAYLOAD = 4096;
+    public static final int TCP_FRAME_CONTROLLER_STATE = 0x01;
+    public static final int TCP_FRAME_HAPTIC = 0x02;
+    public static final int TCP_FRAME_PING = 0x03; // echo the payload back as a PONG
+    public static final int TCP_FRAME_PONG = 0x04;
+    public static final int TCP_FRAME_RESUME = 0x05; // u64 token from an earlier SESSION frame
+    public static final int TCP_FRAME_SESSION = 0x06; // u64 token | u8 flags | u16 heartbeat interval ms | u16 heartbeat timeout ms
+    public static final int TCP_FRAME_SEND_RATE = 0x07; // u8 flags (bit0 = left hand) | varuint states per second
+    public static final int TCP_FRAME_HAPTIC_ENVELOPE = 0x08; // u8 flags (bit0 = left hand) | u8 count | count x (duration, amplitude, frequency) zigzag varints
+
+    // Binary mode reconnects on its own after a drop, backing off exponentially between attempts
+    public static final long TCP_CLIENT_RECONNECT_MIN_DELAY = 100L;
+    public static final long TCP_CLIENT_RECONNECT_MAX_DELAY = 2000L;
+
+    // Controller state over UDP (driver UdpServer.h), the TCP session still carries login and haptics
+    public static final boolean UDP_TRANSPORT = true;
+    public static final byte UDP_VERSION = 2;
+    public static final int UDP_HEADER_SIZE = 20;
+    public static final int UDP_MAX_DATAGRAM = 1200;
+    public static final int UDP_REDUNDANT_STATES = 2; // previous states repeated in every datagram (max 7)
 }
\ No newline at end of file
@@ -1,14 +1,18 @@
 package org.s2uk.vrcontroller;
 
 import android.content.Context;
+import android.os.SystemClock;
 import android.util.Log;
 
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
 import java.io.BufferedReader;
-import java.io.BufferedWriter;
+import java.io.DataInputStream;
+import java.io.EOFException;
+import java.io.InputStream;
 import java.io.InputStreamReader;
-import java.io.OutputStreamWriter;
-import java.io.PrintWriter;
 import java.io.IOException;
+import java.io.OutputStream;
 import java.net.InetAddress;
 import java.net.InetSocketAddress;
 import java.net.Socket;
@@ -30,15 +34,27 @@ public class TcpClient {
     // runtime control
     private volatile boolean mRun = false;
     private volatile long connectionTimestamp = 0L;
+    private volatile boolean connectionUp = false;
+    // session resume, see TCP_Constants.TCP_FRAME_SESSION
+    private volatile long resumeToken = 0L;
+    private volatile boolean sessionConfirmed = false;
+    // login, see TCP_Constants.TCP_CLIENT_HELLO_MSG
+    private volatile boolean helloRejected = false; // the driver predates the hello, use the fixed login strings
+    private volatile WireFormat wireFormat = null;  // what the last welcome settled on, null = defaults
+    private volatile String deviceRole = null;
     private final Context context;
 
     // socket / streams
-    private PrintWriter mBufferOut;
-    private BufferedReader mBufferIn;
+    private OutputStream mBufferOut;
+    private InputStream mBufferIn;
     private Socket mSocket;
+    private volatile UdpSender udpSender; // controller state over UDP, see TCP_Constants.UDP_TRANSPORT
 
-    // sending queue
-    private final LinkedBlockingQueue<String> sendQueue = new LinkedBlockingQueue<>(1000); // bounded for safety
+    // wire format, see TCP_Constants.TCP_CLIENT_BINARY_FRAMING
+    private final boolean binaryFraming = TCP_Constants.TCP_CLIENT_BINARY_FRAMING;
+
+    // sending queue, already encoded for the wire
+    private final LinkedBlockingQueue<byte[]> sendQueue = new LinkedBlockingQueue<>(1000); // bounded for safety
     private Thread senderThread = null;
 
     /**
@@ -91,7 +107,55 @@ public class TcpClient {
      */
     public void sendMessage(String message) {
         if (message == null) return;
-        boolean offered = sendQueue.offer(message);
+        enqueue((message + "\n").getBytes(StandardCharsets.UTF_8));
+    }
+
+    /**
+     * Enqueue one binary frame (see TCP_Constants.TCP_FRAME_*). Only valid in binary framing mode.
+     */
+    public void sendFrame(int type, byte[] payload) {
+        if (payload == null || payload.length > TCP_Constants.TCP_FRAME_MAX_PAYLOAD) return;
+        byte[] frame = new byte[TCP_Constants.TCP_FRAME_HEADER_SIZE + payload.length];
+        frame[0] = (byte) (payload.length & 0xFF);
+        frame[1] = (byte) ((payload.length >> 8) & 0xFF);
+        frame[2] = (byte) type;
+        System.arraycopy(payload, 0, frame, TCP_Constants.TCP_FRAME_HEADER_SIZE, payload.length);
+        enqueue(frame);
+    }
+
+    /**
+     * Send one raw controller state: over UDP when available, otherwise as a TCP frame.
+     */
+    public void sendState(boolean isLeft, byte[] payload) {
+        UdpSender udp = udpSender;
+        if (udp != null) {
+            udp.sendState(isLeft, payload);
+        } else {
+            sendFrame(TCP_Constants.TCP_FRAME_CONTROLLER_STATE, payload);
+        }
+    }
+
+    public boolean isBinaryFraming() {
+        return binaryFraming;
+    }
+
+    /**
+     * Which hand this phone is, announced in the hello. Takes effect on the next connection.
+     */
+    public void setDeviceRole(boolean isLeft) {
+        deviceRole = isLeft ? "left" : "right";
+    }
+
+    /**
+     * The packet format and start rate the driver agreed to, or null for the defaults
+     * (older drivers, or no welcome yet).
+     */
+    public WireFormat getWireFormat() {
+        return wireFormat;
+    }
+
+    private void enqueue(byte[] data) {
+        boolean offered = sendQueue.offer(data);
         if (!offered) {
             notifyStatus("send failed, queue is full");
         }
@@ -102,12 +166,16 @@ public class TcpClient {
      */
     public void stopClient() {
         if(!mRun) return;
-        try {
-            sendMessage(TCP_Constants.TCP_CLIENT_CLOSED_CONNECTION);
-        } catch (Exception ignored) { }
+        if (!binaryFraming) {
+            // binary clients just close the socket, the server treats EOF as a disconnect
+            try {
+                sendMessage(TCP_Constants.TCP_CLIENT_CLOSED_CONNECTION);
+            } catch (Exception ignored) { }
+        }
 
         mRun = false;
         connectionTimestamp = 0L;
+        closeUdp();
 
         if (senderThread != null) {
             try {
@@ -154,6 +222,8 @@ public class TcpClient {
     /**
      * Call this method to run the client connection loop.
      * Intended to be called from a background thread (e.g. Thread or Executor).
+     * In binary mode a dropped connection is retried until stopClient(), and the driver
+     * gets the previous session's token so it can pick up where it left off.
      */
     public void run() {
         if (mServerIp == null || mServerIp.isEmpty()) {
@@ -162,7 +232,39 @@ public class TcpClient {
         }
 
         mRun = true;
+        long backoff = TCP_Constants.TCP_CLIENT_RECONNECT_MIN_DELAY;
+        try {
+            while (mRun) {
+                boolean helloBefore = !helloRejected;
+                boolean hadSession = runConnection();
+                // an older driver dropping our hello is worth one more attempt in text mode too
+                boolean fellBack = helloBefore && helloRejected;
+                if ((!binaryFraming && !fellBack) || !mRun) break;
+
+                // a connection that got as far as a session resets the backoff
+                if (hadSession) backoff = TCP_Constants.TCP_CLIENT_RECONNECT_MIN_DELAY;
+                try {
+                    Thread.sleep(backoff);
+                } catch (InterruptedException ie) {
+                    Thread.currentThread().interrupt();
+                    break;
+                }
+                backoff = Math.min(backoff * 2, TCP_Constants.TCP_CLIENT_RECONNECT_MAX_DELAY);
+            }
+        } finally {
+            mRun = false;
+            connectionTimestamp = 0L;
+            // notifyStatus("DISCONNECTED");
+        }
+    }
+
+    // One connection, from connect() until the socket goes away. Returns true if the driver
+    // confirmed a session on it.
+    private boolean runConnection() {
         notifyStatus(context.getString(R.string.tcp_client_status_connecting));
+        sessionConfirmed = false;
+        wireFormat = null;
+        sendQueue.clear(); // states queued for a dead connection are stale by now
 
         try {
             InetAddress serverAddr = InetAddress.getByName(mServerIp);
@@ -173,40 +275,65 @@ public class TcpClient {
             } catch (SocketTimeoutException ste) {
                 notifyStatus(context.getString(R.string.tcp_client_status_connection_timeout));
                 try { socket.close(); } catch (IOException ignored) {}
-                return;
+                return false;
             }
 
             synchronized (this) {
+                if (!mRun) { // stopClient() came in while we were connecting
+                    try { socket.close(); } catch (IOException ignored) {}
+                    return false;
+                }
                 mSocket = socket;
             }
 
             notifyStatus(context.getString(R.string.tcp_client_status_connected));
             connectionTimestamp = System.currentTimeMillis();
+            connectionUp = true;
 
+            long token = resumeToken;
+            boolean resuming = binaryFraming && !helloRejected && token != 0L;
             try {
                 synchronized (this) {
-                    mBufferOut = new PrintWriter(new BufferedWriter(new OutputStreamWriter(socket.getOutputStream(), StandardCharsets.UTF_8)), true);
-                    mBufferIn = new BufferedReader(new InputStreamReader(socket.getInputStream(), StandardCharsets.UTF_8));
+                    mBufferOut = new BufferedOutputStream(socket.getOutputStream());
+                    mBufferIn = new BufferedInputStream(socket.getInputStream());
+
+                    // send login message, it selects the wire format for the rest of the session;
+                    // a driver that still has our session takes a resume line in place of the hello
+                    String login = helloRejected
+                            ? (binaryFraming ? TCP_Constants.TCP_CLIENT_LOGIN_MSG_BINARY : TCP_Constants.TCP_CLIENT_LOGIN_MSG)
+                            : resuming ? resumeLine(token) : helloLine();
+                    mBufferOut.write((login + "\n").getBytes(StandardCharsets.UTF_8));
+                    if (helloRejected && binaryFraming && token != 0L) {
+                        mBufferOut.write(resumeFrame(token));
+                    }
+                    mBufferOut.flush();
                 }
 
-                // send login message
-                if (mBufferOut != null && !mBufferOut.checkError()) {
-                    mBufferOut.println(TCP_Constants.TCP_CLIENT_LOGIN_MSG);
-                    mBufferOut.flush();
-                } else {
-                    notifyStatus("Sender output stream isn't available");
+                // the welcome comes back before anything in the agreed framing
+                if (!helloRejected && !readWelcome(socket, resuming)) {
+                    return false;
+                }
+
+                // the driver only accepts datagrams naming a session it welcomed over TCP
+                WireFormat welcomed = wireFormat;
+                if (binaryFraming && TCP_Constants.UDP_TRANSPORT && welcomed != null && welcomed.session != 0) {
+                    try {
+                        udpSender = new UdpSender(serverAddr, SERVER_PORT, welcomed.session);
+                    } catch (Exception e) {
+                        Log.w(TAG, "UDP transport unavailable, falling back to TCP", e);
+                    }
                 }
 
                 senderThread = new Thread(() -> {
                     try {
-                        while (mRun || !sendQueue.isEmpty()) {
-                            String msg = sendQueue.poll(50, TimeUnit.MILLISECONDS);
+                        while (connectionUp && (mRun || !sendQueue.isEmpty())) {
+                            byte[] msg = sendQueue.poll(50, TimeUnit.MILLISECONDS);
                             if (msg == null) continue;
 
                             try {
                                 synchronized (this) {
-                                    if (mBufferOut != null && !mBufferOut.checkError()) {
-                                        mBufferOut.println(msg);
+                                    if (mBufferOut != null) {
+                                        mBufferOut.write(msg);
                                         mBufferOut.flush();
                                     } else {
                                         notifyStatus("Sender output stream isn't available");
@@ -222,37 +349,19 @@ public class TcpClient {
                 }, "TcpClient-Sender");
                 senderThread.start();
 
-                // Listen for server messages
-                while (mRun) {
-                    try {
-                        mServerMessage = mBufferIn.readLine();
-                    } catch (IOException ioe) {
-                        // readLine failed - probably socket closed
-                        Log.w(TAG, "readLine failed (socket closed?)", ioe);
-                        notifyStatus(context.getString(R.string.tcp_client_status_connection_null));
-                        break;
-                    }
-
-                    if (mServerMessage != null && mMessageListener != null) {
-                        mMessageListener.messageReceived(mServerMessage);
-                        if(mServerMessage != null) {
-                            inMessages.enqueue(mServerMessage);
-                            mServerMessage = null;
-                        }
-                    } else if (mServerMessage == null) {
-                        // remote end closed connection — break loop and update status
-                        notifyStatus(context.getString(R.string.tcp_client_status_connection_closed));
-                        Log.i(TAG, "Server closed connection (readLine null)");
-                        break;
-                    }
+                if (binaryFraming) {
+                    readFrames(new DataInputStream(mBufferIn));
+                } else {
+                    readLines(new BufferedReader(new InputStreamReader(mBufferIn, StandardCharsets.UTF_8)));
                 }
 
                 Log.i(TAG, "Previous Response: \"" + mServerMessage + "\".");
             } catch (Exception e) {
                 notifyStatus("ERROR: " + e.getMessage());
             } finally {
-                mRun = false;
+                connectionUp = false;
                 connectionTimestamp = 0L;
+                closeUdp();
 
                 if (senderThread != null) {
                     try {
@@ -270,16 +379,223 @@ public class TcpClient {
                             mSocket = null;
                         }
                     }
+                    mBufferOut = null;
+                    mBufferIn = null;
                 }
             }
 
         } catch (Exception e) {
             notifyStatus(context.getString(R.string.tcp_client_status_fail));
-        } finally {
-            mRun = false;
-            connectionTimestamp = 0L;
-            // notifyStatus("DISCONNECTED");
         }
+        return sessionConfirmed;
+    }
+
+    // s2uk_hello proto=1 framing=binary,text codec=delta,fixed,varint gyro_scale=1000 joy_scale=100000 orientation=quat,euler rate=250 role=left haptics=envelope,pulse imu=batch
+    private String helloLine() {
+        StringBuilder sb = new StringBuilder(TCP_Constants.TCP_CLIENT_HELLO_MSG);
+        sb.append(" proto=").append(TCP_Constants.TCP_PROTOCOL_VERSION);
+        sb.append(" framing=").append(binaryFraming ? "binary,text" : "text");
+        sb.append(" codec=").append(TCP_Constants.TCP_CLIENT_CODECS);
+        sb.append(" gyro_scale=").append(TCP_Constants.TCP_CLIENT_GYRO_SCALE);
+        sb.append(" joy_scale=").append(TCP_Constants.TCP_CLIENT_JOY_SCALE);
+        sb.append(" orientation=").append(TCP_Constants.TCP_CLIENT_ORIENTATIONS);
+        sb.append(" rate=").append(TCP_Constants.TCP_CLIENT_MAX_SEND_RATE);
+        String role = deviceRole;
+        if (role != null) sb.append(" role=").append(role);
+        sb.append(" haptics=").append(TCP_Constants.TCP_CLIENT_HAPTICS);
+        sb.append(" imu=").append(TCP_Constants.TCP_CLIENT_IMU);
+        return sb.toString();
+    }
+
+    // s2uk_resume proto=1 token=0123456789abcdef
+    private static String resumeLine(long token) {
+        return TCP_Constants.TCP_CLIENT_RESUME_MSG + " proto=" + TCP_Constants.TCP_PROTOCOL_VERSION + " token=" + Long.toHexString(token);
+    }
+
+    // Reads the driver's answer to the hello or resume line, byte by byte so whatever follows
+    // stays buffered for the frame reader. A driver that closes on us instead is older than the
+    // line; one that doesn't know our session any more waits for the hello.
+    private boolean readWelcome(Socket socket, boolean resuming) throws IOException {
+        StringBuilder line = new StringBuilder();
+        try {
+            socket.setSoTimeout(TCP_Constants.TCP_CLIENT_CONNECTION_TIMEOUT);
+            while (true) {
+                int b = mBufferIn.read();
+                if (b < 0) {
+                    notifyStatus(context.getString(R.string.tcp_client_status_connection_closed));
+                    if (resuming) {
+                        resumeToken = 0L; // the hello next time
+                        Log.i(TAG, "Driver does not know the resume line, sending the hello");
+                    } else {
+                        helloRejected = true;
+                        Log.i(TAG, "Driver does not know the hello, falling back to the old login");
+                    }
+                    return false;
+                }
+                if (b == '\n') break;
+                if (line.length() >= TCP_Constants.TCP_FRAME_MAX_PAYLOAD) {
+                    notifyStatus("ERROR: malformed welcome from server");
+                    return false;
+                }
+                line.append((char) b);
+            }
+        } catch (SocketTimeoutException ste) {
+            notifyStatus(context.getString(R.string.tcp_client_status_connection_timeout));
+            return false;
+        }
+
+        if (resuming && line.toString().trim().equals(TCP_Constants.TCP_CLIENT_RESUME_UNKNOWN_MSG)) {
+            resumeToken = 0L;
+            Log.i(TAG, "Driver no longer has our session, sending the hello");
+            synchronized (this) {
+                if (mBufferOut == null) return false;
+                mBufferOut.write((helloLine() + "\n").getBytes(StandardCharsets.UTF_8));
+                mBufferOut.flush();
+            }
+            return readWelcome(socket, false);
+        }
+
+        WireFormat format = WireFormat.parse(line.toString().trim());
+        if (format == null) {
+            notifyStatus("ERROR: malformed welcome from server");
+            return false;
+        }
+        socket.setSoTimeout(0); // the Session frame sets the heartbeat timeout
+        wireFormat = format;
+        Log.i(TAG, "Welcome: " + line);
+        return true;
+    }
+
+    // Legacy text mode: one base64 message per line.
+    private void readLines(BufferedReader in) {
+        // Listen for server messages
+        while (mRun) {
+            try {
+                mServerMessage = in.readLine();
+            } catch (IOException ioe) {
+                // readLine failed - probably socket closed
+                Log.w(TAG, "readLine failed (socket closed?)", ioe);
+                notifyStatus(context.getString(R.string.tcp_client_status_connection_null));
+                break;
+            }
+
+            if (mServerMessage != null && mMessageListener != null) {
+                mMessageListener.messageReceived(mServerMessage);
+                if(mServerMessage != null) {
+                    inMessages.enqueue(mServerMessage);
+                    mServerMessage = null;
+                }
+            } else if (mServerMessage == null) {
+                // remote end closed connection — break loop and update status
+                notifyStatus(context.getString(R.string.tcp_client_status_connection_closed));
+                Log.i(TAG, "Server closed connection (readLine null)");
+                break;
+            }
+        }
+    }
+
+    // Binary mode: u16 little-endian payload length | u8 frame type | payload.
+    private void readFrames(DataInputStream in) {
+        byte[] header = new byte[TCP_Constants.TCP_FRAME_HEADER_SIZE];
+        while (mRun) {
+            byte[] payload;
+            int type;
+            long receivedUs;
+            try {
+                in.readFully(header);
+                int len = (header[0] & 0xFF) | ((header[1] & 0xFF) << 8);
+                type = header[2] & 0xFF;
+                if (len > TCP_Constants.TCP_FRAME_MAX_PAYLOAD) {
+                    notifyStatus("ERROR: malformed frame from server");
+                    break;
+                }
+                payload = new byte[len];
+                in.readFully(payload);
+                receivedUs = SystemClock.elapsedRealtimeNanos() / 1000L;
+            } catch (EOFException eof) {
+                notifyStatus(context.getString(R.string.tcp_client_status_connection_closed));
+                Log.i(TAG, "Server closed connection (EOF)");
+                break;
+            } catch (SocketTimeoutException ste) {
+                // the driver pings several times per timeout, silence means it or the network is gone
+                notifyStatus(context.getString(R.string.tcp_client_status_connection_timeout));
+                Log.i(TAG, "Server missed its heartbeats");
+                break;
+            } catch (IOException ioe) {
+                Log.w(TAG, "readFully failed (socket closed?)", ioe);
+                notifyStatus(context.getString(R.string.tcp_client_status_connection_null));
+                break;
+            }
+
+            if (type == TCP_Constants.TCP_FRAME_HAPTIC) {
+                inMessages.enqueueRaw(payload);
+            } else if (type == TCP_Constants.TCP_FRAME_PING) {
+                // the driver measures round-trip time with these, and syncs its clock to ours
+                // from the receive/send times we append
+                sendFrame(TCP_Constants.TCP_FRAME_PONG, clockSyncPong(payload, receivedUs));
+            } else if (type == TCP_Constants.TCP_FRAME_SEND_RATE) {
+                inMessages.enqueueRate(payload);
+            } else if (type == TCP_Constants.TCP_FRAME_HAPTIC_ENVELOPE) {
+                inMessages.enqueueEnvelope(payload);
+            } else if (type == TCP_Constants.TCP_FRAME_SESSION && payload.length >= 13) {
+                onSessionInfo(payload);
+            }
+        }
+    }
+
+    // Session payload: u64 token | u8 flags (bit0 = resumed) | u16 heartbeat interval ms | u16 heartbeat timeout ms
+    private void onSessionInfo(byte[] payload) {
+        long token = 0L;
+        for (int i = 0; i < 8; i++) {
+            token |= (payload[i] & 0xFFL) << (8 * i);
+        }
+        boolean resumed = (payload[8] & 0x01) != 0;
+        int timeoutMs = (payload[11] & 0xFF) | ((payload[12] & 0xFF) << 8);
+
+        resumeToken = token;
+        sessionConfirmed = true;
+        Log.i(TAG, resumed ? "Session resumed" : "New session");
+
+        // the driver keeps pinging us, a read that blocks past its timeout means the link is dead
+        if (timeoutMs > 0) {
+            synchronized (this) {
+                try {
+                    if (mSocket != null) mSocket.setSoTimeout(timeoutMs);
+                } catch (IOException e) {
+                    Log.w(TAG, "setSoTimeout failed", e);
+                }
+            }
+        }
+    }
+
+    private static byte[] resumeFrame(long token) {
+        byte[] frame = new byte[TCP_Constants.TCP_FRAME_HEADER_SIZE + 8];
+        frame[0] = 8;
+        frame[1] = 0;
+        frame[2] = (byte) TCP_Constants.TCP_FRAME_RESUME;
+        for (int i = 0; i < 8; i++) {
+            frame[TCP_Constants.TCP_FRAME_HEADER_SIZE + i] = (byte) (token >>> (8 * i));
+        }
+        return frame;
+    }
+
+    // Pong payload: the ping payload | u64 receive time | u64 send time, little-endian,
+    // SystemClock.elapsedRealtimeNanos() base in us (the same clock as SensorEvent.timestamp).
+    private static byte[] clockSyncPong(byte[] ping, long receivedUs) {
+        byte[] pong = new byte[ping.length + 16];
+        System.arraycopy(ping, 0, pong, 0, ping.length);
+        long sentUs = SystemClock.elapsedRealtimeNanos() / 1000L;
+        for (int i = 0; i < 8; i++) {
+            pong[ping.length + i] = (byte) (receivedUs >>> (8 * i));
+            pong[ping.length + 8 + i] = (byte) (sentUs >>> (8 * i));
+        }
+        return pong;
+    }
+
+    private void closeUdp() {
+        UdpSender udp = udpSender;
+        udpSender = null;
+        if (udp != null) udp.close();
     }
 
     private void notifyStatus(String status) {
@@ -301,10 +617,68 @@ public class TcpClient {
         return connectionTimestamp;
     }
 
+    /**
+     * True once states can go out: right away when the driver confirmed a session,
+     * otherwise (text framing, older drivers) after TCP_CLIENT_FIRST_PACKET_DELAY.
+     */
+    public boolean readyToSend() {
+        if (!connectionUp) return false;
+        if (sessionConfirmed) return true;
+        long connected = connectionTimestamp;
+        return connected != 0L && System.currentTimeMillis() - connected >= TCP_Constants.TCP_CLIENT_FIRST_PACKET_DELAY;
+    }
+
     public String getLastServerMessage() {
         return mServerMessage;
     }
 
+    /**
+     * The driver's side of the hello, see TCP_Constants.TCP_CLIENT_HELLO_MSG.
+     */
+    public static final class WireFormat {
+        public int version = TCP_Constants.TCP_PROTOCOL_VERSION;
+        public String framing = "binary";
+        public String codec = "varint";
+        public int gyroScale = TCP_Constants.TCP_CLIENT_GYRO_SCALE;
+        public int joyScale = TCP_Constants.TCP_CLIENT_JOY_SCALE;
+        public String orientation = "euler"; // drivers that don't know quaternions leave it out
+        public int rateHz = 0; // states per second to start at, 0 = keep the default cadence
+        public String imu = "none"; // "batch": the sensor samples since the last state go with each one
+        public int session = 0; // goes in every UDP datagram, 0 = driver without UDP sessions
+
+        // null if the line is not a welcome; unknown keys are skipped
+        static WireFormat parse(String line) {
+            String[] tokens = line.split(" +");
+            if (tokens.length == 0 || !tokens[0].equals(TCP_Constants.TCP_CLIENT_WELCOME_MSG)) return null;
+
+            WireFormat f = new WireFormat();
+            for (int i = 1; i < tokens.length; i++) {
+                int eq = tokens[i].indexOf('=');
+                if (eq <= 0) continue;
+                String key = tokens[i].substring(0, eq);
+                String value = tokens[i].substring(eq + 1);
+                try {
+                    switch (key) {
+                        case "proto": f.version = Integer.parseInt(value); break;
+                        case "framing": f.framing = value; break;
+                        case "codec": f.codec = value; break;
+                        case "gyro_scale": f.gyroScale = Integer.parseInt(value); break;
+                        case "joy_scale": f.joyScale = Integer.parseInt(value); break;
+                        case "orientation": f.orientation = value; break;
+                        case "rate": f.rateHz = Integer.parseInt(value); break;
+                        case "imu": f.imu = value; break;
+                        case "session": f.session = (int) Long.parseLong(value); break;
+                        default: break;
+                    }
+                } catch (NumberFormatException e) {
+                    return null;
+                }
+            }
+            if (f.gyroScale <= 0 || f.joyScale <= 0) return null;
+            return f;
+        }
+    }
+
     //Declare the interface. The method messageReceived(String message) must be implemented
     // by the calling class (e.g. activity) that listens for server messages.
     public interface OnMessageReceived {
@@ -0,0 +1,126 @@
+package org.s2uk.vrcontroller;
+
+import android.os.SystemClock;
+import android.util.Log;
+
+import java.net.DatagramPacket;
+import java.net.DatagramSocket;
+import java.net.InetAddress;
+import java.net.SocketException;
+import java.util.ArrayDeque;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Sends controller state as UDP datagrams (driver UdpServer.h):
+ * u8 magic | u8 version | u8 deviceId | u8 stateCount | u32 seq | u64 sendTimeUs | u32 session | stateCount x (u8 len | state)
+ * All integers little-endian, states newest first. Every datagram repeats the previous
+ * TCP_Constants.UDP_REDUNDANT_STATES states, so a single lost datagram costs nothing.
+ */
+public class UdpSender {
+    private static final String TAG = "UdpSenderJVM";
+
+    private final DatagramSocket socket;
+    private final InetAddress serverAddr;
+    private final int serverPort;
+    private final int session; // the welcome's session=, tells the driver which login the states belong to
+
+    private final ArrayDeque<byte[]> history = new ArrayDeque<>(); // newest first, sender thread only
+    private int seq = 0;
+
+    // latest-wins: a full queue drops its oldest state to make room for the new one
+    private final LinkedBlockingQueue<byte[]> sendQueue = new LinkedBlockingQueue<>(64);
+    private final Thread senderThread;
+    private volatile boolean mRun = true;
+
+    public UdpSender(InetAddress serverAddr, int serverPort, int session) throws SocketException {
+        this.serverAddr = serverAddr;
+        this.serverPort = serverPort;
+        this.session = session;
+        this.socket = new DatagramSocket();
+        this.senderThread = new Thread(this::senderLoop, "UdpSender");
+        this.senderThread.start();
+    }
+
+    /**
+     * Queue one raw controller state. Safe to call from the UI thread.
+     */
+    public void sendState(boolean isLeft, byte[] state) {
+        if (state == null || state.length == 0 || state.length > 255) return;
+        byte[] tagged = new byte[state.length + 1];
+        tagged[0] = (byte) (isLeft ? 1 : 0);
+        System.arraycopy(state, 0, tagged, 1, state.length);
+        // The sender thread may take one in between, then the offer simply succeeds.
+        while (!sendQueue.offer(tagged)) {
+            sendQueue.poll();
+        }
+    }
+
+    public void close() {
+        mRun = false;
+        senderThread.interrupt();
+        try {
+            senderThread.join(500);
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+        socket.close();
+    }
+
+    private void senderLoop() {
+        while (mRun) {
+            byte[] tagged;
+            try {
+                tagged = sendQueue.poll(50, TimeUnit.MILLISECONDS);
+            } catch (InterruptedException e) {
+                break;
+            }
+            if (tagged == null) continue;
+
+            byte deviceId = tagged[0];
+            byte[] state = new byte[tagged.length - 1];
+            System.arraycopy(tagged, 1, state, 0, state.length);
+
+            history.addFirst(state);
+            while (history.size() > 1 + TCP_Constants.UDP_REDUNDANT_STATES) history.removeLast();
+            seq++;
+
+            byte[] datagram = build(deviceId);
+            try {
+                socket.send(new DatagramPacket(datagram, datagram.length, serverAddr, serverPort));
+            } catch (Exception e) {
+                Log.w(TAG, "send failed: " + e.getMessage());
+            }
+        }
+    }
+
+    private byte[] build(byte deviceId) {
+        int size = TCP_Constants.UDP_HEADER_SIZE;
+        int count = 0;
+        for (byte[] s : history) {
+            if (size + 1 + s.length > TCP_Constants.UDP_MAX_DATAGRAM) break;
+            size += 1 + s.length;
+            count++;
+        }
+
+        byte[] out = new byte[size];
+        long sendTimeUs = SystemClock.elapsedRealtimeNanos() / 1000L;
+        out[0] = 'S';
+        out[1] = TCP_Constants.UDP_VERSION;
+        out[2] = deviceId;
+        out[3] = (byte) count;
+        for (int i = 0; i < 4; i++) out[4 + i] = (byte) (seq >>> (8 * i));
+        for (int i = 0; i < 8; i++) out[8 + i] = (byte) (sendTimeUs >>> (8 * i));
+        for (int i = 0; i < 4; i++) out[16 + i] = (byte) (session >>> (8 * i));
+
+        int pos = TCP_Constants.UDP_HEADER_SIZE;
+        int i = 0;
+        for (byte[] s : history) {
+            if (i++ == count) break;
+            out[pos++] = (byte) s.length;
+            System.arraycopy(s, 0, out, pos, s.length);
+            pos += s.length;
+        }
+        return out;
+    }
+}
@@ -0,0 +1,352 @@
+#pragma once
+#ifndef S2UK_Base64
+#define S2UK_Base64
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define S2UK_BASE64_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define S2UK_BASE64_TARGET(t)
+#else
+#include <cpuid.h>
+#define S2UK_BASE64_TARGET(t) __attribute__((target(t)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define S2UK_BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+
+/**
+Standard base64 (RFC 4648 alphabet, '=' padding) into and out of caller buffers, shared by
+the driver (Crypto.h) and the phone (native-lib.cpp, C++17).
+
+Validation is a single pass over one 256-entry table that classifies every byte as a 6-bit
+value, padding, whitespace or invalid. Whole blocks go through SIMD kernels where the CPU has
+them: AVX2 or SSSE3 on x86 (picked at runtime, the driver is built for plain x64) and NEON on
+64-bit ARM. A block the kernel cannot take (padding, whitespace, bad bytes) and the tail go
+through the scalar loop, which gives the same results as the kernels.
+**/
+namespace s2uk_base64 {
+	enum class Status : uint8_t {
+		Ok = 0,
+		Invalid,    // a byte outside the alphabet, or not a whole number of quads
+		BadPadding, // '=' where it cannot be
+		NoSpace,    // the output buffer is too small
+	};
+
+	constexpr size_t encodedSize(size_t len) { return (len + 2) / 3 * 4; }
+	constexpr size_t maxDecodedSize(size_t len) { return (len + 3) / 4 * 3; }
+
+	namespace detail {
+		constexpr uint8_t kPad = 0x40;
+		constexpr uint8_t kSpace = 0x80;
+		constexpr uint8_t kInvalid = 0xFF;
+
+		constexpr char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		constexpr std::array<uint8_t, 256> makeDecodeTable() {
+			std::array<uint8_t, 256> t{};
+			for (size_t i = 0; i < t.size(); ++i) t[i] = kInvalid;
+			for (uint8_t i = 0; i < 64; ++i) t[static_cast<uint8_t>(kAlphabet[i])] = i;
+			t['='] = kPad;
+			t[' '] = t['\t'] = t['\n'] = t['\v'] = t['\f'] = t['\r'] = kSpace; // what std::isspace skipped
+			return t;
+		}
+		inline constexpr std::array<uint8_t, 256> kDecodeTable = makeDecodeTable();
+
+		// Only alphabet characters, '=' and whitespace, and a whole number of quads: what tells
+		// input that is not base64 at all from base64 with broken padding.
+		inline bool wellFormed(const char* in, size_t len) {
+			size_t n = 0;
+			for (size_t i = 0; i < len; ++i) {
+				const uint8_t v = kDecodeTable[static_cast<uint8_t>(in[i])];
+				if (v == kInvalid) return false;
+				if (v != kSpace) ++n;
+			}
+			return n % 4 == 0;
+		}
+
+		inline void encodeQuad(const uint8_t* in, char* out) {
+			const uint32_t v = (uint32_t(in[0]) << 16) | (uint32_t(in[1]) << 8) | in[2];
+			out[0] = kAlphabet[(v >> 18) & 0x3F];
+			out[1] = kAlphabet[(v >> 12) & 0x3F];
+			out[2] = kAlphabet[(v >> 6) & 0x3F];
+			out[3] = kAlphabet[v & 0x3F];
+		}
+
+#if defined(S2UK_BASE64_X86)
+		struct CpuFeatures {
+			bool ssse3 = false;
+			bool avx2 = false;
+		};
+
+		inline CpuFeatures detectCpu() {
+			CpuFeatures f;
+#if defined(_MSC_VER) && !defined(__clang__)
+			int r[4];
+			__cpuid(r, 0);
+			const int maxLeaf = r[0];
+			__cpuid(r, 1);
+			f.ssse3 = (r[2] & (1 << 9)) != 0;
+			const bool osAvx = (r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+			if (maxLeaf >= 7 && osAvx) {
+				__cpuidex(r, 7, 0);
+				f.avx2 = (r[1] & (1 << 5)) != 0;
+			}
+#else
+			__builtin_cpu_init();
+			f.ssse3 = __builtin_cpu_supports("ssse3");
+			f.avx2 = __builtin_cpu_supports("avx2");
+#endif
+			return f;
+		}
+
+		inline const CpuFeatures& cpu() {
+			static const CpuFeatures f = detectCpu();
+			return f;
+		}
+
+		// 6-bit indices -> ASCII (Mula's pshufb lookup): offset per index range, picked by a
+		// saturating subtract and one compare.
+		S2UK_BASE64_TARGET("ssse3")
+		inline __m128i indicesToAscii128(__m128i idx) {
+			const __m128i shiftLut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+			__m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+			const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+			r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+			return _mm_add_epi8(_mm_shuffle_epi8(shiftLut, r), idx);
+		}
+
+		// 12 input bytes (16 readable) -> 16 characters.
+		S2UK_BASE64_TARGET("ssse3")
+		inline void encodeBlock128(const uint8_t* in, char* out) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+			v = _mm_shuffle_epi8(v, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+			const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+			const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), indicesToAscii128(_mm_or_si128(t0, t1)));
+		}
+
+		// 16 characters -> 12 bytes. False (nothing written) if any of them is not a plain
+		// alphabet character.
+		S2UK_BASE64_TARGET("ssse3")
+		inline bool decodeBlock128(const char* in, uint8_t* out) {
+			const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+			const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+			const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+			const __m128i slash = _mm_set1_epi8(0x2F);
+
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+			const __m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), _mm_set1_epi8(0x0F));
+			const __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+			const __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, lo), _mm_shuffle_epi8(lutHi, hi));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xFFFF) return false;
+
+			const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(_mm_cmpeq_epi8(v, slash), hi));
+			v = _mm_add_epi8(v, roll);
+			v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+			v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+			v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), v);
+			const uint32_t last = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(v, 8)));
+			std::memcpy(out + 8, &last, 4);
+			return true;
+		}
+
+		S2UK_BASE64_TARGET("avx2")
+		inline __m256i indicesToAscii256(__m256i idx) {
+			const __m256i shiftLut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+			__m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+			const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+			r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+			return _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, r), idx);
+		}
+
+		// 24 input bytes (28 readable) -> 32 characters, 12 bytes per 128-bit lane.
+		S2UK_BASE64_TARGET("avx2")
+		inline void encodeBlock256(const uint8_t* in, char* out) {
+			const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+			const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12));
+			__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+			v = _mm256_shuffle_epi8(v, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+				10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+			const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+			const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), indicesToAscii256(_mm256_or_si256(t0, t1)));
+		}
+
+		// 32 characters -> 24 bytes, same rules as decodeBlock128.
+		S2UK_BASE64_TARGET("avx2")
+		inline bool decodeBlock256(const char* in, uint8_t* out) {
+			const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+				0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+			const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+				0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+			const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+				0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+			const __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi8(0x0F));
+			const __m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+			if (!_mm256_testz_si256(_mm256_shuffle_epi8(lutLo, lo), _mm256_shuffle_epi8(lutHi, hi))) return false;
+
+			const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x2F)), hi));
+			v = _mm256_add_epi8(v, roll);
+			v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+			v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+			v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+			v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(v));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm256_extracti128_si256(v, 1));
+			return true;
+		}
+#endif
+
+#if defined(S2UK_BASE64_NEON)
+		// 48 bytes -> 64 characters: de-interleave into the four 6-bit fields, one 64-entry
+		// table lookup each.
+		inline void encodeBlockNeon(const uint8_t* in, char* out) {
+			const uint8x16x4_t table = { { vld1q_u8(reinterpret_cast<const uint8_t*>(kAlphabet)), vld1q_u8(reinterpret_cast<const uint8_t*>(kAlphabet) + 16),
+				vld1q_u8(reinterpret_cast<const uint8_t*>(kAlphabet) + 32), vld1q_u8(reinterpret_cast<const uint8_t*>(kAlphabet) + 48) } };
+			const uint8x16x3_t v = vld3q_u8(in);
+			uint8x16x4_t idx;
+			idx.val[0] = vshrq_n_u8(v.val[0], 2);
+			idx.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(v.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(v.val[1], 4));
+			idx.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(v.val[1], vdupq_n_u8(0x0F)), 2), vshrq_n_u8(v.val[2], 6));
+			idx.val[3] = vandq_u8(v.val[2], vdupq_n_u8(0x3F));
+			uint8x16x4_t chars;
+			for (int k = 0; k < 4; ++k) chars.val[k] = vqtbl4q_u8(table, idx.val[k]);
+			vst4q_u8(reinterpret_cast<uint8_t*>(out), chars);
+		}
+
+		// 64 characters -> 48 bytes, through the first half of kDecodeTable. False (nothing
+		// written) if any of them is not a plain alphabet character.
+		inline bool decodeBlockNeon(const char* in, uint8_t* out) {
+			const uint8_t* t = kDecodeTable.data();
+			const uint8x16x4_t lo = { { vld1q_u8(t), vld1q_u8(t + 16), vld1q_u8(t + 32), vld1q_u8(t + 48) } };
+			const uint8x16x4_t hi = { { vld1q_u8(t + 64), vld1q_u8(t + 80), vld1q_u8(t + 96), vld1q_u8(t + 112) } };
+			const uint8x16x4_t c = vld4q_u8(reinterpret_cast<const uint8_t*>(in));
+			uint8x16x4_t v;
+			uint8x16_t bad = vdupq_n_u8(0);
+			for (int k = 0; k < 4; ++k) {
+				// Out of range indices give 0, so bytes >= 128 are flagged separately.
+				v.val[k] = vorrq_u8(vqtbl4q_u8(lo, c.val[k]), vqtbl4q_u8(hi, vsubq_u8(c.val[k], vdupq_n_u8(64))));
+				bad = vorrq_u8(bad, vorrq_u8(v.val[k], vcgeq_u8(c.val[k], vdupq_n_u8(128))));
+			}
+			if (vmaxvq_u8(bad) >= 64) return false;
+
+			uint8x16x3_t o;
+			o.val[0] = vorrq_u8(vshlq_n_u8(v.val[0], 2), vshrq_n_u8(v.val[1], 4));
+			o.val[1] = vorrq_u8(vshlq_n_u8(v.val[1], 4), vshrq_n_u8(v.val[2], 2));
+			o.val[2] = vorrq_u8(vshlq_n_u8(v.val[2], 6), v.val[3]);
+			vst3q_u8(out, o);
+			return true;
+		}
+#endif
+	}
+
+	// out must hold encodedSize(len) characters. Returns how many were written.
+	inline size_t encode(const uint8_t* in, size_t len, char* out) {
+		size_t i = 0, o = 0;
+#if defined(S2UK_BASE64_X86)
+		if (detail::cpu().avx2) {
+			for (; i + 28 <= len; i += 24, o += 32) detail::encodeBlock256(in + i, out + o);
+		}
+		if (detail::cpu().ssse3) {
+			for (; i + 16 <= len; i += 12, o += 16) detail::encodeBlock128(in + i, out + o);
+		}
+#elif defined(S2UK_BASE64_NEON)
+		for (; i + 48 <= len; i += 48, o += 64) detail::encodeBlockNeon(in + i, out + o);
+#endif
+		for (; i + 3 <= len; i += 3, o += 4) detail::encodeQuad(in + i, out + o);
+
+		const size_t rem = len - i;
+		if (rem) {
+			const uint8_t last[3] = { in[i], rem == 2 ? in[i + 1] : uint8_t(0), 0 };
+			detail::encodeQuad(last, out + o);
+			out[o + 3] = '=';
+			if (rem == 1) out[o + 2] = '=';
+			o += 4;
+		}
+		return o;
+	}
+
+	// Decodes into out (capacity bytes, maxDecodedSize(len) is always enough); outLen is the
+	// decoded size. Whitespace anywhere is skipped. Nothing but whitespace may follow padding.
+	// Invalid wins over BadPadding, so callers can treat it as "not base64".
+	inline Status decode(const char* in, size_t len, uint8_t* out, size_t capacity, size_t& outLen) {
+		size_t i = 0, o = 0;
+#if defined(S2UK_BASE64_X86)
+		if (detail::cpu().avx2) {
+			for (; i + 32 <= len && o + 24 <= capacity; i += 32, o += 24) {
+				if (!detail::decodeBlock256(in + i, out + o)) break;
+			}
+		}
+		if (detail::cpu().ssse3) {
+			for (; i + 16 <= len && o + 12 <= capacity; i += 16, o += 12) {
+				if (!detail::decodeBlock128(in + i, out + o)) break;
+			}
+		}
+#elif defined(S2UK_BASE64_NEON)
+		for (; i + 64 <= len && o + 48 <= capacity; i += 64, o += 48) {
+			if (!detail::decodeBlockNeon(in + i, out + o)) break;
+		}
+#endif
+
+		uint32_t acc = 0;
+		int n = 0;    // 6-bit values in acc
+		int pads = 0; // '=' seen
+		for (; i < len; ++i) {
+			const uint8_t v = detail::kDecodeTable[static_cast<uint8_t>(in[i])];
+			if (v < 64) {
+				if (pads) return detail::wellFormed(in, len) ? Status::BadPadding : Status::Invalid;
+				acc = (acc << 6) | v;
+				if (++n == 4) {
+					if (o + 3 > capacity) return Status::NoSpace;
+					out[o++] = static_cast<uint8_t>(acc >> 16);
+					out[o++] = static_cast<uint8_t>(acc >> 8);
+					out[o++] = static_cast<uint8_t>(acc);
+					acc = 0;
+					n = 0;
+				}
+			}
+			else if (v == detail::kSpace) {
+				continue;
+			}
+			else if (v == detail::kPad) {
+				// "xx==" or "xxx=" only.
+				if (n + pads >= 4 || n < 2) return detail::wellFormed(in, len) ? Status::BadPadding : Status::Invalid;
+				++pads;
+			}
+			else {
+				return Status::Invalid;
+			}
+		}
+
+		if (pads) {
+			if (n + pads != 4) return Status::Invalid;
+			const size_t tail = static_cast<size_t>(n - 1);
+			if (o + tail > capacity) return Status::NoSpace;
+			acc <<= 6 * pads;
+			out[o++] = static_cast<uint8_t>(acc >> 16);
+			if (tail == 2) out[o++] = static_cast<uint8_t>(acc >> 8);
+		}
+		else if (n) {
+			return Status::Invalid;
+		}
+		outLen = o;
+		return Status::Ok;
+	}
+}
+#endif
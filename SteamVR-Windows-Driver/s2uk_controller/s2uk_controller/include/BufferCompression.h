@@ -2,42 +2,19 @@
 #ifndef S2UK_BufferDecryptor
 #define S2UK_BufferDecryptor
 
+#include <span>
+#include <string>
+#include <stdexcept>
+#include <string_view>
 #include <vector>
 #include "Crypto.h"
 #include "VectorMath.h"
+#include "FrameParser.h"
+#include "Handshake.h"
+#include "PacketSchema.h"
+#include "PacketBatch.h"
 
-class ByteReader {
-public:
-    explicit ByteReader(std::vector<uint8_t> data) : bytes(std::move(data)), pos(0) {}
-    size_t remaining() const { return bytes.size() - pos; }
-
-    uint8_t readByte() {
-        if (pos >= bytes.size()) throw std::out_of_range("unexpected buffer end");
-        return bytes[pos++];
-    }
-
-    uint64_t readVarUint64() {
-        uint64_t result = 0;
-        unsigned shift = 0;
-        const unsigned maxBytes = 10;
-        unsigned consumed = 0;
-        while (true) {
-            if (pos >= bytes.size()) throw std::out_of_range("out of range");
-            uint8_t b = bytes[pos++];
-            ++consumed;
-            result |= (uint64_t)(b & 0x7F) << shift;
-            if ((b & 0x80) == 0) break;
-            shift += 7;
-            if (shift >= 64 || consumed > maxBytes) throw std::invalid_argument("variant exeeds max bytes");
-        }
-        return result;
-    }
-
-private:
-    std::vector<uint8_t> bytes;
-    size_t pos;
-};
-
+// Driver side of the packets in PacketSchema.h: wire values to and from ControllerState.
 class BufferCompression {
 public:
     struct ControllerState {
@@ -56,74 +33,217 @@ public:
 
         Vec3 gyro{}; // gx, gy, gz
         Vec2 joy{};  // jx, jy
+
+        // Set instead of gyro when the phone sent its orientation as a quaternion (s2uk_packet::kFlagQuaternion).
+        bool hasOrientation = false;
+        Quaternion orientation{ 1.0, 0.0, 0.0, 0.0 };
+
+        uint64_t senderTimeUs = 0; // sensor event time on the phone's clock, 0 if the phone doesn't send it
+        uint64_t sampleTimeUs = 0; // the same instant on NetTelemetry::nowUs() time, 0 until the clocks are synced
     };
 
-    static ControllerState decryptControllerState(const std::string& b64) {
-        auto b64_ = b64;
-        const double gyroScale = 1000.0;
-        const double joyScale = 100000.0;
+    enum class DecodeStatus : uint8_t {
+        Ok = 0,
+        TooShort,   // less than the three fixed bytes, or a short fixed-layout packet
+        Truncated,  // a varint runs past the end
+        BadVarint,  // a varint longer than 10 bytes
+        BadBase64,  // text packets only
+        BadLayout,  // fixed layout packet with an unknown layout byte, or a delta that can't apply
+        NoKeyframe, // delta codec: the keyframe it is against was lost, wait for the next one
+    };
 
-        std::vector<uint8_t> bytes = s2uk_crypto::base64_decode(b64_);
-        if (bytes.size() < 3) return {}; // throw std::invalid_argument("buffer too small");
+    // Legacy text packets: base64 of the raw controller packet, decoded on the stack.
+    // Never throws and never allocates; out is only written on Ok.
+    static DecodeStatus decryptControllerState(std::string_view b64, ControllerState& out, const Handshake::WireFormat& format = {}) {
+        uint8_t raw[StreamFrameParser::kMaxPayload];
+        size_t len = 0;
+        if (s2uk_base64::decode(b64.data(), b64.size(), raw, sizeof(raw), len) != s2uk_base64::Status::Ok) return DecodeStatus::BadBase64;
+        return decodeControllerState(std::span<const uint8_t>(raw, len), out, format);
+    }
 
-        ByteReader r(std::move(bytes));
+    // Binary frames: the raw controller packet, no base64, read where it lies.
+    // format carries the codec and quantization scales agreed in the hello; legacy phones use
+    // the defaults. Never throws and never allocates; out is only written on Ok. Delta codec
+    // deltas need the phone's stream, see TcpSocketClass::DecodeDelta.
+    static DecodeStatus decodeControllerState(std::span<const uint8_t> bytes, ControllerState& out, const Handshake::WireFormat& format = {}) {
+        s2uk_packet::ControllerPacket p;
+        const s2uk_packet::Status status = s2uk_packet::decode(bytes.data(), bytes.size(), format.codec, p);
+        if (status != s2uk_packet::Status::Ok) return toDecodeStatus(status);
+        out = fromPacket(p, format);
+        return DecodeStatus::Ok;
+    }
 
-        uint8_t flags = r.readByte();
+    // A decoded packet as a state, at the scales in format.
+    static ControllerState fromPacket(const s2uk_packet::ControllerPacket& p, const Handshake::WireFormat& format = {}) {
         ControllerState st;
-        st.left_controller = (flags & (1 << 0)) != 0;
-        st.btn_system_or_menu_state = (flags & (1 << 1)) != 0;
-        st.btn_a_or_x_state = (flags & (1 << 2)) != 0;
-        st.btn_b_or_y_state = (flags & (1 << 3)) != 0;
-        st.controller_battery_plugged = (flags & (1 << 4)) != 0;
-        st.joy_in_dz = (flags & (1 << 5)) != 0;
-
-        uint8_t modes = r.readByte();
-        st.trigger_state = (modes >> 0) & 0x3;
-        st.grip_state = (modes >> 2) & 0x3;
-        st.joy_state = (modes >> 4) & 0x3;
-
-        uint8_t battery = r.readByte();
-        if (battery > 100) battery = 100; // clamp
-        st.batteryPercentage = battery / 100.0f;
-
-        // read 5 zigzag varints: gxi, gyi, gzi, jxi, jyi
-        int64_t gxi = s2uk_crypto::zigzag64Decode(r.readVarUint64());
-        int64_t gyi = s2uk_crypto::zigzag64Decode(r.readVarUint64());
-        int64_t gzi = s2uk_crypto::zigzag64Decode(r.readVarUint64());
-        int64_t jxi = s2uk_crypto::zigzag64Decode(r.readVarUint64());
-        int64_t jyi = s2uk_crypto::zigzag64Decode(r.readVarUint64());
-
-        st.gyro.x = static_cast<double>(gxi) / gyroScale;
-        st.gyro.y = static_cast<double>(gyi) / gyroScale;
-        st.gyro.z = static_cast<double>(gzi) / gyroScale;
-
-        st.joy.x = static_cast<double>(jxi) / joyScale;
-        st.joy.y = static_cast<double>(jyi) / joyScale;
+        st.left_controller = (p.flags & s2uk_packet::kFlagLeft) != 0;
+        st.btn_system_or_menu_state = (p.flags & s2uk_packet::kFlagSystemOrMenu) != 0;
+        st.btn_a_or_x_state = (p.flags & s2uk_packet::kFlagAOrX) != 0;
+        st.btn_b_or_y_state = (p.flags & s2uk_packet::kFlagBOrY) != 0;
+        st.controller_battery_plugged = (p.flags & s2uk_packet::kFlagBatteryPlugged) != 0;
+        st.joy_in_dz = (p.flags & s2uk_packet::kFlagJoyInDZ) != 0;
+
+        st.trigger_state = s2uk_packet::kModeTrigger.get(p.modes);
+        st.grip_state = s2uk_packet::kModeGrip.get(p.modes);
+        st.joy_state = s2uk_packet::kModeJoy.get(p.modes);
+
+        st.batteryPercentage = std::min<uint8_t>(p.battery, s2uk_packet::kMaxBattery) / 100.0f;
+
+        if (p.flags & s2uk_packet::kFlagQuaternion) {
+            double q[4];
+            s2uk_packet::unpackSmallestThree(p.quat, q);
+            st.hasOrientation = true;
+            st.orientation = { q[0], q[1], q[2], q[3] };
+        }
+        else {
+            st.gyro.x = s2uk_packet::dequantize(p.gyro[0], format.gyroScale);
+            st.gyro.y = s2uk_packet::dequantize(p.gyro[1], format.gyroScale);
+            st.gyro.z = s2uk_packet::dequantize(p.gyro[2], format.gyroScale);
+        }
+        st.joy.x = s2uk_packet::dequantize(p.joy[0], format.joyScale);
+        st.joy.y = s2uk_packet::dequantize(p.joy[1], format.joyScale);
+
+        st.senderTimeUs = p.senderTimeUs;
+        return st;
+    }
+
+    // The samples of an IMU batch that came with packet p, decoded as newest, oldest first:
+    // newest with each sample's orientation and time (ages taken off both of newest's times).
+    // out must hold s2uk_packet::kMaxImuSamples states. Returns how many were written.
+    static size_t fromImuBatch(const s2uk_packet::ImuBatch& batch, const s2uk_packet::ControllerPacket& p, const ControllerState& newest,
+                               ControllerState* out, const Handshake::WireFormat& format = {}) {
+        const size_t count = std::min<size_t>(batch.count, s2uk_packet::kMaxImuSamples);
+        for (size_t i = 0; i < count; ++i) {
+            const s2uk_packet::ImuSample& s = batch.samples[i];
+            ControllerState st = newest;
+            if (p.flags & s2uk_packet::kFlagQuaternion) {
+                double q[4];
+                s2uk_packet::unpackSmallestThree(s.quat, q);
+                st.orientation = { q[0], q[1], q[2], q[3] };
+            }
+            else {
+                st.gyro.x = s2uk_packet::dequantize(s.gyro[0], format.gyroScale);
+                st.gyro.y = s2uk_packet::dequantize(s.gyro[1], format.gyroScale);
+                st.gyro.z = s2uk_packet::dequantize(s.gyro[2], format.gyroScale);
+            }
+            st.senderTimeUs = newest.senderTimeUs > s.ageUs ? newest.senderTimeUs - s.ageUs : 0;
+            st.sampleTimeUs = newest.sampleTimeUs > s.ageUs ? newest.sampleTimeUs - s.ageUs : 0;
+            out[i] = st;
+        }
+        return count;
+    }
+
+    // Several binary packets in one format at once, e.g. the states of one UDP datagram. The
+    // same results as decodeControllerState on each, through s2uk_packet::decodeBatch. out[i]
+    // is only written where status[i] is Ok. A single packet skips the batch set-up.
+    static void decodeControllerStates(const std::span<const uint8_t>* packets, size_t count, ControllerState* out, DecodeStatus* status, const Handshake::WireFormat& format = {}) {
+        if (count == 1) {
+            status[0] = decodeControllerState(packets[0], out[0], format);
+            return;
+        }
+        s2uk_packet::PacketBatch batch;
+        double scaled[s2uk_packet::kBatchValues][s2uk_packet::kBatchSize];
+        for (size_t base = 0; base < count; base += s2uk_packet::kBatchSize) {
+            const size_t n = std::min<size_t>(count - base, s2uk_packet::kBatchSize);
+            s2uk_packet::decodeBatch(packets + base, n, format.codec, batch);
+            for (size_t f = 0; f < s2uk_packet::kBatchValues; ++f) {
+                s2uk_packet::dequantizeRow(batch.values[f], n, f < 3 ? format.gyroScale : format.joyScale, batch.small[f], scaled[f]);
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                status[base + i] = toDecodeStatus(batch.status[i]);
+                if (batch.status[i] != s2uk_packet::Status::Ok) continue;
+
+                ControllerState st;
+                const uint8_t flags = batch.flags[i], modes = batch.modes[i];
+                st.left_controller = (flags & s2uk_packet::kFlagLeft) != 0;
+                st.btn_system_or_menu_state = (flags & s2uk_packet::kFlagSystemOrMenu) != 0;
+                st.btn_a_or_x_state = (flags & s2uk_packet::kFlagAOrX) != 0;
+                st.btn_b_or_y_state = (flags & s2uk_packet::kFlagBOrY) != 0;
+                st.controller_battery_plugged = (flags & s2uk_packet::kFlagBatteryPlugged) != 0;
+                st.joy_in_dz = (flags & s2uk_packet::kFlagJoyInDZ) != 0;
+
+                st.trigger_state = s2uk_packet::kModeTrigger.get(modes);
+                st.grip_state = s2uk_packet::kModeGrip.get(modes);
+                st.joy_state = s2uk_packet::kModeJoy.get(modes);
+
+                st.batteryPercentage = std::min<uint8_t>(batch.battery[i], s2uk_packet::kMaxBattery) / 100.0f;
+
+                if (flags & s2uk_packet::kFlagQuaternion) {
+                    double q[4];
+                    s2uk_packet::unpackSmallestThree(batch.quat[i], q);
+                    st.hasOrientation = true;
+                    st.orientation = { q[0], q[1], q[2], q[3] };
+                }
+                else {
+                    st.gyro = Vec3(scaled[0][i], scaled[1][i], scaled[2][i]);
+                }
+                st.joy = Vec2(scaled[3][i], scaled[4][i]);
+                st.senderTimeUs = batch.senderTimeUs[i];
+                out[base + i] = st;
+            }
+        }
+    }
+
+    // Throwing wrappers with the old contract: a default state for input that is too short or
+    // not base64, std::invalid_argument for anything else malformed.
+    static ControllerState decryptControllerState(std::string_view b64, const Handshake::WireFormat& format = {}) {
+        uint8_t raw[StreamFrameParser::kMaxPayload];
+        const size_t len = s2uk_crypto::base64_decode(b64, raw, sizeof(raw));
+        return decodeControllerState(raw, len, format);
+    }
+
+    static ControllerState decodeControllerState(const std::vector<uint8_t>& bytes, const Handshake::WireFormat& format = {}) {
+        return decodeControllerState(bytes.data(), bytes.size(), format);
+    }
 
+    static ControllerState decodeControllerState(const uint8_t* data, size_t len, const Handshake::WireFormat& format = {}) {
+        ControllerState st;
+        const DecodeStatus status = decodeControllerState(std::span<const uint8_t>(data, len), st, format);
+        if (status == DecodeStatus::TooShort) return {};
+        if (status != DecodeStatus::Ok) throw std::invalid_argument("malformed controller packet");
         return st;
     }
 
+    // Legacy text clients get the haptic packet base64 encoded.
     static std::string compressResponseData(bool isLeftController, float amplitude, float frequency, float duration) {
+        return s2uk_crypto::base64_encode(encodeResponseData(isLeftController, amplitude, frequency, duration));
+    }
+
+    static std::string encodeResponseData(bool isLeftController, float amplitude, float frequency, float duration) {
         if (duration <= 0.0f) duration = 0.005f;
 
-        std::string buf;
-        buf.reserve(32);
+        s2uk_packet::HapticPacket p;
+        if (isLeftController) p.flags |= s2uk_packet::kFlagLeft;
+        // Rounded in float as it always was, so the bytes don't change.
+        p.amplitude = std::llround(amplitude * static_cast<float>(s2uk_packet::kAmplitudeScale));
+        p.frequency = std::llround(frequency * static_cast<float>(s2uk_packet::kFrequencyScale));
+        p.duration = std::llround(duration * static_cast<float>(s2uk_packet::kDurationScale));
 
-        // 1 byte flags
-        uint8_t flags = 0;
-        if (isLeftController) flags |= 1 << 0; // bit0
-        buf.push_back(static_cast<char>(flags));
+        uint8_t buf[s2uk_packet::kMaxHapticSize];
+        return std::string(reinterpret_cast<const char*>(buf), s2uk_packet::encode(p, buf));
+    }
 
-        int64_t ampInt = static_cast<int64_t>(std::llround(amplitude * 1000.0f));
-        int64_t freqInt = static_cast<int64_t>(std::llround(frequency * 100.0f));
-        int64_t durInt = static_cast<int64_t>(std::llround(duration * 1000.0f));
+    // Binary clients only, see s2uk_packet::SendRatePacket.
+    static std::string encodeSendRate(bool isLeftController, uint32_t hz) {
+        s2uk_packet::SendRatePacket p;
+        if (isLeftController) p.flags |= s2uk_packet::kFlagLeft;
+        p.hz = hz;
 
-        s2uk_crypto::appendVarUint64(buf, s2uk_crypto::zigzag64(ampInt));
-        s2uk_crypto::appendVarUint64(buf, s2uk_crypto::zigzag64(freqInt));
-        s2uk_crypto::appendVarUint64(buf, s2uk_crypto::zigzag64(durInt));
+        uint8_t buf[s2uk_packet::kMaxSendRateSize];
+        return std::string(reinterpret_cast<const char*>(buf), s2uk_packet::encode(p, buf));
+    }
 
-        // Base64 encode
-        return s2uk_crypto::base64_encode(buf);
+    static DecodeStatus toDecodeStatus(s2uk_packet::Status s) {
+        switch (s) {
+        case s2uk_packet::Status::Ok: return DecodeStatus::Ok;
+        case s2uk_packet::Status::TooShort: return DecodeStatus::TooShort;
+        case s2uk_packet::Status::Truncated: return DecodeStatus::Truncated;
+        case s2uk_packet::Status::BadVarint: return DecodeStatus::BadVarint;
+        case s2uk_packet::Status::BadLayout: return DecodeStatus::BadLayout;
+        case s2uk_packet::Status::NoKeyframe: return DecodeStatus::NoKeyframe;
+        }
+        return DecodeStatus::TooShort;
     }
 };
 #endif
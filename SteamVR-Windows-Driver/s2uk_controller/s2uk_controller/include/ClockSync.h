@@ -0,0 +1,123 @@
+#pragma once
+#ifndef S2UK_ClockSync
+#define S2UK_ClockSync
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+NTP-style offset and drift estimate between a phone's clock and the driver's
+(NetTelemetry::nowUs()). Fed from ping/pong exchanges over the TCP session:
+
+	t0  driver sends Ping      (driver clock)
+	t1  phone receives it      (phone clock)
+	t2  phone sends the Pong   (phone clock)
+	t3  driver receives Pong   (driver clock)
+
+	offset = ((t1 - t0) + (t2 - t3)) / 2    phone - driver, exact if both legs take equally long
+	delay  = (t3 - t0) - (t2 - t1)          round trip without the phone's turnaround
+
+Queueing only ever adds delay and skews the offset, so early on the offset comes from the
+lowest-delay sample among the last few (NTP's clock filter). Once there is enough history, a
+least-squares line through the low-delay samples of the last quarter minute or so gives both
+the offset and the drift, clamped to what real crystals do.
+Loop thread only; copy estimate() out for other threads.
+**/
+class ClockSync {
+public:
+	struct Estimate {
+		bool valid = false;
+		int64_t offsetUs = 0;    // phone - driver at refLocalUs
+		double skew = 0.0;       // offset change per driver microsecond, 20e-6 = 20 ppm
+		uint64_t refLocalUs = 0;
+		uint32_t delayUs = 0;    // round trip of the sample the offset came from
+		uint32_t samples = 0;
+
+		// Phone timestamp -> driver clock.
+		uint64_t toLocal(uint64_t remoteUs) const {
+			const double approxLocal = double(int64_t(remoteUs) - offsetUs);
+			const double offset = double(offsetUs) + skew * (approxLocal - double(refLocalUs));
+			return static_cast<uint64_t>(int64_t(remoteUs) - std::llround(offset));
+		}
+	};
+
+	// Returns false for samples that cannot be right (time running backwards).
+	bool addSample(uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3) {
+		if (t3 < t0 || t2 < t1 || t3 - t0 < t2 - t1) return false;
+
+		Sample& s = window[next];
+		s.offsetUs = ((int64_t(t1) - int64_t(t0)) + (int64_t(t2) - int64_t(t3))) / 2;
+		s.localUs = t0 + (t3 - t0) / 2;
+		const uint64_t delay = (t3 - t0) - (t2 - t1);
+		s.delayUs = delay > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(delay);
+		next = (next + 1) % kWindow;
+		if (count < kWindow) ++count;
+
+		update();
+		return true;
+	}
+
+	const Estimate& estimate() const { return est; }
+
+private:
+	struct Sample {
+		int64_t offsetUs = 0;
+		uint64_t localUs = 0;
+		uint32_t delayUs = 0;
+	};
+
+	static constexpr size_t kWindow = 64;  // drift fit, about 16 s at four pings per second
+	static constexpr size_t kFilter = 8;   // offset: best of the most recent samples
+	static constexpr double kMinFitSpanUs = 5e6;
+	static constexpr double kMaxSkew = 500e-6;
+
+	const Sample& recent(size_t age) const { return window[(next + kWindow - 1 - age) % kWindow]; }
+
+	void update() {
+		const Sample* best = &recent(0);
+		const size_t filter = count < kFilter ? count : kFilter;
+		for (size_t i = 1; i < filter; ++i) {
+			if (recent(i).delayUs < best->delayUs) best = &recent(i);
+		}
+
+		// Drift from the samples that went through the network about as fast as it allows.
+		uint32_t minDelay = UINT32_MAX;
+		for (size_t i = 0; i < count; ++i) minDelay = recent(i).delayUs < minDelay ? recent(i).delayUs : minDelay;
+		const double maxDelay = double(minDelay) * 2.0 + 1000.0;
+
+		double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, xMin = 0, xMax = 0;
+		const double y0 = double(best->offsetUs);
+		for (size_t i = 0; i < count; ++i) {
+			const Sample& s = recent(i);
+			if (s.delayUs > maxDelay) continue;
+			const double x = double(int64_t(s.localUs - best->localUs));
+			const double y = double(s.offsetUs) - y0;
+			if (n == 0 || x < xMin) xMin = x;
+			if (n == 0 || x > xMax) xMax = x;
+			n += 1; sx += x; sy += y; sxx += x * x; sxy += x * y;
+		}
+		const double det = n * sxx - sx * sx;
+		if (n >= 4 && xMax - xMin >= kMinFitSpanUs && det > 0) {
+			// Enough history: take both drift and offset from the fitted line, at the newest sample.
+			est.skew = std::fmax(-kMaxSkew, std::fmin(kMaxSkew, (n * sxy - sx * sy) / det));
+			const double xNow = double(int64_t(recent(0).localUs - best->localUs));
+			est.offsetUs = static_cast<int64_t>(std::llround(y0 + sy / n + est.skew * (xNow - sx / n)));
+			est.refLocalUs = recent(0).localUs;
+		}
+		else {
+			est.offsetUs = best->offsetUs;
+			est.refLocalUs = best->localUs;
+		}
+
+		est.valid = true;
+		est.delayUs = best->delayUs;
+		est.samples = static_cast<uint32_t>(count);
+	}
+
+	Sample window[kWindow];
+	size_t count = 0;
+	size_t next = 0;
+	Estimate est;
+};
+#endif
@@ -2,9 +2,18 @@
 // #include "SocketClass.h"
 #include <openvr_driver.h>
 #include <windows.h>
+#include <atomic>
 #include <chrono>
+#include <mutex>
 
 #include "BufferCompression.h"
+#include "StateMailbox.h"
+#include "JitterBuffer.h"
+#include "ImuHistory.h"
+#include "NetTelemetry.h"
+#include "SendRateController.h"
+#include "InputFastLane.h"
+#include "PoseScheduler.h"
 
 
 using namespace vr;
@@ -69,7 +78,90 @@ public:
 	void RunFrame();
 
 	void ReadBuffer(BufferCompression::ControllerState state);
+
+	/**
+	Called from the network thread with every decoded state for this hand. Never blocks; 
+	RunFrame picks up the newest one.
+	**/
+	void PublishState(const BufferCompression::ControllerState& state);
+
+	/**
+	One orientation sample from an IMU batch (or the packet it came with), on our clock. Kept
+	by sample time; with the jitter buffer on, RunFrame takes the orientation for the instant
+	it plays from these rather than blending the packets around it.
+	**/
+	void PushImuSample(const BufferCompression::ControllerState& sample);
+
+	StateMailbox<BufferCompression::ControllerState>::Stats GetMailboxStats() const;
+
+	/**
+	How old states are when they reach the driver (sensor event on the phone to PublishState), 
+	from the clock-synced timestamps. Zero until the phone's clock is known.
+	**/
+	struct AgeStats {
+		uint32_t lastUs = 0;
+		uint32_t smoothedUs = 0;
+		uint64_t stamped = 0; // states that carried a usable timestamp
+	};
+	AgeStats GetAgeStats() const;
+
+	/**
+	Link telemetry to include in DebugRequest("stats"). Read-only, may be null.
+	**/
+	void SetTelemetry(const NetTelemetry* table);
+
+	/**
+	Optional playout buffer: states are released on a steady timeline and interpolated 
+	between packets instead of being applied the moment they arrive. maxDelayUs caps the 
+	delay it may add. Call before the network threads start.
+	**/
+	void SetJitterBuffer(bool enabled, uint32_t maxDelayUs);
+
+	/**
+	Adaptive send rate: RunFrame works out how often the phone should send (display rate, 
+	motion, link quality) and, if adaptive, pushes it to the phones. Call before the network 
+	threads start.
+	**/
+	void SetSendRate(bool adaptive, uint32_t idleHz);
+
+	/**
+	Called from the network thread for every packet of this hand, with the TCP session it came 
+	from (Frame::session), its size on the wire and how long it took to decode. Feeds the rate 
+	control and its stats.
+	**/
+	void AccountPacket(uint32_t session, size_t wireBytes, uint32_t decodeNs);
+
+	SendRateController::Stats GetSendRateStats() const;
+
+	/**
+	Input fast lane: button, click, touch, trigger and grip changes go to IVRDriverInput from 
+	the network thread as soon as their packet is decoded, backdated to the sensor time, 
+	instead of on the next RunFrame. Pose and stick axes stay frame-aligned. Call before the 
+	network threads start.
+	**/
+	void SetInputFastLane(bool enabled);
+
+	InputFastLane::Stats GetInputFastLaneStats() const;
+
+	/**
+	When poses go to SteamVR: every frame (as before), as soon as a state arrives, or every 
+	frame predicted to photon time. See PoseScheduler.h. Call before the network threads start.
+	**/
+	void SetPoseScheduler(PoseScheduler::Mode mode);
+
+	PoseScheduler::Stats GetPoseSchedulerStats() const;
 private:
+	void SubmitInputs(const InputFastLane::Inputs& now, const InputFastLane::Inputs* before, float timeOffset);
+
+	DriverPose_t MakePose(const Quaternion& rotation, const Vec3& position, double timeOffset) const;
+	void SubmitPose(const Quaternion& rotation, const Vec3& position, uint64_t nowUs, uint64_t sampleTimeUs, uint64_t poseTimeUs, bool fromArrival);
+	void SubmitArrivalPose(const BufferCompression::ControllerState& state);
+	void SubmitFramePose();
+	void SampleDisplayTiming();
+
+	void UpdateSendRate(const BufferCompression::ControllerState* applied);
+	SendRateController::LinkQuality SampleLinkQuality();
+
 	struct ControllerData {
 		// Position
 		Vec3 position = Vec3(0, 0, 0);
@@ -80,6 +172,7 @@ private:
 		// Timing
 		std::chrono::high_resolution_clock::time_point lastScalarValueUpdate;
 		float deltaTime = 0.0f;
+		uint64_t sampleTimeUs = 0; // of the applied state, 0 while the phone's clock is unknown
 
 		// Joystick
 		bool joystickThumbrest = false;
@@ -131,4 +224,30 @@ private:
 	VRInputComponentHandle_t hapticHandleR;
 
 	ControllerData controllerData;
+	StateMailbox<BufferCompression::ControllerState> stateMailbox;
+	JitterBuffer<BufferCompression::ControllerState> jitterBuffer;
+	ImuHistory<BufferCompression::ControllerState> imuHistory;
+	bool jitterBufferEnabled = false;
+	std::atomic<uint32_t> lastAgeUs{ 0 };
+	std::atomic<uint32_t> smoothedAgeUs{ 0 };
+	std::atomic<uint64_t> stampedStates{ 0 };
+	const NetTelemetry* telemetry = nullptr;
+
+	SendRateController sendRate;
+	bool sendRateEnabled = false;
+	InputFastLane inputFastLane;
+	bool inputFastLaneEnabled = false;
+	std::atomic<bool> inputActive{ false }; // component handles are valid (Activate .. Deactivate)
+	std::atomic<uint32_t> lastSession{ 0 }; // of the last packet, picks the links to sample
+	PoseScheduler poseScheduler;
+	std::mutex poseMutex; // onArrival: network threads and the RunFrame fallback take turns
+	uint64_t lastArrivalSenderUs = 0; // under poseMutex
+	Vec3 arrivalPosition{}; // under poseMutex, RunFrame's controllerData.position for the arrival poses
+	// RunFrame thread
+	float displayHz = 90.0f;
+	float vsyncToPhotonsS = 0.0f;
+	uint64_t slowChecksUs = 0; // display rate and link quality are sampled once a second
+	SendRateController::LinkQuality linkQuality;
+	uint64_t linkExpected = 0;
+	uint64_t linkLost = 0;
 };
\ No newline at end of file
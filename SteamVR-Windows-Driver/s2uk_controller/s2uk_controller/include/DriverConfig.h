@@ -5,6 +5,7 @@
 #include <json.hpp>
 #include <filesystem>
 #include <cmath>
+#include <string>
 
 class DriverConfig {
 public:
@@ -14,6 +15,21 @@ public:
 		double rightHandEMA = .3;
 
 		int sensorTilt = 0;
+
+		// Per-phone network limits ("network" object, optional). 0 disables a limit.
+		int netMaxQueuedMessages = 64;
+		int netMaxQueuedBytes = 64 * 1024;
+		std::string netOutboundPolicy = "coalesce"; // "dropOldest", "coalesce" or "disconnect"
+		int netMaxInboundBytesPerSec = 64 * 1024;
+		int netMaxInboundMessagesPerSec = 1000;
+		std::string netInboundPolicy = "throttle";  // "throttle" or "disconnect"
+		bool netSharedMemory = false; // local producers (emulators, test scripts), see ShmTransport.h
+		bool netJitterBuffer = false; // smooth out Wi-Fi jitter at the cost of a little latency, see JitterBuffer.h
+		int netJitterBufferMaxDelayMs = 40;
+		bool netAdaptiveRate = true;  // tell phones how fast to send from display rate, motion and link, see SendRateController.h
+		int netIdleRateHz = 20;
+		bool netInputFastLane = false; // submit button/trigger/grip changes from the network thread (unsmoothed steps), see InputFastLane.h
+		std::string netPoseScheduler = "perFrame"; // "perFrame", "onArrival" or "vsyncPredicted", see PoseScheduler.h
 	};
 
 	DriverConfig() {
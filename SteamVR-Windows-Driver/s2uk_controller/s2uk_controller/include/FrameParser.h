@@ -0,0 +1,199 @@
+#pragma once
+#ifndef S2UK_FrameParser
+#define S2UK_FrameParser
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Wire framing shared by the TCP server and the phone clients.
+//
+// Text mode (legacy clients): every message is a base64 string terminated by '\n'.
+// Binary mode: every message is a frame of
+//     u16 payload length (little-endian) | u8 frame type | payload
+// with no base64 and no terminator.
+//
+// Session frame payload (binary mode, right after login and in reply to Resume):
+//     u64 resume token | u8 flags (bit0 = resumed) | u16 heartbeat interval ms | u16 heartbeat timeout ms
+//
+// TCP is a byte stream, so one recv() can hold half a message or several of them.
+// StreamFrameParser buffers whatever arrives and hands out complete messages only.
+//
+// The receive path does not copy: recv() writes straight into the parser's slab
+// (prepare/commit), frames are views into it and the decoders read those views in place.
+// Slabs come from a RecvSlabPool and go back to it as soon as a parser has nothing
+// buffered, so idle sessions hold no memory and steady-state receive allocates nothing.
+
+enum class WireMode : uint8_t {
+    Text = 0,
+    Binary = 1,
+};
+
+enum class FrameType : uint8_t {
+    ControllerState = 0x01, // client -> driver, raw BufferCompression controller packet
+    Haptic = 0x02,          // driver -> client, raw BufferCompression haptic packet
+    Ping = 0x03,            // either direction, opaque payload (u64 sender time in us)
+    Pong = 0x04,            // reply to Ping, echoes its payload; phones append u64 receive time and
+                            // u64 send time of their own clock (see ClockSync.h)
+    Resume = 0x05,          // client -> driver, u64 token from an earlier Session frame
+    Session = 0x06,         // driver -> client, resume token and heartbeat settings (see above)
+    SendRate = 0x07,        // driver -> client, state rate for one hand (BufferCompression::encodeSendRate)
+    HapticEnvelope = 0x08,  // driver -> client, a few frames of one hand's haptics (HapticEnvelope.h),
+                            // instead of Haptic for phones that asked for it in the hello
+};
+
+// Fixed-size receive buffers shared by the parsers of one thread. Not thread-safe.
+class RecvSlabPool {
+public:
+    static constexpr size_t kSlabSize = 64 * 1024;
+
+    char* acquire() {
+        if (freeList.empty()) {
+            slabs.push_back(std::make_unique<char[]>(kSlabSize));
+            freeList.reserve(slabs.size()); // release() never has to grow it
+            return slabs.back().get();
+        }
+        char* slab = freeList.back();
+        freeList.pop_back();
+        return slab;
+    }
+
+    void release(char* slab) { freeList.push_back(slab); }
+
+    size_t allocated() const { return slabs.size(); }
+    size_t available() const { return freeList.size(); }
+
+private:
+    std::vector<std::unique_ptr<char[]>> slabs;
+    std::vector<char*> freeList;
+};
+
+struct Frame {
+    FrameType type = FrameType::ControllerState;
+    std::string_view payload; // valid until the next append()
+    uint32_t peerAddr = 0;    // IPv4 of the sender, network byte order, 0 = same host; set by the transport
+    uint32_t session = 0;     // TcpSocketClass session it belongs to, 0 = none (same host, old phones); set by the transport
+};
+
+class StreamFrameParser {
+public:
+    static constexpr size_t kHeaderSize = 3;
+    static constexpr size_t kMaxPayload = 4096;
+    static constexpr size_t kMaxBuffered = RecvSlabPool::kSlabSize;
+
+    enum class Status {
+        NeedMore, // no complete message buffered yet
+        Ready,    // out was filled
+        Error,    // stream is corrupt, the connection should be dropped
+    };
+
+    // pool must outlive the parser; without one the parser keeps a slab of its own.
+    explicit StreamFrameParser(WireMode mode = WireMode::Text, RecvSlabPool* pool = nullptr)
+        : mode(mode), pool(pool ? pool : &ownPool) {}
+    ~StreamFrameParser() { if (slab) pool->release(slab); }
+    StreamFrameParser(const StreamFrameParser&) = delete;
+    StreamFrameParser& operator=(const StreamFrameParser&) = delete;
+
+    WireMode getMode() const { return mode; }
+    void setMode(WireMode m) { mode = m; }
+
+    // Space to recv() into, room bytes of it. Null if a partial message already fills the
+    // whole buffer (the peer pushed more unframed data than we are willing to hold).
+    char* prepare(size_t& room) {
+        if (!slab) slab = pool->acquire();
+        compact();
+        room = kMaxBuffered - tail;
+        return room ? slab + tail : nullptr;
+    }
+
+    // n bytes were written at prepare()'s pointer.
+    void commit(size_t n) { tail += n; }
+
+    // Gives the slab back once every buffered byte has been handed out. Frames from next()
+    // are invalid afterwards.
+    void reclaim() {
+        if (!slab || head != tail) return;
+        pool->release(slab);
+        slab = nullptr;
+        head = tail = 0;
+    }
+
+    // Copying variant of prepare/commit. Returns false if the data does not fit.
+    bool append(const char* data, size_t len) {
+        size_t room = 0;
+        char* dst = prepare(room);
+        if (!dst || len > room) return false;
+        std::memcpy(dst, data, len);
+        commit(len);
+        return true;
+    }
+
+    Status next(Frame& out) {
+        return (mode == WireMode::Binary) ? nextBinary(out) : nextText(out);
+    }
+
+    // Encodes one binary frame header + payload onto out.
+    static void appendFrame(std::string& out, FrameType type, std::string_view payload) {
+        const uint16_t len = static_cast<uint16_t>(payload.size());
+        out.push_back(static_cast<char>(len & 0xFF));
+        out.push_back(static_cast<char>((len >> 8) & 0xFF));
+        out.push_back(static_cast<char>(type));
+        out.append(payload.data(), payload.size());
+    }
+
+private:
+    Status nextBinary(Frame& out) {
+        const size_t avail = tail - head;
+        if (avail < kHeaderSize) return Status::NeedMore;
+
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(slab + head);
+        const size_t len = static_cast<size_t>(p[0]) | (static_cast<size_t>(p[1]) << 8);
+        if (len > kMaxPayload) return Status::Error;
+        if (avail < kHeaderSize + len) return Status::NeedMore;
+
+        out.type = static_cast<FrameType>(p[2]);
+        out.payload = std::string_view(slab + head + kHeaderSize, len);
+        head += kHeaderSize + len;
+        return Status::Ready;
+    }
+
+    Status nextText(Frame& out) {
+        while (true) {
+            const size_t avail = tail - head;
+            if (avail == 0) return Status::NeedMore;
+            const char* start = slab + head;
+            const void* nl = std::memchr(start, '\n', avail);
+            if (nl == nullptr) {
+                return (avail > kMaxPayload) ? Status::Error : Status::NeedMore;
+            }
+
+            size_t len = static_cast<const char*>(nl) - start;
+            head += len + 1;
+            while (len > 0 && (start[len - 1] == '\r' || start[len - 1] == ' ' || start[len - 1] == '\t')) --len;
+            if (len == 0) continue; // blank line / keep-alive
+
+            out.type = FrameType::ControllerState;
+            out.payload = std::string_view(start, len);
+            return Status::Ready;
+        }
+    }
+
+    // Moves the unconsumed tail (at most one partial message) to the front.
+    void compact() {
+        if (head == 0) return;
+        if (tail > head) std::memmove(slab, slab + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+
+    WireMode mode;
+    RecvSlabPool ownPool;
+    RecvSlabPool* pool;
+    char* slab = nullptr;
+    size_t head = 0; // first unconsumed byte
+    size_t tail = 0; // end of the received bytes
+};
+#endif
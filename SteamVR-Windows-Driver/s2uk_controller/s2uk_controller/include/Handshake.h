@@ -0,0 +1,271 @@
+#pragma once
+#ifndef S2UK_Handshake
+#define S2UK_Handshake
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "FrameParser.h"
+#include "PacketSchema.h"
+
+/**
+Versioned hello exchange, the successor of the fixed login strings. Like them it is a single
+text line, and whatever follows it uses the framing it settles on:
+
+	phone   s2uk_hello proto=1 framing=binary,text codec=delta,fixed,varint gyro_scale=1000 joy_scale=100000 orientation=quat,euler rate=200 role=left haptics=envelope,pulse imu=batch
+	driver  s2uk_welcome proto=1 framing=binary codec=fixed gyro_scale=90 joy_scale=32767 orientation=quat rate=90 role=left haptics=envelope imu=batch session=7
+
+Lists are in the phone's order of preference and the driver takes the first entry it
+supports; delta streams only go with binary framing. The scales are what the phone multiplies gyro degrees and stick values by before
+rounding; the driver echoes the ones it will decode with (its defaults if the offer is out
+of range, capped for the fixed codec) and the phone has to use those. orientation says
+whether the phone may send quaternions; without it in the welcome it sends Euler angles.
+rate is the most states per second the phone can send; the welcome carries the one to
+start at, which is the old fixed cadence or less.
+role pins the phone to one hand: packets flagged for the other hand are dropped, so a
+phone that flips its flag can't drive both controllers. auto keeps the hand per packet.
+Later SendRate frames move it, and the phone never goes above its own maximum. haptics=envelope
+gets binary phones HapticEnvelope frames instead of a Haptic frame per pulse, and imu=batch
+has them put the sensor samples between two packets after each (s2uk_packet::ImuBatch) if the
+driver has a use for them (negotiate's imuBatch). session is the id the phone puts in its UDP
+datagrams (UdpServer.h), so they are decoded with this login's agreement even when other
+phones share the address; it changes with every connection. Unknown keys
+are ignored on both sides, so later versions can add to the line without breaking older
+peers.
+
+A phone that held a binary session sends a resume line instead of the hello when it
+reconnects, with the token from that session's Session frame (FrameParser.h):
+
+	phone   s2uk_resume proto=1 token=0123456789abcdef
+	driver  s2uk_welcome proto=1 framing=binary codec=fixed ... session=7
+
+The driver answers with the welcome of the agreement the session was parked with, session id
+included, so the phone skips the negotiation and its datagrams keep their session; a Session
+frame with the resumed flag follows. A token the driver no longer has gets "s2uk_resume_unknown"
+and the connection stays at the login, waiting for a hello. A driver that closes the
+connection on a resume line predates it, and the phone sends the hello next time.
+
+Phones that send the old "s2uk_connection_init" / "s2uk_connection_init_bin" get the old
+behaviour and the default WireFormat. A phone whose hello gets the connection closed is
+talking to an older driver and logs in the old way on its next attempt.
+**/
+namespace Handshake {
+	constexpr std::string_view kHello = "s2uk_hello";
+	constexpr std::string_view kWelcome = "s2uk_welcome";
+	constexpr std::string_view kResume = "s2uk_resume";
+	constexpr std::string_view kResumeUnknown = "s2uk_resume_unknown";
+	constexpr uint32_t kVersion = 1;
+	constexpr uint32_t kMaxScale = 10000000;
+	constexpr uint32_t kStartRateHz = 90; // the phones' cadence before rate control
+
+	// Controller packet encodings and their limits, see PacketSchema.h.
+	using Codec = s2uk_packet::Codec;
+	using Orientation = s2uk_packet::Orientation;
+	constexpr uint32_t kFixedGyroScale = s2uk_packet::kFixedGyroScale;
+	constexpr uint32_t kFixedJoyScale = s2uk_packet::kFixedJoyScale;
+
+	enum class Role : uint8_t {
+		Auto = 0, // hand taken from every packet's flags, as before
+		Left,
+		Right,
+	};
+
+	// How controller packets of one phone are encoded. Default-constructed = legacy phones.
+	struct WireFormat {
+		Codec codec = Codec::Varint;
+		uint32_t gyroScale = s2uk_packet::kDefaultGyroScale;
+		uint32_t joyScale = s2uk_packet::kDefaultJoyScale;
+		// What the phone may send. Packets flag a quaternion themselves, so decoding doesn't
+		// depend on it.
+		Orientation orientation = Orientation::Euler;
+		bool imuBatch = false; // every packet ends in an s2uk_packet::ImuBatch, binary framing only
+		Role role = Role::Auto; // the only hand its packets may be for
+	};
+
+	struct Agreement {
+		uint32_t version = kVersion;
+		WireMode framing = WireMode::Binary;
+		WireFormat format;
+		uint32_t rateHz = kStartRateHz;
+		bool hapticEnvelopes = false; // HapticEnvelope frames instead of Haptic, binary framing only
+	};
+
+	namespace detail {
+		inline bool parseU32(std::string_view s, uint32_t& out) {
+			auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+			return ec == std::errc() && ptr == s.data() + s.size();
+		}
+
+		// Calls fn(item) for every comma separated entry until it returns true.
+		template<class Fn>
+		bool firstOf(std::string_view list, Fn&& fn) {
+			while (!list.empty()) {
+				const size_t comma = list.find(',');
+				if (fn(list.substr(0, comma))) return true;
+				if (comma == std::string_view::npos) break;
+				list.remove_prefix(comma + 1);
+			}
+			return false;
+		}
+
+		// Calls fn(key, value) for every key=value token after the line's first word, which
+		// has to be word. False if it isn't.
+		template<class Fn>
+		bool forEachKey(std::string_view line, std::string_view word, Fn&& fn) {
+			if (line.substr(0, word.size()) != word) return false;
+			if (line.size() > word.size() && line[word.size()] != ' ') return false;
+			line.remove_prefix(word.size());
+			while (!line.empty()) {
+				const size_t start = line.find_first_not_of(' ');
+				if (start == std::string_view::npos) break;
+				line.remove_prefix(start);
+				const size_t end = line.find(' ');
+				const std::string_view token = line.substr(0, end);
+				line.remove_prefix(end == std::string_view::npos ? line.size() : end);
+
+				const size_t eq = token.find('=');
+				if (eq == std::string_view::npos) continue;
+				if (!fn(token.substr(0, eq), token.substr(eq + 1))) return false;
+			}
+			return true;
+		}
+
+		inline const char* framingName(WireMode m) { return m == WireMode::Binary ? "binary" : "text"; }
+		inline const char* codecName(Codec c) { return c == Codec::Fixed ? "fixed" : c == Codec::Delta ? "delta" : "varint"; }
+		inline const char* orientationName(Orientation o) { return o == Orientation::Quaternion ? "quat" : "euler"; }
+		inline const char* roleName(Role r) { return r == Role::Left ? "left" : r == Role::Right ? "right" : "auto"; }
+	}
+
+	// Parses a hello line and settles on what both sides support. False if it is not a
+	// hello, or no framing or codec in it is one we speak. imuBatch: whether the driver reads
+	// IMU batches; without a reader they would only cost the phone sensor time and airtime.
+	inline bool negotiate(std::string_view line, Agreement& out, bool imuBatch = false) {
+		Agreement a;
+		bool framing = false, version = false;
+		std::string_view codecs;
+		const bool hello = detail::forEachKey(line, kHello, [&](std::string_view key, std::string_view value) {
+			uint32_t n = 0;
+
+			if (key == "proto") {
+				if (!detail::parseU32(value, n) || n == 0) return false; // ends the scan, and the hello
+				a.version = std::min<uint32_t>(n, kVersion);
+				version = true;
+			}
+			else if (key == "framing") {
+				framing = detail::firstOf(value, [&](std::string_view f) {
+					if (f == "binary") a.framing = WireMode::Binary;
+					else if (f == "text") a.framing = WireMode::Text;
+					else return false;
+					return true;
+				});
+			}
+			else if (key == "codec") {
+				codecs = value; // settled below, it depends on the framing
+			}
+			else if (key == "orientation") {
+				detail::firstOf(value, [&](std::string_view o) {
+					if (o == "quat") a.format.orientation = Orientation::Quaternion;
+					else if (o == "euler") a.format.orientation = Orientation::Euler;
+					else return false;
+					return true;
+				});
+			}
+			else if (key == "gyro_scale") {
+				if (detail::parseU32(value, n) && n > 0 && n <= kMaxScale) a.format.gyroScale = n;
+			}
+			else if (key == "joy_scale") {
+				if (detail::parseU32(value, n) && n > 0 && n <= kMaxScale) a.format.joyScale = n;
+			}
+			else if (key == "rate") {
+				if (detail::parseU32(value, n) && n > 0) a.rateHz = std::min<uint32_t>(n, kStartRateHz);
+			}
+			else if (key == "role") {
+				a.format.role = value == "left" ? Role::Left : value == "right" ? Role::Right : Role::Auto;
+			}
+			else if (key == "imu") {
+				a.format.imuBatch = imuBatch && detail::firstOf(value, [](std::string_view i) { return i == "batch"; });
+			}
+			else if (key == "haptics") {
+				detail::firstOf(value, [&](std::string_view h) {
+					if (h == "envelope") a.hapticEnvelopes = true;
+					else if (h == "pulse") a.hapticEnvelopes = false;
+					else return false;
+					return true;
+				});
+			}
+			return true;
+		});
+		if (!hello) return false;
+		// The driver keeps delta streams per phone for the binary frame types only.
+		const bool codec = detail::firstOf(codecs, [&](std::string_view c) {
+			if (c == "varint") a.format.codec = Codec::Varint;
+			else if (c == "fixed") a.format.codec = Codec::Fixed;
+			else if (c == "delta" && a.framing == WireMode::Binary) a.format.codec = Codec::Delta;
+			else return false;
+			return true;
+		});
+		if (!version || !framing || !codec) return false;
+		if (a.framing != WireMode::Binary) {
+			a.hapticEnvelopes = false; // no frame types to tell them apart
+			a.format.imuBatch = false; // keeps base64 lines what older tools expect
+		}
+
+		// Scales offered for the varint codec would overflow the fixed one's int16.
+		if (a.format.codec == Codec::Fixed) {
+			a.format.gyroScale = std::min<uint32_t>(a.format.gyroScale, kFixedGyroScale);
+			a.format.joyScale = std::min<uint32_t>(a.format.joyScale, kFixedJoyScale);
+		}
+
+		out = a;
+		return true;
+	}
+
+	// The reply line, without the newline. session: TcpSocketClass's id for the login.
+	inline std::string welcome(const Agreement& a, uint32_t session) {
+		std::string out(kWelcome);
+		out += " proto=" + std::to_string(a.version);
+		out += " framing="; out += detail::framingName(a.framing);
+		out += " codec="; out += detail::codecName(a.format.codec);
+		out += " gyro_scale=" + std::to_string(a.format.gyroScale);
+		out += " joy_scale=" + std::to_string(a.format.joyScale);
+		out += " orientation="; out += detail::orientationName(a.format.orientation);
+		out += " rate=" + std::to_string(a.rateHz);
+		out += " role="; out += detail::roleName(a.format.role);
+		out += " haptics="; out += a.hapticEnvelopes ? "envelope" : "pulse";
+		out += " imu="; out += a.format.imuBatch ? "batch" : "none";
+		out += " session=" + std::to_string(session);
+		return out;
+	}
+
+	// Parses a resume line. False if it is not one or has no usable token.
+	inline bool parseResume(std::string_view line, uint64_t& token) {
+		uint64_t t = 0;
+		bool version = false;
+		const bool resume = detail::forEachKey(line, kResume, [&](std::string_view key, std::string_view value) {
+			uint32_t n = 0;
+			if (key == "proto") version = detail::parseU32(value, n) && n != 0;
+			else if (key == "token") {
+				auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), t, 16);
+				if (ec != std::errc() || ptr != value.data() + value.size()) t = 0;
+			}
+			return true;
+		});
+		if (!resume || !version || t == 0) return false;
+		token = t;
+		return true;
+	}
+
+	// The phone's side, without the newline.
+	inline std::string resumeLine(uint64_t token) {
+		char hex[17];
+		const auto [end, ec] = std::to_chars(hex, hex + sizeof(hex), token, 16);
+		std::string out(kResume);
+		out += " proto=" + std::to_string(kVersion);
+		out += " token="; out.append(hex, end);
+		return out;
+	}
+}
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef S2UK_HapticEnvelope
+#define S2UK_HapticEnvelope
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "PacketSchema.h"
+
+/**
+The haptic pulses of one hand collected into an s2uk_packet::HapticEnvelopePacket, so phones
+that take envelopes get one message every kWindowUs instead of one per pulse, and play the
+pulses at the spacing they had here rather than the spacing the network gives them.
+
+The envelope starts at its first pulse; every later pulse goes in at its offset from there
+(in ms, the duration scale) and cuts short whatever is still playing, as a new pulse does on
+the phone. Everything reaches the phone kWindowUs late, the same for every pulse, which is
+what keeps the gaps between them as they were. Not thread-safe.
+**/
+class HapticEnvelope {
+public:
+	static constexpr uint64_t kWindowUs = 33000; // three frames at 90 Hz
+	static constexpr int64_t kMinDuration = 5;   // ms, a pulse of 0 s is still felt (BufferCompression::encodeResponseData)
+
+	explicit HapticEnvelope(bool isLeftController) : left(isLeftController) {}
+
+	// Adds a pulse that starts at nowUs. False if it doesn't fit: send take() and add it again.
+	bool add(uint64_t nowUs, float amplitude, float frequency, float duration) {
+		if (packet.count == 0) startUs = nowUs;
+		const int64_t at = static_cast<int64_t>((nowUs - startUs + 500) / 1000);
+
+		// Pulses the new one replaces: those that start at its offset or later go, the one
+		// playing at that moment stops there.
+		while (packet.count > 0 && endMs - last().duration >= at) {
+			endMs -= last().duration;
+			--packet.count;
+		}
+		if (packet.count > 0 && endMs > at) {
+			last().duration -= endMs - at;
+			endMs = at;
+		}
+
+		const size_t needed = at > endMs ? 2 : 1; // a pause up to the pulse, then the pulse
+		if (packet.count + needed > s2uk_packet::kMaxEnvelopePoints) return false;
+		if (at > endMs) {
+			packet.points[packet.count++] = { at - endMs, 0, 0 };
+			endMs = at;
+		}
+
+		s2uk_packet::HapticEnvelopePacket::Point& p = packet.points[packet.count++];
+		// Rounded in float like the pulse packets.
+		p.amplitude = std::llround(amplitude * static_cast<float>(s2uk_packet::kAmplitudeScale));
+		p.frequency = std::llround(frequency * static_cast<float>(s2uk_packet::kFrequencyScale));
+		p.duration = std::max<int64_t>(std::llround(duration * static_cast<float>(s2uk_packet::kDurationScale)), kMinDuration);
+		endMs += p.duration;
+		return true;
+	}
+
+	bool empty() const { return packet.count == 0; }
+
+	// The envelope has covered its window and should go out.
+	bool due(uint64_t nowUs) const { return packet.count > 0 && nowUs - startUs >= kWindowUs; }
+
+	// The encoded envelope; the next pulse starts a new one.
+	std::string take() {
+		packet.flags = left ? s2uk_packet::kFlagLeft : 0;
+		uint8_t buf[s2uk_packet::kMaxHapticEnvelopeSize];
+		std::string out(reinterpret_cast<const char*>(buf), s2uk_packet::encode(packet, buf));
+		packet.count = 0;
+		endMs = 0;
+		return out;
+	}
+
+private:
+	s2uk_packet::HapticEnvelopePacket::Point& last() { return packet.points[packet.count - 1]; }
+
+	bool left;
+	s2uk_packet::HapticEnvelopePacket packet;
+	uint64_t startUs = 0;
+	int64_t endMs = 0; // where the points so far stop playing, from startUs
+};
+#endif
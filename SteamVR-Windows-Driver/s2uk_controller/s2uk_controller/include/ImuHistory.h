@@ -0,0 +1,112 @@
+#pragma once
+#ifndef S2UK_ImuHistory
+#define S2UK_ImuHistory
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+/**
+Recent samples of one hand by sample time (NetTelemetry::nowUs() clock). With IMU batches
+(s2uk_packet::ImuBatch) they come at the phone's sensor rate rather than one per packet,
+and at() gives the sample for any instant they cover, blended between the two around it,
+so whatever wants the orientation at some time is not limited to packet times.
+
+Writers (the network threads) and the reader (RunFrame) share a tiny spin flag; the reader
+only holds it for a binary search and two copies.
+**/
+template<class T, size_t Capacity = 128>
+class ImuHistory {
+	static_assert(std::is_trivially_copyable_v<T>, "ImuHistory needs a trivially copyable payload");
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	struct Stats {
+		uint64_t pushed = 0;
+		uint64_t stale = 0; // not newer than what was there: redundant copies, reordering
+		uint64_t resets = 0; // the sender's timeline jumped back, history started over
+	};
+
+	// Any thread. Samples must come in time order; older ones are dropped, unless they are so
+	// much older that the sender must have started over.
+	void push(const T& value, uint64_t timeUs) noexcept {
+		while (lock.test_and_set(std::memory_order_acquire)) {}
+		if (count > 0 && timeUs <= newestUs) {
+			if (newestUs - timeUs < kRestartUs) {
+				lock.clear(std::memory_order_release);
+				stale.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			count = 0;
+			resets.fetch_add(1, std::memory_order_relaxed);
+		}
+		ring[head & (Capacity - 1)] = Entry{ value, timeUs };
+		++head;
+		count = std::min<size_t>(count + 1, Capacity);
+		newestUs = timeUs;
+		lock.clear(std::memory_order_release);
+		pushed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// The sample at timeUs, lerp(a, b, t) between the two around it. False if timeUs is
+	// outside what the history holds.
+	template<class Lerp>
+	bool at(uint64_t timeUs, T& out, Lerp&& lerp) const {
+		Entry a, b;
+		{
+			while (lock.test_and_set(std::memory_order_acquire)) {}
+			const uint64_t oldest = head - count;
+			if (count == 0 || timeUs < entry(oldest).timeUs || timeUs > newestUs) {
+				lock.clear(std::memory_order_release);
+				return false;
+			}
+			// First entry at or after timeUs.
+			uint64_t lo = oldest, hi = head - 1;
+			while (lo < hi) {
+				const uint64_t mid = lo + (hi - lo) / 2;
+				if (entry(mid).timeUs < timeUs) lo = mid + 1;
+				else hi = mid;
+			}
+			b = entry(lo);
+			a = lo > oldest ? entry(lo - 1) : b;
+			lock.clear(std::memory_order_release);
+		}
+		if (b.timeUs == timeUs || a.timeUs == b.timeUs) {
+			out = b.value;
+			return true;
+		}
+		out = lerp(a.value, b.value, double(timeUs - a.timeUs) / double(b.timeUs - a.timeUs));
+		return true;
+	}
+
+	Stats getStats() const {
+		Stats st;
+		st.pushed = pushed.load(std::memory_order_relaxed);
+		st.stale = stale.load(std::memory_order_relaxed);
+		st.resets = resets.load(std::memory_order_relaxed);
+		return st;
+	}
+
+private:
+	struct Entry {
+		T value;
+		uint64_t timeUs;
+	};
+
+	// A sample this much older than the newest is a new timeline (clock resync, reconnect).
+	static constexpr uint64_t kRestartUs = 1000000;
+
+	const Entry& entry(uint64_t i) const { return ring[i & (Capacity - 1)]; }
+
+	Entry ring[Capacity] = {};
+	uint64_t head = 0;   // entries ever written
+	size_t count = 0;    // valid entries, ending at head
+	uint64_t newestUs = 0;
+	mutable std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+	std::atomic<uint64_t> pushed{ 0 };
+	std::atomic<uint64_t> stale{ 0 };
+	std::atomic<uint64_t> resets{ 0 };
+};
+#endif
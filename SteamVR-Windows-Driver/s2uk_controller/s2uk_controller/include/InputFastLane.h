@@ -0,0 +1,140 @@
+#pragma once
+#ifndef S2UK_InputFastLane
+#define S2UK_InputFastLane
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "BufferCompression.h"
+
+/**
+Edge detector for the discrete controller inputs: buttons, joystick click/touch/thumbrest and
+the trigger and grip steps. Every decoded state goes through onState() on the network thread;
+when one of those inputs differs from the last state it calls submit, which pushes them to
+IVRDriverInput right there instead of waiting for the next RunFrame. Pose and stick axes are
+continuous and stay frame-aligned.
+
+The time offset handed to submit is how long ago the input changed on the phone (negative
+seconds, as IVRDriverInput wants it), from the clock-synced sample time; 0 while the phone's
+clock is unknown. A state slightly older than the last one seen is ignored, so a datagram that
+arrived late cannot undo a newer press; one from much further back is another phone (or a
+rebooted one) and starts over.
+
+Stats run with the lane switched off too: frameWaitUs is what the frame path adds on top of
+the network for every edge, submitNs what the fast lane spends instead.
+**/
+class InputFastLane {
+public:
+	struct Inputs {
+		bool system = false;
+		bool a = false;         // A or X
+		bool b = false;         // B or Y
+		bool joyClick = false;
+		bool joyTouch = false;
+		bool thumbrest = false;
+		float trigger = 0.0f;   // 0, 0.5 or 1
+		float grip = 0.0f;
+
+		bool operator==(const Inputs&) const = default;
+
+		static Inputs from(const BufferCompression::ControllerState& s) {
+			Inputs in;
+			in.system = s.btn_system_or_menu_state;
+			in.a = s.btn_a_or_x_state;
+			in.b = s.btn_b_or_y_state;
+			in.joyClick = s.joy_state == 2;
+			in.joyTouch = s.joy_state == 1;
+			in.thumbrest = s.joy_state != 0;
+			in.trigger = stepValue(s.trigger_state);
+			in.grip = stepValue(s.grip_state);
+			return in;
+		}
+	};
+
+	struct Stats {
+		uint64_t edges = 0;         // states that changed a discrete input
+		uint64_t stale = 0;         // states ignored for being older than the last one
+		uint32_t submitNs = 0;      // average time spent in submit per edge
+		uint32_t frameWaitUs = 0;   // average time an edge waited for the next RunFrame
+		uint32_t timeOffsetUs = 0;  // average age of an edge when it was submitted
+	};
+
+	// Network threads. submit(const Inputs& now, const Inputs* before, float timeOffsetS) runs
+	// under the lane's lock, so updates reach IVRDriverInput in packet order; before is null
+	// for the first state. Returns true if the state was an edge.
+	template<class Submit>
+	bool onState(const BufferCompression::ControllerState& s, uint64_t nowUs, Submit&& submit) {
+		const Inputs in = Inputs::from(s);
+		std::lock_guard<std::mutex> lock(mutex);
+		if (s.senderTimeUs) {
+			if (s.senderTimeUs < lastSenderUs && lastSenderUs - s.senderTimeUs < kReorderWindowUs) {
+				stale.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			lastSenderUs = s.senderTimeUs;
+		}
+		if (have && in == last) return false;
+
+		uint64_t ageUs = 0;
+		if (s.sampleTimeUs && nowUs > s.sampleTimeUs) ageUs = std::min<uint64_t>(nowUs - s.sampleTimeUs, kMaxOffsetUs);
+
+		const auto start = std::chrono::steady_clock::now();
+		submit(in, have ? &last : nullptr, -static_cast<float>(ageUs) * 1e-6f);
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		last = in;
+		have = true;
+		edges.fetch_add(1, std::memory_order_relaxed);
+		submitNsTotal.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+		offsetUsTotal.fetch_add(ageUs, std::memory_order_relaxed);
+		uint64_t none = 0;
+		pendingEdgeUs.compare_exchange_strong(none, nowUs, std::memory_order_relaxed);
+		return true;
+	}
+
+	// RunFrame thread, once per frame: the oldest edge since the last frame is applied now on
+	// the frame path.
+	void onFrame(uint64_t nowUs) {
+		const uint64_t edgeUs = pendingEdgeUs.exchange(0, std::memory_order_relaxed);
+		if (!edgeUs || nowUs < edgeUs) return;
+		frameWaitUsTotal.fetch_add(nowUs - edgeUs, std::memory_order_relaxed);
+		frameWaits.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Stats getStats() const {
+		Stats st;
+		st.edges = edges.load(std::memory_order_relaxed);
+		st.stale = stale.load(std::memory_order_relaxed);
+		const uint64_t waits = frameWaits.load(std::memory_order_relaxed);
+		if (st.edges) {
+			st.submitNs = static_cast<uint32_t>(submitNsTotal.load(std::memory_order_relaxed) / st.edges);
+			st.timeOffsetUs = static_cast<uint32_t>(offsetUsTotal.load(std::memory_order_relaxed) / st.edges);
+		}
+		if (waits) st.frameWaitUs = static_cast<uint32_t>(frameWaitUsTotal.load(std::memory_order_relaxed) / waits);
+		return st;
+	}
+
+private:
+	// Past this the sync is off rather than the packet that old; don't backdate further.
+	static constexpr uint64_t kMaxOffsetUs = 100000;
+	static constexpr uint64_t kReorderWindowUs = 1000000;
+
+	static float stepValue(uint8_t s) { return (s == 1) ? 1.0f : (s == 2) ? 0.5f : 0.0f; }
+
+	std::mutex mutex;
+	Inputs last;
+	bool have = false;
+	uint64_t lastSenderUs = 0;
+
+	std::atomic<uint64_t> pendingEdgeUs{ 0 };
+	std::atomic<uint64_t> edges{ 0 };
+	std::atomic<uint64_t> stale{ 0 };
+	std::atomic<uint64_t> submitNsTotal{ 0 };
+	std::atomic<uint64_t> offsetUsTotal{ 0 };
+	std::atomic<uint64_t> frameWaitUsTotal{ 0 };
+	std::atomic<uint64_t> frameWaits{ 0 };
+};
+#endif
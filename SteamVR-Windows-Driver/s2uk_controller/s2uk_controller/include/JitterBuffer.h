@@ -0,0 +1,203 @@
+#pragma once
+#ifndef S2UK_JitterBuffer
+#define S2UK_JitterBuffer
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <type_traits>
+
+/**
+Adaptive playout buffer between the network threads and RunFrame.
+
+Producers push every decoded state with its arrival time. The reader rebuilds a steady
+timeline from the arrivals: the sender's period is estimated from the mean gap, every
+sample gets a virtual send time on that grid (never later than its arrival), and is
+played out at send time + delay. The delay is one period (so there is normally a next
+sample to interpolate towards) plus how late samples have recently arrived (fast attack,
+slow release), capped at maxDelayUs. Between two samples the reader interpolates, so the
+output moves at frame rate instead of at packet rate.
+**/
+template<class T, size_t Capacity = 64>
+class JitterBuffer {
+	static_assert(std::is_trivially_copyable_v<T>, "JitterBuffer needs a trivially copyable payload");
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	struct Stats {
+		uint32_t delayUs = 0;  // current playout delay added on top of the network
+		uint32_t jitterUs = 0; // smoothed inter-arrival jitter (RFC 3550 style)
+		uint32_t periodUs = 0; // estimated sender period
+		uint64_t pushed = 0;
+		uint64_t played = 0;   // samples that became the current output
+		uint64_t late = 0;     // arrived after their playout time
+		uint64_t underruns = 0; // frames where the buffer ran dry and the last sample was held
+		uint64_t overflow = 0; // pushes dropped because the reader fell behind
+	};
+
+	// Set before any push.
+	void setMaxDelay(uint32_t us) { maxDelayUs = us; }
+
+	// Any thread. Producers serialize on a tiny spin flag, the reader never takes it.
+	void push(const T& value, uint64_t arrivalUs) noexcept {
+		while (writeLock.test_and_set(std::memory_order_acquire)) {}
+		const uint64_t head = ringHead.load(std::memory_order_relaxed);
+		if (head - ringTail.load(std::memory_order_acquire) >= Capacity) {
+			writeLock.clear(std::memory_order_release);
+			overflow.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		ring[head & (Capacity - 1)] = Entry{ value, arrivalUs };
+		ringHead.store(head + 1, std::memory_order_release);
+		writeLock.clear(std::memory_order_release);
+		pushed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Single reader, once per frame. Writes the state due at nowUs into out; lerp(a, b, t)
+	// blends two samples. Returns false until the first sample is due.
+	template<class Lerp>
+	bool sample(uint64_t nowUs, T& out, Lerp&& lerp) {
+		drain();
+		if (pending.empty()) return false;
+
+		// Drop everything older than the newest sample that is already due.
+		size_t due = 0;
+		while (due + 1 < pending.size() && playoutTime(pending[due + 1]) <= nowUs) ++due;
+		if (due > 0) {
+			played.fetch_add(due, std::memory_order_relaxed);
+			pending.erase(pending.begin(), pending.begin() + due);
+		}
+
+		const Sample& a = pending.front();
+		const uint64_t pa = playoutTime(a);
+		if (pa > nowUs && !started) return false;
+		started = true;
+
+		if (pending.size() < 2) {
+			if (nowUs > pa + periodUs + periodUs / 2) underruns.fetch_add(1, std::memory_order_relaxed);
+			out = a.value;
+			return true;
+		}
+
+		const Sample& b = pending[1];
+		const uint64_t pb = playoutTime(b);
+		double t = pb > pa ? double(int64_t(nowUs) - int64_t(pa)) / double(pb - pa) : 1.0;
+		out = lerp(a.value, b.value, std::clamp(t, 0.0, 1.0));
+		return true;
+	}
+
+	Stats getStats() const {
+		Stats st;
+		st.delayUs = delayStat.load(std::memory_order_relaxed);
+		st.jitterUs = jitterStat.load(std::memory_order_relaxed);
+		st.periodUs = periodStat.load(std::memory_order_relaxed);
+		st.pushed = pushed.load(std::memory_order_relaxed);
+		st.played = played.load(std::memory_order_relaxed);
+		st.late = late.load(std::memory_order_relaxed);
+		st.underruns = underruns.load(std::memory_order_relaxed);
+		st.overflow = overflow.load(std::memory_order_relaxed);
+		return st;
+	}
+
+private:
+	struct Entry {
+		T value;
+		uint64_t arrivalUs;
+	};
+
+	struct Sample {
+		T value;
+		uint64_t sendUs; // virtual send time on the reconstructed grid
+	};
+
+	// Gaps outside this range are pauses or bursts, not the sender's cadence.
+	static constexpr uint64_t kMinPeriodUs = 1000;
+	static constexpr uint64_t kMaxPeriodUs = 100000;
+	// Lateness envelope release per sample (about 1.5 s at 90 Hz) and grid pull per arrival.
+	static constexpr uint64_t kLatenessRelease = 128;
+	static constexpr uint64_t kGridPull = 64;
+
+	uint64_t playoutTime(const Sample& s) const { return s.sendUs + delayUs; }
+
+	void drain() {
+		const uint64_t head = ringHead.load(std::memory_order_acquire);
+		uint64_t tail = ringTail.load(std::memory_order_relaxed);
+		for (; tail != head; ++tail) accept(ring[tail & (Capacity - 1)]);
+		ringTail.store(tail, std::memory_order_release);
+
+		// The reader only ever needs a few samples ahead; anything beyond the cap is stale.
+		while (pending.size() > Capacity) pending.pop_front();
+	}
+
+	void accept(const Entry& e) {
+		// Producers stamp before they take the lock, so two of them can land slightly out of order.
+		const uint64_t a = std::max<uint64_t>(e.arrivalUs, lastArrivalUs);
+		uint64_t sendUs = a;
+
+		// After a pause (or the very first sample) the grid starts over at the arrival.
+		const uint64_t gap = a - lastArrivalUs;
+		if (lastArrivalUs && gap <= kMaxPeriodUs) {
+			if (gap >= kMinPeriodUs) {
+				periodUs = periodUs ? periodUs + (int64_t(gap) - int64_t(periodUs)) / 16 : gap;
+				const uint64_t d = uint64_t(std::llabs(int64_t(gap) - int64_t(periodUs)));
+				jitterUs += (int64_t(d) - int64_t(jitterUs)) / 16;
+			}
+
+			// Next slot on the grid, never after the arrival. The grid is also pulled a little
+			// towards every arrival so a period estimate that is slightly off cannot make it
+			// drift away; the ceiling bounds the rest.
+			const uint64_t slot = lastSendUs + periodUs;
+			sendUs = slot < a ? slot + (a - slot) / kGridPull : a;
+			if (a > maxDelayUs && sendUs < a - maxDelayUs) sendUs = a - maxDelayUs;
+		}
+
+		// How late this sample is relative to the grid. Late means after the playout time the
+		// reader was using, so it counts against the delay from before this sample raised it.
+		// The envelope jumps up to any late sample and then bleeds off slowly, so it sits near
+		// the worst recent lateness.
+		const uint64_t lateness = a - sendUs;
+		if (lateness > delayUs) late.fetch_add(1, std::memory_order_relaxed);
+		if (lateness > latenessUs) latenessUs = lateness;
+		else latenessUs -= (latenessUs - lateness) / kLatenessRelease;
+
+		// One extra period so the next sample is normally in hand to interpolate towards.
+		delayUs = std::min<uint64_t>(latenessUs + periodUs, maxDelayUs);
+
+		lastArrivalUs = a;
+		lastSendUs = sendUs;
+		pending.push_back(Sample{ e.value, sendUs });
+
+		delayStat.store(static_cast<uint32_t>(delayUs), std::memory_order_relaxed);
+		jitterStat.store(static_cast<uint32_t>(jitterUs), std::memory_order_relaxed);
+		periodStat.store(static_cast<uint32_t>(periodUs), std::memory_order_relaxed);
+	}
+
+	// Producer side
+	Entry ring[Capacity];
+	std::atomic<uint64_t> ringHead{ 0 };
+	std::atomic<uint64_t> ringTail{ 0 };
+	std::atomic_flag writeLock = ATOMIC_FLAG_INIT;
+
+	// Reader side
+	std::deque<Sample> pending;
+	uint64_t maxDelayUs = 40000;
+	uint64_t delayUs = 0;
+	uint64_t latenessUs = 0;
+	uint64_t periodUs = 0;
+	uint64_t jitterUs = 0;
+	uint64_t lastArrivalUs = 0;
+	uint64_t lastSendUs = 0;
+	bool started = false;
+
+	std::atomic<uint32_t> delayStat{ 0 };
+	std::atomic<uint32_t> jitterStat{ 0 };
+	std::atomic<uint32_t> periodStat{ 0 };
+	std::atomic<uint64_t> pushed{ 0 };
+	std::atomic<uint64_t> played{ 0 };
+	std::atomic<uint64_t> late{ 0 };
+	std::atomic<uint64_t> underruns{ 0 };
+	std::atomic<uint64_t> overflow{ 0 };
+};
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef S2UK_NetEventLoop
+#define S2UK_NetEventLoop
+
+#include "NetPlatform.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+Single-threaded readiness loop: every registered socket, timer and posted task runs on
+the thread that calls run(). Backend is epoll on Linux and WSAPoll on Windows.
+
+Handlers may add/modify/remove sockets (including their own) while being dispatched.
+Other threads talk to the loop only through post() and wakeup().
+**/
+class NetEventLoop {
+public:
+	enum Events : uint32_t {
+		Readable = 1 << 0,
+		Writable = 1 << 1,
+		Error = 1 << 2, // hang-up or socket error, always reported
+	};
+
+	using IoHandler = std::function<void(SOCKET sock, uint32_t events)>;
+	using Task = std::function<void()>;
+
+	NetEventLoop() = default;
+	~NetEventLoop();
+	NetEventLoop(const NetEventLoop&) = delete;
+	NetEventLoop& operator=(const NetEventLoop&) = delete;
+
+	bool init();
+
+	bool add(SOCKET sock, uint32_t interest, IoHandler handler);
+	bool modify(SOCKET sock, uint32_t interest);
+	void remove(SOCKET sock);
+
+	// Periodic timer, first fires one period from now.
+	void addTimer(std::chrono::milliseconds period, Task task);
+
+	// Thread-safe. Runs task on the loop thread as soon as possible.
+	void post(Task task);
+
+	// Thread-safe. Interrupts a blocking wait without queueing anything.
+	void wakeup();
+
+	// run() returns once stop() was called, also if that was before run() started.
+	void run();
+	void stop();
+
+	bool isLoopThread() const { return std::this_thread::get_id() == loopThread.load(); }
+	size_t size() const { return entries.size(); }
+
+private:
+	struct Entry {
+		uint32_t interest = 0;
+		IoHandler handler;
+	};
+
+	struct Timer {
+		std::chrono::milliseconds period;
+		std::chrono::steady_clock::time_point due;
+		Task task;
+	};
+
+	int waitTimeoutMs() const;
+	void runTimers();
+	void runPosted();
+	void drainWakeup();
+	void dispatch(SOCKET sock, uint32_t events);
+
+	// Backend specific
+	bool backendInit();
+	void backendShutdown();
+	bool backendAdd(SOCKET sock, uint32_t interest);
+	bool backendModify(SOCKET sock, uint32_t interest);
+	void backendRemove(SOCKET sock);
+	void backendWait(int timeoutMs);
+
+	std::unordered_map<SOCKET, Entry> entries;
+	std::vector<Timer> timers;
+
+	std::mutex postedMutex;
+	std::vector<Task> posted;
+	std::atomic<bool> wakePending{ false };
+
+	std::atomic<bool> stopRequested{ false };
+	std::atomic<std::thread::id> loopThread{};
+	bool initialized = false;
+
+#ifdef _WIN32
+	// WSAPoll has no user events, a loopback UDP socket connected to itself stands in for one.
+	SOCKET wakeSock = INVALID_SOCKET;
+	std::vector<WSAPOLLFD> pollSet;
+	bool pollSetDirty = true;
+#else
+	int epollFd = -1;
+	int wakeFd = -1; // eventfd
+#endif
+};
+#endif
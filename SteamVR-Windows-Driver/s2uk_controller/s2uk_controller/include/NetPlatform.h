@@ -0,0 +1,152 @@
+#pragma once
+#ifndef S2UK_NetPlatform
+#define S2UK_NetPlatform
+
+// Thin socket portability layer. The driver itself only ships on Windows, but keeping the
+// networking code free of raw Winsock calls lets the transport build and run on Linux too.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using SOCKET = int;
+#ifndef INVALID_SOCKET
+#define INVALID_SOCKET (-1)
+#endif
+#ifndef SOCKET_ERROR
+#define SOCKET_ERROR (-1)
+#endif
+#endif
+
+namespace s2uk_net {
+	inline bool startup() {
+#ifdef _WIN32
+		WSADATA wsaData;
+		return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+		return true;
+#endif
+	}
+
+	inline void cleanup() {
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+	inline int lastError() {
+#ifdef _WIN32
+		return WSAGetLastError();
+#else
+		return errno;
+#endif
+	}
+
+	inline bool wouldBlock(int err) {
+#ifdef _WIN32
+		return err == WSAEWOULDBLOCK;
+#else
+		return err == EAGAIN || err == EWOULDBLOCK;
+#endif
+	}
+
+	inline bool interrupted(int err) {
+#ifdef _WIN32
+		return err == WSAEINTR;
+#else
+		return err == EINTR;
+#endif
+	}
+
+	inline void closeSocket(SOCKET s) {
+#ifdef _WIN32
+		closesocket(s);
+#else
+		close(s);
+#endif
+	}
+
+	inline bool setNonBlocking(SOCKET s) {
+#ifdef _WIN32
+		u_long mode = 1;
+		return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+		int flags = fcntl(s, F_GETFL, 0);
+		return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+	}
+
+	inline void setNoDelay(SOCKET s) {
+		int one = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&one), sizeof(one));
+	}
+
+	inline void setReuseAddr(SOCKET s) {
+		int one = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&one), sizeof(one));
+	}
+
+	// send() that never raises SIGPIPE on a half-closed peer.
+	inline int sendBytes(SOCKET s, const char* data, int len) {
+#ifdef _WIN32
+		return send(s, data, len, 0);
+#else
+		return static_cast<int>(send(s, data, static_cast<size_t>(len), MSG_NOSIGNAL));
+#endif
+	}
+
+	// One slice of a gather write.
+	struct ConstBuffer {
+		const char* data;
+		size_t len;
+	};
+
+	// Upper bound on slices per gather call (POSIX guarantees at least 16 for IOV_MAX).
+	constexpr size_t kMaxGather = 16;
+
+	// Writes up to kMaxGather slices with a single syscall (WSASend / sendmsg).
+	// Returns the number of bytes sent or SOCKET_ERROR, like sendBytes().
+	inline int sendGather(SOCKET s, const ConstBuffer* bufs, size_t count) {
+		if (count > kMaxGather) count = kMaxGather;
+#ifdef _WIN32
+		WSABUF wsaBufs[kMaxGather];
+		for (size_t i = 0; i < count; ++i) {
+			wsaBufs[i].buf = const_cast<char*>(bufs[i].data);
+			wsaBufs[i].len = static_cast<ULONG>(bufs[i].len);
+		}
+		DWORD sent = 0;
+		if (WSASend(s, wsaBufs, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) == SOCKET_ERROR) return SOCKET_ERROR;
+		return static_cast<int>(sent);
+#else
+		iovec iov[kMaxGather];
+		for (size_t i = 0; i < count; ++i) {
+			iov[i].iov_base = const_cast<char*>(bufs[i].data);
+			iov[i].iov_len = bufs[i].len;
+		}
+		msghdr msg{};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		return static_cast<int>(sendmsg(s, &msg, MSG_NOSIGNAL));
+#endif
+	}
+
+	inline int recvBytes(SOCKET s, char* data, int len) {
+#ifdef _WIN32
+		return recv(s, data, len, 0);
+#else
+		return static_cast<int>(recv(s, data, static_cast<size_t>(len), 0));
+#endif
+	}
+}
+#endif
@@ -0,0 +1,276 @@
+#pragma once
+#ifndef S2UK_NetTelemetry
+#define S2UK_NetTelemetry
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/**
+Link quality counters for every TCP session and UDP stream.
+
+A fixed table of slots, one per link. Each slot has exactly one writer (the network loop
+that owns the link); any thread may read it at any time without locks. Readers can see
+a snapshot where some counters are one update ahead of others, which is fine for telemetry.
+**/
+class NetTelemetry {
+public:
+	static constexpr size_t kMaxLinks = 16;
+
+	// Jitter histogram: bucket 0 is < 250us, every next bucket doubles, the last one is open ended.
+	static constexpr size_t kJitterBuckets = 9;
+	static constexpr uint32_t kJitterBucketBaseUs = 250;
+
+	enum class Kind : uint8_t { Free = 0, Tcp = 1, Udp = 2, Shm = 3 };
+
+	struct Snapshot {
+		Kind kind = Kind::Free;
+		uint32_t peerAddr = 0; // IPv4, network byte order
+		uint16_t peerPort = 0; // host byte order
+		uint32_t session = 0;  // TcpSocketClass session of the phone, 0 = none (same host, not logged in yet)
+
+		uint64_t packetsIn = 0;
+		uint64_t packetsOut = 0;
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+
+		uint32_t jitterUs = 0; // smoothed, RFC 3550 style
+		uint32_t jitterHistogram[kJitterBuckets] = {};
+
+		uint64_t seqExpected = 0; // sequence numbers the sender used
+		uint64_t seqLost = 0;     // of those, never arrived (before any redundancy recovery)
+
+		uint32_t rttUs = 0;         // last ping/pong
+		uint32_t rttSmoothedUs = 0;
+		uint32_t rttMinUs = 0;
+
+		uint32_t queueDepth = 0; // outbound messages waiting for the socket
+		uint64_t lastSeenUs = 0; // NetTelemetry::nowUs() of the last inbound packet
+
+		int64_t clockOffsetUs = 0; // peer clock - ours, see ClockSync.h (0 until synced)
+		double clockSkewPpm = 0.0;
+
+		double lossRatio() const { return seqExpected ? double(seqLost) / double(seqExpected) : 0.0; }
+	};
+
+	// Writer side of one slot. Only the owning loop thread calls these.
+	class Link {
+	public:
+		// Data packet: counted and sampled for jitter.
+		void onReceive(size_t bytes, uint64_t nowUs, uint64_t senderTimeUs = 0) {
+			countReceive(bytes, nowUs);
+
+			// Without sender timestamps the arrival gaps alone stand in for transit time.
+			const int64_t transit = senderTimeUs ? int64_t(nowUs) - int64_t(senderTimeUs) : int64_t(nowUs);
+			if (haveTransit) {
+				const int64_t d = senderTimeUs ? transit - lastTransit : (int64_t(nowUs - lastArrivalUs) - lastGapUs);
+				const uint32_t absD = static_cast<uint32_t>(d < 0 ? -d : d);
+				jitterState += (int64_t(absD) * 16 - jitterState) / 16; // J += (|D| - J) / 16, kept x16
+				jitterUs.store(static_cast<uint32_t>(jitterState / 16), std::memory_order_relaxed);
+				bump(jitterHistogram[bucketFor(absD)], 1u);
+			}
+			if (lastArrivalUs) lastGapUs = int64_t(nowUs - lastArrivalUs);
+			lastTransit = transit;
+			haveTransit = lastArrivalUs != 0;
+			lastArrivalUs = nowUs;
+		}
+
+		// Control packet (ping/pong, late duplicates): counted but kept out of the jitter samples.
+		void countReceive(size_t bytes, uint64_t nowUs) {
+			bump(packetsIn, 1);
+			bump(bytesIn, bytes);
+			lastSeenUs.store(nowUs, std::memory_order_relaxed);
+		}
+
+		void onSend(size_t packets, size_t bytes) {
+			bump(packetsOut, packets);
+			bump(bytesOut, bytes);
+		}
+
+		// expected: how far the sequence advanced, lost: how many of those never arrived.
+		void onSequence(uint64_t expected, uint64_t lost) {
+			bump(seqExpected, expected);
+			if (lost) bump(seqLost, lost);
+		}
+
+		void onRtt(uint32_t rtt) {
+			rttUs.store(rtt, std::memory_order_relaxed);
+			const uint32_t minNow = rttMinUs.load(std::memory_order_relaxed);
+			if (minNow == 0 || rtt < minNow) rttMinUs.store(rtt, std::memory_order_relaxed);
+			const uint32_t s = rttSmoothedUs.load(std::memory_order_relaxed);
+			rttSmoothedUs.store(s ? s + (int32_t(rtt) - int32_t(s)) / 8 : rtt, std::memory_order_relaxed); // RFC 6298 alpha
+		}
+
+		void setQueueDepth(size_t depth) {
+			queueDepth.store(static_cast<uint32_t>(depth), std::memory_order_relaxed);
+		}
+
+		// The TCP session whose phone the link belongs to; phones behind one address each have their own.
+		void setSession(uint32_t id) {
+			session.store(id, std::memory_order_relaxed);
+		}
+
+		void onClockSync(int64_t offsetUs, double skew) {
+			clockOffsetUs.store(offsetUs, std::memory_order_relaxed);
+			clockSkewPpb.store(static_cast<int32_t>(skew * 1e9), std::memory_order_relaxed);
+		}
+
+	private:
+		friend class NetTelemetry;
+
+		template<class A, class V>
+		static void bump(A& a, V n) { a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+		static size_t bucketFor(uint32_t us) {
+			size_t b = 0;
+			for (uint32_t limit = kJitterBucketBaseUs; b + 1 < kJitterBuckets && us >= limit; limit <<= 1) ++b;
+			return b;
+		}
+
+		void reset() {
+			packetsIn = packetsOut = bytesIn = bytesOut = 0;
+			seqExpected = seqLost = 0;
+			jitterUs = rttUs = rttSmoothedUs = rttMinUs = queueDepth = 0;
+			for (auto& b : jitterHistogram) b = 0;
+			lastSeenUs = 0;
+			session = 0;
+			clockOffsetUs = 0;
+			clockSkewPpb = 0;
+			jitterState = lastTransit = lastGapUs = 0;
+			lastArrivalUs = 0;
+			haveTransit = false;
+		}
+
+		std::atomic<uint64_t> packetsIn{ 0 }, packetsOut{ 0 }, bytesIn{ 0 }, bytesOut{ 0 };
+		std::atomic<uint32_t> jitterUs{ 0 };
+		std::atomic<uint32_t> jitterHistogram[kJitterBuckets] = {};
+		std::atomic<uint64_t> seqExpected{ 0 }, seqLost{ 0 };
+		std::atomic<uint32_t> rttUs{ 0 }, rttSmoothedUs{ 0 }, rttMinUs{ 0 };
+		std::atomic<uint32_t> queueDepth{ 0 };
+		std::atomic<uint64_t> lastSeenUs{ 0 };
+		std::atomic<uint32_t> session{ 0 };
+		std::atomic<int64_t> clockOffsetUs{ 0 };
+		std::atomic<int32_t> clockSkewPpb{ 0 };
+
+		// Writer-only state
+		int64_t jitterState = 0;
+		int64_t lastTransit = 0;
+		int64_t lastGapUs = 0;
+		uint64_t lastArrivalUs = 0;
+		bool haveTransit = false;
+	};
+
+	static uint64_t nowUs() {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	// Claims a free slot. Returns nullptr when all kMaxLinks are taken (the link just goes unmetered).
+	Link* acquire(Kind kind, uint32_t peerAddr, uint16_t peerPort) {
+		for (auto& slot : slots) {
+			uint8_t expected = static_cast<uint8_t>(Kind::Free);
+			if (!slot.claimed.compare_exchange_strong(expected, 1, std::memory_order_acquire)) continue;
+			slot.link.reset();
+			slot.peerAddr.store(peerAddr, std::memory_order_relaxed);
+			slot.peerPort.store(peerPort, std::memory_order_relaxed);
+			slot.kind.store(static_cast<uint8_t>(kind), std::memory_order_release);
+			return &slot.link;
+		}
+		return nullptr;
+	}
+
+	void release(Link* link) {
+		if (!link) return;
+		for (auto& slot : slots) {
+			if (&slot.link != link) continue;
+			slot.kind.store(static_cast<uint8_t>(Kind::Free), std::memory_order_release);
+			slot.claimed.store(0, std::memory_order_release);
+			return;
+		}
+	}
+
+	// Any thread. Calls fn(const Snapshot&) for every link in use.
+	template<class Fn>
+	void forEach(Fn&& fn) const {
+		for (auto& slot : slots) {
+			Snapshot s;
+			if (read(slot, s)) fn(s);
+		}
+	}
+
+	// Compact JSON array of all links, for DebugRequest and logging.
+	std::string toJson() const {
+		std::string out = "[";
+		forEach([&](const Snapshot& s) {
+			char buf[640];
+			const uint64_t now = nowUs();
+			int n = snprintf(buf, sizeof(buf),
+				"%s{\"kind\":\"%s\",\"peer\":\"%u.%u.%u.%u:%u\",\"session\":%u,\"pktIn\":%llu,\"pktOut\":%llu,\"bytesIn\":%llu,\"bytesOut\":%llu,"
+				"\"jitterUs\":%u,\"jitterHist\":[%u,%u,%u,%u,%u,%u,%u,%u,%u],\"loss\":%.4f,\"rttUs\":%u,\"rttSmoothedUs\":%u,\"rttMinUs\":%u,"
+				"\"queue\":%u,\"lastSeenMs\":%llu,\"clockOffsetUs\":%lld,\"clockSkewPpm\":%.2f}",
+				out.size() > 1 ? "," : "", kindName(s.kind),
+				s.peerAddr & 0xFF, (s.peerAddr >> 8) & 0xFF, (s.peerAddr >> 16) & 0xFF, (s.peerAddr >> 24) & 0xFF, s.peerPort, s.session,
+				(unsigned long long)s.packetsIn, (unsigned long long)s.packetsOut, (unsigned long long)s.bytesIn, (unsigned long long)s.bytesOut,
+				s.jitterUs, s.jitterHistogram[0], s.jitterHistogram[1], s.jitterHistogram[2], s.jitterHistogram[3], s.jitterHistogram[4],
+				s.jitterHistogram[5], s.jitterHistogram[6], s.jitterHistogram[7], s.jitterHistogram[8],
+				s.lossRatio(), s.rttUs, s.rttSmoothedUs, s.rttMinUs, s.queueDepth,
+				(unsigned long long)(s.lastSeenUs && now > s.lastSeenUs ? (now - s.lastSeenUs) / 1000 : 0),
+				(long long)s.clockOffsetUs, s.clockSkewPpm);
+			if (n > 0) out.append(buf, std::min<size_t>(static_cast<size_t>(n), sizeof(buf) - 1));
+		});
+		out += "]";
+		return out;
+	}
+
+private:
+	static const char* kindName(Kind kind) {
+		switch (kind) {
+		case Kind::Tcp: return "tcp";
+		case Kind::Udp: return "udp";
+		case Kind::Shm: return "shm";
+		default: return "free";
+		}
+	}
+
+	struct Slot {
+		std::atomic<uint8_t> claimed{ 0 };
+		std::atomic<uint8_t> kind{ 0 };
+		std::atomic<uint32_t> peerAddr{ 0 };
+		std::atomic<uint16_t> peerPort{ 0 };
+		Link link;
+	};
+
+	static bool read(const Slot& slot, Snapshot& s) {
+		s.kind = static_cast<Kind>(slot.kind.load(std::memory_order_acquire));
+		if (s.kind == Kind::Free) return false;
+
+		const Link& l = slot.link;
+		s.peerAddr = slot.peerAddr.load(std::memory_order_relaxed);
+		s.peerPort = slot.peerPort.load(std::memory_order_relaxed);
+		s.session = l.session.load(std::memory_order_relaxed);
+		s.packetsIn = l.packetsIn.load(std::memory_order_relaxed);
+		s.packetsOut = l.packetsOut.load(std::memory_order_relaxed);
+		s.bytesIn = l.bytesIn.load(std::memory_order_relaxed);
+		s.bytesOut = l.bytesOut.load(std::memory_order_relaxed);
+		s.jitterUs = l.jitterUs.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < kJitterBuckets; ++i) s.jitterHistogram[i] = l.jitterHistogram[i].load(std::memory_order_relaxed);
+		s.seqExpected = l.seqExpected.load(std::memory_order_relaxed);
+		s.seqLost = l.seqLost.load(std::memory_order_relaxed);
+		s.rttUs = l.rttUs.load(std::memory_order_relaxed);
+		s.rttSmoothedUs = l.rttSmoothedUs.load(std::memory_order_relaxed);
+		s.rttMinUs = l.rttMinUs.load(std::memory_order_relaxed);
+		s.queueDepth = l.queueDepth.load(std::memory_order_relaxed);
+		s.lastSeenUs = l.lastSeenUs.load(std::memory_order_relaxed);
+		s.clockOffsetUs = l.clockOffsetUs.load(std::memory_order_relaxed);
+		s.clockSkewPpm = l.clockSkewPpb.load(std::memory_order_relaxed) / 1000.0;
+
+		// Slot got released while we were reading it.
+		return slot.kind.load(std::memory_order_acquire) != static_cast<uint8_t>(Kind::Free);
+	}
+
+	Slot slots[kMaxLinks];
+};
+#endif
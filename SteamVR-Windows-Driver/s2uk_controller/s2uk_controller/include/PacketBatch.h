@@ -0,0 +1,244 @@
+#pragma once
+#ifndef S2UK_PacketBatch
+#define S2UK_PacketBatch
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "PacketSchema.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define S2UK_PACKET_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/**
+Controller packets decoded a batch at a time, for the driver's bursts (the states of one UDP
+datagram). Gives the same values and statuses as s2uk_packet::decode on each packet.
+
+Varint codec: one movemask per 16 bytes (SSE2, the x64 baseline; SWAR elsewhere) gives the
+continuation bits of the whole packet, read where it lies. Field ends are the clear bits,
+found with a bit scan instead of a loop per byte, and each varint of up to 8 bytes is one
+8-byte load compacted from 7-bit groups with three masked shifts. Loads never go past the
+packet: the last one is placed to end with it. Longer varints (times past 2^56 us) and
+packets under 8 bytes take the byte loop. The values land in rows per field, and zigzag
+and the int64 -> double scaling (dequantizeRow) run over the rows two lanes at a time.
+Packets over 64 bytes go through decode() as they are.
+**/
+namespace s2uk_packet {
+	constexpr size_t kBatchSize = 64;
+	constexpr size_t kBatchValues = 5; // gx, gy, gz, jx, jy
+
+	// Up to kBatchSize packets in rows. values are zigzag decoded; the gyro rows are unused
+	// for packets with kFlagQuaternion, and everything is unused where status isn't Ok.
+	struct PacketBatch {
+		size_t count = 0;
+		Status status[kBatchSize];
+		uint8_t flags[kBatchSize];
+		uint8_t modes[kBatchSize];
+		uint8_t battery[kBatchSize];
+		uint8_t quat[kBatchSize][kSmallestThreeBytes];
+		int64_t values[kBatchValues][kBatchSize];
+		uint64_t senderTimeUs[kBatchSize];
+		bool small[kBatchValues]; // every value of the row within +-2^51, exact as a double
+	};
+
+	namespace detail {
+		constexpr size_t kMaskBytes = 64;
+
+		// Top bits of 8 bytes, as 8 bits.
+		inline uint64_t highBits8(const uint8_t* p) {
+			uint64_t w;
+			std::memcpy(&w, p, 8);
+			return ((w & 0x8080808080808080ull) >> 7) * 0x0102040810204080ull >> 56;
+		}
+
+		// Bit i set if byte i of the packet has its continuation bit. Reads only the packet:
+		// the last block is loaded so that it ends with it, overlapping the one before.
+		inline uint64_t continuationMask(const uint8_t* p, size_t len) {
+			uint64_t m = 0;
+#ifdef S2UK_PACKET_SSE2
+			if (len >= 16) {
+				size_t off = 0;
+				for (; off + 16 <= len; off += 16) {
+					m |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + off))))) << off;
+				}
+				if (off < len) {
+					m |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + len - 16))))) << (len - 16);
+				}
+				return m;
+			}
+#endif
+			if (len >= 8) {
+				size_t off = 0;
+				for (; off + 8 <= len; off += 8) m |= highBits8(p + off) << off;
+				if (off < len) m |= highBits8(p + len - 8) << (len - 8);
+				return m;
+			}
+			for (size_t i = 0; i < len; ++i) m |= static_cast<uint64_t>(p[i] >> 7) << i;
+			return m;
+		}
+
+		inline unsigned lowestBit(uint64_t m) {
+#if defined(_MSC_VER) && !defined(__clang__)
+			unsigned long i;
+			_BitScanForward64(&i, m);
+			return static_cast<unsigned>(i);
+#else
+			return static_cast<unsigned>(__builtin_ctzll(m));
+#endif
+		}
+
+		// The varint of n bytes (1..8) at start, as one 8-byte load that stays inside the
+		// packet (len >= 8) and three masked shifts that drop the continuation bits.
+		inline uint64_t compactVarint(const uint8_t* p, size_t len, unsigned start, unsigned n) {
+			uint64_t x;
+			if (start + 8 <= len) std::memcpy(&x, p + start, 8);
+			else {
+				std::memcpy(&x, p + len - 8, 8);
+				x >>= 8 * (start + 8 - len);
+			}
+			x &= ~0ull >> (64 - 8 * n);
+			x = ((x & 0x7F007F007F007F00ull) >> 1) | (x & 0x007F007F007F007Full);
+			x = ((x & 0x3FFF00003FFF0000ull) >> 2) | (x & 0x00003FFF00003FFFull);
+			x = ((x & 0x0FFFFFFF00000000ull) >> 4) | (x & 0x000000000FFFFFFFull);
+			return x;
+		}
+
+		// Next varint from byte start on; ends holds the clear continuation bits from start up.
+		inline Status nextVarint(const uint8_t* p, size_t len, unsigned& start, uint64_t& ends, uint64_t& out) {
+			const size_t avail = len - start;
+			const unsigned end = ends ? lowestBit(ends) : 64;
+			const unsigned n = end - start + 1;
+			if (ends == 0 || n > kMaxVarintBytes) return avail >= kMaxVarintBytes ? Status::BadVarint : Status::Truncated;
+			if (n <= 8 && len >= 8) out = compactVarint(p, len, start, n);
+			else {
+				const uint8_t* r = p + start;
+				readVarint(r, p + len, out);
+			}
+			start = end + 1;
+			ends &= ends - 1;
+			return Status::Ok;
+		}
+
+		inline void decodeVarintInto(const uint8_t* p, size_t len, PacketBatch& out, size_t i, uint64_t (&raw)[kBatchValues][kBatchSize]) {
+			if (len > kMaskBytes) {
+				// Past the longest packet anyone sends; keep decode()'s handling of what trails.
+				ControllerPacket cp;
+				out.status[i] = decode(p, len, Codec::Varint, cp);
+				out.flags[i] = cp.flags;
+				out.modes[i] = cp.modes;
+				out.battery[i] = cp.battery;
+				std::memcpy(out.quat[i], cp.quat, kSmallestThreeBytes);
+				for (size_t f = 0; f < 3; ++f) raw[f][i] = zigzag(cp.gyro[f]);
+				for (size_t f = 0; f < 2; ++f) raw[3 + f][i] = zigzag(cp.joy[f]);
+				out.senderTimeUs[i] = cp.senderTimeUs;
+				return;
+			}
+			if (len < 3) { out.status[i] = Status::TooShort; return; }
+
+			const uint8_t flags = p[0];
+			out.flags[i] = flags;
+			out.modes[i] = p[1];
+			out.battery[i] = p[2];
+
+			unsigned start = 3;
+			size_t first = 0;
+			if (flags & kFlagQuaternion) {
+				if (len < 3 + kSmallestThreeBytes) { out.status[i] = Status::Truncated; return; }
+				std::memcpy(out.quat[i], p + 3, kSmallestThreeBytes);
+				start += kSmallestThreeBytes;
+				first = 3;
+			}
+
+			const uint64_t inPacket = len == kMaskBytes ? ~0ull : (1ull << len) - 1;
+			uint64_t ends = ~continuationMask(p, len) & inPacket & (~0ull << start);
+			for (size_t f = first; f < kBatchValues; ++f) {
+				const Status s = nextVarint(p, len, start, ends, raw[f][i]);
+				if (s != Status::Ok) { out.status[i] = s; return; }
+			}
+			out.senderTimeUs[i] = 0;
+			if (start != len) {
+				const Status s = nextVarint(p, len, start, ends, out.senderTimeUs[i]);
+				if (s != Status::Ok) { out.status[i] = s; return; }
+			}
+			out.status[i] = Status::Ok;
+		}
+
+		// In place, raw zigzag values to signed ones.
+		inline void unzigzagRow(uint64_t* row, size_t n) {
+			size_t i = 0;
+#ifdef S2UK_PACKET_SSE2
+			const __m128i one = _mm_set1_epi64x(1);
+			for (; i + 2 <= n; i += 2) {
+				const __m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+				const __m128i sign = _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(z, one));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_xor_si128(_mm_srli_epi64(z, 1), sign));
+			}
+#endif
+			for (; i < n; ++i) row[i] = static_cast<uint64_t>(unzigzag(row[i]));
+		}
+	}
+
+	// Decodes count (up to kBatchSize) packets into out.
+	inline void decodeBatch(const std::span<const uint8_t>* packets, size_t count, Codec codec, PacketBatch& out) {
+		out.count = count;
+		if (codec != Codec::Varint) {
+			// Fixed: already one load per field, only the rows are different. Delta: keyframes
+			// only, deltas need the stream's DeltaDecoder.
+			for (size_t i = 0; i < count; ++i) {
+				ControllerPacket p;
+				out.status[i] = decode(packets[i].data(), packets[i].size(), codec, p);
+				out.flags[i] = p.flags;
+				out.modes[i] = p.modes;
+				out.battery[i] = p.battery;
+				std::memcpy(out.quat[i], p.quat, kSmallestThreeBytes);
+				for (size_t f = 0; f < 3; ++f) out.values[f][i] = p.gyro[f];
+				for (size_t f = 0; f < 2; ++f) out.values[3 + f][i] = p.joy[f];
+				out.senderTimeUs[i] = p.senderTimeUs;
+			}
+			for (bool& s : out.small) s = codec == Codec::Fixed; // int16
+			return;
+		}
+
+		uint64_t (&raw)[kBatchValues][kBatchSize] = reinterpret_cast<uint64_t (&)[kBatchValues][kBatchSize]>(out.values);
+		for (size_t i = 0; i < count; ++i) {
+			for (size_t f = 0; f < kBatchValues; ++f) raw[f][i] = 0; // rows stay defined for failed packets
+			detail::decodeVarintInto(packets[i].data(), packets[i].size(), out, i, raw);
+		}
+		for (size_t f = 0; f < kBatchValues; ++f) {
+			// A zigzag value under 2^52 is a signed one within +-2^51.
+			uint64_t all = 0;
+			for (size_t i = 0; i < count; ++i) all |= raw[f][i];
+			out.small[f] = all < (1ull << 52);
+			detail::unzigzagRow(raw[f], count);
+		}
+	}
+
+	// out[i] = dequantize(q[i], scale), bit for bit. small: every q within +-2^51 (PacketBatch::small).
+	inline void dequantizeRow(const int64_t* q, size_t n, uint32_t scale, bool small, double* out) {
+		size_t i = 0;
+#ifdef S2UK_PACKET_SSE2
+		if (small) {
+			// Exact int64 -> double without AVX-512: the integer goes into the mantissa of 1.5 * 2^52.
+			const __m128i magicBits = _mm_set1_epi64x(0x4338000000000000ll);
+			const __m128d magic = _mm_castsi128_pd(magicBits);
+			const __m128d s = _mm_set1_pd(static_cast<double>(scale));
+			for (; i + 2 <= n; i += 2) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + i));
+				const __m128d d = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(v, magicBits)), magic);
+				_mm_storeu_pd(out + i, _mm_div_pd(d, s));
+			}
+		}
+#else
+		(void)small;
+#endif
+		for (; i < n; ++i) out[i] = dequantize(q[i], scale);
+	}
+}
+#endif
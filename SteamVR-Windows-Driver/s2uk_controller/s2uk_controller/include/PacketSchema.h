@@ -0,0 +1,809 @@
+#pragma once
+#ifndef S2UK_PacketSchema
+#define S2UK_PacketSchema
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#include <type_traits>
+#define S2UK_PACKET_CONSTEVAL_CHECK 1
+#endif
+
+/**
+The wire packets between phone and driver, described once and shared by the driver
+(BufferCompression.h, ControllerDriver.cpp) and the phone (native-lib.cpp, C++17; the debug
+decoder in DebugReceiver.java goes through it too).
+
+Controller state, phone -> driver. Every codec carries the same fields in the same order:
+
+	flags     bit 0 left hand, 1 system/menu, 2 A/X, 3 B/Y, 4 battery plugged,
+	          5 stick in dead zone, 6 orientation is a quaternion (kFlagQuaternion)
+	modes     bits 0-1 trigger, 2-3 grip, 4-5 stick state
+	battery   percent
+	gyro      yaw, pitch, roll in degrees * gyroScale, or the smallest-three quaternion
+	joy       stick x, y * joyScale
+	time      sensor event time on the phone's clock in us, optional
+
+The varint codec writes flags, modes and battery as bytes, then zigzag varints with the
+time left out when it is 0. The fixed codec puts every field at the offset kFixedSlots
+gives it. The delta codec sends varint keyframes and, in between, only what changed since
+the last one (see DeltaEncoder). Any of them may carry the IMU samples taken since the last
+packet after it (ImuBatch). Haptic pulses and envelopes (driver -> phone) and send rates
+(driver -> phone) are below.
+
+Everything here is constexpr, and the static_asserts at the end check the layout and
+round-trip a matrix of packets through every codec, so a change that breaks either side
+breaks the build of both.
+**/
+namespace s2uk_packet {
+	enum class Codec : uint8_t {
+		Varint = 0, // flags, modes, battery, zigzag varints
+		Fixed,      // the same fields as int16 at fixed offsets (kFixedSlots)
+		Delta,      // varint keyframes and changes against them (DeltaEncoder)
+	};
+
+	enum class Orientation : uint8_t {
+		Euler = 0,  // yaw, pitch, roll in degrees * gyroScale
+		Quaternion, // smallest-three (kFlagQuaternion)
+	};
+
+	enum class Status : uint8_t {
+		Ok = 0,
+		TooShort,  // less than the bytes every packet has, or a short fixed layout packet
+		Truncated, // a varint runs past the end
+		BadVarint, // a varint longer than kMaxVarintBytes
+		BadLayout, // fixed layout packet with an unknown layout byte, or a delta that can't apply
+		NoKeyframe, // a delta against a keyframe we don't have: lost, or from before a reconnect
+	};
+
+	constexpr uint8_t kFlagLeft = 1 << 0;
+	constexpr uint8_t kFlagSystemOrMenu = 1 << 1;
+	constexpr uint8_t kFlagAOrX = 1 << 2;
+	constexpr uint8_t kFlagBOrY = 1 << 3;
+	constexpr uint8_t kFlagBatteryPlugged = 1 << 4;
+	constexpr uint8_t kFlagJoyInDZ = 1 << 5;
+	constexpr uint8_t kFlagQuaternion = 1 << 6;
+
+	// A field of the modes byte.
+	struct BitField {
+		uint8_t shift;
+		uint8_t mask;
+
+		constexpr uint8_t get(uint8_t byte) const { return static_cast<uint8_t>((byte >> shift) & mask); }
+		constexpr uint8_t put(unsigned value) const { return static_cast<uint8_t>((value & mask) << shift); }
+	};
+	constexpr BitField kModeTrigger{ 0, 0x3 };
+	constexpr BitField kModeGrip{ 2, 0x3 };
+	constexpr BitField kModeJoy{ 4, 0x3 };
+
+	constexpr uint8_t kMaxBattery = 100;
+
+	// What legacy phones quantize with; the hello may agree on others.
+	constexpr uint32_t kDefaultGyroScale = 1000;
+	constexpr uint32_t kDefaultJoyScale = 100000;
+	// The fixed codec's int16 fields fit these scales: +-364 degrees, +-1 stick.
+	constexpr uint32_t kFixedGyroScale = 90;
+	constexpr uint32_t kFixedJoyScale = 32767;
+
+	constexpr size_t kMaxVarintBytes = 10;
+	constexpr size_t kSmallestThreeBytes = 6;
+
+	enum class Field : uint8_t { Flags, Modes, Battery, Layout, Gyro, Joy, Reserved, SenderTime };
+
+	// Fixed layout: count little-endian values of width bytes each at offset.
+	struct Slot {
+		Field field;
+		uint8_t offset;
+		uint8_t count;
+		uint8_t width;
+	};
+	inline constexpr Slot kFixedSlots[] = {
+		{ Field::Flags,      0,  1, 1 },
+		{ Field::Modes,      1,  1, 1 },
+		{ Field::Battery,    2,  1, 1 },
+		{ Field::Layout,     3,  1, 1 }, // kFixedLayout
+		{ Field::Gyro,       4,  3, 2 }, // int16, or the smallest-three quaternion
+		{ Field::Joy,        10, 2, 2 }, // int16
+		{ Field::Reserved,   14, 1, 2 }, // 0
+		{ Field::SenderTime, 16, 1, 8 }, // u64, 0 if the phone has no sensor time
+	};
+	constexpr size_t kFixedPacketSize = 24;
+	constexpr uint8_t kFixedLayout = 1;
+
+	constexpr Slot slot(Field f) {
+		for (const Slot& s : kFixedSlots) {
+			if (s.field == f) return s;
+		}
+		return { f, 0, 0, 0 };
+	}
+
+	// Largest packet any codec writes: a delta keyframe with every value at 10 bytes.
+	constexpr size_t kMaxPacketSize = 1 + 3 + 6 * kMaxVarintBytes;
+
+	// Delta codec header byte, and the change bits of a delta (see DeltaEncoder).
+	constexpr uint8_t kDeltaFrame = 1 << 7;   // a delta, not a keyframe
+	constexpr uint8_t kDeltaLeft = 1 << 6;    // the left hand's stream
+	constexpr uint8_t kDeltaKeyIdMask = 0x3F; // keyframe id, counts up per keyframe
+	constexpr uint32_t kKeyframeInterval = 32; // a keyframe at least every this many packets
+
+	constexpr uint8_t kChangedFlags = 1 << 0;
+	constexpr uint8_t kChangedModes = 1 << 1;
+	constexpr uint8_t kChangedBattery = 1 << 2;
+	constexpr uint8_t kChangedGyro = 1 << 3; // bits 3-5, one per gyro value or quaternion component
+	constexpr uint8_t kChangedJoy = 1 << 6;  // bits 6-7
+
+	// One controller state as it goes on the wire, quantized but not yet encoded.
+	struct ControllerPacket {
+		uint8_t flags = 0;
+		uint8_t modes = 0;
+		uint8_t battery = 0;
+		int64_t gyro[3] = {};                    // unused with kFlagQuaternion
+		uint8_t quat[kSmallestThreeBytes] = {};  // with kFlagQuaternion only
+		int64_t joy[2] = {};
+		uint64_t senderTimeUs = 0;
+	};
+
+	// Haptic pulse, driver -> phone: u8 flags (bit 0 left hand), then amplitude, frequency and
+	// duration as zigzag varints at these scales.
+	constexpr uint32_t kAmplitudeScale = 1000;
+	constexpr uint32_t kFrequencyScale = 100;
+	constexpr uint32_t kDurationScale = 1000;
+	constexpr size_t kMaxHapticSize = 1 + 3 * kMaxVarintBytes;
+
+	struct HapticPacket {
+		uint8_t flags = 0;
+		int64_t amplitude = 0;
+		int64_t frequency = 0;
+		int64_t duration = 0;
+	};
+
+	// Haptic envelope, driver -> phone: the pulses of one hand over a few frames as one
+	// timeline. u8 flags (bit 0 left hand) | u8 point count | per point duration, amplitude
+	// and frequency as zigzag varints at the pulse scales. The phone plays the points back to
+	// back from when the envelope arrives, amplitude 0 is a pause; like a pulse, an envelope
+	// replaces whatever of the previous one is still playing.
+	constexpr size_t kMaxEnvelopePoints = 16;
+	constexpr size_t kMaxHapticEnvelopeSize = 2 + kMaxEnvelopePoints * 3 * kMaxVarintBytes;
+
+	struct HapticEnvelopePacket {
+		struct Point {
+			int64_t duration = 0;
+			int64_t amplitude = 0;
+			int64_t frequency = 0;
+		};
+		uint8_t flags = 0;
+		uint8_t count = 0;
+		Point points[kMaxEnvelopePoints] = {};
+	};
+
+	// IMU batch, phone -> driver, after every controller packet once the hello agreed on
+	// imu=batch: the orientation samples the sensor gave since the previous packet, oldest
+	// first. The packet itself is the newest.
+	//
+	//	packet | count x { varuint age | orientation } | u8 size of the samples
+	//
+	// age is in us before the packet's time. orientation has the packet's form: the
+	// smallest-three quaternion with kFlagQuaternion, else the three gyro values as zigzag
+	// differences from the packet's. The size goes last, so the packet is everything before
+	// the samples whatever its codec.
+	constexpr size_t kMaxImuSamples = 7;
+	constexpr size_t kMaxImuSampleSize = 5 + 3 * kMaxVarintBytes; // u32 age, three int64 differences
+	constexpr size_t kMaxImuBatchSize = kMaxImuSamples * kMaxImuSampleSize + 1;
+
+	struct ImuSample {
+		uint32_t ageUs = 0;                     // before the packet's senderTimeUs
+		int64_t gyro[3] = {};                   // as ControllerPacket::gyro, unused with kFlagQuaternion
+		uint8_t quat[kSmallestThreeBytes] = {}; // with kFlagQuaternion only
+	};
+
+	struct ImuBatch {
+		uint8_t count = 0;
+		ImuSample samples[kMaxImuSamples] = {};
+	};
+
+	// Send rate, driver -> phone: u8 flags (bit 0 left hand) | varuint states per second.
+	constexpr size_t kMaxSendRateSize = 1 + kMaxVarintBytes;
+
+	struct SendRatePacket {
+		uint8_t flags = 0;
+		uint64_t hz = 0;
+	};
+
+	constexpr uint64_t zigzag(int64_t v) {
+		return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+	}
+
+	constexpr int64_t unzigzag(uint64_t z) {
+		return static_cast<int64_t>((z >> 1) ^ (~(z & 1) + 1));
+	}
+
+	inline int64_t quantize(double v, uint32_t scale) { return std::llround(v * static_cast<double>(scale)); }
+	inline double dequantize(int64_t q, uint32_t scale) { return static_cast<double>(q) / static_cast<double>(scale); }
+
+	namespace detail {
+		constexpr Slot kFlags = slot(Field::Flags);
+		constexpr Slot kModes = slot(Field::Modes);
+		constexpr Slot kBattery = slot(Field::Battery);
+		constexpr Slot kLayout = slot(Field::Layout);
+		constexpr Slot kGyro = slot(Field::Gyro);
+		constexpr Slot kJoy = slot(Field::Joy);
+		constexpr Slot kSenderTime = slot(Field::SenderTime);
+
+		// Byte loops in constant evaluation and on C++17; a single load or store otherwise.
+		constexpr uint64_t getLE(const uint8_t* p, size_t width) {
+#ifdef S2UK_PACKET_CONSTEVAL_CHECK
+			if (!std::is_constant_evaluated()) {
+				uint64_t v = 0;
+				std::memcpy(&v, p, width); // little-endian hosts only, like the rest of the wire
+				return v;
+			}
+#endif
+			uint64_t v = 0;
+			for (size_t i = 0; i < width; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+			return v;
+		}
+
+		constexpr void putLE(uint8_t* p, uint64_t v, size_t width) {
+			for (size_t i = 0; i < width; ++i) p[i] = static_cast<uint8_t>(v >> (8 * i));
+		}
+
+		constexpr int64_t clamp16(int64_t v) {
+			return v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v;
+		}
+
+		constexpr uint8_t* putVarint(uint8_t* p, uint64_t v) {
+			while (v >= 0x80) {
+				*p++ = static_cast<uint8_t>((v & 0x7F) | 0x80);
+				v >>= 7;
+			}
+			*p++ = static_cast<uint8_t>(v);
+			return p;
+		}
+
+		// p only moves on Ok.
+		constexpr Status readVarint(const uint8_t*& p, const uint8_t* end, uint64_t& out) {
+			const size_t avail = static_cast<size_t>(end - p);
+			// With room for the longest varint the only branch per byte is the continuation bit.
+			const size_t limit = avail >= kMaxVarintBytes ? kMaxVarintBytes : avail;
+			uint64_t result = 0;
+			for (size_t i = 0; i < limit; ++i) {
+				const uint8_t b = p[i];
+				result |= static_cast<uint64_t>(b & 0x7F) << (7 * i);
+				if ((b & 0x80) == 0) {
+					p += i + 1;
+					out = result;
+					return Status::Ok;
+				}
+			}
+			return avail >= kMaxVarintBytes ? Status::BadVarint : Status::Truncated;
+		}
+	}
+
+	// out must hold kMaxPacketSize bytes. Returns the packet size. Codec::Delta gives a
+	// keyframe with id 0 here; streams go through a DeltaEncoder.
+	constexpr size_t encode(const ControllerPacket& p, Codec codec, uint8_t* out) {
+		const bool quat = (p.flags & kFlagQuaternion) != 0;
+		if (codec == Codec::Delta) {
+			out[0] = (p.flags & kFlagLeft) ? kDeltaLeft : 0;
+			return 1 + encode(p, Codec::Varint, out + 1);
+		}
+		if (codec == Codec::Fixed) {
+			for (size_t i = 0; i < kFixedPacketSize; ++i) out[i] = 0;
+			out[detail::kFlags.offset] = p.flags;
+			out[detail::kModes.offset] = p.modes;
+			out[detail::kBattery.offset] = p.battery;
+			out[detail::kLayout.offset] = kFixedLayout;
+			if (quat) {
+				for (size_t i = 0; i < kSmallestThreeBytes; ++i) out[detail::kGyro.offset + i] = p.quat[i];
+			}
+			else {
+				for (size_t i = 0; i < 3; ++i) {
+					detail::putLE(out + detail::kGyro.offset + i * detail::kGyro.width,
+						static_cast<uint16_t>(detail::clamp16(p.gyro[i])), detail::kGyro.width);
+				}
+			}
+			for (size_t i = 0; i < 2; ++i) {
+				detail::putLE(out + detail::kJoy.offset + i * detail::kJoy.width,
+					static_cast<uint16_t>(detail::clamp16(p.joy[i])), detail::kJoy.width);
+			}
+			detail::putLE(out + detail::kSenderTime.offset, p.senderTimeUs, detail::kSenderTime.width);
+			return kFixedPacketSize;
+		}
+
+		uint8_t* w = out;
+		*w++ = p.flags;
+		*w++ = p.modes;
+		*w++ = p.battery;
+		if (quat) {
+			for (size_t i = 0; i < kSmallestThreeBytes; ++i) *w++ = p.quat[i];
+		}
+		else {
+			for (size_t i = 0; i < 3; ++i) w = detail::putVarint(w, zigzag(p.gyro[i]));
+		}
+		for (size_t i = 0; i < 2; ++i) w = detail::putVarint(w, zigzag(p.joy[i]));
+		// Optional trailer, older drivers stop reading before it.
+		if (p.senderTimeUs != 0) w = detail::putVarint(w, p.senderTimeUs);
+		return static_cast<size_t>(w - out);
+	}
+
+	// Reads in place. out is filled as the fields are read, so it is only meaningful on Ok;
+	// decode into scratch storage. Longer fixed layout packets are accepted so fields can be
+	// appended later. Codec::Delta only reads keyframes here, deltas need their DeltaDecoder.
+	constexpr Status decode(const uint8_t* data, size_t len, Codec codec, ControllerPacket& out) {
+		ControllerPacket& p = out;
+		if (codec == Codec::Delta) {
+			if (len < 2) return Status::TooShort;
+			if (data[0] & kDeltaFrame) return Status::NoKeyframe;
+			return decode(data + 1, len - 1, Codec::Varint, out);
+		}
+		if (codec == Codec::Fixed) {
+			if (len < kFixedPacketSize) return Status::TooShort;
+			// Also catches a varint packet sent before the phone applied the welcome.
+			if (data[detail::kLayout.offset] != kFixedLayout) return Status::BadLayout;
+			p.flags = data[detail::kFlags.offset];
+			p.modes = data[detail::kModes.offset];
+			p.battery = data[detail::kBattery.offset];
+			if (p.flags & kFlagQuaternion) {
+				for (size_t i = 0; i < kSmallestThreeBytes; ++i) p.quat[i] = data[detail::kGyro.offset + i];
+			}
+			else {
+				for (size_t i = 0; i < 3; ++i) {
+					p.gyro[i] = static_cast<int16_t>(detail::getLE(data + detail::kGyro.offset + i * detail::kGyro.width, detail::kGyro.width));
+				}
+			}
+			for (size_t i = 0; i < 2; ++i) {
+				p.joy[i] = static_cast<int16_t>(detail::getLE(data + detail::kJoy.offset + i * detail::kJoy.width, detail::kJoy.width));
+			}
+			p.senderTimeUs = detail::getLE(data + detail::kSenderTime.offset, detail::kSenderTime.width);
+			return Status::Ok;
+		}
+
+		if (len < 3) return Status::TooShort;
+		const uint8_t* r = data;
+		const uint8_t* const end = data + len;
+		p.flags = *r++;
+		p.modes = *r++;
+		p.battery = *r++;
+
+		uint64_t v = 0;
+		Status s = Status::Ok;
+		if (p.flags & kFlagQuaternion) {
+			if (static_cast<size_t>(end - r) < kSmallestThreeBytes) return Status::Truncated;
+			for (size_t i = 0; i < kSmallestThreeBytes; ++i) p.quat[i] = *r++;
+		}
+		else {
+			for (size_t i = 0; i < 3; ++i) {
+				if ((s = detail::readVarint(r, end, v)) != Status::Ok) return s;
+				p.gyro[i] = unzigzag(v);
+			}
+		}
+		for (size_t i = 0; i < 2; ++i) {
+			if ((s = detail::readVarint(r, end, v)) != Status::Ok) return s;
+			p.joy[i] = unzigzag(v);
+		}
+		// Optional trailing field, older phones end the packet here.
+		p.senderTimeUs = 0;
+		if (r != end) {
+			if ((s = detail::readVarint(r, end, v)) != Status::Ok) return s;
+			p.senderTimeUs = v;
+		}
+		return Status::Ok;
+	}
+
+	/**
+	Delta codec streams. Every packet starts with a header byte:
+
+		bit 7       kDeltaFrame, clear for keyframes
+		bit 6       kDeltaLeft, the hand of the stream
+		bits 0-5    id of the keyframe (kDeltaKeyIdMask)
+
+	A keyframe is the header and then the varint packet. A delta is the header, a byte of
+	kChanged* bits, and the changed fields in packet order: flags, modes and battery as bytes,
+	then gyro (or the quaternion's three packed components) and joy as zigzag varint
+	differences from the keyframe. The time difference from the keyframe trails as a zigzag
+	varint, left out when it is 0.
+
+	Deltas are against the keyframe, never the packet before, so losing one costs nothing and
+	losing a keyframe costs the deltas up to the next one, at most kKeyframeInterval packets
+	later. The encoder also starts a keyframe when the hand, the orientation kind or the
+	quaternion's dropped component changes, or when a delta would be no shorter.
+	**/
+	struct DeltaEncoder {
+		ControllerPacket key;
+		int64_t keyValues[5] = {}; // what deltas are against: gyro or quaternion components, joy
+		uint8_t keyId = 0;
+		uint32_t sinceKey = 0; // packets sent since the keyframe
+		bool hasKey = false;
+	};
+
+	// One per stream: phone and hand.
+	struct DeltaDecoder {
+		ControllerPacket key;
+		int64_t keyValues[5] = {};
+		uint8_t keyId = 0;
+		bool hasKey = false;
+	};
+
+	namespace detail {
+		constexpr size_t kMaxDeltaSize = 2 + 3 + 6 * kMaxVarintBytes;
+		constexpr uint64_t kQuatIndexMask = 0x3;
+		constexpr uint64_t kQuatComponentMask = 0x7FFF;
+
+		// The values a delta carries as differences: gyro or the packed quaternion components, then joy.
+		constexpr void deltaValues(const ControllerPacket& p, int64_t (&v)[5]) {
+			if (p.flags & kFlagQuaternion) {
+				const uint64_t bits = getLE(p.quat, kSmallestThreeBytes);
+				for (size_t i = 0; i < 3; ++i) v[i] = static_cast<int64_t>((bits >> (2 + 15 * i)) & kQuatComponentMask);
+			}
+			else {
+				for (size_t i = 0; i < 3; ++i) v[i] = p.gyro[i];
+			}
+			v[3] = p.joy[0];
+			v[4] = p.joy[1];
+		}
+
+		// Wrapping, so any two values have a difference.
+		constexpr uint64_t difference(int64_t v, int64_t base) {
+			return zigzag(static_cast<int64_t>(static_cast<uint64_t>(v) - static_cast<uint64_t>(base)));
+		}
+
+		constexpr int64_t applyDifference(int64_t base, uint64_t d) {
+			return static_cast<int64_t>(static_cast<uint64_t>(base) + static_cast<uint64_t>(unzigzag(d)));
+		}
+
+		// out must hold kMaxDeltaSize bytes.
+		constexpr size_t putDelta(const ControllerPacket& p, const DeltaEncoder& stream, uint8_t* out) {
+			const ControllerPacket& key = stream.key;
+			uint8_t changed = 0;
+			uint8_t* w = out + 2;
+			if (p.flags != key.flags) { changed |= kChangedFlags; *w++ = p.flags; }
+			if (p.modes != key.modes) { changed |= kChangedModes; *w++ = p.modes; }
+			if (p.battery != key.battery) { changed |= kChangedBattery; *w++ = p.battery; }
+
+			int64_t v[5] = {};
+			deltaValues(p, v);
+			for (size_t i = 0; i < 5; ++i) {
+				if (v[i] == stream.keyValues[i]) continue;
+				changed |= static_cast<uint8_t>(kChangedGyro << i);
+				w = putVarint(w, difference(v[i], stream.keyValues[i]));
+			}
+			if (p.senderTimeUs != key.senderTimeUs) {
+				w = putVarint(w, difference(static_cast<int64_t>(p.senderTimeUs), static_cast<int64_t>(key.senderTimeUs)));
+			}
+
+			out[0] = static_cast<uint8_t>(kDeltaFrame | ((p.flags & kFlagLeft) ? kDeltaLeft : 0) | stream.keyId);
+			out[1] = changed;
+			return static_cast<size_t>(w - out);
+		}
+
+		// r points past the header. Every field of out is written once, from the keyframe where
+		// the delta leaves it out.
+		constexpr Status applyDelta(const uint8_t* r, const uint8_t* end, const DeltaDecoder& stream, ControllerPacket& out) {
+			const ControllerPacket& key = stream.key;
+			const uint8_t changed = *r++;
+			const size_t bytes = ((changed & kChangedFlags) != 0) + ((changed & kChangedModes) != 0) + ((changed & kChangedBattery) != 0);
+			if (static_cast<size_t>(end - r) < bytes) return Status::Truncated;
+			out.flags = (changed & kChangedFlags) ? *r++ : key.flags;
+			out.modes = (changed & kChangedModes) ? *r++ : key.modes;
+			out.battery = (changed & kChangedBattery) ? *r++ : key.battery;
+			const bool quat = (out.flags & kFlagQuaternion) != 0;
+			if (quat != ((key.flags & kFlagQuaternion) != 0)) return Status::BadLayout;
+
+			int64_t v[5] = { stream.keyValues[0], stream.keyValues[1], stream.keyValues[2], stream.keyValues[3], stream.keyValues[4] };
+			for (size_t i = 0; i < 5; ++i) {
+				if (!(changed & (kChangedGyro << i))) continue;
+				uint64_t d = 0;
+				const Status s = readVarint(r, end, d);
+				if (s != Status::Ok) return s;
+				v[i] = applyDifference(v[i], d);
+			}
+
+			if (quat) {
+				uint64_t bits = getLE(key.quat, kSmallestThreeBytes) & kQuatIndexMask;
+				for (size_t i = 0; i < 3; ++i) {
+					if (v[i] < 0 || v[i] > static_cast<int64_t>(kQuatComponentMask)) return Status::BadLayout;
+					bits |= static_cast<uint64_t>(v[i]) << (2 + 15 * i);
+				}
+				putLE(out.quat, bits, kSmallestThreeBytes);
+			}
+			else {
+				for (size_t i = 0; i < 3; ++i) out.gyro[i] = v[i];
+			}
+			out.joy[0] = v[3];
+			out.joy[1] = v[4];
+
+			out.senderTimeUs = key.senderTimeUs;
+			if (r != end) {
+				uint64_t d = 0;
+				const Status s = readVarint(r, end, d);
+				if (s != Status::Ok) return s;
+				out.senderTimeUs = static_cast<uint64_t>(applyDifference(static_cast<int64_t>(key.senderTimeUs), d));
+			}
+			return Status::Ok;
+		}
+	}
+
+	// out must hold kMaxPacketSize bytes. Returns the packet size.
+	constexpr size_t encode(const ControllerPacket& p, DeltaEncoder& stream, uint8_t* out) {
+		const size_t keyLen = encode(p, Codec::Delta, out);
+		const ControllerPacket& key = stream.key;
+
+		bool keyframe = !stream.hasKey || stream.sinceKey + 1 >= kKeyframeInterval ||
+			((p.flags ^ key.flags) & (kFlagLeft | kFlagQuaternion)) != 0;
+		if (!keyframe && (p.flags & kFlagQuaternion)) {
+			keyframe = ((p.quat[0] ^ key.quat[0]) & detail::kQuatIndexMask) != 0;
+		}
+		if (!keyframe) {
+			uint8_t delta[detail::kMaxDeltaSize] = {};
+			const size_t n = detail::putDelta(p, stream, delta);
+			if (n < keyLen) {
+				for (size_t i = 0; i < n; ++i) out[i] = delta[i];
+				++stream.sinceKey;
+				return n;
+			}
+		}
+
+		stream.keyId = stream.hasKey ? static_cast<uint8_t>((stream.keyId + 1) & kDeltaKeyIdMask) : 0;
+		stream.key = p;
+		detail::deltaValues(p, stream.keyValues);
+		stream.sinceKey = 0;
+		stream.hasKey = true;
+		out[0] |= stream.keyId;
+		return keyLen;
+	}
+
+	// A keyframe replaces the stream's, a delta is read against it. out is only meaningful on
+	// Ok, and a packet that fails leaves the stream as it was.
+	constexpr Status decode(const uint8_t* data, size_t len, DeltaDecoder& stream, ControllerPacket& out) {
+		if (len < 2) return Status::TooShort;
+		const uint8_t id = data[0] & kDeltaKeyIdMask;
+		if (!(data[0] & kDeltaFrame)) {
+			ControllerPacket key;
+			const Status s = decode(data + 1, len - 1, Codec::Varint, key);
+			if (s != Status::Ok) return s;
+			stream.key = key;
+			detail::deltaValues(key, stream.keyValues);
+			stream.keyId = id;
+			stream.hasKey = true;
+			out = key;
+			return Status::Ok;
+		}
+		if (!stream.hasKey || id != stream.keyId) return Status::NoKeyframe;
+		return detail::applyDelta(data + 1, data + len, stream, out);
+	}
+
+	// out must hold kMaxHapticSize bytes. Returns the packet size.
+	constexpr size_t encode(const HapticPacket& p, uint8_t* out) {
+		uint8_t* w = out;
+		*w++ = p.flags;
+		w = detail::putVarint(w, zigzag(p.amplitude));
+		w = detail::putVarint(w, zigzag(p.frequency));
+		w = detail::putVarint(w, zigzag(p.duration));
+		return static_cast<size_t>(w - out);
+	}
+
+	constexpr Status decode(const uint8_t* data, size_t len, HapticPacket& out) {
+		if (len < 1) return Status::TooShort;
+		const uint8_t* r = data;
+		const uint8_t* const end = data + len;
+		HapticPacket p;
+		p.flags = *r++;
+		uint64_t v[3] = {};
+		for (uint64_t& x : v) {
+			const Status s = detail::readVarint(r, end, x);
+			if (s != Status::Ok) return s;
+		}
+		p.amplitude = unzigzag(v[0]);
+		p.frequency = unzigzag(v[1]);
+		p.duration = unzigzag(v[2]);
+		out = p;
+		return Status::Ok;
+	}
+
+	// out must hold kMaxHapticEnvelopeSize bytes. Returns the packet size.
+	constexpr size_t encode(const HapticEnvelopePacket& p, uint8_t* out) {
+		uint8_t* w = out;
+		*w++ = p.flags;
+		*w++ = p.count;
+		for (size_t i = 0; i < p.count; ++i) {
+			w = detail::putVarint(w, zigzag(p.points[i].duration));
+			w = detail::putVarint(w, zigzag(p.points[i].amplitude));
+			w = detail::putVarint(w, zigzag(p.points[i].frequency));
+		}
+		return static_cast<size_t>(w - out);
+	}
+
+	constexpr Status decode(const uint8_t* data, size_t len, HapticEnvelopePacket& out) {
+		if (len < 2) return Status::TooShort;
+		if (data[1] > kMaxEnvelopePoints) return Status::BadLayout;
+		const uint8_t* r = data + 2;
+		const uint8_t* const end = data + len;
+		HapticEnvelopePacket p;
+		p.flags = data[0];
+		p.count = data[1];
+		for (size_t i = 0; i < p.count; ++i) {
+			uint64_t v[3] = {};
+			for (uint64_t& x : v) {
+				const Status s = detail::readVarint(r, end, x);
+				if (s != Status::Ok) return s;
+			}
+			p.points[i].duration = unzigzag(v[0]);
+			p.points[i].amplitude = unzigzag(v[1]);
+			p.points[i].frequency = unzigzag(v[2]);
+		}
+		out = p;
+		return Status::Ok;
+	}
+
+	namespace detail {
+		constexpr uint8_t* putImuSample(uint8_t* w, const ControllerPacket& p, const ImuSample& s) {
+			w = putVarint(w, s.ageUs);
+			if (p.flags & kFlagQuaternion) {
+				for (size_t i = 0; i < kSmallestThreeBytes; ++i) *w++ = s.quat[i];
+			}
+			else {
+				for (size_t i = 0; i < 3; ++i) w = putVarint(w, zigzag(s.gyro[i] - p.gyro[i]));
+			}
+			return w;
+		}
+	}
+
+	// The samples of b to go after packet p, size byte included. Takes the newest that fit in
+	// budget bytes (a UDP entry has a u8 length). out must hold kMaxImuBatchSize bytes.
+	// Returns the bytes written, 0 if not even the size byte fits.
+	constexpr size_t encode(const ControllerPacket& p, const ImuBatch& b, uint8_t* out, size_t budget = kMaxImuBatchSize) {
+		if (budget == 0) return 0;
+		const size_t count = b.count < kMaxImuSamples ? b.count : kMaxImuSamples;
+		size_t first = count, size = 0;
+		while (first > 0) {
+			uint8_t scratch[kMaxImuSampleSize] = {};
+			const size_t n = static_cast<size_t>(detail::putImuSample(scratch, p, b.samples[first - 1]) - scratch);
+			if (size + n + 1 > budget) break;
+			size += n;
+			--first;
+		}
+		uint8_t* w = out;
+		for (size_t i = first; i < count; ++i) w = detail::putImuSample(w, p, b.samples[i]);
+		*w++ = static_cast<uint8_t>(size);
+		return static_cast<size_t>(w - out);
+	}
+
+	// Where the samples start in a packet of len bytes that carries them, i.e. the length of
+	// the codec's part.
+	constexpr Status splitImuBatch(const uint8_t* data, size_t len, size_t& packetLen) {
+		if (len < 1) return Status::TooShort;
+		const size_t size = data[len - 1];
+		if (size + 1 > len) return Status::Truncated;
+		packetLen = len - 1 - size;
+		return Status::Ok;
+	}
+
+	// The size bytes of samples that went after p (see splitImuBatch), size byte excluded.
+	constexpr Status decode(const uint8_t* data, size_t size, const ControllerPacket& p, ImuBatch& out) {
+		const uint8_t* r = data;
+		const uint8_t* const end = data + size;
+		ImuBatch b;
+		while (r != end) {
+			if (b.count == kMaxImuSamples) return Status::BadLayout;
+			ImuSample& s = b.samples[b.count++];
+			uint64_t age = 0;
+			Status st = detail::readVarint(r, end, age);
+			if (st != Status::Ok) return st;
+			if (age > UINT32_MAX) return Status::BadLayout;
+			s.ageUs = static_cast<uint32_t>(age);
+			if (p.flags & kFlagQuaternion) {
+				if (static_cast<size_t>(end - r) < kSmallestThreeBytes) return Status::Truncated;
+				for (size_t i = 0; i < kSmallestThreeBytes; ++i) s.quat[i] = *r++;
+			}
+			else {
+				for (size_t i = 0; i < 3; ++i) {
+					uint64_t z = 0;
+					st = detail::readVarint(r, end, z);
+					if (st != Status::Ok) return st;
+					s.gyro[i] = p.gyro[i] + unzigzag(z);
+				}
+			}
+		}
+		out = b;
+		return Status::Ok;
+	}
+
+	// out must hold kMaxSendRateSize bytes. Returns the packet size.
+	constexpr size_t encode(const SendRatePacket& p, uint8_t* out) {
+		out[0] = p.flags;
+		return static_cast<size_t>(detail::putVarint(out + 1, p.hz) - out);
+	}
+
+	constexpr Status decode(const uint8_t* data, size_t len, SendRatePacket& out) {
+		if (len < 2) return Status::TooShort;
+		const uint8_t* r = data + 1;
+		uint64_t hz = 0;
+		const Status s = detail::readVarint(r, data + len, hz);
+		if (s != Status::Ok) return s;
+		out.flags = data[0];
+		out.hz = hz;
+		return Status::Ok;
+	}
+
+	/**
+	Smallest-three quaternion, kSmallestThreeBytes little-endian bytes:
+
+		bits 0-1    index of the dropped (largest) component, 0..3 = w, x, y, z
+		bits 2-46   the other three in w, x, y, z order, 15 bits each, [-1/sqrt2, 1/sqrt2]
+		bit 47      0
+
+	The dropped component is made positive before packing (q and -q are the same rotation),
+	so unpacking is one sqrt. Worst case error is about 0.004 degrees. Components are in the
+	driver's axes; the phone relabels its own before packing.
+	**/
+	inline void packSmallestThree(const double q[4], uint8_t out[kSmallestThreeBytes]) {
+		double c[4] = { q[0], q[1], q[2], q[3] };
+		const double n = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+		if (n > 0.0) {
+			for (double& v : c) v /= n;
+		}
+		else {
+			c[0] = 1.0; c[1] = c[2] = c[3] = 0.0;
+		}
+
+		unsigned dropped = 0;
+		for (unsigned i = 1; i < 4; ++i) {
+			if (std::fabs(c[i]) > std::fabs(c[dropped])) dropped = i;
+		}
+		const double sign = c[dropped] < 0.0 ? -1.0 : 1.0;
+
+		constexpr double kSqrt2 = 1.41421356237309504880;
+		uint64_t bits = dropped;
+		unsigned shift = 2;
+		for (unsigned i = 0; i < 4; ++i) {
+			if (i == dropped) continue;
+			const double v = std::clamp(c[i] * sign * kSqrt2, -1.0, 1.0);
+			bits |= static_cast<uint64_t>(std::lround((v + 1.0) * 0.5 * 32767.0)) << shift;
+			shift += 15;
+		}
+		detail::putLE(out, bits, kSmallestThreeBytes);
+	}
+
+	inline void unpackSmallestThree(const uint8_t p[kSmallestThreeBytes], double out[4]) {
+		constexpr double kMax = 32767.0;
+		constexpr double kRange = 0.70710678118654752440; // 1/sqrt2
+		const uint64_t bits = detail::getLE(p, kSmallestThreeBytes);
+		const unsigned dropped = static_cast<unsigned>(bits & 0x3);
+
+		double sum = 0.0;
+		unsigned shift = 2;
+		for (unsigned i = 0; i < 4; ++i) {
+			if (i == dropped) continue;
+			const double v = (static_cast<double>((bits >> shift) & 0x7FFF) / kMax * 2.0 - 1.0) * kRange;
+			out[i] = v;
+			sum += v * v;
+			shift += 15;
+		}
+		out[dropped] = std::sqrt(std::max<double>(0.0, 1.0 - sum));
+	}
+
+	namespace detail {
+		constexpr bool layoutIsSound() {
+			size_t end = 0;
+			for (const Slot& s : kFixedSlots) {
+				if (s.offset != end) return false;         // in order, no gaps or overlaps
+				if (s.offset % s.width != 0) return false; // aligned from the packet start
+				end = s.offset + s.count * s.width;
+			}
+			return end == kFixedPacketSize;
+		}
+	}
+
+	static_assert(kMaxImuBatchSize - 1 <= UINT8_MAX, "an IMU batch's size has to fit its u8");
+	static_assert(kChangedJoy == kChangedGyro << 3 && (kChangedGyro << 4) <= 0x80, "a delta's five values take bits 3-7");
+	static_assert(detail::layoutIsSound(), "kFixedSlots must be in order, aligned, and fill kFixedPacketSize");
+	static_assert(detail::kGyro.width == 2 && detail::kJoy.width == 2, "the fixed codec's values are int16");
+	static_assert(kSmallestThreeBytes <= detail::kGyro.count * detail::kGyro.width, "the quaternion goes where the angles would");
+	static_assert(364 * kFixedGyroScale <= INT16_MAX && kFixedJoyScale <= INT16_MAX, "fixed scales must fit int16");
+	static_assert((kFlagQuaternion & (kFlagLeft | kFlagSystemOrMenu | kFlagAOrX | kFlagBOrY | kFlagBatteryPlugged | kFlagJoyInDZ)) == 0, "flag bits overlap");
+	static_assert((kModeTrigger.put(3) & kModeGrip.put(3)) == 0 && (kModeGrip.put(3) & kModeJoy.put(3)) == 0, "mode fields overlap");
+}
+#endif
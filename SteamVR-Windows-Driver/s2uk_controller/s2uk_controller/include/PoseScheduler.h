@@ -0,0 +1,185 @@
+#pragma once
+#ifndef S2UK_PoseScheduler
+#define S2UK_PoseScheduler
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "VectorMath.h"
+
+/**
+When a hand's pose goes to SteamVR (TrackedDevicePoseUpdated), and for what time.
+
+	perFrame        once per RunFrame with the newest applied state, as it always was
+	onArrival       from the network thread as soon as a state is decoded; RunFrame only
+	                submits on frames nothing arrived for
+	vsyncPredicted  once per RunFrame, the orientation carried forward to when the frame
+	                being rendered lights up: next vsync + Prop_SecondsFromVsyncToPhotons_Float,
+	                the time OpenVR tells apps to predict to
+
+Prediction uses the angular velocity of the last applied states and goes at most
+kMaxPredictUs ahead. SteamVR extrapolates from the pose's velocities, which stay zero, so
+nothing is predicted twice.
+
+Staleness is measured the same way in every mode: sampleAgeUs is how old the sensor sample
+was when its pose went out, photonAgeUs how far the time the pose stands for lags the photon
+time estimated at submission. The second is what the user sees, and what the modes trade.
+Both need the phone's clock (ClockSync.h); poses without it are counted but not timed.
+**/
+class PoseScheduler {
+public:
+	enum class Mode : uint8_t {
+		PerFrame,
+		OnArrival,
+		VsyncPredicted,
+	};
+
+	struct Stats {
+		uint64_t submitted = 0;
+		uint64_t arrivals = 0;      // of those, sent from the network thread
+		uint32_t sampleAgeUs = 0;   // smoothed
+		uint32_t photonAgeUs = 0;   // smoothed
+		uint32_t predictUs = 0;     // smoothed horizon, vsyncPredicted only
+		uint32_t framePeriodUs = 0;
+		uint32_t vsyncToPhotonsUs = 0;
+	};
+
+	// DriverConfig's network.poseScheduler. Anything else is perFrame.
+	static Mode parseMode(const std::string& name) {
+		if (name == "onArrival") return Mode::OnArrival;
+		if (name == "vsyncPredicted") return Mode::VsyncPredicted;
+		return Mode::PerFrame;
+	}
+
+	static const char* modeName(Mode m) {
+		switch (m) {
+		case Mode::OnArrival: return "onArrival";
+		case Mode::VsyncPredicted: return "vsyncPredicted";
+		default: return "perFrame";
+		}
+	}
+
+	void setMode(Mode m) { mode = m; }
+	Mode getMode() const { return mode; }
+
+	// RunFrame thread. lastVsyncUs is on the NetTelemetry::nowUs() clock, 0 if unknown.
+	void setDisplayTiming(uint64_t lastVsyncUs, uint32_t periodUs, uint32_t toPhotonsUs) {
+		vsyncUs.store(lastVsyncUs, std::memory_order_relaxed);
+		framePeriodUs.store(periodUs, std::memory_order_relaxed);
+		vsyncToPhotonsUs.store(toPhotonsUs, std::memory_order_relaxed);
+	}
+
+	// Any thread: when a pose submitted at nowUs is seen. Without a vsync to count from,
+	// half a frame stands in for the wait until the next one.
+	uint64_t photonTimeUs(uint64_t nowUs) const {
+		const uint64_t vsync = vsyncUs.load(std::memory_order_relaxed);
+		const uint64_t period = framePeriodUs.load(std::memory_order_relaxed);
+		const uint64_t toPhotons = vsyncToPhotonsUs.load(std::memory_order_relaxed);
+		if (!vsync || !period || vsync > nowUs) return nowUs + period / 2 + toPhotons;
+		return vsync + ((nowUs - vsync) / period + 1) * period + toPhotons;
+	}
+
+	// RunFrame thread, for every applied state with a sample time.
+	void observe(const Quaternion& q, uint64_t sampleTimeUs) {
+		if (lastUs && sampleTimeUs > lastUs && sampleTimeUs - lastUs <= kMaxGapUs) {
+			// World-frame rotation from the last sample to this one, as an axis times rad/s.
+			Quaternion d = q * Quaternion{ last.w, -last.x, -last.y, -last.z };
+			if (d.w < 0.0) d = { -d.w, -d.x, -d.y, -d.z };
+			const double s = std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+			const double scale = s > 1e-9 ? 2.0 * std::atan2(s, d.w) / s / (double(sampleTimeUs - lastUs) * 1e-6) : 0.0;
+			const Vec3 w(d.x * scale, d.y * scale, d.z * scale);
+			omega = haveOmega ? omega + (w - omega) * kOmegaSmoothing : w;
+			haveOmega = true;
+		}
+		else if (!lastUs || sampleTimeUs > lastUs) {
+			haveOmega = false; // first sample, or a gap too long to tell how it turned
+		}
+		else {
+			return; // older than what we have
+		}
+		last = q;
+		lastUs = sampleTimeUs;
+	}
+
+	// RunFrame thread: q, sampled at sampleTimeUs, turned on to the photon time of a pose
+	// submitted at nowUs. Returns the time q stands for afterwards.
+	uint64_t predict(uint64_t nowUs, Quaternion& q, uint64_t sampleTimeUs) {
+		if (!sampleTimeUs) return 0;
+		const uint64_t target = photonTimeUs(nowUs);
+		if (!haveOmega || target <= sampleTimeUs || sampleTimeUs - lastUs > kMaxGapUs) return sampleTimeUs;
+
+		const uint64_t horizon = std::min<uint64_t>(target - sampleTimeUs, kMaxPredictUs);
+		const double angle = std::sqrt(omega.x * omega.x + omega.y * omega.y + omega.z * omega.z) * (double(horizon) * 1e-6);
+		q = Quaternion::fromAxisAngle(omega.x, omega.y, omega.z, angle) * q;
+		q.normalize();
+		smooth(predictSmoothedUs, static_cast<uint32_t>(horizon));
+		return sampleTimeUs + horizon;
+	}
+
+	// Any thread, for every pose submitted at nowUs. poseTimeUs is the time it stands for,
+	// both 0 when the phone's clock is unknown.
+	void account(uint64_t nowUs, uint64_t sampleTimeUs, uint64_t poseTimeUs, bool fromArrival) {
+		submitted.fetch_add(1, std::memory_order_relaxed);
+		if (fromArrival) {
+			arrivals.fetch_add(1, std::memory_order_relaxed);
+			arrivedSinceFrame.store(true, std::memory_order_relaxed);
+		}
+		if (!sampleTimeUs) return;
+		// Slightly negative ages are sync error, not time travel.
+		smooth(sampleAgeSmoothedUs, clampUs(nowUs > sampleTimeUs ? nowUs - sampleTimeUs : 0));
+		const uint64_t photon = photonTimeUs(nowUs);
+		smooth(photonAgeSmoothedUs, clampUs(photon > poseTimeUs ? photon - poseTimeUs : 0));
+	}
+
+	// RunFrame thread, onArrival: whether the network thread submitted since the last call.
+	bool takeArrived() { return arrivedSinceFrame.exchange(false, std::memory_order_relaxed); }
+
+	Stats getStats() const {
+		Stats st;
+		st.submitted = submitted.load(std::memory_order_relaxed);
+		st.arrivals = arrivals.load(std::memory_order_relaxed);
+		st.sampleAgeUs = sampleAgeSmoothedUs.load(std::memory_order_relaxed);
+		st.photonAgeUs = photonAgeSmoothedUs.load(std::memory_order_relaxed);
+		st.predictUs = predictSmoothedUs.load(std::memory_order_relaxed);
+		st.framePeriodUs = framePeriodUs.load(std::memory_order_relaxed);
+		st.vsyncToPhotonsUs = vsyncToPhotonsUs.load(std::memory_order_relaxed);
+		return st;
+	}
+
+private:
+	// Past this a guess gets worse than the stale pose it replaces.
+	static constexpr uint64_t kMaxPredictUs = 50000;
+	// Samples further apart than this don't give a usable angular velocity.
+	static constexpr uint64_t kMaxGapUs = 100000;
+	static constexpr double kOmegaSmoothing = 0.5;
+
+	static uint32_t clampUs(uint64_t us) { return static_cast<uint32_t>(std::min<uint64_t>(us, UINT32_MAX)); }
+
+	static void smooth(std::atomic<uint32_t>& avg, uint32_t v) {
+		const uint32_t old = avg.load(std::memory_order_relaxed);
+		avg.store(old ? static_cast<uint32_t>(int64_t(old) + (int64_t(v) - int64_t(old)) / 16) : v, std::memory_order_relaxed);
+	}
+
+	Mode mode = Mode::PerFrame;
+
+	std::atomic<uint64_t> vsyncUs{ 0 };
+	std::atomic<uint32_t> framePeriodUs{ 0 };
+	std::atomic<uint32_t> vsyncToPhotonsUs{ 0 };
+
+	// RunFrame thread
+	Quaternion last{ 1.0, 0.0, 0.0, 0.0 };
+	uint64_t lastUs = 0;
+	Vec3 omega;
+	bool haveOmega = false;
+
+	std::atomic<bool> arrivedSinceFrame{ false };
+	std::atomic<uint64_t> submitted{ 0 };
+	std::atomic<uint64_t> arrivals{ 0 };
+	std::atomic<uint32_t> sampleAgeSmoothedUs{ 0 };
+	std::atomic<uint32_t> photonAgeSmoothedUs{ 0 };
+	std::atomic<uint32_t> predictSmoothedUs{ 0 };
+};
+#endif
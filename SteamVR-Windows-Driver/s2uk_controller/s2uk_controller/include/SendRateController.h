@@ -0,0 +1,197 @@
+#pragma once
+#ifndef S2UK_SendRateController
+#define S2UK_SendRateController
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "BufferCompression.h"
+
+/**
+Picks how often the phone holding one hand should send its state, and keeps score of what
+that saves.
+
+	motion    smoothed angular speed of the applied states, scaled to 0..1; any
+	          button/trigger/stick change counts as full motion
+	target    idleHz + (displayHz - idleHz) * motion, rounded to 10 Hz
+	link      a lossy, slow or backed-up link caps the target at half the display rate
+
+Raising the rate goes out at once so motion is never starved; lowering it waits until the
+target has stayed lower for a while. The current rate is repeated every few seconds so
+phones that (re)connect pick it up. Phones that never got a rate keep their fixed cadence,
+which is also the baseline the savings are measured against.
+**/
+class SendRateController {
+public:
+	struct LinkQuality {
+		bool known = false;
+		double loss = 0.0;      // over the last window
+		uint32_t rttUs = 0;     // smoothed
+		uint32_t queueDepth = 0;
+	};
+
+	struct Stats {
+		uint32_t targetHz = 0;
+		uint32_t displayHz = 0;
+		uint32_t motionDegS = 0;      // smoothed angular speed
+		uint32_t achievedHz = 0;      // packets received over the last second
+		uint32_t bytesPerSec = 0;
+		uint32_t savedPerSec = 0;     // packets per second below the fixed cadence
+		uint32_t bytesSavedPerSec = 0;
+		uint32_t decodeNs = 0;        // average decode cost of one packet
+		uint32_t decodeUsSavedPerSec = 0;
+		uint64_t rateChanges = 0;
+	};
+
+	// The phones' fixed cadence before rate control (11 ms loop).
+	static constexpr uint32_t kBaselineHz = 90;
+
+	void setIdleRate(uint32_t hz) { idleHz = std::clamp<uint32_t>(hz, kMinHz, kMaxHz); }
+
+	// Network threads, for every packet of this hand.
+	void onPacket(size_t bytes, uint32_t decodeNs) {
+		packets.fetch_add(1, std::memory_order_relaxed);
+		packetBytes.fetch_add(bytes, std::memory_order_relaxed);
+		packetDecodeNs.fetch_add(decodeNs, std::memory_order_relaxed);
+	}
+
+	// RunFrame thread, once per frame with the state that was applied (or null). Returns true
+	// when outHz should be sent to the phone.
+	bool update(uint64_t nowUs, float displayHz, const BufferCompression::ControllerState* state, const LinkQuality& link, uint32_t& outHz) {
+		const uint32_t maxHz = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(displayHz > 0.0f ? displayHz : 90.0f)), kMinHz, kMaxHz);
+		if (state) trackMotion(nowUs, *state);
+		if (nowUs - windowStartUs >= kWindowUs) closeWindow(nowUs);
+
+		// Release: the activity bleeds off over about half a second of calm.
+		if (lastUpdateUs && nowUs > lastUpdateUs) activity *= std::exp(-double(nowUs - lastUpdateUs) / kReleaseUs);
+		lastUpdateUs = nowUs;
+
+		uint32_t target = idleHz + static_cast<uint32_t>(std::lround(double(maxHz - std::min<uint32_t>(idleHz, maxHz)) * activity));
+		if (link.known && (link.loss > kMaxLoss || link.rttUs > kMaxRttUs || link.queueDepth > kMaxQueue)) {
+			target = std::min<uint32_t>(target, std::max<uint32_t>(kMinLinkHz, maxHz / 2));
+		}
+		target = target + 5 >= maxHz ? maxHz : std::max<uint32_t>(idleHz, (target + 5) / 10 * 10);
+
+		if (target >= currentHz) lowerSinceUs = 0;
+		else if (!lowerSinceUs) lowerSinceUs = nowUs;
+
+		bool send = false;
+		if (target > currentHz) send = true;
+		else if (lowerSinceUs && nowUs - lowerSinceUs >= kLowerAfterUs) send = true;
+		else if (currentHz && nowUs - lastSentUs >= kRefreshUs) send = true;
+		if (!send) return false;
+		lowerSinceUs = 0;
+
+		if (target != currentHz) rateChanges.fetch_add(1, std::memory_order_relaxed);
+		currentHz = target;
+		lastSentUs = nowUs;
+		targetStat.store(target, std::memory_order_relaxed);
+		displayStat.store(maxHz, std::memory_order_relaxed);
+		outHz = target;
+		return true;
+	}
+
+	Stats getStats() const {
+		Stats st;
+		st.targetHz = targetStat.load(std::memory_order_relaxed);
+		st.displayHz = displayStat.load(std::memory_order_relaxed);
+		st.motionDegS = motionStat.load(std::memory_order_relaxed);
+		st.achievedHz = achievedStat.load(std::memory_order_relaxed);
+		st.bytesPerSec = bytesStat.load(std::memory_order_relaxed);
+		st.decodeNs = decodeStat.load(std::memory_order_relaxed);
+		st.savedPerSec = st.achievedHz && st.achievedHz < kBaselineHz ? kBaselineHz - st.achievedHz : 0;
+		st.bytesSavedPerSec = st.achievedHz ? static_cast<uint32_t>(uint64_t(st.savedPerSec) * st.bytesPerSec / st.achievedHz) : 0;
+		st.decodeUsSavedPerSec = static_cast<uint32_t>(uint64_t(st.savedPerSec) * st.decodeNs / 1000);
+		st.rateChanges = rateChanges.load(std::memory_order_relaxed);
+		return st;
+	}
+
+private:
+	static constexpr uint32_t kMinHz = 10;
+	static constexpr uint32_t kMaxHz = 250;
+	static constexpr uint32_t kMinLinkHz = 30;
+	// Below kStillDegS is sensor noise, kFullDegS and up wants the full display rate.
+	static constexpr double kStillDegS = 5.0;
+	static constexpr double kFullDegS = 90.0;
+	static constexpr double kSpeedAttackUs = 30000.0;
+	static constexpr double kSpeedReleaseUs = 250000.0;
+	static constexpr double kReleaseUs = 500000.0;
+	static constexpr uint64_t kLowerAfterUs = 1000000; // the target has to stay lower this long
+	static constexpr uint64_t kRefreshUs = 2000000;
+	static constexpr uint64_t kWindowUs = 1000000;
+	static constexpr double kMaxLoss = 0.05;
+	static constexpr uint32_t kMaxRttUs = 60000;
+	static constexpr uint32_t kMaxQueue = 16;
+
+	static double angleDelta(double a, double b) { return std::fabs(std::fmod(b - a + 540.0, 360.0) - 180.0); }
+
+	void trackMotion(uint64_t nowUs, const BufferCompression::ControllerState& s) {
+		if (havePrev && nowUs > prevUs) {
+			const double dt = double(nowUs - prevUs) * 1e-6;
+			const double d = (prev.hasOrientation && s.hasOrientation)
+				? s2uk_vecMath::angleBetweenDeg(prev.orientation, s.orientation)
+				: std::max({ angleDelta(prev.gyro.x, s.gyro.x), angleDelta(prev.gyro.y, s.gyro.y), angleDelta(prev.gyro.z, s.gyro.z) });
+			const double speed = d / dt;
+			const double tau = speed > speedDegS ? kSpeedAttackUs : kSpeedReleaseUs;
+			speedDegS += (speed - speedDegS) * std::min(1.0, dt * 1e6 / tau);
+
+			const double a = std::clamp((speedDegS - kStillDegS) / (kFullDegS - kStillDegS), 0.0, 1.0);
+			const bool input = s.btn_system_or_menu_state != prev.btn_system_or_menu_state || s.btn_a_or_x_state != prev.btn_a_or_x_state ||
+				s.btn_b_or_y_state != prev.btn_b_or_y_state || s.trigger_state != prev.trigger_state || s.grip_state != prev.grip_state ||
+				s.joy_state != prev.joy_state || !s.joy_in_dz;
+			const double now = input ? 1.0 : a;
+			if (now > activity) activity = now;
+		}
+		prev = s;
+		prevUs = nowUs;
+		havePrev = true;
+		motionStat.store(static_cast<uint32_t>(speedDegS), std::memory_order_relaxed);
+	}
+
+	void closeWindow(uint64_t nowUs) {
+		const uint64_t p = packets.load(std::memory_order_relaxed);
+		const uint64_t b = packetBytes.load(std::memory_order_relaxed);
+		const uint64_t ns = packetDecodeNs.load(std::memory_order_relaxed);
+		if (windowStartUs) {
+			const double seconds = double(nowUs - windowStartUs) * 1e-6;
+			const uint64_t dp = p - lastPackets;
+			achievedStat.store(static_cast<uint32_t>(std::lround(double(dp) / seconds)), std::memory_order_relaxed);
+			bytesStat.store(static_cast<uint32_t>(std::lround(double(b - lastBytes) / seconds)), std::memory_order_relaxed);
+			if (dp) decodeStat.store(static_cast<uint32_t>((ns - lastDecodeNs) / dp), std::memory_order_relaxed);
+		}
+		lastPackets = p;
+		lastBytes = b;
+		lastDecodeNs = ns;
+		windowStartUs = nowUs;
+	}
+
+	// RunFrame thread
+	uint32_t idleHz = 20;
+	uint32_t currentHz = 0;
+	double activity = 1.0; // start at full rate until the controller proves it is still
+	double speedDegS = 0.0;
+	BufferCompression::ControllerState prev;
+	bool havePrev = false;
+	uint64_t prevUs = 0;
+	uint64_t lastUpdateUs = 0;
+	uint64_t lowerSinceUs = 0;
+	uint64_t lastSentUs = 0;
+	uint64_t windowStartUs = 0;
+	uint64_t lastPackets = 0, lastBytes = 0, lastDecodeNs = 0;
+
+	// Network threads
+	std::atomic<uint64_t> packets{ 0 };
+	std::atomic<uint64_t> packetBytes{ 0 };
+	std::atomic<uint64_t> packetDecodeNs{ 0 };
+
+	std::atomic<uint32_t> targetStat{ 0 };
+	std::atomic<uint32_t> displayStat{ 0 };
+	std::atomic<uint32_t> motionStat{ 0 };
+	std::atomic<uint32_t> achievedStat{ 0 };
+	std::atomic<uint32_t> bytesStat{ 0 };
+	std::atomic<uint32_t> decodeStat{ 0 };
+	std::atomic<uint64_t> rateChanges{ 0 };
+};
+#endif
@@ -0,0 +1,164 @@
+#pragma once
+#ifndef S2UK_ShmTransport
+#define S2UK_ShmTransport
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "NetPlatform.h"
+#include "FrameParser.h"
+#include "NetTelemetry.h"
+
+/**
+Shared-memory ring for producers on the same machine (phone emulators, scripted input,
+benchmarks). The driver creates the mapping; producers attach and publish raw controller
+packets straight into it, skipping sockets, base64 and framing.
+
+Layout (all fields native endian, the ring never leaves the host):
+
+	Header  magic | version | slotCount | slotSize | writeIndex
+	Slot[slotCount]  seq | sendTimeUs | len | type | payload
+
+Producers claim a slot with fetch_add on writeIndex, fill it and then publish it by
+storing seq = index + 1. The single consumer walks the indices in order. A consumer that
+falls more than slotCount behind skips ahead; states are latest-wins anyway.
+**/
+namespace ShmRing {
+	constexpr uint32_t kMagic = 0x524B3253; // "S2KR"
+	constexpr uint32_t kVersion = 1;
+	constexpr uint32_t kSlotCount = 256;
+	constexpr size_t kSlotPayload = 232;
+
+#ifdef _WIN32
+	constexpr const char* kDefaultName = "Local\\s2uk_controller_ring";
+#else
+	constexpr const char* kDefaultName = "/s2uk_controller_ring";
+#endif
+
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> seq;
+		uint64_t sendTimeUs; // NetTelemetry::nowUs() of the producer, same clock on one host
+		uint16_t len;
+		uint8_t type;        // FrameType
+		uint8_t reserved[5];
+		char payload[kSlotPayload];
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slotCount;
+		uint32_t slotSize;
+		alignas(64) std::atomic<uint64_t> writeIndex;
+	};
+
+	struct Layout {
+		Header header;
+		Slot slots[kSlotCount];
+	};
+
+	static_assert(sizeof(Slot) == 256, "ShmRing::Slot is part of the cross-process ABI");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "ShmRing needs address-free 64-bit atomics");
+	static_assert((kSlotCount & (kSlotCount - 1)) == 0, "kSlotCount must be a power of two");
+
+	// Named mapping, POSIX shm on Linux and a pagefile-backed file mapping on Windows.
+	class Mapping {
+	public:
+		Mapping() = default;
+		~Mapping() { close(); }
+		Mapping(const Mapping&) = delete;
+		Mapping& operator=(const Mapping&) = delete;
+
+		bool create(const char* name, size_t size); // owner, removes the name on close (POSIX)
+		bool open(const char* name, size_t size);
+		void close();
+
+		void* data() const { return view; }
+
+	private:
+		void* view = nullptr;
+		size_t mappedSize = 0;
+		bool owner = false;
+		std::string mappedName;
+#ifdef _WIN32
+		void* handle = nullptr;
+#else
+		int fd = -1;
+#endif
+	};
+
+	// Producer side, for tools and emulators. publish() is safe from several threads and
+	// several processes at once.
+	class Producer {
+	public:
+		bool attach(const char* name = kDefaultName);
+		void detach() { mapping.close(); layout = nullptr; }
+		bool attached() const { return layout != nullptr; }
+
+		bool publish(FrameType type, const void* data, size_t len);
+
+	private:
+		Mapping mapping;
+		Layout* layout = nullptr;
+	};
+}
+
+/**
+Consumer side inside the driver. Hands every published packet to the same handler the
+TCP and UDP servers use (WireMode::Binary, sock = INVALID_SOCKET), on its own thread.
+**/
+class ShmTransportClass {
+public:
+	using MessageHandler = std::function<void(SOCKET sock, WireMode mode, const Frame& frame)>;
+
+	struct Stats {
+		uint64_t received = 0; // packets handed to the handler
+		uint64_t overruns = 0; // packets overwritten before they were read
+		uint64_t abandoned = 0; // slots a producer claimed but never published
+	};
+
+	// Both must be set before Connect(), the telemetry table is optional.
+	void SetMessageHandler(MessageHandler handler);
+	void SetTelemetry(NetTelemetry* table);
+
+	bool Connect(const char* name = ShmRing::kDefaultName);
+	bool GetStatus();
+	Stats GetStats() const;
+
+	void Close();
+
+private:
+	ShmRing::Mapping mapping;
+	ShmRing::Layout* layout = nullptr;
+
+	std::thread pollThread;
+	std::atomic<bool> running{ false };
+
+	MessageHandler messageHandler;
+	NetTelemetry* telemetry = nullptr;
+	NetTelemetry::Link* link = nullptr;
+
+	// Poll thread only
+	uint64_t readIndex = 0;
+	std::chrono::steady_clock::time_point pendingSince{}; // when the slot at readIndex was first seen unpublished
+
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> overruns{ 0 };
+	std::atomic<uint64_t> abandoned{ 0 };
+
+	// A claimed slot that stays unpublished this long is skipped (producer died mid-write).
+	const std::chrono::milliseconds ABANDON_TIMEOUT{ 50 };
+	// Idle polling: spin briefly after traffic, then back off to short sleeps.
+	const int SPIN_ITERATIONS = 2000;
+	const std::chrono::microseconds IDLE_SLEEP{ 500 };
+
+	void pollLoop();
+	bool drain();
+};
+
+#endif
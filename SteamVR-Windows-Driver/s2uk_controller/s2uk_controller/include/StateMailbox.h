@@ -0,0 +1,89 @@
+#pragma once
+#ifndef S2UK_StateMailbox
+#define S2UK_StateMailbox
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+Latest-wins slot between the network thread(s) and the vrserver thread.
+
+Writers overwrite the single slot (seqlock), the reader copies out whatever is newest
+and never blocks. States the reader never got to see are counted instead of queued,
+so a slow consumer sees less data rather than older data.
+**/
+template<class T>
+class StateMailbox {
+	static_assert(std::is_trivially_copyable_v<T>, "StateMailbox needs a trivially copyable payload");
+
+public:
+	struct Stats {
+		uint64_t published = 0; // states written by the network side
+		uint64_t consumed = 0;  // states picked up by the reader
+		uint64_t dropped = 0;   // states overwritten before the reader saw them
+	};
+
+	// Any thread. Writers serialize on a tiny spin flag, readers are never blocked by it.
+	void publish(const T& value) noexcept {
+		uint64_t words[kWords] = {};
+		std::memcpy(words, &value, sizeof(T));
+
+		while (writeLock.test_and_set(std::memory_order_acquire)) {}
+
+		const uint64_t s = seq.load(std::memory_order_relaxed);
+		seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < kWords; ++i) slot[i].store(words[i], std::memory_order_relaxed);
+		seq.store(s + 2, std::memory_order_release);
+
+		writeLock.clear(std::memory_order_release);
+		published.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Single reader. Returns true and fills out if something was published since the last call.
+	bool consume(T& out) noexcept {
+		uint64_t words[kWords];
+		uint64_t s0;
+		for (;;) {
+			s0 = seq.load(std::memory_order_acquire);
+			if (s0 == lastSeq) return false;
+			if (s0 & 1) continue; // writer mid-update
+
+			for (size_t i = 0; i < kWords; ++i) words[i] = slot[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq.load(std::memory_order_relaxed) == s0) break;
+		}
+
+		const uint64_t skipped = (s0 - lastSeq) / 2 - 1;
+		lastSeq = s0;
+		std::memcpy(&out, words, sizeof(T));
+
+		consumed.fetch_add(1, std::memory_order_relaxed);
+		if (skipped) dropped.fetch_add(skipped, std::memory_order_relaxed);
+		return true;
+	}
+
+	Stats getStats() const noexcept {
+		Stats st;
+		st.published = published.load(std::memory_order_relaxed);
+		st.consumed = consumed.load(std::memory_order_relaxed);
+		st.dropped = dropped.load(std::memory_order_relaxed);
+		return st;
+	}
+
+private:
+	static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	std::atomic<uint64_t> seq{ 0 };
+	std::atomic<uint64_t> slot[kWords] = {};
+	std::atomic_flag writeLock = ATOMIC_FLAG_INIT;
+
+	uint64_t lastSeq = 0; // reader side only
+
+	std::atomic<uint64_t> published{ 0 };
+	std::atomic<uint64_t> consumed{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+};
+#endif
@@ -1,65 +1,294 @@
-
 #pragma once
 #ifndef TcpServer_H
 #define TcpServer_H
 
 //#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
-#include <ws2tcpip.h>
-#pragma comment(lib, "Ws2_32.lib")
 
-#include <queue>
 #include <unordered_map>
 
+#include "NetPlatform.h"
+#include "NetEventLoop.h"
+#include "FrameParser.h"
+#include "NetTelemetry.h"
+#include "ClockSync.h"
+#include "Handshake.h"
+
+/**
+Per-session resource caps. Zero disables a limit.
+
+Outbound (driver -> phone) queues are capped by message count and bytes; what happens on
+overflow is outboundPolicy. Inbound traffic is metered with token buckets that hold one
+second worth of budget: with InboundPolicy::Throttle the server stops reading the socket
+(TCP flow control pushes back on the phone) and drops messages over the rate, with
+Disconnect the session is closed instead.
+**/
+struct SessionLimits {
+	enum class OutboundPolicy : uint8_t {
+		DropOldest, // discard the oldest message that has not started going out
+		Coalesce,   // replace an unsent message of the same frame type and hand, else drop oldest
+		Disconnect, // the client is not reading, close it
+	};
+	enum class InboundPolicy : uint8_t {
+		Throttle,
+		Disconnect,
+	};
+
+	size_t maxQueuedMessages = 64;
+	size_t maxQueuedBytes = 64 * 1024;
+	OutboundPolicy outboundPolicy = OutboundPolicy::Coalesce;
+
+	uint32_t maxInboundBytesPerSec = 64 * 1024;
+	uint32_t maxInboundMessagesPerSec = 1000;
+	InboundPolicy inboundPolicy = InboundPolicy::Throttle;
+};
+
+/**
+TCP server for the phone clients. All sockets (listener and every session) live on one
+NetEventLoop thread, so the thread count stays fixed no matter how many phones connect.
+**/
 class TcpSocketClass {
-	SOCKET tcpSocket = 0, acceptSocket = 0;
+	SOCKET tcpSocket = INVALID_SOCKET;
 	int port = 0;
-	WSADATA wsaData;
-	int wsaerr = 0;
-	WORD wVersionRequested = 0;
 
-	std::mutex clientsMutex;
-	std::vector<SOCKET> clients;
+	NetEventLoop loop;
+	std::thread loopThread;
+	std::atomic<bool> running{ false };
 
-	struct ClientMessage {
-		SOCKET sock;
-		std::string msg;
-	};
+	// Encoded once per broadcast and shared by every session queue that carries it.
+	using Payload = std::shared_ptr<const std::string>;
 
+	// What Coalesce compares: both hands' drivers broadcast SendRate and haptic frames, one
+	// hand's must not replace the other's.
 	struct OutMsg {
-		std::string data;
+		Payload data;
+		FrameType type = FrameType::Haptic;
+		bool left = false; // per-hand frames only
 		size_t offset = 0;
 		OutMsg() = default;
-		OutMsg(std::string d) : data(std::move(d)), offset(0) {}
+		OutMsg(Payload d, FrameType t, bool l) : data(std::move(d)), type(t), left(l), offset(0) {}
+	};
+
+	// A broadcast in both encodings, sessions pick the one matching their wire mode.
+	struct Broadcast {
+		FrameType type;
+		bool left;
+		Payload text;
+		Payload binary;
+	};
+
+	// Refills continuously at rate per second, holds at most one second worth.
+	struct TokenBucket {
+		double rate = 0; // 0 = unlimited
+		double tokens = 0;
+		std::chrono::steady_clock::time_point last;
+
+		void reset(double r, std::chrono::steady_clock::time_point now) { rate = r; tokens = r; last = now; }
+		void refill(std::chrono::steady_clock::time_point now) {
+			if (rate <= 0) return;
+			tokens = std::min<double>(rate, tokens + rate * std::chrono::duration<double>(now - last).count());
+			last = now;
+		}
+		bool limited() const { return rate > 0; }
 	};
 
-	std::mutex msgMutex;
-	std::queue<ClientMessage> msgQueue;
-	std::condition_variable msgCv;
+	// Receive buffers of all sessions, see FrameParser.h. Loop thread only, and declared
+	// before sessions so it outlives their parsers.
+	RecvSlabPool recvSlabs;
+
+	// Owned by the loop thread.
+	struct Session {
+		explicit Session(RecvSlabPool* slabs) : parser(WireMode::Text, slabs) {}
+
+		SOCKET sock = INVALID_SOCKET;
+		uint32_t peerAddr = 0; // IPv4, network byte order
+		bool loggedIn = false;
+		uint32_t id = 0; // set at login, the key of peers and the welcome's session=
+		NetTelemetry::Link* link = nullptr; // may be null if the telemetry table is full
+		StreamFrameParser parser;
+		std::deque<OutMsg> outgoing;
+		size_t queuedBytes = 0; // unsent bytes in outgoing
+		bool writeBlocked = false; // waiting for Writable
+		bool throttled = false;    // reading paused by the inbound byte budget
+		TokenBucket inBytes;
+		TokenBucket inMessages;
+		ClockSync clock; // phone clock vs ours, from the Pong timestamps
+		// Agreed in the hello or brought back by a resume line; defaults with the login's
+		// framing for the old login strings. hapticEnvelopes: takes HapticEnvelope frames
+		// instead of Haptic ones.
+		Handshake::Agreement agreement;
+		uint64_t resumeToken = 0; // binary sessions only, 0 = none
+		bool heartbeat = false;   // has answered a ping, so going quiet means it is gone
+		std::chrono::steady_clock::time_point lastSeen;
+	};
+	std::unordered_map<SOCKET, std::unique_ptr<Session>> sessions;
+
+	// What a closed binary session leaves behind for a reconnect with its resume token.
+	// Loop thread only.
+	struct ParkedSession {
+		Handshake::Agreement agreement; // a resume line logs in with it, see Handshake.h
+		uint32_t id = 0; // and gets the session id back unless it has been taken since
+		ClockSync clock;
+		NetTelemetry::Link* link = nullptr; // kept, so the link's counters carry on
+		std::chrono::steady_clock::time_point parkedAt;
+	};
+	std::unordered_map<uint64_t, ParkedSession> parkedSessions;
+	std::mt19937_64 tokenRng{ std::random_device{}() };
+
+	// Lets broadcastMessage skip encoding when nobody is listening.
+	std::atomic<size_t> loggedInClients{ 0 };
+	std::atomic<size_t> envelopeClients{ 0 }; // logged in with hapticEnvelopes
+
+	// What the UDP receiver and the message handlers need of a logged-in session, by Session::id.
+	// Keyed by session rather than address: phones behind one NAT, or one phone logged in
+	// twice, each keep their own format, clock and delta streams.
+	struct Peer {
+		uint32_t addr = 0; // IPv4, network byte order
+		ClockSync::Estimate clock;
+		Handshake::WireFormat format;
+		s2uk_packet::DeltaDecoder delta[2]; // Codec::Delta streams, right and left hand
+	};
+	mutable std::mutex peersMutex;
+	std::unordered_map<uint32_t, Peer> peers;
+	uint32_t lastSessionId = 0; // loop thread only
 
-	std::unordered_map<SOCKET, std::deque<OutMsg>> outgoingMessages;
+	// Broadcasts handed over from other threads, fanned out to the sessions by the loop.
 	std::mutex outgoingMutex;
+	std::vector<Broadcast> outgoingMessages;
+
+	SessionLimits limits;
+	bool acceptImuBatch = false;
+	size_t throttledSessions = 0; // loop thread only
+
+	std::atomic<uint64_t> droppedOldest{ 0 };
+	std::atomic<uint64_t> coalesced{ 0 };
+	std::atomic<uint64_t> queueDisconnects{ 0 };
+	std::atomic<uint64_t> throttleEvents{ 0 };
+	std::atomic<uint64_t> droppedInbound{ 0 };
+	std::atomic<uint64_t> rateDisconnects{ 0 };
+	std::atomic<uint64_t> peakQueuedMessages{ 0 }; // loop thread writes
+	std::atomic<uint64_t> peakQueuedBytes{ 0 };
+	std::atomic<uint64_t> resumedSessions{ 0 };
+	std::atomic<uint64_t> heartbeatTimeouts{ 0 };
+
+public:
+	// Called on the loop thread for every complete client message. frame.payload is the
+	// base64 line in text mode and the raw frame payload in binary mode; it is only valid
+	// for the duration of the call.
+	using MessageHandler = std::function<void(SOCKET sock, WireMode mode, const Frame& frame)>;
+
+private:
+	MessageHandler messageHandler;
+	NetTelemetry* telemetry = nullptr;
 
 	const std::string CLIENT_CONNECTION_MESSAGE = "s2uk_connection_init";
-	const DWORD CLIENT_TIMEOUT = 30 * 1000;
+	const std::string CLIENT_CONNECTION_MESSAGE_BINARY = "s2uk_connection_init_bin";
+	const std::string CLIENT_CLOSED_CONNECTION_MESSAGE = "s2uk_connection_closed";
+	const std::chrono::milliseconds CLIENT_TIMEOUT{ 30 * 1000 };
+	const std::chrono::milliseconds HOUSEKEEPING_INTERVAL{ 1000 };
+	// Most one recv() takes, so the inbound budgets are checked between reads.
+	const size_t RECV_CHUNK = 4096;
+	// Binary sessions get a Ping this often; the Pong gives the round-trip time and the clock
+	// sync, and a session that answered before but stays silent for HEARTBEAT_TIMEOUT is dead.
+	const std::chrono::milliseconds HEARTBEAT_INTERVAL{ 250 };
+	const std::chrono::milliseconds HEARTBEAT_TIMEOUT{ 750 };
+	// How long a dropped binary session can be resumed.
+	const std::chrono::milliseconds RESUME_WINDOW{ 60 * 1000 };
+	// How often throttled sessions are checked for refilled budget.
+	const std::chrono::milliseconds THROTTLE_INTERVAL{ 20 };
 public:
 	bool GetStatus();
 
+	// Must be set before Connect().
+	void SetMessageHandler(MessageHandler handler);
+
+	// Optional, must be set before Connect(). Every session gets a slot in this table.
+	void SetTelemetry(NetTelemetry* table);
+
+	// Optional, must be set before Connect().
+	void SetLimits(const SessionLimits& sessionLimits);
+
+	// Optional, must be set before Connect(). Whether hellos may agree on imu=batch; only
+	// worth it when something reads the samples (ControllerDriver's IMU history).
+	void SetImuBatch(bool accept);
+
+	// Every enforcement action SessionLimits took, thread-safe.
+	struct LimitStats {
+		uint64_t droppedOldest = 0;    // outbound messages discarded on overflow
+		uint64_t coalesced = 0;        // outbound messages replaced by a newer one of the same type
+		uint64_t queueDisconnects = 0; // sessions closed because their queue overflowed
+		uint64_t throttleEvents = 0;   // times reading was paused by the byte budget
+		uint64_t droppedInbound = 0;   // inbound messages over the rate, discarded
+		uint64_t rateDisconnects = 0;  // sessions closed for exceeding an inbound budget
+		uint64_t peakQueuedMessages = 0; // the most any session had queued at once
+		uint64_t peakQueuedBytes = 0;    // the most unsent bytes any session had queued at once
+	};
+	LimitStats GetLimitStats() const;
+
+	struct SessionStats {
+		uint64_t resumed = 0;           // reconnects that got their previous session back
+		uint64_t heartbeatTimeouts = 0; // sessions closed for missing heartbeats
+	};
+	SessionStats GetSessionStats() const;
+
 	void Connect(int port);
 
-	void Receive(char* outStr, int maxLen = 2048);
-	void broadcastMessage(const std::string& msg);
+	// The port Connect() listens on, the one the system picked if it was given 0.
+	int GetPort() const;
 
-	void CloseSocket();
-private:
-	void sendQueuedMessages();
+	// Thread-safe. True if session is logged in from this IPv4 address (network byte order).
+	bool HasSession(uint32_t session, uint32_t addr) const;
 
-	bool sendMessagesToClient(SOCKET clientSock);
+	// Thread-safe. Maps a timestamp taken on the phone of session to NetTelemetry::nowUs() time.
+	// False until that phone has answered a ping with its clock (binary sessions only).
+	bool MapPeerTime(uint32_t session, uint64_t remoteUs, uint64_t& localUs) const;
 
-	void enqueueMessage(SOCKET sock, const std::string& msg);
+	// Thread-safe. How controller packets of session are encoded (UDP datagrams name the TCP
+	// session whose agreement they use). Defaults for unknown sessions and old phones.
+	Handshake::WireFormat PeerFormat(uint32_t session) const;
 
-	void handleClient(SOCKET clientSock);
+	// Thread-safe. Decodes a Codec::Delta packet of session, TCP or UDP, against that phone's
+	// keyframes for the packet's hand. NoKeyframe for sessions that aren't logged in.
+	s2uk_packet::Status DecodeDelta(uint32_t session, const uint8_t* data, size_t len, s2uk_packet::ControllerPacket& out);
+
+	// Thread-safe. True if some logged-in phone takes HapticEnvelope frames; the others keep
+	// getting a Haptic frame per pulse, so callers broadcast both.
+	bool WantsHapticEnvelopes() const;
+
+	// payload is the raw (not base64) packet, it gets encoded per client wire mode. Haptic
+	// frames only go to sessions without hapticEnvelopes, HapticEnvelope frames only to those with.
+	void broadcastMessage(FrameType type, const std::string& payload);
+
+	void CloseSocket();
+private:
+	void onAccept();
+	void onSessionEvent(SOCKET sock, uint32_t events);
+	bool readFromSession(Session& session);
+	bool handleFrame(Session& session, const Frame& frame);
+	bool flushSession(Session& session);
+	void closeSession(SOCKET sock, const char* reason);
+	bool enqueue(Session& session, Payload payload, FrameType type, bool left = false);
+	void notePeakQueue(const Session& session);
+	void updateInterest(Session& session);
+	void resumeThrottled();
+	void collectOutgoing();
+	void checkTimeouts();
+	void sendPings();
+	void heartbeat();
+	bool sendSessionInfo(Session& session, bool resumed);
+	bool resumeSession(Session& session, uint64_t token);
+	bool resumeLogin(Session& session, uint64_t token);
+	void logIn(Session& session, uint32_t id);
+	void closeResumed(const Session& session, uint64_t token);
 };
 
 #endif
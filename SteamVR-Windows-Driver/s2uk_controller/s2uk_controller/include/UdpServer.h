@@ -0,0 +1,117 @@
+#pragma once
+#ifndef S2UK_UdpServer
+#define S2UK_UdpServer
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "NetPlatform.h"
+#include "NetEventLoop.h"
+#include "FrameParser.h"
+#include "NetTelemetry.h"
+
+/**
+Controller state datagram, all integers little-endian:
+
+	u8  magic        'S'
+	u8  version      2
+	u8  deviceId     0 = right hand, 1 = left hand
+	u8  stateCount   1..kMaxStates
+	u32 seq          per device, +1 for every new state
+	u64 sendTimeUs   sender monotonic clock
+	u32 session      the sender's TCP session, the welcome's session= (Handshake.h)
+	stateCount x { u8 len | len bytes }   raw controller state (BufferCompression), newest first
+
+Entry i carries the state for seq - i, so a datagram can repeat the last few states and a
+single lost datagram costs nothing.
+**/
+namespace UdpDatagram {
+	constexpr uint8_t kMagic = 'S';
+	constexpr uint8_t kVersion = 2; // 1 had no session, its datagrams are rejected
+	constexpr size_t kHeaderSize = 20;
+	constexpr size_t kMaxStates = 8;
+	constexpr size_t kMaxSize = 1200; // stays under a typical Wi-Fi MTU
+
+	struct Header {
+		uint8_t deviceId = 0;
+		uint8_t stateCount = 0;
+		uint32_t seq = 0;
+		uint64_t sendTimeUs = 0;
+		uint32_t session = 0;
+	};
+
+	// Fills header and states (newest first). Returns false on anything malformed.
+	bool parse(const char* data, size_t len, Header& header, std::string_view (&states)[kMaxStates]);
+}
+
+/**
+Receives controller state over UDP on its own NetEventLoop thread. The TCP connection
+still carries the login and haptics; datagrams are only accepted from peers the filter
+approves (normally: the logged-in TCP session they name, from the same host).
+**/
+class UdpSocketClass {
+public:
+	// Same shape as TcpSocketClass::MessageHandler, always called with WireMode::Binary.
+	using MessageHandler = std::function<void(SOCKET sock, WireMode mode, const Frame& frame)>;
+	using PeerFilter = std::function<bool(const sockaddr_in& from, uint32_t session)>;
+
+	struct Stats {
+		uint64_t received = 0;   // datagrams read from the socket
+		uint64_t accepted = 0;   // datagrams that delivered a new state
+		uint64_t outOfOrder = 0; // late or duplicate datagrams, dropped
+		uint64_t recovered = 0;  // states rebuilt from redundant copies after a loss
+		uint64_t lost = 0;       // states missing even after redundancy
+		uint64_t rejected = 0;   // malformed or from an unknown peer
+	};
+
+	// All must be set before Connect(), the telemetry table is optional.
+	void SetMessageHandler(MessageHandler handler);
+	void SetPeerFilter(PeerFilter filter);
+	void SetTelemetry(NetTelemetry* table);
+
+	bool Connect(int port);
+	bool GetStatus();
+	Stats GetStats() const;
+
+	void CloseSocket();
+
+private:
+	SOCKET udpSocket = INVALID_SOCKET;
+
+	NetEventLoop loop;
+	std::thread loopThread;
+	std::atomic<bool> running{ false };
+
+	MessageHandler messageHandler;
+	PeerFilter peerFilter;
+	NetTelemetry* telemetry = nullptr;
+
+	// One sequence stream per (sender address, port, device). Loop thread only.
+	struct Stream {
+		uint32_t lastSeq = 0;
+		std::chrono::steady_clock::time_point lastSeen;
+		NetTelemetry::Link* link = nullptr;
+	};
+	std::unordered_map<uint64_t, Stream> streams;
+
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> accepted{ 0 };
+	std::atomic<uint64_t> outOfOrder{ 0 };
+	std::atomic<uint64_t> recovered{ 0 };
+	std::atomic<uint64_t> lost{ 0 };
+	std::atomic<uint64_t> rejected{ 0 };
+
+	const std::chrono::milliseconds STREAM_TIMEOUT{ 30 * 1000 };
+	const std::chrono::milliseconds HOUSEKEEPING_INTERVAL{ 1000 };
+
+	void onReadable();
+	void handleDatagram(const sockaddr_in& from, const char* data, size_t len);
+	void expireStreams();
+};
+
+#endif
@@ -4,7 +4,13 @@
 
 #include <cmath>
 #include <string>
+// libstdc++ only has <format> from GCC 13 on; older ones (the Linux test builds) print with snprintf.
+#if __has_include(<format>)
 #include <format>
+#define S2UK_HAVE_FORMAT 1
+#else
+#include <cstdio>
+#endif
 
 
 # define M_PI           3.14159265358979323846
@@ -28,7 +34,13 @@ struct Vec2 {
     Vec2& operator/=(double scalar) { x /= scalar; y /= scalar; return *this; }
 
     std::string toString() {
+#ifdef S2UK_HAVE_FORMAT
         return std::format("Vec2({:.5f}, {:.5f})", x, y);
+#else
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "Vec2(%.5f, %.5f)", x, y);
+        return buf;
+#endif
     }
 };
 
@@ -52,7 +64,13 @@ struct Vec3 {
     Vec3& operator/=(double scalar) { x /= scalar; y /= scalar; z /= scalar; return *this; }
 
     std::string toString() {
+#ifdef S2UK_HAVE_FORMAT
         return std::format("Vec3({:.5f}, {:.5f}, {:.5f})", x, y, z);
+#else
+        char buf[128];
+        std::snprintf(buf, sizeof(buf), "Vec3(%.5f, %.5f, %.5f)", x, y, z);
+        return buf;
+#endif
     }
 };
 
@@ -71,6 +89,8 @@ struct Quaternion {
         };
     }
 
+    double dot(const Quaternion& rhs) const noexcept { return w * rhs.w + x * rhs.x + y * rhs.y + z * rhs.z; }
+
     void normalize() noexcept {
         double n = std::sqrt(w * w + x * x + y * y + z * z);
         if (n > 0.0) {
@@ -92,7 +112,13 @@ struct Quaternion {
     }
 
     std::string toString() {
+#ifdef S2UK_HAVE_FORMAT
         return std::format("Quaternion({:.5f}, {:.5f}, {:.5f}, {:.5f})", w, x, y, z);
+#else
+        char buf[160];
+        std::snprintf(buf, sizeof(buf), "Quaternion(%.5f, %.5f, %.5f, %.5f)", w, x, y, z);
+        return buf;
+#endif
     }
 };
 
@@ -118,6 +144,22 @@ public:
         q.normalize();
         return q;
     }
+
+    // Normalized lerp along the shorter arc. Close enough to slerp for the small steps between
+    // two packets, with one sqrt and no trig.
+    static Quaternion nlerp(const Quaternion& a, const Quaternion& b, double t) noexcept {
+        const double u = 1.0 - t;
+        const double s = a.dot(b) < 0.0 ? -t : t;
+        Quaternion q{ a.w * u + b.w * s, a.x * u + b.x * s, a.y * u + b.y * s, a.z * u + b.z * s };
+        q.normalize();
+        return q;
+    }
+
+    // Rotation between two unit quaternions, in degrees.
+    static double angleBetweenDeg(const Quaternion& a, const Quaternion& b) noexcept {
+        const double d = std::fabs(a.dot(b));
+        return 2.0 * std::acos(d < 1.0 ? d : 1.0) * (180.0 / M_PI);
+    }
 };
 
 class Vec3EMA {
@@ -8,6 +8,7 @@
 #include <chrono>
 #include <sstream>
 #include "BufferCompression.h"
+#include "HapticEnvelope.h"
 #include "PositionalTracking.h"
 #include "DriverConfig.h"
 
@@ -25,12 +26,36 @@ auto map2StateVar = [](int s) -> float {
 	return (s == 1) ? 1.0f : (s == 2) ? 0.5f : 0.0f;
 	};
 
+// Right and left hand. Both controllers poll the one event queue on the vrserver thread, so
+// either may add to either envelope.
+static HapticEnvelope hapticEnvelopes[2] = { HapticEnvelope(false), HapticEnvelope(true) };
+
 constexpr float lerpSpeed = 700.0f;
 auto lerp = [](float current, float target, float deltaTime, float speed) -> float {
 	float t = 1.0f - std::exp(-speed * deltaTime);
 	return current + (target - current) * t;
 	};
 
+// Gyro carries absolute Euler angles in degrees: blend along the short way around.
+static double lerpAngle(double a, double b, double t) {
+	double d = std::fmod(b - a + 540.0, 360.0) - 180.0;
+	return a + d * t;
+}
+
+// Continuous values are blended, discrete ones (buttons, battery) come from the older sample
+// so a press is never shown before its packet is due.
+static BufferCompression::ControllerState interpolateState(const BufferCompression::ControllerState& a,
+	const BufferCompression::ControllerState& b, double t) {
+	BufferCompression::ControllerState out = a;
+	if (a.hasOrientation && b.hasOrientation) out.orientation = s2uk_vecMath::nlerp(a.orientation, b.orientation, t);
+	else out.gyro = Vec3(lerpAngle(a.gyro.x, b.gyro.x, t), lerpAngle(a.gyro.y, b.gyro.y, t), lerpAngle(a.gyro.z, b.gyro.z, t));
+	out.joy = a.joy + (b.joy - a.joy) * t;
+	// The blend's own time, so the IMU history can be asked for the same instant.
+	if (a.sampleTimeUs && b.sampleTimeUs)
+		out.sampleTimeUs = a.sampleTimeUs + static_cast<int64_t>(static_cast<double>(int64_t(b.sampleTimeUs - a.sampleTimeUs)) * t);
+	return out;
+}
+
 void ControllerDriver::ReadBuffer(BufferCompression::ControllerState state) {
 	if (state.left_controller == ((ControllerIndex==1) ? true : false)) {
 		try {
@@ -41,7 +66,8 @@ void ControllerDriver::ReadBuffer(BufferCompression::ControllerState state) {
 			controllerData.isCharging = state.controller_battery_plugged;
 			controllerData.batteryPercentage = state.batteryPercentage;
 
-			controllerData.controllerRotation = s2uk_vecMath::eulerToQuaternion(state.gyro);
+			controllerData.controllerRotation = state.hasOrientation ? state.orientation : s2uk_vecMath::eulerToQuaternion(state.gyro);
+			controllerData.sampleTimeUs = state.sampleTimeUs;
 
 			controllerData.triggerStateRaw = map2StateVar(state.trigger_state);
 			controllerData.gripStateRaw = map2StateVar(state.grip_state);
@@ -75,6 +101,232 @@ void ControllerDriver::ReadBuffer(BufferCompression::ControllerState state) {
 	}
 }
 
+void ControllerDriver::PublishState(const BufferCompression::ControllerState& state)
+{
+	if (state.sampleTimeUs) {
+		// Slightly negative ages are sync error, not time travel.
+		const uint64_t now = NetTelemetry::nowUs();
+		const uint32_t age = static_cast<uint32_t>(std::min<uint64_t>(now > state.sampleTimeUs ? now - state.sampleTimeUs : 0, UINT32_MAX));
+		const uint32_t smoothed = smoothedAgeUs.load(std::memory_order_relaxed);
+		lastAgeUs.store(age, std::memory_order_relaxed);
+		smoothedAgeUs.store(smoothed ? static_cast<uint32_t>(int64_t(smoothed) + (int64_t(age) - int64_t(smoothed)) / 16) : age, std::memory_order_relaxed);
+		stampedStates.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Edges are tracked with the lane off too, for the stats.
+	inputFastLane.onState(state, NetTelemetry::nowUs(), [this](const InputFastLane::Inputs& now, const InputFastLane::Inputs* before, float timeOffset) {
+		if (inputFastLaneEnabled && inputActive.load(std::memory_order_acquire)) SubmitInputs(now, before, timeOffset);
+	});
+
+	if (poseScheduler.getMode() == PoseScheduler::Mode::OnArrival && inputActive.load(std::memory_order_acquire) &&
+		state.left_controller == (ControllerIndex == 1)) {
+		SubmitArrivalPose(state);
+	}
+
+	if (jitterBufferEnabled) jitterBuffer.push(state, NetTelemetry::nowUs());
+	else stateMailbox.publish(state);
+}
+
+// Network thread. The rotation is built from the state alone, controllerData belongs to
+// RunFrame; the position is the one RunFrame last filtered, handed over under poseMutex.
+void ControllerDriver::SubmitArrivalPose(const BufferCompression::ControllerState& state)
+{
+	Vec3 gyro = state.gyro;
+	const Quaternion rotation = state.hasOrientation ? state.orientation : s2uk_vecMath::eulerToQuaternion(gyro);
+
+	std::lock_guard<std::mutex> lock(poseMutex);
+	// A datagram that arrived late must not take the pose back; much older is a new timeline.
+	if (state.senderTimeUs) {
+		if (state.senderTimeUs < lastArrivalSenderUs && lastArrivalSenderUs - state.senderTimeUs < 1000000) return;
+		lastArrivalSenderUs = state.senderTimeUs;
+	}
+	SubmitPose(rotation, arrivalPosition, NetTelemetry::nowUs(), state.sampleTimeUs, state.sampleTimeUs, true);
+}
+
+// RunFrame thread.
+void ControllerDriver::SubmitFramePose()
+{
+	const uint64_t now = NetTelemetry::nowUs();
+	const uint64_t sampleUs = controllerData.sampleTimeUs;
+	switch (poseScheduler.getMode()) {
+	case PoseScheduler::Mode::OnArrival: {
+		// Frames nothing arrived for still get a pose, as they did per frame.
+		std::lock_guard<std::mutex> lock(poseMutex);
+		arrivalPosition = controllerData.position;
+		if (!poseScheduler.takeArrived()) SubmitPose(controllerData.controllerRotation, controllerData.position, now, sampleUs, sampleUs, false);
+		break;
+	}
+	case PoseScheduler::Mode::VsyncPredicted: {
+		Quaternion rotation = controllerData.controllerRotation;
+		const uint64_t poseUs = poseScheduler.predict(now, rotation, sampleUs);
+		SubmitPose(rotation, controllerData.position, now, sampleUs, poseUs, false);
+		break;
+	}
+	default:
+		SubmitPose(controllerData.controllerRotation, controllerData.position, now, sampleUs, sampleUs, false);
+		break;
+	}
+}
+
+// poseTimeOffset says when the pose is for. With zero velocities SteamVR has nothing to
+// extrapolate with, but it knows how old the pose is.
+void ControllerDriver::SubmitPose(const Quaternion& rotation, const Vec3& position, uint64_t nowUs, uint64_t sampleTimeUs, uint64_t poseTimeUs, bool fromArrival)
+{
+	const double offset = poseTimeUs ? std::clamp<double>(double(int64_t(poseTimeUs - nowUs)) * 1e-6, -0.1, 0.1) : 0.0;
+	VRServerDriverHost()->TrackedDevicePoseUpdated(this->driverId, MakePose(rotation, position, offset), sizeof(vr::DriverPose_t));
+	poseScheduler.account(nowUs, sampleTimeUs, poseTimeUs, fromArrival);
+}
+
+// Where the last vsync was on our clock. Frame timings count system time in QPC seconds;
+// only its distance from now is used.
+void ControllerDriver::SampleDisplayTiming()
+{
+	const uint64_t now = NetTelemetry::nowUs();
+	uint64_t vsyncUs = 0;
+	vr::Compositor_FrameTiming timing = {};
+	timing.m_nSize = sizeof(vr::Compositor_FrameTiming);
+	LARGE_INTEGER counter, frequency;
+	if (VRServerDriverHost()->GetFrameTimings(&timing, 1) == 1 && QueryPerformanceFrequency(&frequency) && QueryPerformanceCounter(&counter)) {
+		const double sinceVsync = double(counter.QuadPart) / double(frequency.QuadPart) - timing.m_flSystemTimeInSeconds;
+		if (sinceVsync >= 0.0 && sinceVsync < 1.0) vsyncUs = now - static_cast<uint64_t>(sinceVsync * 1e6);
+	}
+	poseScheduler.setDisplayTiming(vsyncUs, static_cast<uint32_t>(std::lround(1e6 / displayHz)), static_cast<uint32_t>(std::lround(vsyncToPhotonsS * 1e6)));
+}
+
+// Network thread, under the fast lane's lock. Only what changed goes out.
+void ControllerDriver::SubmitInputs(const InputFastLane::Inputs& now, const InputFastLane::Inputs* before, float timeOffset)
+{
+	auto changed = [&](auto InputFastLane::Inputs::* field) { return !before || now.*field != before->*field; };
+
+	if (changed(&InputFastLane::Inputs::trigger)) {
+		VRDriverInput()->UpdateScalarComponent(TriggerHandle, now.trigger, timeOffset);
+		VRDriverInput()->UpdateBooleanComponent(TriggerTouchHandle, now.trigger > 0.95f, timeOffset);
+	}
+	if (changed(&InputFastLane::Inputs::grip)) {
+		VRDriverInput()->UpdateScalarComponent(GripHandle, now.grip, timeOffset);
+		VRDriverInput()->UpdateBooleanComponent(GripTouchHandle, now.grip > 0.95f, timeOffset);
+	}
+	if (changed(&InputFastLane::Inputs::joyTouch)) VRDriverInput()->UpdateBooleanComponent(joystickTouchHandle, now.joyTouch, timeOffset);
+	if (changed(&InputFastLane::Inputs::joyClick)) VRDriverInput()->UpdateBooleanComponent(joystickClickHandle, now.joyClick, timeOffset);
+	if (changed(&InputFastLane::Inputs::thumbrest)) VRDriverInput()->UpdateBooleanComponent(thumbrestHandle, now.thumbrest, timeOffset);
+	if (changed(&InputFastLane::Inputs::system)) VRDriverInput()->UpdateBooleanComponent(SystemHandle, now.system, timeOffset);
+	if (changed(&InputFastLane::Inputs::a)) VRDriverInput()->UpdateBooleanComponent(ControllerIndex == 1 ? XHandle : AHandle, now.a, timeOffset);
+	if (changed(&InputFastLane::Inputs::b)) VRDriverInput()->UpdateBooleanComponent(ControllerIndex == 1 ? YHandle : BHandle, now.b, timeOffset);
+}
+
+void ControllerDriver::PushImuSample(const BufferCompression::ControllerState& sample)
+{
+	imuHistory.push(sample, sample.sampleTimeUs);
+}
+
+StateMailbox<BufferCompression::ControllerState>::Stats ControllerDriver::GetMailboxStats() const
+{
+	return stateMailbox.getStats();
+}
+
+ControllerDriver::AgeStats ControllerDriver::GetAgeStats() const
+{
+	AgeStats st;
+	st.lastUs = lastAgeUs.load(std::memory_order_relaxed);
+	st.smoothedUs = smoothedAgeUs.load(std::memory_order_relaxed);
+	st.stamped = stampedStates.load(std::memory_order_relaxed);
+	return st;
+}
+
+void ControllerDriver::SetTelemetry(const NetTelemetry* table)
+{
+	telemetry = table;
+}
+
+void ControllerDriver::SetJitterBuffer(bool enabled, uint32_t maxDelayUs)
+{
+	jitterBufferEnabled = enabled;
+	jitterBuffer.setMaxDelay(maxDelayUs);
+}
+
+void ControllerDriver::SetSendRate(bool adaptive, uint32_t idleHz)
+{
+	sendRateEnabled = adaptive;
+	sendRate.setIdleRate(idleHz);
+}
+
+void ControllerDriver::SetInputFastLane(bool enabled)
+{
+	inputFastLaneEnabled = enabled;
+}
+
+InputFastLane::Stats ControllerDriver::GetInputFastLaneStats() const
+{
+	return inputFastLane.getStats();
+}
+
+void ControllerDriver::SetPoseScheduler(PoseScheduler::Mode mode)
+{
+	poseScheduler.setMode(mode);
+}
+
+PoseScheduler::Stats ControllerDriver::GetPoseSchedulerStats() const
+{
+	return poseScheduler.getStats();
+}
+
+void ControllerDriver::AccountPacket(uint32_t session, size_t wireBytes, uint32_t decodeNs)
+{
+	lastSession.store(session, std::memory_order_relaxed);
+	sendRate.onPacket(wireBytes, decodeNs);
+}
+
+SendRateController::Stats ControllerDriver::GetSendRateStats() const
+{
+	return sendRate.getStats();
+}
+
+// Worst of the links the phone for this hand talks over, its TCP session and the UDP stream
+// naming that session; other phones behind the same address are not mixed in. Loss is taken
+// over the last second, not since connect.
+SendRateController::LinkQuality ControllerDriver::SampleLinkQuality()
+{
+	SendRateController::LinkQuality q;
+	const uint32_t session = lastSession.load(std::memory_order_relaxed);
+	if (!telemetry || session == 0) return q;
+
+	uint64_t expected = 0, lost = 0;
+	telemetry->forEach([&](const NetTelemetry::Snapshot& s) {
+		if (s.session != session) return;
+		q.known = true;
+		expected += s.seqExpected;
+		lost += s.seqLost;
+		q.rttUs = std::max<uint32_t>(q.rttUs, s.rttSmoothedUs);
+		q.queueDepth = std::max<uint32_t>(q.queueDepth, s.queueDepth);
+	});
+	if (expected >= linkExpected && lost >= linkLost && expected > linkExpected) {
+		q.loss = double(lost - linkLost) / double(expected - linkExpected);
+	}
+	linkExpected = expected;
+	linkLost = lost;
+	return q;
+}
+
+void ControllerDriver::UpdateSendRate(const BufferCompression::ControllerState* applied)
+{
+	const uint64_t now = NetTelemetry::nowUs();
+	if (now - slowChecksUs >= 1000000) {
+		slowChecksUs = now;
+		const PropertyContainerHandle_t hmd = VRProperties()->TrackedDeviceToPropertyContainer(vr::k_unTrackedDeviceIndex_Hmd);
+		const float hz = VRProperties()->GetFloatProperty(hmd, vr::Prop_DisplayFrequency_Float);
+		if (hz > 0.0f) displayHz = hz;
+		const float toPhotons = VRProperties()->GetFloatProperty(hmd, vr::Prop_SecondsFromVsyncToPhotons_Float);
+		if (toPhotons >= 0.0f && toPhotons < 0.1f) vsyncToPhotonsS = toPhotons;
+		linkQuality = SampleLinkQuality();
+	}
+
+	uint32_t hz = 0;
+	// Runs with the feature off too, so the stats show what it would have done.
+	if (sendRate.update(now, displayHz, applied, linkQuality, hz) && sendRateEnabled && tcpSocketObj) {
+		tcpSocketObj->broadcastMessage(FrameType::SendRate, BufferCompression::encodeSendRate(ControllerIndex == 1, hz));
+	}
+}
+
 void ControllerDriver::SetControllerIndex(int32_t CtrlIndex)
 {
 	ControllerIndex = CtrlIndex;
@@ -183,27 +435,37 @@ EVRInitError ControllerDriver::Activate(uint32_t unObjectId)
 		break;
 	}
 
+	inputActive.store(true, std::memory_order_release);
 	return VRInitError_None;
 }
 
 DriverPose_t ControllerDriver::GetPose()
 {
-	pose.deviceIsConnected = true;
-	pose.poseIsValid = true;
-	pose.result = true ? vr::ETrackingResult::TrackingResult_Running_OK : vr::ETrackingResult::TrackingResult_Running_OutOfRange;
-	pose.willDriftInYaw = false;
-	pose.shouldApplyHeadModel = false;
-	pose.qDriverFromHeadRotation.w = pose.qWorldFromDriverRotation.w = pose.qRotation.w = 1.0;
-
-	pose.qRotation = std::bit_cast<HmdQuaternion_t>(controllerData.controllerRotation);
-
-	pose.vecPosition[0] = controllerData.position.x; // right
-	pose.vecPosition[1] = controllerData.position.y; // up
-	pose.vecPosition[2] = controllerData.position.z; // forward
-
+	pose = MakePose(controllerData.controllerRotation, controllerData.position, 0.0);
 	return pose;
 }
 
+// Any thread, touches nothing but its arguments.
+DriverPose_t ControllerDriver::MakePose(const Quaternion& rotation, const Vec3& position, double timeOffset) const
+{
+	DriverPose_t p = { 0 };
+	p.poseTimeOffset = timeOffset;
+	p.deviceIsConnected = true;
+	p.poseIsValid = true;
+	p.result = true ? vr::ETrackingResult::TrackingResult_Running_OK : vr::ETrackingResult::TrackingResult_Running_OutOfRange;
+	p.willDriftInYaw = false;
+	p.shouldApplyHeadModel = false;
+	p.qDriverFromHeadRotation.w = p.qWorldFromDriverRotation.w = p.qRotation.w = 1.0;
+
+	p.qRotation = std::bit_cast<HmdQuaternion_t>(rotation);
+
+	p.vecPosition[0] = position.x; // right
+	p.vecPosition[1] = position.y; // up
+	p.vecPosition[2] = position.z; // forward
+
+	return p;
+}
+
 void ControllerDriver::RunFrame()
 {
 	PropertyContainerHandle_t props = VRProperties()->TrackedDeviceToPropertyContainer(driverId);
@@ -213,17 +475,41 @@ void ControllerDriver::RunFrame()
 	controllerData.deltaTime = elapsed.count();
 	controllerData.lastScalarValueUpdate = now;
 
-	VRServerDriverHost()->TrackedDevicePoseUpdated(this->driverId, GetPose(), sizeof(vr::DriverPose_t));
-	VRDriverInput()->UpdateScalarComponent(GripHandle, controllerData.gripState, 0);
-	VRDriverInput()->UpdateBooleanComponent(GripTouchHandle, controllerData.gripState > 0.95f, 0);
-	VRDriverInput()->UpdateScalarComponent(TriggerHandle, controllerData.triggerState, 0);
-	VRDriverInput()->UpdateBooleanComponent(TriggerTouchHandle, controllerData.triggerState > 0.95f, 0);
-	VRDriverInput()->UpdateBooleanComponent(joystickTouchHandle, controllerData.joystickTouch, 0);
-	VRDriverInput()->UpdateBooleanComponent(joystickClickHandle, controllerData.joystickClick, 0);
-	VRDriverInput()->UpdateBooleanComponent(thumbrestHandle, controllerData.joystickThumbrest, 0);
+	BufferCompression::ControllerState latestState;
+	bool applied = false;
+	if (jitterBufferEnabled) {
+		applied = jitterBuffer.sample(NetTelemetry::nowUs(), latestState, interpolateState);
+		// The jitter buffer blends packets; with IMU batches there are samples between them to use instead.
+		BufferCompression::ControllerState imu;
+		if (applied && latestState.sampleTimeUs && imuHistory.at(latestState.sampleTimeUs, imu, interpolateState)) {
+			latestState.hasOrientation = imu.hasOrientation;
+			latestState.orientation = imu.orientation;
+			latestState.gyro = imu.gyro;
+		}
+	}
+	else applied = stateMailbox.consume(latestState);
+	if (applied) {
+		ReadBuffer(latestState);
+		if (controllerData.sampleTimeUs) poseScheduler.observe(controllerData.controllerRotation, controllerData.sampleTimeUs);
+	}
+	UpdateSendRate(applied ? &latestState : nullptr);
+	inputFastLane.onFrame(NetTelemetry::nowUs());
+
+	SampleDisplayTiming();
+	SubmitFramePose();
+	// With the fast lane on, the discrete inputs were already submitted from the network thread.
+	if (!inputFastLaneEnabled) {
+		VRDriverInput()->UpdateScalarComponent(GripHandle, controllerData.gripState, 0);
+		VRDriverInput()->UpdateBooleanComponent(GripTouchHandle, controllerData.gripState > 0.95f, 0);
+		VRDriverInput()->UpdateScalarComponent(TriggerHandle, controllerData.triggerState, 0);
+		VRDriverInput()->UpdateBooleanComponent(TriggerTouchHandle, controllerData.triggerState > 0.95f, 0);
+		VRDriverInput()->UpdateBooleanComponent(joystickTouchHandle, controllerData.joystickTouch, 0);
+		VRDriverInput()->UpdateBooleanComponent(joystickClickHandle, controllerData.joystickClick, 0);
+		VRDriverInput()->UpdateBooleanComponent(thumbrestHandle, controllerData.joystickThumbrest, 0);
+		VRDriverInput()->UpdateBooleanComponent(SystemHandle, controllerData.btnSystem, 0);
+	}
 	VRDriverInput()->UpdateScalarComponent(joystickXHandle, controllerData.joystickX, 0);
 	VRDriverInput()->UpdateScalarComponent(joystickYHandle, controllerData.joystickY, 0);
-	VRDriverInput()->UpdateBooleanComponent(SystemHandle, controllerData.btnSystem, 0);
 
 	vr::VRProperties()->SetFloatProperty(props, vr::Prop_DeviceBatteryPercentage_Float, static_cast<float>(controllerData.batteryPercentage));
 	vr::VRProperties()->SetBoolProperty(props, vr::Prop_DeviceIsCharging_Bool, controllerData.isCharging);
@@ -258,24 +544,28 @@ void ControllerDriver::RunFrame()
 		if (vrEvent.eventType != vr::VREvent_Input_HapticVibration)
 			continue;
 
-		if (vrEvent.data.hapticVibration.componentHandle == hapticHandleL) {
-			// LOG("hapticEvent_L");
-			std::string result = BufferCompression::compressResponseData(true,
-				vrEvent.data.hapticVibration.fAmplitude,
-				vrEvent.data.hapticVibration.fFrequency,
-				vrEvent.data.hapticVibration.fDurationSeconds);
-			tcpSocketObj->broadcastMessage(result.c_str());
-		}
-		if (vrEvent.data.hapticVibration.componentHandle != hapticHandleL) {
-			// LOG("hapticEvent_R");
-			std::string result = BufferCompression::compressResponseData(false,
-				vrEvent.data.hapticVibration.fAmplitude,
-				vrEvent.data.hapticVibration.fFrequency,
-				vrEvent.data.hapticVibration.fDurationSeconds);
-			tcpSocketObj->broadcastMessage(result.c_str());
+		const vr::VREvent_HapticVibration_t& haptic = vrEvent.data.hapticVibration;
+		const bool left = haptic.componentHandle == hapticHandleL;
+		// Phones without envelopes still get every pulse on its own.
+		std::string result = BufferCompression::encodeResponseData(left, haptic.fAmplitude, haptic.fFrequency, haptic.fDurationSeconds);
+		tcpSocketObj->broadcastMessage(FrameType::Haptic, result);
+
+		if (tcpSocketObj->WantsHapticEnvelopes()) {
+			HapticEnvelope& envelope = hapticEnvelopes[left ? 1 : 0];
+			const uint64_t nowUs = NetTelemetry::nowUs();
+			if (!envelope.add(nowUs, haptic.fAmplitude, haptic.fFrequency, haptic.fDurationSeconds)) {
+				tcpSocketObj->broadcastMessage(FrameType::HapticEnvelope, envelope.take());
+				envelope.add(nowUs, haptic.fAmplitude, haptic.fFrequency, haptic.fDurationSeconds);
+			}
 		}
 	}
 
+	const uint64_t hapticNowUs = NetTelemetry::nowUs();
+	for (HapticEnvelope& envelope : hapticEnvelopes) {
+		if (envelope.due(hapticNowUs)) tcpSocketObj->broadcastMessage(FrameType::HapticEnvelope, envelope.take());
+	}
+
+	if (inputFastLaneEnabled) return;
 	switch (ControllerIndex) {
 	case 1:
 		// left
@@ -292,6 +582,7 @@ void ControllerDriver::RunFrame()
 
 void ControllerDriver::Deactivate()
 {
+	inputActive.store(false, std::memory_order_release);
 	driverId = k_unTrackedDeviceIndexInvalid;
 }
 
@@ -313,4 +604,45 @@ void ControllerDriver::DebugRequest(const char* pchRequest, char* pchResponseBuf
 	{
 		pchResponseBuffer[0] = 0;
 	}
+
+	if (unResponseBufferSize > 1 && pchRequest != nullptr && strcmp(pchRequest, "stats") == 0)
+	{
+		auto st = stateMailbox.getStats();
+		auto jb = jitterBuffer.getStats();
+		auto age = GetAgeStats();
+		auto rate = sendRate.getStats();
+		auto lane = inputFastLane.getStats();
+		auto imu = imuHistory.getStats();
+		auto poses = poseScheduler.getStats();
+		TcpSocketClass::SessionStats sessions;
+		if (tcpSocketObj) sessions = tcpSocketObj->GetSessionStats();
+		std::string links = telemetry ? telemetry->toJson() : "[]";
+		snprintf(pchResponseBuffer, unResponseBufferSize,
+			"{\"published\":%llu,\"consumed\":%llu,\"dropped\":%llu,"
+			"\"jitterBuffer\":{\"enabled\":%s,\"delayUs\":%u,\"jitterUs\":%u,\"periodUs\":%u,\"pushed\":%llu,\"played\":%llu,"
+			"\"late\":%llu,\"underruns\":%llu,\"overflow\":%llu},"
+			"\"age\":{\"lastUs\":%u,\"smoothedUs\":%u,\"stamped\":%llu},"
+			"\"sessions\":{\"resumed\":%llu,\"heartbeatTimeouts\":%llu},"
+			"\"sendRate\":{\"adaptive\":%s,\"targetHz\":%u,\"displayHz\":%u,\"motionDegS\":%u,\"achievedHz\":%u,\"bytesPerSec\":%u,"
+			"\"baselineHz\":%u,\"savedPerSec\":%u,\"bytesSavedPerSec\":%u,\"decodeNs\":%u,\"decodeUsSavedPerSec\":%u,\"rateChanges\":%llu},"
+			"\"inputFastLane\":{\"enabled\":%s,\"edges\":%llu,\"stale\":%llu,\"submitNs\":%u,\"frameWaitUs\":%u,\"timeOffsetUs\":%u},"
+			"\"imuHistory\":{\"pushed\":%llu,\"stale\":%llu,\"resets\":%llu},"
+			"\"poseScheduler\":{\"mode\":\"%s\",\"submitted\":%llu,\"arrivals\":%llu,\"sampleAgeUs\":%u,\"photonAgeUs\":%u,\"predictUs\":%u,"
+			"\"framePeriodUs\":%u,\"vsyncToPhotonsUs\":%u},"
+			"\"links\":%s}",
+			(unsigned long long)st.published, (unsigned long long)st.consumed, (unsigned long long)st.dropped,
+			jitterBufferEnabled ? "true" : "false", jb.delayUs, jb.jitterUs, jb.periodUs, (unsigned long long)jb.pushed, (unsigned long long)jb.played,
+			(unsigned long long)jb.late, (unsigned long long)jb.underruns, (unsigned long long)jb.overflow,
+			age.lastUs, age.smoothedUs, (unsigned long long)age.stamped,
+			(unsigned long long)sessions.resumed, (unsigned long long)sessions.heartbeatTimeouts,
+			sendRateEnabled ? "true" : "false", rate.targetHz, rate.displayHz, rate.motionDegS, rate.achievedHz, rate.bytesPerSec,
+			SendRateController::kBaselineHz, rate.savedPerSec, rate.bytesSavedPerSec, rate.decodeNs, rate.decodeUsSavedPerSec,
+			(unsigned long long)rate.rateChanges,
+			inputFastLaneEnabled ? "true" : "false", (unsigned long long)lane.edges, (unsigned long long)lane.stale,
+			lane.submitNs, lane.frameWaitUs, lane.timeOffsetUs,
+			(unsigned long long)imu.pushed, (unsigned long long)imu.stale, (unsigned long long)imu.resets,
+			PoseScheduler::modeName(poseScheduler.getMode()), (unsigned long long)poses.submitted, (unsigned long long)poses.arrivals,
+			poses.sampleAgeUs, poses.photonAgeUs, poses.predictUs, poses.framePeriodUs, poses.vsyncToPhotonsUs,
+			links.c_str());
+	}
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "TcpServer.h"
+#include "UdpServer.h"
+#include "ShmTransport.h"
 #include <DeviceProvider.h>
 #include <thread>
 #include "InterfaceHookInjector.h"
@@ -8,12 +10,16 @@
 #include "PositionalTracking.h"
 #include "DriverConfig.h"
 
-void GetSensorData(TcpSocketClass* tcpSocketObject, ControllerDriver* left, ControllerDriver* right);
+void DispatchControllerMessage(ControllerDriver* left, ControllerDriver* right, WireMode mode, const Frame& frame);
+SessionLimits SessionLimitsFromConfig(const DriverConfig::configStruct& cfg);
 
 void GetPositionalData(PositionalTrackingClass* posTrackingObject);
 void InterpolatePositionalData(PositionalTrackingClass* posTrackingObject);
 
 TcpSocketClass* tcpSocketObj;
+UdpSocketClass* udpSocketObj;
+ShmTransportClass* shmTransportObj;
+NetTelemetry* netTelemetryObj;
 PositionalTrackingClass* posTrackingObj;
 DriverConfig* driverConfigObj;
 
@@ -48,15 +54,60 @@ EVRInitError DeviceProvider::Init(IVRDriverContext* pDriverContext)
     controllerDriverL->SetControllerIndex(1);
     VRServerDriverHost()->TrackedDeviceAdded("WMHD315M3114GV", TrackedDeviceClass_Controller, controllerDriverL);
 
+    driverConfigObj = new DriverConfig();
+
+    netTelemetryObj = new NetTelemetry();
+    controllerDriverR->SetTelemetry(netTelemetryObj);
+    controllerDriverL->SetTelemetry(netTelemetryObj);
+
+    const auto& cfg = driverConfigObj->getConfig();
+    const uint32_t maxPlayoutDelayUs = static_cast<uint32_t>(std::max<int>(cfg.netJitterBufferMaxDelayMs, 0)) * 1000;
+    controllerDriverR->SetJitterBuffer(cfg.netJitterBuffer, maxPlayoutDelayUs);
+    controllerDriverL->SetJitterBuffer(cfg.netJitterBuffer, maxPlayoutDelayUs);
+    const uint32_t idleRateHz = static_cast<uint32_t>(std::max<int>(cfg.netIdleRateHz, 0));
+    controllerDriverR->SetSendRate(cfg.netAdaptiveRate, idleRateHz);
+    controllerDriverL->SetSendRate(cfg.netAdaptiveRate, idleRateHz);
+    controllerDriverR->SetInputFastLane(cfg.netInputFastLane);
+    controllerDriverL->SetInputFastLane(cfg.netInputFastLane);
+    const PoseScheduler::Mode poseMode = PoseScheduler::parseMode(cfg.netPoseScheduler);
+    controllerDriverR->SetPoseScheduler(poseMode);
+    controllerDriverL->SetPoseScheduler(poseMode);
+
     tcpSocketObj = new TcpSocketClass();
-    std::thread getSensorDatathread(GetSensorData, tcpSocketObj,controllerDriverL,controllerDriverR);
-    getSensorDatathread.detach();
+    tcpSocketObj->SetTelemetry(netTelemetryObj);
+    tcpSocketObj->SetLimits(SessionLimitsFromConfig(driverConfigObj->getConfig()));
+    // The IMU history is only read on the jitter buffer's path.
+    tcpSocketObj->SetImuBatch(cfg.netJitterBuffer);
+    tcpSocketObj->SetMessageHandler([left = controllerDriverL, right = controllerDriverR](SOCKET, WireMode mode, const Frame& frame) {
+        DispatchControllerMessage(left, right, mode, frame);
+    });
+    tcpSocketObj->Connect(9775);
+
+    // Controller state may also arrive over UDP on the same port number, but only from
+    // phones that logged in over TCP first; each datagram names its TCP session.
+    udpSocketObj = new UdpSocketClass();
+    udpSocketObj->SetTelemetry(netTelemetryObj);
+    udpSocketObj->SetPeerFilter([tcp = tcpSocketObj](const sockaddr_in& from, uint32_t session) {
+        return tcp->HasSession(session, from.sin_addr.s_addr);
+    });
+    udpSocketObj->SetMessageHandler([left = controllerDriverL, right = controllerDriverR](SOCKET, WireMode mode, const Frame& frame) {
+        DispatchControllerMessage(left, right, mode, frame);
+    });
+    udpSocketObj->Connect(9775);
+
+    // Same-host producers, off unless enabled in driver_config.json.
+    shmTransportObj = new ShmTransportClass();
+    if (driverConfigObj->getConfig().netSharedMemory) {
+        shmTransportObj->SetTelemetry(netTelemetryObj);
+        shmTransportObj->SetMessageHandler([left = controllerDriverL, right = controllerDriverR](SOCKET, WireMode mode, const Frame& frame) {
+            DispatchControllerMessage(left, right, mode, frame);
+        });
+        shmTransportObj->Connect();
+    }
 
     posTrackingObj = new PositionalTrackingClass();
     HRESULT hr = posTrackingObj->sensorInit();
 
-    driverConfigObj = new DriverConfig();
-    
     posTrackingObj->setSensorTilt(driverConfigObj->getConfig().sensorTilt);
     TrackingEMA::headFilter.setAlpha(static_cast<float>(driverConfigObj->getConfig().headEMA));
     TrackingEMA::lhFilter.setAlpha(static_cast<float>(driverConfigObj->getConfig().leftHandEMA));
@@ -81,43 +132,124 @@ void DeviceProvider::Cleanup()
     posTrackingObj->isRunning = false;
     posTrackingObj->sensorShutdown();
 
+    shmTransportObj->Close();
+    delete shmTransportObj;
+    udpSocketObj->CloseSocket();
+    delete udpSocketObj;
     tcpSocketObj->CloseSocket();
     delete tcpSocketObj;
     delete controllerDriverL;
     delete controllerDriverR;
     controllerDriverL = NULL;
     controllerDriverR = NULL;
+    delete netTelemetryObj;
+    netTelemetryObj = NULL;
 
     DisableHooks();
     VR_CLEANUP_SERVER_DRIVER_CONTEXT();
 }
 
-void GetSensorData(TcpSocketClass* SocketObject,ControllerDriver* left, ControllerDriver* right) {
-    SocketObject->Connect(9775);
-    while (SocketObject->GetStatus()) {
-        char buffer[2048];
-        SocketObject->Receive(buffer);
-        BufferCompression::ControllerState controllerState = BufferCompression::decryptControllerState(std::string(buffer));
-
-        // std::ostringstream oss;
-        // oss << std::boolalpha;
-        // oss << "left_controller: " << controllerState.left_controller << "\n";
-        // oss << "btn_system_or_menu_state: " << controllerState.btn_system_or_menu_state << "\n";
-        // oss << "btn_a_or_x_state: " << controllerState.btn_a_or_x_state << "\n";
-        // oss << "btn_b_or_y_state: " << controllerState.btn_b_or_y_state << "\n";
-        // oss << "controller_battery_plugged: " << controllerState.controller_battery_plugged << "\n";
-        // oss << "joy_in_dz: " << controllerState.joy_in_dz << "\n";
-        // oss << "trigger_state: " << +controllerState.trigger_state << "\n";
-        // oss << "grip_state: " << +controllerState.grip_state << "\n";
-        // oss << "joy_state: " << +controllerState.joy_state << "\n";
-        // oss << "batteryPercentage: " << +controllerState.batteryPercentage << "\n";
-        // oss << "gyro: " << controllerState.gyro.x << ", " << controllerState.gyro.y << ", " << controllerState.gyro.z << "\n";
-        // oss << "joy:  " << controllerState.joy.x << ", " << controllerState.joy.y << "\n";
-        // LOG(oss.str().c_str());
-        
-        left->ReadBuffer(controllerState);
-        right->ReadBuffer(controllerState);
+SessionLimits SessionLimitsFromConfig(const DriverConfig::configStruct& cfg) {
+    SessionLimits limits;
+    limits.maxQueuedMessages = static_cast<size_t>(std::max<int>(cfg.netMaxQueuedMessages, 0));
+    limits.maxQueuedBytes = static_cast<size_t>(std::max<int>(cfg.netMaxQueuedBytes, 0));
+    limits.maxInboundBytesPerSec = static_cast<uint32_t>(std::max<int>(cfg.netMaxInboundBytesPerSec, 0));
+    limits.maxInboundMessagesPerSec = static_cast<uint32_t>(std::max<int>(cfg.netMaxInboundMessagesPerSec, 0));
+
+    if (cfg.netOutboundPolicy == "dropOldest") limits.outboundPolicy = SessionLimits::OutboundPolicy::DropOldest;
+    else if (cfg.netOutboundPolicy == "disconnect") limits.outboundPolicy = SessionLimits::OutboundPolicy::Disconnect;
+    else limits.outboundPolicy = SessionLimits::OutboundPolicy::Coalesce;
+
+    limits.inboundPolicy = cfg.netInboundPolicy == "disconnect"
+        ? SessionLimits::InboundPolicy::Disconnect
+        : SessionLimits::InboundPolicy::Throttle;
+    return limits;
+}
+
+// Runs on the network thread. Decodes and hands the state to its hand's mailbox, the
+// vrserver thread applies it in ControllerDriver::RunFrame.
+void DispatchControllerMessage(ControllerDriver* left, ControllerDriver* right, WireMode mode, const Frame& frame) {
+    if (frame.type != FrameType::ControllerState) return;
+
+    // Quantization agreed in the session's hello, same-host producers use the defaults.
+    const Handshake::WireFormat format = (frame.session && tcpSocketObj) ? tcpSocketObj->PeerFormat(frame.session) : Handshake::WireFormat{};
+
+    const auto decodeStart = std::chrono::steady_clock::now();
+    BufferCompression::ControllerState controllerState;
+    std::span<const uint8_t> bytes(reinterpret_cast<const uint8_t*>(frame.payload.data()), frame.payload.size());
+
+    // The IMU batch sits after the packet, whatever its codec.
+    const bool imuBatch = mode == WireMode::Binary && format.imuBatch;
+    std::span<const uint8_t> imuBytes;
+    if (imuBatch) {
+        size_t packetLen = 0;
+        if (s2uk_packet::splitImuBatch(bytes.data(), bytes.size(), packetLen) != s2uk_packet::Status::Ok) return;
+        imuBytes = bytes.subspan(packetLen, bytes.size() - packetLen - 1);
+        bytes = bytes.first(packetLen);
+    }
+
+    BufferCompression::DecodeStatus status;
+    s2uk_packet::ControllerPacket packet;
+    const bool delta = mode == WireMode::Binary && format.codec == Handshake::Codec::Delta && tcpSocketObj;
+    if (delta || imuBatch) {
+        // Deltas are against the phone's last keyframe, kept with its login; the batch's
+        // samples are against the packet's values.
+        status = BufferCompression::toDecodeStatus(delta
+            ? tcpSocketObj->DecodeDelta(frame.session, bytes.data(), bytes.size(), packet)
+            : s2uk_packet::decode(bytes.data(), bytes.size(), format.codec, packet));
+        if (status == BufferCompression::DecodeStatus::Ok) controllerState = BufferCompression::fromPacket(packet, format);
+    }
+    else {
+        status = (mode == WireMode::Binary)
+            ? BufferCompression::decodeControllerState(bytes, controllerState, format)
+            : BufferCompression::decryptControllerState(frame.payload, controllerState, format);
+    }
+    if (status != BufferCompression::DecodeStatus::Ok) {
+        return; // malformed packet, or a delta without its keyframe: keep the last good state
+    }
+
+    // A phone that announced its hand only drives that one.
+    if (format.role != Handshake::Role::Auto && controllerState.left_controller != (format.role == Handshake::Role::Left)) {
+        return;
+    }
+
+    // Sensor time on the phone's clock -> ours. Same-host producers already stamp with our clock.
+    if (controllerState.senderTimeUs) {
+        if (frame.peerAddr == 0) controllerState.sampleTimeUs = controllerState.senderTimeUs;
+        else if (tcpSocketObj) tcpSocketObj->MapPeerTime(frame.session, controllerState.senderTimeUs, controllerState.sampleTimeUs);
+    }
+
+    // std::ostringstream oss;
+    // oss << std::boolalpha;
+    // oss << "left_controller: " << controllerState.left_controller << "\n";
+    // oss << "btn_system_or_menu_state: " << controllerState.btn_system_or_menu_state << "\n";
+    // oss << "btn_a_or_x_state: " << controllerState.btn_a_or_x_state << "\n";
+    // oss << "btn_b_or_y_state: " << controllerState.btn_b_or_y_state << "\n";
+    // oss << "controller_battery_plugged: " << controllerState.controller_battery_plugged << "\n";
+    // oss << "joy_in_dz: " << controllerState.joy_in_dz << "\n";
+    // oss << "trigger_state: " << +controllerState.trigger_state << "\n";
+    // oss << "grip_state: " << +controllerState.grip_state << "\n";
+    // oss << "joy_state: " << +controllerState.joy_state << "\n";
+    // oss << "batteryPercentage: " << +controllerState.batteryPercentage << "\n";
+    // oss << "gyro: " << controllerState.gyro.x << ", " << controllerState.gyro.y << ", " << controllerState.gyro.z << "\n";
+    // oss << "joy:  " << controllerState.joy.x << ", " << controllerState.joy.y << "\n";
+    // LOG(oss.str().c_str());
+
+    ControllerDriver* hand = controllerState.left_controller ? left : right;
+    const auto decodeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - decodeStart).count();
+    hand->AccountPacket(frame.session, frame.payload.size(), static_cast<uint32_t>(std::min<int64_t>(decodeNs, UINT32_MAX)));
+
+    // Only samples on our clock can go in the history; until the clocks sync they are dropped.
+    if (imuBatch && controllerState.sampleTimeUs) {
+        s2uk_packet::ImuBatch batch;
+        if (s2uk_packet::decode(imuBytes.data(), imuBytes.size(), packet, batch) == s2uk_packet::Status::Ok) {
+            BufferCompression::ControllerState samples[s2uk_packet::kMaxImuSamples];
+            const size_t n = BufferCompression::fromImuBatch(batch, packet, controllerState, samples, format);
+            for (size_t i = 0; i < n; ++i) hand->PushImuSample(samples[i]);
+        }
+        hand->PushImuSample(controllerState);
     }
+    hand->PublishState(controllerState);
 }
 
 void GetPositionalData(PositionalTrackingClass* posTrackingObject) {
@@ -33,6 +33,21 @@ bool DriverConfig::writeConfig() {
         json["leftHandEMA"] = cfg.leftHandEMA;
         json["rightHandEMA"] = cfg.rightHandEMA;
         json["sensorTilt"] = cfg.sensorTilt;
+        json["network"] = {
+            { "maxQueuedMessages", cfg.netMaxQueuedMessages },
+            { "maxQueuedBytes", cfg.netMaxQueuedBytes },
+            { "outboundPolicy", cfg.netOutboundPolicy },
+            { "maxInboundBytesPerSec", cfg.netMaxInboundBytesPerSec },
+            { "maxInboundMessagesPerSec", cfg.netMaxInboundMessagesPerSec },
+            { "inboundPolicy", cfg.netInboundPolicy },
+            { "sharedMemory", cfg.netSharedMemory },
+            { "jitterBuffer", cfg.netJitterBuffer },
+            { "jitterBufferMaxDelayMs", cfg.netJitterBufferMaxDelayMs },
+            { "adaptiveRate", cfg.netAdaptiveRate },
+            { "idleRateHz", cfg.netIdleRateHz },
+            { "inputFastLane", cfg.netInputFastLane },
+            { "poseScheduler", cfg.netPoseScheduler },
+        };
 
         std::ofstream ofs(cfgPath);
         if (!ofs.is_open()) return false;
@@ -66,6 +81,25 @@ bool DriverConfig::readConfig_i(configStruct& out) {
         out.rightHandEMA = json["rightHandEMA"].get<double>();
         out.sensorTilt = json["sensorTilt"].get<int>();
 
+        // Added later, older configs don't have it: keep the defaults.
+        if (json.contains("network")) {
+            const auto& net = json["network"];
+            configStruct defaults;
+            out.netMaxQueuedMessages = net.value("maxQueuedMessages", defaults.netMaxQueuedMessages);
+            out.netMaxQueuedBytes = net.value("maxQueuedBytes", defaults.netMaxQueuedBytes);
+            out.netOutboundPolicy = net.value("outboundPolicy", defaults.netOutboundPolicy);
+            out.netMaxInboundBytesPerSec = net.value("maxInboundBytesPerSec", defaults.netMaxInboundBytesPerSec);
+            out.netMaxInboundMessagesPerSec = net.value("maxInboundMessagesPerSec", defaults.netMaxInboundMessagesPerSec);
+            out.netInboundPolicy = net.value("inboundPolicy", defaults.netInboundPolicy);
+            out.netSharedMemory = net.value("sharedMemory", defaults.netSharedMemory);
+            out.netJitterBuffer = net.value("jitterBuffer", defaults.netJitterBuffer);
+            out.netJitterBufferMaxDelayMs = net.value("jitterBufferMaxDelayMs", defaults.netJitterBufferMaxDelayMs);
+            out.netAdaptiveRate = net.value("adaptiveRate", defaults.netAdaptiveRate);
+            out.netIdleRateHz = net.value("idleRateHz", defaults.netIdleRateHz);
+            out.netInputFastLane = net.value("inputFastLane", defaults.netInputFastLane);
+            out.netPoseScheduler = net.value("poseScheduler", defaults.netPoseScheduler);
+        }
+
         LOG("Read config successfully.");
 
         return true;
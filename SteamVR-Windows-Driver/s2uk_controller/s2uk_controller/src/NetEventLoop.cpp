@@ -0,0 +1,282 @@
+#include "NetEventLoop.h"
+#include "VRLog.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+NetEventLoop::~NetEventLoop() {
+    stop();
+    if (initialized) backendShutdown();
+}
+
+bool NetEventLoop::init() {
+    if (initialized) return true;
+    initialized = backendInit();
+    return initialized;
+}
+
+bool NetEventLoop::add(SOCKET sock, uint32_t interest, IoHandler handler) {
+    if (!backendAdd(sock, interest)) return false;
+    entries[sock] = Entry{ interest, std::move(handler) };
+    return true;
+}
+
+bool NetEventLoop::modify(SOCKET sock, uint32_t interest) {
+    auto it = entries.find(sock);
+    if (it == entries.end()) return false;
+    if (it->second.interest == interest) return true;
+    if (!backendModify(sock, interest)) return false;
+    it->second.interest = interest;
+    return true;
+}
+
+void NetEventLoop::remove(SOCKET sock) {
+    if (entries.erase(sock) == 0) return;
+    backendRemove(sock);
+}
+
+void NetEventLoop::addTimer(std::chrono::milliseconds period, Task task) {
+    timers.push_back({ period, std::chrono::steady_clock::now() + period, std::move(task) });
+}
+
+void NetEventLoop::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lockGuard(postedMutex);
+        posted.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+void NetEventLoop::run() {
+    loopThread = std::this_thread::get_id();
+    // A stop() that came before this thread got here still counts.
+    while (!stopRequested) {
+        backendWait(waitTimeoutMs());
+        runPosted();
+        runTimers();
+    }
+    runPosted();
+    stopRequested = false; // the loop can be run again
+    loopThread = std::thread::id{};
+}
+
+void NetEventLoop::stop() {
+    stopRequested = true;
+    if (initialized) wakeup();
+}
+
+int NetEventLoop::waitTimeoutMs() const {
+    if (timers.empty()) return 1000;
+
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::min_element(timers.begin(), timers.end(),
+        [](const Timer& a, const Timer& b) { return a.due < b.due; })->due;
+    if (next <= now) return 0;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+    return static_cast<int>(std::min<long long>(ms, 1000));
+}
+
+void NetEventLoop::runTimers() {
+    auto now = std::chrono::steady_clock::now();
+    // Index loop: a timer task may register another timer.
+    for (size_t i = 0; i < timers.size(); ++i) {
+        if (timers[i].due > now) continue;
+        timers[i].due = now + timers[i].period;
+        Task task = timers[i].task;
+        task();
+    }
+}
+
+void NetEventLoop::runPosted() {
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lockGuard(postedMutex);
+        tasks.swap(posted);
+    }
+    for (auto& task : tasks) task();
+}
+
+void NetEventLoop::dispatch(SOCKET sock, uint32_t events) {
+    auto it = entries.find(sock);
+    if (it == entries.end()) return; // removed earlier in this batch
+
+    // Copy: the handler may remove itself and invalidate the entry.
+    IoHandler handler = it->second.handler;
+    handler(sock, events);
+}
+
+#ifdef _WIN32
+// ---------------- WSAPoll backend ----------------
+
+static short toPollEvents(uint32_t interest) {
+    short ev = 0;
+    if (interest & NetEventLoop::Readable) ev |= POLLRDNORM;
+    if (interest & NetEventLoop::Writable) ev |= POLLWRNORM;
+    return ev;
+}
+
+bool NetEventLoop::backendInit() {
+    wakeSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (wakeSock == INVALID_SOCKET) { LOG("NetEventLoop: wake socket() failed: %d", s2uk_net::lastError()); return false; }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int addrLen = sizeof(addr);
+    if (bind(wakeSock, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(wakeSock, (SOCKADDR*)&addr, &addrLen) == SOCKET_ERROR ||
+        connect(wakeSock, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        LOG("NetEventLoop: wake socket setup failed: %d", s2uk_net::lastError());
+        s2uk_net::closeSocket(wakeSock);
+        wakeSock = INVALID_SOCKET;
+        return false;
+    }
+    s2uk_net::setNonBlocking(wakeSock);
+    pollSetDirty = true;
+    return true;
+}
+
+void NetEventLoop::backendShutdown() {
+    if (wakeSock != INVALID_SOCKET) s2uk_net::closeSocket(wakeSock);
+    wakeSock = INVALID_SOCKET;
+}
+
+bool NetEventLoop::backendAdd(SOCKET, uint32_t) { pollSetDirty = true; return true; }
+bool NetEventLoop::backendModify(SOCKET, uint32_t) { pollSetDirty = true; return true; }
+void NetEventLoop::backendRemove(SOCKET) { pollSetDirty = true; }
+
+void NetEventLoop::wakeup() {
+    if (wakePending.exchange(true)) return;
+    char b = 0;
+    send(wakeSock, &b, 1, 0);
+}
+
+void NetEventLoop::drainWakeup() {
+    char buf[64];
+    while (recv(wakeSock, buf, sizeof(buf), 0) > 0) {}
+    wakePending = false;
+}
+
+void NetEventLoop::backendWait(int timeoutMs) {
+    if (pollSetDirty) {
+        pollSet.clear();
+        pollSet.push_back({ wakeSock, POLLRDNORM, 0 });
+        for (auto& [sock, entry] : entries) {
+            pollSet.push_back({ sock, toPollEvents(entry.interest), 0 });
+        }
+        pollSetDirty = false;
+    }
+    else {
+        for (auto& pfd : pollSet) pfd.revents = 0;
+    }
+
+    int n = WSAPoll(pollSet.data(), static_cast<ULONG>(pollSet.size()), timeoutMs);
+    if (n == SOCKET_ERROR) {
+        LOG("WSAPoll() failed with error: %d", s2uk_net::lastError());
+        return;
+    }
+    if (n == 0) return;
+
+    // Handlers can dirty pollSet, so collect first.
+    std::vector<std::pair<SOCKET, uint32_t>> ready;
+    ready.reserve(n);
+    for (auto& pfd : pollSet) {
+        if (pfd.revents == 0) continue;
+        if (pfd.fd == wakeSock) { drainWakeup(); continue; }
+
+        uint32_t ev = 0;
+        if (pfd.revents & (POLLRDNORM | POLLHUP)) ev |= Readable;
+        if (pfd.revents & POLLWRNORM) ev |= Writable;
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ev |= Error;
+        ready.emplace_back(pfd.fd, ev);
+    }
+    for (auto& [sock, ev] : ready) dispatch(sock, ev);
+}
+
+#else
+// ---------------- epoll backend ----------------
+
+static uint32_t toEpollEvents(uint32_t interest) {
+    uint32_t ev = 0;
+    if (interest & NetEventLoop::Readable) ev |= EPOLLIN | EPOLLRDHUP;
+    if (interest & NetEventLoop::Writable) ev |= EPOLLOUT;
+    return ev;
+}
+
+bool NetEventLoop::backendInit() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) { LOG("NetEventLoop: epoll_create1() failed: %d", errno); return false; }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) { LOG("NetEventLoop: eventfd() failed: %d", errno); close(epollFd); epollFd = -1; return false; }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+    return true;
+}
+
+void NetEventLoop::backendShutdown() {
+    if (wakeFd >= 0) close(wakeFd);
+    if (epollFd >= 0) close(epollFd);
+    wakeFd = epollFd = -1;
+}
+
+bool NetEventLoop::backendAdd(SOCKET sock, uint32_t interest) {
+    epoll_event ev{};
+    ev.events = toEpollEvents(interest);
+    ev.data.fd = sock;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &ev) == 0;
+}
+
+bool NetEventLoop::backendModify(SOCKET sock, uint32_t interest) {
+    epoll_event ev{};
+    ev.events = toEpollEvents(interest);
+    ev.data.fd = sock;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, sock, &ev) == 0;
+}
+
+void NetEventLoop::backendRemove(SOCKET sock) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, nullptr);
+}
+
+void NetEventLoop::wakeup() {
+    if (wakePending.exchange(true)) return;
+    uint64_t one = 1;
+    ssize_t r = write(wakeFd, &one, sizeof(one));
+    (void)r;
+}
+
+void NetEventLoop::drainWakeup() {
+    uint64_t value;
+    ssize_t r = read(wakeFd, &value, sizeof(value));
+    (void)r;
+    wakePending = false;
+}
+
+void NetEventLoop::backendWait(int timeoutMs) {
+    epoll_event events[64];
+    int n = epoll_wait(epollFd, events, 64, timeoutMs);
+    if (n < 0) {
+        if (errno != EINTR) LOG("epoll_wait() failed with error: %d", errno);
+        return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == wakeFd) { drainWakeup(); continue; }
+
+        uint32_t ev = 0;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) ev |= Readable;
+        if (events[i].events & EPOLLOUT) ev |= Writable;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) ev |= Error;
+        dispatch(fd, ev);
+    }
+}
+#endif
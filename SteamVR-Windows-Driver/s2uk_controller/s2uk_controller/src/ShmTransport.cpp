@@ -0,0 +1,258 @@
+#include "ShmTransport.h"
+#include "VRLog.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// ---------------- Mapping ----------------
+
+#ifdef _WIN32
+bool ShmRing::Mapping::create(const char* name, size_t size) {
+    close();
+    HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), name);
+    if (!h) { LOG("ShmRing: CreateFileMapping() failed: %lu", GetLastError()); return false; }
+
+    void* v = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!v) { LOG("ShmRing: MapViewOfFile() failed: %lu", GetLastError()); CloseHandle(h); return false; }
+
+    handle = h;
+    view = v;
+    mappedSize = size;
+    owner = true;
+    mappedName = name;
+    return true;
+}
+
+bool ShmRing::Mapping::open(const char* name, size_t size) {
+    close();
+    HANDLE h = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    if (!h) return false;
+
+    void* v = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!v) { CloseHandle(h); return false; }
+
+    handle = h;
+    view = v;
+    mappedSize = size;
+    owner = false;
+    mappedName = name;
+    return true;
+}
+
+void ShmRing::Mapping::close() {
+    // The kernel drops the object once the last handle is gone.
+    if (view) UnmapViewOfFile(view);
+    if (handle) CloseHandle(static_cast<HANDLE>(handle));
+    view = nullptr;
+    handle = nullptr;
+    mappedSize = 0;
+    owner = false;
+}
+#else
+bool ShmRing::Mapping::create(const char* name, size_t size) {
+    close();
+    int f = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (f < 0) { LOG("ShmRing: shm_open() failed: %d", errno); return false; }
+    if (ftruncate(f, static_cast<off_t>(size)) != 0) { LOG("ShmRing: ftruncate() failed: %d", errno); ::close(f); return false; }
+
+    void* v = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    if (v == MAP_FAILED) { LOG("ShmRing: mmap() failed: %d", errno); ::close(f); return false; }
+
+    fd = f;
+    view = v;
+    mappedSize = size;
+    owner = true;
+    mappedName = name;
+    return true;
+}
+
+bool ShmRing::Mapping::open(const char* name, size_t size) {
+    close();
+    int f = shm_open(name, O_RDWR, 0);
+    if (f < 0) return false;
+
+    struct stat st {};
+    if (fstat(f, &st) != 0 || static_cast<size_t>(st.st_size) < size) { ::close(f); return false; }
+
+    void* v = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+    if (v == MAP_FAILED) { ::close(f); return false; }
+
+    fd = f;
+    view = v;
+    mappedSize = size;
+    owner = false;
+    mappedName = name;
+    return true;
+}
+
+void ShmRing::Mapping::close() {
+    if (view) munmap(view, mappedSize);
+    if (fd >= 0) ::close(fd);
+    if (owner) shm_unlink(mappedName.c_str());
+    view = nullptr;
+    fd = -1;
+    mappedSize = 0;
+    owner = false;
+}
+#endif
+
+// ---------------- Producer ----------------
+
+bool ShmRing::Producer::attach(const char* name) {
+    if (!mapping.open(name, sizeof(Layout))) return false;
+
+    auto* l = static_cast<Layout*>(mapping.data());
+    if (l->header.magic != kMagic || l->header.version != kVersion ||
+        l->header.slotCount != kSlotCount || l->header.slotSize != sizeof(Slot)) {
+        mapping.close();
+        return false;
+    }
+    layout = l;
+    return true;
+}
+
+bool ShmRing::Producer::publish(FrameType type, const void* data, size_t len) {
+    if (!layout || len > kSlotPayload) return false;
+
+    const uint64_t index = layout->header.writeIndex.fetch_add(1, std::memory_order_acq_rel);
+    Slot& slot = layout->slots[index & (kSlotCount - 1)];
+
+    // Same protocol as a seqlock: invalidate, write, publish.
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sendTimeUs = NetTelemetry::nowUs();
+    slot.len = static_cast<uint16_t>(len);
+    slot.type = static_cast<uint8_t>(type);
+    std::memcpy(slot.payload, data, len);
+    slot.seq.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+// ---------------- Consumer ----------------
+
+void ShmTransportClass::SetMessageHandler(MessageHandler handler) {
+    messageHandler = std::move(handler);
+}
+
+void ShmTransportClass::SetTelemetry(NetTelemetry* table) {
+    telemetry = table;
+}
+
+bool ShmTransportClass::Connect(const char* name) {
+    if (!mapping.create(name, sizeof(ShmRing::Layout))) return false;
+
+    // A crashed driver may have left the object behind, start from a clean ring either way.
+    layout = static_cast<ShmRing::Layout*>(mapping.data());
+    std::memset(static_cast<void*>(layout), 0, sizeof(ShmRing::Layout));
+    layout->header.slotCount = ShmRing::kSlotCount;
+    layout->header.slotSize = sizeof(ShmRing::Slot);
+    layout->header.version = ShmRing::kVersion;
+    std::atomic_thread_fence(std::memory_order_release);
+    layout->header.magic = ShmRing::kMagic; // producers check this last
+    readIndex = 0;
+
+    if (telemetry) link = telemetry->acquire(NetTelemetry::Kind::Shm, 0, 0);
+
+    running = true;
+    pollThread = std::thread([this]() { pollLoop(); });
+    LOG("Shared-memory transport ready (%s).", name);
+    return true;
+}
+
+void ShmTransportClass::pollLoop() {
+    int idle = 0;
+    while (running) {
+        if (drain()) { idle = 0; continue; }
+        if (++idle < SPIN_ITERATIONS) std::this_thread::yield();
+        else std::this_thread::sleep_for(IDLE_SLEEP);
+    }
+}
+
+// Returns true if anything was consumed.
+bool ShmTransportClass::drain() {
+    using clock = std::chrono::steady_clock;
+
+    auto& header = layout->header;
+    bool progressed = false;
+    char buf[ShmRing::kSlotPayload];
+
+    for (;;) {
+        const uint64_t write = header.writeIndex.load(std::memory_order_acquire);
+        if (readIndex >= write) return progressed;
+
+        if (write - readIndex > ShmRing::kSlotCount) {
+            overruns += write - readIndex - ShmRing::kSlotCount;
+            readIndex = write - ShmRing::kSlotCount;
+        }
+
+        ShmRing::Slot& slot = layout->slots[readIndex & (ShmRing::kSlotCount - 1)];
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+
+        if (seq == readIndex + 1) {
+            const size_t len = std::min<size_t>(slot.len, ShmRing::kSlotPayload);
+            const FrameType type = static_cast<FrameType>(slot.type);
+            const uint64_t sendTimeUs = slot.sendTimeUs;
+            std::memcpy(buf, slot.payload, len);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const bool intact = slot.seq.load(std::memory_order_relaxed) == seq;
+
+            ++readIndex;
+            pendingSince = clock::time_point{};
+            if (!intact) { ++overruns; continue; } // a producer lapped us mid-copy
+
+            ++received;
+            progressed = true;
+            if (link) link->onReceive(len, NetTelemetry::nowUs(), sendTimeUs);
+            if (messageHandler) {
+                Frame frame{ type, std::string_view(buf, len) };
+                messageHandler(INVALID_SOCKET, WireMode::Binary, frame);
+            }
+        }
+        else if (seq > readIndex + 1) {
+            // Slot already reused for a later index.
+            ++overruns;
+            ++readIndex;
+        }
+        else {
+            // Claimed but not published yet; give up on it if the producer never finishes.
+            auto now = clock::now();
+            if (pendingSince == clock::time_point{}) pendingSince = now;
+            else if (now - pendingSince >= ABANDON_TIMEOUT) {
+                ++abandoned;
+                ++readIndex;
+                pendingSince = clock::time_point{};
+                continue;
+            }
+            return progressed;
+        }
+    }
+}
+
+bool ShmTransportClass::GetStatus() {
+    return running;
+}
+
+ShmTransportClass::Stats ShmTransportClass::GetStats() const {
+    Stats st;
+    st.received = received;
+    st.overruns = overruns;
+    st.abandoned = abandoned;
+    return st;
+}
+
+void ShmTransportClass::Close() {
+    if (!running.exchange(false)) return;
+    if (pollThread.joinable()) pollThread.join();
+
+    if (telemetry) telemetry->release(link);
+    link = nullptr;
+    layout = nullptr;
+    mapping.close();
+}
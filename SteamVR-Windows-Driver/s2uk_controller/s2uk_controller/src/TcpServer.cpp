@@ -1,179 +1,348 @@
 #include "TcpServer.h"
 #include "VRLog.h"
+#include "Crypto.h"
 
+#include <algorithm>
 
-SOCKET tcpSocket;
-int port;
-WSADATA wsaData;
-int wsaerr;
-WORD wVersionRequested;
-bool running;
-
-std::mutex clientsMutex;
-std::vector<SOCKET> clients;
+namespace {
+    uint64_t readU64(std::string_view s, size_t pos) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) v |= uint64_t(uint8_t(s[pos + i])) << (8 * i);
+        return v;
+    }
 
-std::mutex msgMutex;
-std::condition_variable msgCv;
+    void appendLE(std::string& out, uint64_t v, size_t bytes) {
+        for (size_t i = 0; i < bytes; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+    }
 
-// Helpers
-static inline void rtrim(std::string& s) {
-    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) s.pop_back();
+    // Haptic, HapticEnvelope and SendRate packets start with the flags byte that names the hand.
+    bool isLeftHand(FrameType type, const std::string& payload) {
+        const bool perHand = type == FrameType::Haptic || type == FrameType::HapticEnvelope || type == FrameType::SendRate;
+        return perHand && !payload.empty() && (uint8_t(payload[0]) & s2uk_packet::kFlagLeft) != 0;
+    }
 }
 
-void TcpSocketClass::enqueueMessage(SOCKET sock, const std::string& msg) {
-    std::lock_guard<std::mutex> lockGuard(msgMutex);
-    TcpSocketClass::msgQueue.push({ sock, msg });
-    // LOG("enqueueMessage -> queue size = %zu", msgQueue.size());
-    msgCv.notify_one();
+void TcpSocketClass::SetMessageHandler(MessageHandler handler) {
+    messageHandler = std::move(handler);
 }
-// ------
-
-void TcpSocketClass::handleClient(SOCKET clientSock) {
-    char buf[2048];
-
-    // Receive init message
-    int byteCount = recv(clientSock, buf, sizeof(buf) - 1, 0);
-    if (byteCount <= 0) { closesocket(clientSock); return; }
-    buf[byteCount] = '\0';
-    std::string firstMsg(buf, byteCount);
-    rtrim(firstMsg);
-
-    if (firstMsg != CLIENT_CONNECTION_MESSAGE) {
-        closesocket(clientSock);
-        return;
-    }
-
-    LOG("Client accepted, starting receive thread.");
-
-    setsockopt(clientSock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&CLIENT_TIMEOUT, sizeof(CLIENT_TIMEOUT));
-
-    std::thread([this, clientSock]() {
-        char buf[2048];
-        while (running) {
-            int byteCount = recv(clientSock, buf, sizeof(buf) - 1, 0);
-
-            if (byteCount == 0) {
-                LOG("Client disconnected.");
-                break;
-            }
-            else if (byteCount == SOCKET_ERROR) {
-                int err = WSAGetLastError();
-                if (err == WSAETIMEDOUT) {
-                    LOG("Client inactive for 30 seconds. Deleting.");
-                }
-                else {
-                    LOG("recv() failed with error: %d", err);
-                }
-                break;
-            }
 
+void TcpSocketClass::SetTelemetry(NetTelemetry* table) {
+    telemetry = table;
+}
 
-            sendQueuedMessages();
+void TcpSocketClass::SetLimits(const SessionLimits& sessionLimits) {
+    limits = sessionLimits;
+}
 
-            buf[byteCount] = '\0';
-            std::string msg(buf, byteCount);
-            rtrim(msg);
+void TcpSocketClass::SetImuBatch(bool accept) {
+    acceptImuBatch = accept;
+}
 
-            this->enqueueMessage(clientSock, msg);
-            //LOG("Received: %s", msg.c_str());
-        }
+TcpSocketClass::LimitStats TcpSocketClass::GetLimitStats() const {
+    LimitStats st;
+    st.droppedOldest = droppedOldest;
+    st.coalesced = coalesced;
+    st.queueDisconnects = queueDisconnects;
+    st.throttleEvents = throttleEvents;
+    st.droppedInbound = droppedInbound;
+    st.rateDisconnects = rateDisconnects;
+    st.peakQueuedMessages = peakQueuedMessages;
+    st.peakQueuedBytes = peakQueuedBytes;
+    return st;
+}
 
-        closesocket(clientSock);
-        {
-            std::lock_guard<std::mutex> lockGuard(clientsMutex);
-            clients.erase(std::remove(clients.begin(), clients.end(), clientSock), clients.end());
-        }
-        {
-            std::lock_guard<std::mutex> lockGuard(outgoingMutex);
-            outgoingMessages.erase(clientSock);
-        }
-        
-        }).detach();
+TcpSocketClass::SessionStats TcpSocketClass::GetSessionStats() const {
+    SessionStats st;
+    st.resumed = resumedSessions;
+    st.heartbeatTimeouts = heartbeatTimeouts;
+    return st;
 }
 
 void TcpSocketClass::Connect(int port_) {
     this->port = port_;
-    wVersionRequested = MAKEWORD(2, 2);
-    wsaerr = WSAStartup(wVersionRequested, &wsaData);
-    if (wsaerr != 0) { LOG("Winsock dll not found!"); return; }
+    if (!s2uk_net::startup()) { LOG("Winsock dll not found!"); return; }
 
     tcpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (tcpSocket == INVALID_SOCKET) { LOG("Error at socket()"); WSACleanup(); return; }
+    if (tcpSocket == INVALID_SOCKET) { LOG("Error at socket()"); s2uk_net::cleanup(); return; }
+
+    s2uk_net::setReuseAddr(tcpSocket);
 
     sockaddr_in service{};
     service.sin_family = AF_INET;
     service.sin_addr.s_addr = INADDR_ANY;
     service.sin_port = htons(port);
-    if (bind(tcpSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) { LOG("bind() failed"); closesocket(tcpSocket); WSACleanup(); return; }
+    if (bind(tcpSocket, (sockaddr*)&service, sizeof(service)) == SOCKET_ERROR) { LOG("bind() failed"); s2uk_net::closeSocket(tcpSocket); s2uk_net::cleanup(); return; }
+
+    if (listen(tcpSocket, SOMAXCONN) == SOCKET_ERROR) { LOG("listen() failed"); s2uk_net::closeSocket(tcpSocket); s2uk_net::cleanup(); return; }
 
-    if (listen(tcpSocket, SOMAXCONN) == SOCKET_ERROR) { LOG("listen() failed"); closesocket(tcpSocket); WSACleanup(); return; }
+    socklen_t boundSz = sizeof(service);
+    if (getsockname(tcpSocket, (sockaddr*)&service, &boundSz) == 0) port = ntohs(service.sin_port);
+
+    s2uk_net::setNonBlocking(tcpSocket);
+
+    if (!loop.init() || !loop.add(tcpSocket, NetEventLoop::Readable, [this](SOCKET, uint32_t) { onAccept(); })) {
+        LOG("Failed to start the network event loop.");
+        s2uk_net::closeSocket(tcpSocket);
+        s2uk_net::cleanup();
+        return;
+    }
+    loop.addTimer(HOUSEKEEPING_INTERVAL, [this]() { checkTimeouts(); });
+    loop.addTimer(HEARTBEAT_INTERVAL, [this]() { heartbeat(); });
+    loop.addTimer(THROTTLE_INTERVAL, [this]() { resumeThrottled(); });
 
     running = true;
+    loopThread = std::thread([this]() { loop.run(); });
+}
 
-    std::thread([this]() {
-        while (running) {
-            sockaddr_in clientInfo{};
-            int clientSz = sizeof(clientInfo);
-            SOCKET clientSock = accept(tcpSocket, (SOCKADDR*)&clientInfo, &clientSz);
-            if (clientSock == INVALID_SOCKET) {
-                int err = WSAGetLastError();
-                if (err == WSAEINTR || err == WSAEWOULDBLOCK) {
-                    LOG("ClientSocket Error.");
-                    continue;
-                }
+void TcpSocketClass::onAccept() {
+    // Drain the backlog, the listener is non-blocking.
+    while (running) {
+        sockaddr_in clientInfo{};
+        socklen_t clientSz = sizeof(clientInfo);
+        SOCKET clientSock = accept(tcpSocket, (sockaddr*)&clientInfo, &clientSz);
+        if (clientSock == INVALID_SOCKET) {
+            int err = s2uk_net::lastError();
+            if (!s2uk_net::wouldBlock(err) && !s2uk_net::interrupted(err)) {
                 LOG("accept() failed with error: %d", err);
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
             }
+            return;
+        }
 
+        s2uk_net::setNonBlocking(clientSock);
+        s2uk_net::setNoDelay(clientSock);
+
+        auto session = std::make_unique<Session>(&recvSlabs);
+        session->sock = clientSock;
+        session->peerAddr = clientInfo.sin_addr.s_addr;
+        if (telemetry) session->link = telemetry->acquire(NetTelemetry::Kind::Tcp, clientInfo.sin_addr.s_addr, ntohs(clientInfo.sin_port));
+        session->lastSeen = std::chrono::steady_clock::now();
+        session->inBytes.reset(limits.maxInboundBytesPerSec, session->lastSeen);
+        session->inMessages.reset(limits.maxInboundMessagesPerSec, session->lastSeen);
+
+        if (!loop.add(clientSock, NetEventLoop::Readable, [this](SOCKET s, uint32_t ev) { onSessionEvent(s, ev); })) {
+            LOG("Failed to register client socket.");
+            if (telemetry) telemetry->release(session->link);
+            s2uk_net::closeSocket(clientSock);
+            continue;
+        }
+        sessions[clientSock] = std::move(session);
+        LOG("Client connected.");
+    }
+}
+
+void TcpSocketClass::onSessionEvent(SOCKET sock, uint32_t events) {
+    auto it = sessions.find(sock);
+    if (it == sessions.end()) return;
+    Session& session = *it->second;
+
+    if (events & NetEventLoop::Readable) {
+        if (!readFromSession(session)) return; // session closed
+    }
+    if (events & NetEventLoop::Writable) {
+        if (!flushSession(session)) { closeSession(sock, "send() failed"); return; }
+    }
+    if ((events & NetEventLoop::Error) && !(events & NetEventLoop::Readable)) {
+        closeSession(sock, "socket error");
+    }
+}
+
+// recv() goes straight into the session parser's slab and the handlers get views into it.
+bool TcpSocketClass::readFromSession(Session& session) {
+    const SOCKET sock = session.sock;
+
+    while (true) {
+        size_t room = 0;
+        char* dst = session.parser.prepare(room);
+        if (dst == nullptr) {
+            closeSession(sock, "Client exceeded the receive buffer. Deleting.");
+            return false;
+        }
+        const int want = static_cast<int>(std::min<size_t>(room, RECV_CHUNK));
 
-            LOG("Client connected.");
-            {
-                std::lock_guard<std::mutex> lockGuard(clientsMutex);
-                clients.push_back(clientSock);
+        int byteCount = s2uk_net::recvBytes(sock, dst, want);
+        if (byteCount == 0) {
+            closeSession(sock, "Client disconnected.");
+            return false;
+        }
+        if (byteCount == SOCKET_ERROR) {
+            int err = s2uk_net::lastError();
+            if (s2uk_net::wouldBlock(err) || s2uk_net::interrupted(err)) {
+                session.parser.reclaim();
+                return true;
             }
+            LOG("recv() failed with error: %d", err);
+            closeSession(sock, "recv() failed.");
+            return false;
+        }
 
-            std::thread t(&TcpSocketClass::handleClient, this, clientSock);
-            t.detach();
+        const auto now = std::chrono::steady_clock::now();
+        session.lastSeen = now;
+        session.parser.commit(static_cast<size_t>(byteCount));
+
+        Frame frame;
+        StreamFrameParser::Status status;
+        while ((status = session.parser.next(frame)) == StreamFrameParser::Status::Ready) {
+            if (session.inMessages.limited()) {
+                session.inMessages.refill(now);
+                if (session.inMessages.tokens < 1) {
+                    if (limits.inboundPolicy == SessionLimits::InboundPolicy::Disconnect) {
+                        ++rateDisconnects;
+                        closeSession(sock, "Client exceeded the message rate limit. Deleting.");
+                        return false;
+                    }
+                    ++droppedInbound;
+                    continue;
+                }
+                session.inMessages.tokens -= 1;
+            }
+            if (!handleFrame(session, frame)) return false;
+        }
+        if (status == StreamFrameParser::Status::Error) {
+            closeSession(sock, "Client sent a malformed stream. Deleting.");
+            return false;
+        }
+        session.parser.reclaim(); // keeps the slab only while a message is half received
+
+        if (session.inBytes.limited()) {
+            // Bytes already read are processed anyway, the budget may go into debt.
+            session.inBytes.refill(now);
+            session.inBytes.tokens -= byteCount;
+            if (session.inBytes.tokens <= 0) {
+                if (limits.inboundPolicy == SessionLimits::InboundPolicy::Disconnect) {
+                    ++rateDisconnects;
+                    closeSession(sock, "Client exceeded the byte rate limit. Deleting.");
+                    return false;
+                }
+                // Stop reading, the kernel buffer fills up and TCP pushes back on the phone.
+                session.throttled = true;
+                ++throttledSessions;
+                ++throttleEvents;
+                updateInterest(session);
+                return true;
+            }
         }
-        }).detach();
 
+        if (byteCount < want) return true; // socket drained
+    }
 }
 
-void TcpSocketClass::broadcastMessage(const std::string& msg) {
-    std::string m = msg;
-    if (!m.empty() && m.back() != '\n') m.push_back('\n');
+// Returns false if the session was closed.
+bool TcpSocketClass::handleFrame(Session& session, const Frame& frame) {
+    if (!session.loggedIn) {
+        // The login line is always text, it picks the wire mode for everything after it
+        // (which may already be sitting in the same segment). Either one of the old fixed
+        // strings, a hello or a resume line (see Handshake.h).
+        Handshake::Agreement agreement;
+        bool hello = false;
+        uint64_t token = 0;
+        if (frame.payload == CLIENT_CONNECTION_MESSAGE) agreement.framing = WireMode::Text;
+        else if (frame.payload == CLIENT_CONNECTION_MESSAGE_BINARY) agreement.framing = WireMode::Binary;
+        else if (Handshake::negotiate(frame.payload, agreement, acceptImuBatch)) hello = true;
+        else if (Handshake::parseResume(frame.payload, token)) return resumeLogin(session, token);
+        else {
+            closeSession(session.sock, "Client sent an invalid login message.");
+            return false;
+        }
 
-    std::vector<SOCKET> snapshot;
-    {
-        std::lock_guard<std::mutex> lockGuard(clientsMutex);
-        snapshot = clients;
+        const WireMode mode = agreement.framing;
+        session.agreement = agreement;
+        logIn(session, 0);
+        if (hello) {
+            LOG("Client accepted (%s framing, hello v%u, role %s, scales %u/%u).", mode == WireMode::Binary ? "binary" : "text", agreement.version,
+                Handshake::detail::roleName(agreement.format.role), agreement.format.gyroScale, agreement.format.joyScale);
+        }
+        else LOG("Client accepted (%s framing).", mode == WireMode::Binary ? "binary" : "text");
+
+        // The welcome is a text line like the hello; the agreed framing starts after it.
+        if (hello) {
+            std::string line = Handshake::welcome(agreement, session.id);
+            line.push_back('\n');
+            if (!enqueue(session, std::make_shared<const std::string>(std::move(line)), FrameType::Session)) return false;
+            if (!flushSession(session)) { closeSession(session.sock, "send() failed"); return false; }
+        }
+
+        // Binary phones get a resume token right away; text clients have no frame types for it.
+        if (mode == WireMode::Binary) {
+            do session.resumeToken = tokenRng(); while (session.resumeToken == 0);
+            return sendSessionInfo(session, false);
+        }
+        return true;
     }
 
-    std::lock_guard<std::mutex> lockGuard(outgoingMutex);
-    for (SOCKET s : snapshot) {
-        outgoingMessages[s].emplace_back(m);
+    const WireMode mode = session.parser.getMode();
+    const uint64_t now = NetTelemetry::nowUs();
+    if (session.link) {
+        const size_t wireSize = frame.payload.size() + (mode == WireMode::Binary ? StreamFrameParser::kHeaderSize : 1);
+        const bool control = mode == WireMode::Binary && (frame.type == FrameType::Ping || frame.type == FrameType::Pong);
+        if (control) session.link->countReceive(wireSize, now);
+        else session.link->onReceive(wireSize, now);
     }
-}
 
-bool TcpSocketClass::sendMessagesToClient(SOCKET clientSock) {
-    std::lock_guard<std::mutex> lockGuard(outgoingMutex);
+    if (mode == WireMode::Text && frame.payload == CLIENT_CLOSED_CONNECTION_MESSAGE) {
+        closeSession(session.sock, "Client closed the connection.");
+        return false;
+    }
 
-    auto it = outgoingMessages.find(clientSock);
-    if (it == outgoingMessages.end() || it->second.empty()) return true; // nothing to send
+    if (mode == WireMode::Binary && frame.type == FrameType::Ping) {
+        std::string pong;
+        StreamFrameParser::appendFrame(pong, FrameType::Pong, frame.payload);
+        if (!enqueue(session, std::make_shared<const std::string>(std::move(pong)), FrameType::Pong)) return false;
+        if (!flushSession(session)) { closeSession(session.sock, "send() failed"); return false; }
+        return true;
+    }
+    if (mode == WireMode::Binary && frame.type == FrameType::Pong) {
+        // Our own Ping coming back: u64 little-endian send time, then (phones that sync
+        // clocks) u64 receive and u64 send time on the phone's clock.
+        if (frame.payload.size() >= sizeof(uint64_t)) {
+            const uint64_t sentUs = readU64(frame.payload, 0);
+            if (session.link && now >= sentUs) session.link->onRtt(static_cast<uint32_t>(std::min<uint64_t>(now - sentUs, UINT32_MAX)));
+            session.heartbeat = true;
+
+            if (frame.payload.size() >= 3 * sizeof(uint64_t) &&
+                session.clock.addSample(sentUs, readU64(frame.payload, 8), readU64(frame.payload, 16), now)) {
+                const ClockSync::Estimate& est = session.clock.estimate();
+                if (session.link) session.link->onClockSync(est.offsetUs, est.skew);
+                std::lock_guard<std::mutex> lockGuard(peersMutex);
+                auto peer = peers.find(session.id);
+                if (peer != peers.end()) peer->second.clock = est;
+            }
+        }
+        return true;
+    }
+    if (mode == WireMode::Binary && frame.type == FrameType::Resume) {
+        if (frame.payload.size() < sizeof(uint64_t)) return true;
+        return resumeSession(session, readU64(frame.payload, 0));
+    }
 
-    auto& queue = it->second;
+    if (messageHandler) {
+        Frame stamped = frame;
+        stamped.peerAddr = session.peerAddr;
+        stamped.session = session.id;
+        messageHandler(session.sock, mode, stamped);
+    }
+    //LOG("Received: %.*s", (int)frame.payload.size(), frame.payload.data());
+    return true;
+}
 
-    while (!queue.empty() && running) {
-        OutMsg& m = queue.front();
-        const char* ptr = m.data.data() + m.offset;
-        int remaining = static_cast<int>(m.data.size() - m.offset);
-        if (remaining <= 0) { queue.pop_front(); continue; }
+bool TcpSocketClass::flushSession(Session& session) {
+    auto& queue = session.outgoing;
 
-        int sent = send(clientSock, ptr, remaining, 0);
+    while (!queue.empty()) {
+        // Hand as many queued messages as fit to the kernel in one gather write.
+        s2uk_net::ConstBuffer slices[s2uk_net::kMaxGather];
+        size_t count = 0;
+        for (auto it = queue.begin(); it != queue.end() && count < s2uk_net::kMaxGather; ++it) {
+            slices[count++] = { it->data->data() + it->offset, it->data->size() - it->offset };
+        }
+
+        int sent = s2uk_net::sendGather(session.sock, slices, count);
         if (sent == SOCKET_ERROR) {
-            int err = WSAGetLastError();
-            if (err == WSAEWOULDBLOCK) {
+            int err = s2uk_net::lastError();
+            if (s2uk_net::wouldBlock(err)) {
+                // Kernel buffer is full, resume once the socket becomes writable.
+                if (session.link) session.link->setQueueDepth(queue.size());
+                session.writeBlocked = true;
+                updateInterest(session);
                 return true;
             }
             LOG("send() failed with error: %d", err);
@@ -184,60 +353,415 @@ bool TcpSocketClass::sendMessagesToClient(SOCKET clientSock) {
             return false;
         }
 
-        m.offset += static_cast<size_t>(sent);
-        if (m.offset >= m.data.size()) {
-            queue.pop_front();
+        size_t left = static_cast<size_t>(sent);
+        size_t completed = 0;
+        session.queuedBytes -= std::min<size_t>(session.queuedBytes, left);
+        while (left > 0) {
+            OutMsg& m = queue.front();
+            size_t chunk = std::min<size_t>(left, m.data->size() - m.offset);
+            m.offset += chunk;
+            left -= chunk;
+            if (m.offset >= m.data->size()) { queue.pop_front(); ++completed; }
         }
-        else {
-            return true;
+        if (session.link) session.link->onSend(completed, static_cast<size_t>(sent));
+    }
+
+    if (session.link) session.link->setQueueDepth(0);
+    session.queuedBytes = 0;
+    session.writeBlocked = false;
+    updateInterest(session);
+    return true;
+}
+
+void TcpSocketClass::updateInterest(Session& session) {
+    uint32_t interest = 0;
+    if (!session.throttled) interest |= NetEventLoop::Readable;
+    if (session.writeBlocked) interest |= NetEventLoop::Writable;
+    loop.modify(session.sock, interest);
+}
+
+void TcpSocketClass::resumeThrottled() {
+    if (throttledSessions == 0) return;
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto& [sock, session] : sessions) {
+        if (!session->throttled) continue;
+        session->inBytes.refill(now);
+        if (session->inBytes.tokens <= 0) continue;
+
+        // Readiness is level-triggered, whatever piled up meanwhile is reported right away.
+        session->throttled = false;
+        --throttledSessions;
+        updateInterest(*session);
+    }
+}
+
+void TcpSocketClass::closeSession(SOCKET sock, const char* reason) {
+    LOG("%s", reason);
+
+    auto it = sessions.find(sock);
+    if (it != sessions.end() && it->second->loggedIn && it->second->resumeToken) {
+        // Keep what the session learned in case the phone comes back with its token.
+        Session& s = *it->second;
+        parkedSessions[s.resumeToken] = ParkedSession{ s.agreement, s.id, s.clock, s.link, std::chrono::steady_clock::now() };
+    }
+    else if (it != sessions.end() && telemetry) telemetry->release(it->second->link);
+    if (it != sessions.end() && it->second->throttled) --throttledSessions;
+    if (it != sessions.end() && it->second->loggedIn) {
+        --loggedInClients;
+        if (it->second->agreement.hapticEnvelopes) --envelopeClients;
+        std::lock_guard<std::mutex> lockGuard(peersMutex);
+        peers.erase(it->second->id);
+    }
+
+    loop.remove(sock);
+    s2uk_net::closeSocket(sock);
+    sessions.erase(sock);
+}
+
+// Returns false if the overflow policy closed the session.
+bool TcpSocketClass::enqueue(Session& session, Payload payload, FrameType type, bool left) {
+    auto& queue = session.outgoing;
+    const size_t size = payload->size();
+
+    auto overflowing = [&]() {
+        return (limits.maxQueuedMessages && queue.size() + 1 > limits.maxQueuedMessages) ||
+            (limits.maxQueuedBytes && session.queuedBytes + size > limits.maxQueuedBytes);
+    };
+
+    if (overflowing()) {
+        if (limits.outboundPolicy == SessionLimits::OutboundPolicy::Disconnect) {
+            ++queueDisconnects;
+            closeSession(session.sock, "Client is not reading, outbound queue overflowed. Deleting.");
+            return false;
+        }
+
+        if (limits.outboundPolicy == SessionLimits::OutboundPolicy::Coalesce) {
+            // Newest of a type (and hand) wins; it takes the queue slot of the older one.
+            for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+                if (it->offset > 0 || it->type != type || it->left != left) continue;
+                session.queuedBytes = session.queuedBytes - it->data->size() + size;
+                it->data = std::move(payload);
+                ++coalesced;
+                if (session.link) session.link->setQueueDepth(queue.size());
+                notePeakQueue(session);
+                return true;
+            }
+        }
+
+        // Drop the oldest messages that have not started going out yet; a partially
+        // written one at the front has to finish or the stream loses sync.
+        while (overflowing()) {
+            auto victim = queue.begin();
+            if (victim != queue.end() && victim->offset > 0) ++victim;
+            if (victim == queue.end()) break;
+            session.queuedBytes -= victim->data->size();
+            queue.erase(victim);
+            ++droppedOldest;
         }
     }
 
+    session.queuedBytes += size;
+    queue.emplace_back(std::move(payload), type, left);
+    if (session.link) session.link->setQueueDepth(queue.size());
+    notePeakQueue(session);
     return true;
 }
 
-void TcpSocketClass::sendQueuedMessages() {
-    std::vector<SOCKET> snapshot;
+void TcpSocketClass::notePeakQueue(const Session& session) {
+    if (session.outgoing.size() > peakQueuedMessages) peakQueuedMessages = session.outgoing.size();
+    if (session.queuedBytes > peakQueuedBytes) peakQueuedBytes = session.queuedBytes;
+}
+
+void TcpSocketClass::collectOutgoing() {
+    std::vector<Broadcast> pending;
     {
-        std::lock_guard<std::mutex> lockGuard(clientsMutex);
-        snapshot = clients; // copy
+        std::lock_guard<std::mutex> lockGuard(outgoingMutex);
+        pending.swap(outgoingMessages);
     }
+    if (pending.empty()) return;
 
-    for (SOCKET s : snapshot) {
-        bool ok = sendMessagesToClient(s);
-        if (!ok) {
-            LOG("sendQueuedMessages: failed -> closing socket %llu", (unsigned long long)s);
-            closesocket(s);
-            std::lock_guard<std::mutex> lockGuard(clientsMutex);
-            clients.erase(std::remove(clients.begin(), clients.end(), s), clients.end());
-            std::lock_guard<std::mutex> lg2(outgoingMutex);
-            outgoingMessages.erase(s);
+    std::vector<Session*> targets;
+    for (auto& [sock, session] : sessions) {
+        if (session->loggedIn) targets.push_back(session.get());
+    }
+
+    // enqueue() and flushSession() can close sessions, so work from a snapshot.
+    for (Session* session : targets) {
+        const SOCKET sock = session->sock;
+        const bool binary = session->parser.getMode() == WireMode::Binary;
+        bool alive = true;
+        for (auto& b : pending) {
+            if (!binary && b.type != FrameType::Haptic) continue; // text clients take every line for a haptic
+            if (b.type == FrameType::Haptic && session->agreement.hapticEnvelopes) continue; // the envelope carries it
+            if (b.type == FrameType::HapticEnvelope && !session->agreement.hapticEnvelopes) continue;
+            if (!(alive = enqueue(*session, binary ? b.binary : b.text, b.type, b.left))) break;
         }
+        if (alive && !flushSession(*session)) closeSession(sock, "sendQueuedMessages: failed -> closing socket");
     }
 }
 
-bool TcpSocketClass::GetStatus() {
-    return running;
+void TcpSocketClass::checkTimeouts() {
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<SOCKET> expired;
+    for (auto& [sock, session] : sessions) {
+        if (now - session->lastSeen >= CLIENT_TIMEOUT) expired.push_back(sock);
+    }
+    for (SOCKET s : expired) closeSession(s, "Client inactive for 30 seconds. Deleting.");
+
+    for (auto it = parkedSessions.begin(); it != parkedSessions.end();) {
+        if (now - it->second.parkedAt < RESUME_WINDOW) { ++it; continue; }
+        if (telemetry) telemetry->release(it->second.link);
+        it = parkedSessions.erase(it);
+    }
 }
 
-void TcpSocketClass::Receive(char* outStr, int maxLen) {
-    std::unique_lock<std::mutex> ul(msgMutex);
+void TcpSocketClass::heartbeat() {
+    // Throttled sessions are not being read, their silence is our doing.
+    auto now = std::chrono::steady_clock::now();
+    std::vector<SOCKET> silent;
+    for (auto& [sock, session] : sessions) {
+        if (session->heartbeat && !session->throttled && now - session->lastSeen >= HEARTBEAT_TIMEOUT) silent.push_back(sock);
+    }
+    for (SOCKET s : silent) {
+        ++heartbeatTimeouts;
+        closeSession(s, "Client missed its heartbeats. Deleting.");
+    }
 
-    msgCv.wait(ul, [&] { return !msgQueue.empty(); });
+    sendPings();
+}
 
-    ClientMessage cm = msgQueue.front();
-    msgQueue.pop();
-    strncpy_s(outStr, maxLen, cm.msg.c_str(), _TRUNCATE);
-    outStr[maxLen - 1] = '\0';
+// Returns false if the session was closed.
+bool TcpSocketClass::sendSessionInfo(Session& session, bool resumed) {
+    std::string payload;
+    appendLE(payload, session.resumeToken, 8);
+    appendLE(payload, resumed ? 1 : 0, 1);
+    appendLE(payload, static_cast<uint64_t>(HEARTBEAT_INTERVAL.count()), 2);
+    appendLE(payload, static_cast<uint64_t>(HEARTBEAT_TIMEOUT.count()), 2);
+
+    std::string frame;
+    StreamFrameParser::appendFrame(frame, FrameType::Session, payload);
+    if (!enqueue(session, std::make_shared<const std::string>(std::move(frame)), FrameType::Session)) return false;
+    if (!flushSession(session)) { closeSession(session.sock, "send() failed"); return false; }
+    return true;
+}
+
+// Marks the session logged in with session.agreement, under id if that is free (0 = a new one).
+void TcpSocketClass::logIn(Session& session, uint32_t id) {
+    session.loggedIn = true;
+    session.parser.setMode(session.agreement.framing);
+    ++loggedInClients;
+    if (session.agreement.hapticEnvelopes) ++envelopeClients;
+    {
+        std::lock_guard<std::mutex> lockGuard(peersMutex);
+        session.id = id;
+        while (session.id == 0 || peers.count(session.id)) session.id = ++lastSessionId;
+        Peer& peer = peers[session.id];
+        peer.addr = session.peerAddr;
+        peer.format = session.agreement.format;
+    }
+    if (session.link) session.link->setSession(session.id);
+}
+
+// The phone may notice a drop before our heartbeat does: the old connection with its token
+// goes now, which parks it.
+void TcpSocketClass::closeResumed(const Session& session, uint64_t token) {
+    SOCKET stale = INVALID_SOCKET;
+    for (auto& [sock, other] : sessions) {
+        if (other.get() != &session && other->resumeToken == token) stale = sock;
+    }
+    if (stale != INVALID_SOCKET) closeSession(stale, "Client resumed its session on a new connection.");
+}
+
+// A resume line in place of the hello: log in with the parked session's agreement and id,
+// clock and link, and tell the phone with the same welcome it got the first time. An unknown
+// token leaves the session at the login for a hello.
+// Returns false if the session was closed.
+bool TcpSocketClass::resumeLogin(Session& session, uint64_t token) {
+    closeResumed(session, token);
+
+    auto it = parkedSessions.find(token);
+    if (it == parkedSessions.end()) {
+        LOG("Client resumed an unknown session, waiting for its hello.");
+        std::string line(Handshake::kResumeUnknown);
+        line.push_back('\n');
+        if (!enqueue(session, std::make_shared<const std::string>(std::move(line)), FrameType::Session)) return false;
+        if (!flushSession(session)) { closeSession(session.sock, "send() failed"); return false; }
+        return true;
+    }
+
+    session.agreement = it->second.agreement;
+    session.clock = it->second.clock;
+    logIn(session, it->second.id);
+    if (it->second.link) {
+        if (telemetry) telemetry->release(session.link);
+        session.link = it->second.link;
+        session.link->setSession(session.id);
+    }
+    parkedSessions.erase(it);
+    session.resumeToken = token;
+    ++resumedSessions;
+
+    if (session.clock.estimate().valid) {
+        std::lock_guard<std::mutex> lockGuard(peersMutex);
+        peers[session.id].clock = session.clock.estimate();
+    }
+    LOG("Client resumed session %u without a hello.", session.id);
+
+    std::string line = Handshake::welcome(session.agreement, session.id);
+    line.push_back('\n');
+    if (!enqueue(session, std::make_shared<const std::string>(std::move(line)), FrameType::Session)) return false;
+    return sendSessionInfo(session, true);
+}
+
+// A Resume frame after a login: hand the new session what its previous one had learned, so
+// timestamps map and stats carry on without waiting for new pings. The agreement and id are
+// the new login's; a resume line (resumeLogin) brings those back as well.
+// Returns false if the session was closed.
+bool TcpSocketClass::resumeSession(Session& session, uint64_t token) {
+    if (token == 0 || token == session.resumeToken) return true;
+
+    closeResumed(session, token);
+
+    auto it = parkedSessions.find(token);
+    if (it == parkedSessions.end()) return sendSessionInfo(session, false); // expired, keep the fresh token
+
+    session.clock = it->second.clock;
+    if (it->second.link) {
+        if (telemetry) telemetry->release(session.link);
+        session.link = it->second.link;
+        session.link->setSession(session.id);
+    }
+    parkedSessions.erase(it);
+    session.resumeToken = token;
+    ++resumedSessions;
+
+    if (session.clock.estimate().valid) {
+        std::lock_guard<std::mutex> lockGuard(peersMutex);
+        auto peer = peers.find(session.id);
+        if (peer != peers.end()) peer->second.clock = session.clock.estimate();
+    }
+    LOG("Client resumed its previous session.");
+    return sendSessionInfo(session, true);
+}
+
+void TcpSocketClass::sendPings() {
+    std::string ping;
+    uint64_t nowUs = NetTelemetry::nowUs();
+    char stamp[sizeof(uint64_t)];
+    for (size_t i = 0; i < sizeof(uint64_t); ++i) stamp[i] = static_cast<char>(nowUs >> (8 * i));
+    StreamFrameParser::appendFrame(ping, FrameType::Ping, std::string_view(stamp, sizeof(stamp)));
+    auto payload = std::make_shared<const std::string>(std::move(ping));
+
+    std::vector<Session*> targets;
+    for (auto& [sock, session] : sessions) {
+        // Text clients have no frame types, they would take the ping for a haptic.
+        if (session->loggedIn && session->parser.getMode() == WireMode::Binary) targets.push_back(session.get());
+    }
+    for (Session* session : targets) {
+        const SOCKET sock = session->sock;
+        if (!enqueue(*session, payload, FrameType::Ping)) continue;
+        if (!flushSession(*session)) closeSession(sock, "send() failed");
+    }
+}
+
+bool TcpSocketClass::WantsHapticEnvelopes() const {
+    return envelopeClients != 0;
+}
+
+void TcpSocketClass::broadcastMessage(FrameType type, const std::string& payload) {
+    if (loggedInClients == 0) return;
+    if (type == FrameType::Haptic && envelopeClients == loggedInClients) return;
+    if (type == FrameType::HapticEnvelope && envelopeClients == 0) return;
+
+    // Encode once per wire mode; every session queue shares the same buffers.
+    std::string textMsg = s2uk_crypto::base64_encode(payload);
+    textMsg.push_back('\n');
+
+    std::string binaryMsg;
+    binaryMsg.reserve(StreamFrameParser::kHeaderSize + payload.size());
+    StreamFrameParser::appendFrame(binaryMsg, type, payload);
+
+    Broadcast b;
+    b.type = type;
+    b.left = isLeftHand(type, payload);
+    b.text = std::make_shared<const std::string>(std::move(textMsg));
+    b.binary = std::make_shared<const std::string>(std::move(binaryMsg));
+    {
+        std::lock_guard<std::mutex> lockGuard(outgoingMutex);
+        outgoingMessages.push_back(std::move(b));
+    }
+
+    // Hand the write over to the loop right away instead of waiting for the phone's next packet.
+    loop.post([this]() { collectOutgoing(); });
+}
+
+bool TcpSocketClass::HasSession(uint32_t session, uint32_t addr) const {
+    std::lock_guard<std::mutex> lockGuard(peersMutex);
+    auto peer = peers.find(session);
+    return peer != peers.end() && peer->second.addr == addr;
+}
+
+bool TcpSocketClass::MapPeerTime(uint32_t session, uint64_t remoteUs, uint64_t& localUs) const {
+    std::lock_guard<std::mutex> lockGuard(peersMutex);
+    auto peer = peers.find(session);
+    if (peer == peers.end() || !peer->second.clock.valid) return false;
+    localUs = peer->second.clock.toLocal(remoteUs);
+    return true;
+}
+
+Handshake::WireFormat TcpSocketClass::PeerFormat(uint32_t session) const {
+    std::lock_guard<std::mutex> lockGuard(peersMutex);
+    auto peer = peers.find(session);
+    return peer != peers.end() ? peer->second.format : Handshake::WireFormat{};
+}
+
+s2uk_packet::Status TcpSocketClass::DecodeDelta(uint32_t session, const uint8_t* data, size_t len, s2uk_packet::ControllerPacket& out) {
+    if (len == 0) return s2uk_packet::Status::TooShort;
+    const bool left = (data[0] & s2uk_packet::kDeltaLeft) != 0;
+    std::lock_guard<std::mutex> lockGuard(peersMutex);
+    auto peer = peers.find(session);
+    if (peer == peers.end()) return s2uk_packet::Status::NoKeyframe;
+    return s2uk_packet::decode(data, len, peer->second.delta[left ? 1 : 0], out);
+}
+
+bool TcpSocketClass::GetStatus() {
+    return running;
+}
+
+int TcpSocketClass::GetPort() const {
+    return port;
 }
 
 void TcpSocketClass::CloseSocket() {
-    running = false;
-    closesocket(tcpSocket);
+    if (!running.exchange(false)) return;
 
-    std::lock_guard<std::mutex> lockGuard(clientsMutex);
-    for (auto c : clients) closesocket(c);
-    clients.clear();
+    loop.stop();
+    if (loopThread.joinable()) loopThread.join();
 
-    WSACleanup();
-}
\ No newline at end of file
+    // Loop thread is gone, safe to tear the sessions down from here.
+    for (auto& [sock, session] : sessions) {
+        s2uk_net::closeSocket(sock);
+        if (telemetry) telemetry->release(session->link);
+    }
+    sessions.clear();
+    for (auto& [token, parked] : parkedSessions) {
+        if (telemetry) telemetry->release(parked.link);
+    }
+    parkedSessions.clear();
+    loop.remove(tcpSocket);
+    s2uk_net::closeSocket(tcpSocket);
+    loggedInClients = 0;
+    envelopeClients = 0;
+    {
+        std::lock_guard<std::mutex> lockGuard(peersMutex);
+        peers.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lockGuard(outgoingMutex);
+        outgoingMessages.clear();
+    }
+
+    s2uk_net::cleanup();
+}
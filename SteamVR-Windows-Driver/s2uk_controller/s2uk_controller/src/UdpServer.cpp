@@ -0,0 +1,203 @@
+#include "UdpServer.h"
+#include "VRLog.h"
+
+#include <algorithm>
+
+namespace {
+    uint32_t readU32(const uint8_t* p) {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    uint64_t readU64(const uint8_t* p) {
+        return uint64_t(readU32(p)) | (uint64_t(readU32(p + 4)) << 32);
+    }
+
+    uint64_t streamKey(const sockaddr_in& from, uint8_t deviceId) {
+        return (uint64_t(ntohl(from.sin_addr.s_addr)) << 24) | (uint64_t(ntohs(from.sin_port)) << 8) | deviceId;
+    }
+}
+
+bool UdpDatagram::parse(const char* data, size_t len, Header& header, std::string_view (&states)[kMaxStates]) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    if (len < kHeaderSize || p[0] != kMagic || p[1] != kVersion) return false;
+
+    header.deviceId = p[2];
+    header.stateCount = p[3];
+    header.seq = readU32(p + 4);
+    header.sendTimeUs = readU64(p + 8);
+    header.session = readU32(p + 16);
+    if (header.deviceId > 1 || header.stateCount == 0 || header.stateCount > kMaxStates) return false;
+
+    size_t pos = kHeaderSize;
+    for (size_t i = 0; i < header.stateCount; ++i) {
+        if (pos >= len) return false;
+        size_t stateLen = p[pos++];
+        if (stateLen == 0 || pos + stateLen > len) return false;
+        states[i] = std::string_view(data + pos, stateLen);
+        pos += stateLen;
+    }
+    return true;
+}
+
+void UdpSocketClass::SetMessageHandler(MessageHandler handler) {
+    messageHandler = std::move(handler);
+}
+
+void UdpSocketClass::SetPeerFilter(PeerFilter filter) {
+    peerFilter = std::move(filter);
+}
+
+void UdpSocketClass::SetTelemetry(NetTelemetry* table) {
+    telemetry = table;
+}
+
+bool UdpSocketClass::Connect(int port) {
+    if (!s2uk_net::startup()) { LOG("Winsock dll not found!"); return false; }
+
+    udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udpSocket == INVALID_SOCKET) { LOG("UDP: Error at socket()"); s2uk_net::cleanup(); return false; }
+
+    sockaddr_in service{};
+    service.sin_family = AF_INET;
+    service.sin_addr.s_addr = INADDR_ANY;
+    service.sin_port = htons(port);
+    if (bind(udpSocket, (sockaddr*)&service, sizeof(service)) == SOCKET_ERROR) {
+        LOG("UDP: bind() failed");
+        s2uk_net::closeSocket(udpSocket);
+        s2uk_net::cleanup();
+        return false;
+    }
+
+    s2uk_net::setNonBlocking(udpSocket);
+
+    if (!loop.init() || !loop.add(udpSocket, NetEventLoop::Readable, [this](SOCKET, uint32_t) { onReadable(); })) {
+        LOG("UDP: Failed to start the network event loop.");
+        s2uk_net::closeSocket(udpSocket);
+        s2uk_net::cleanup();
+        return false;
+    }
+    loop.addTimer(HOUSEKEEPING_INTERVAL, [this]() { expireStreams(); });
+
+    running = true;
+    loopThread = std::thread([this]() { loop.run(); });
+    LOG("UDP transport listening on port %d.", port);
+    return true;
+}
+
+void UdpSocketClass::onReadable() {
+    char buf[UdpDatagram::kMaxSize];
+
+    // Drain everything that is queued, the socket is non-blocking.
+    while (running) {
+        sockaddr_in from{};
+        socklen_t fromLen = sizeof(from);
+        int n = static_cast<int>(recvfrom(udpSocket, buf, sizeof(buf), 0, (sockaddr*)&from, &fromLen));
+        if (n == SOCKET_ERROR) {
+            int err = s2uk_net::lastError();
+            if (s2uk_net::wouldBlock(err) || s2uk_net::interrupted(err)) return;
+#ifdef _WIN32
+            // Oversized datagram or an ICMP port unreachable from an earlier reply, keep going.
+            if (err == WSAEMSGSIZE || err == WSAECONNRESET) { ++rejected; continue; }
+#endif
+            LOG("UDP: recvfrom() failed with error: %d", err);
+            return;
+        }
+
+        ++received;
+        handleDatagram(from, buf, static_cast<size_t>(n));
+    }
+}
+
+void UdpSocketClass::handleDatagram(const sockaddr_in& from, const char* data, size_t len) {
+    UdpDatagram::Header header;
+    std::string_view states[UdpDatagram::kMaxStates];
+    if (!UdpDatagram::parse(data, len, header, states) || (peerFilter && !peerFilter(from, header.session))) {
+        ++rejected;
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    const uint64_t key = streamKey(from, header.deviceId);
+    auto it = streams.find(key);
+
+    // How many of the carried states are new to us, oldest of them first.
+    size_t fresh = 1;
+    size_t advanced = 1;
+    size_t missedNow = 0;
+    if (it != streams.end()) {
+        const int32_t ahead = static_cast<int32_t>(header.seq - it->second.lastSeq); // wrap-safe
+        if (ahead <= 0) {
+            ++outOfOrder;
+            if (it->second.link) it->second.link->countReceive(len, NetTelemetry::nowUs());
+            return;
+        }
+        const size_t missed = static_cast<size_t>(ahead) - 1;
+        const size_t carried = header.stateCount - 1;
+        fresh = 1 + std::min<size_t>(missed, carried);
+        advanced = static_cast<size_t>(ahead);
+        missedNow = missed;
+        recovered += fresh - 1;
+        lost += missed - (fresh - 1);
+    }
+    else {
+        it = streams.emplace(key, Stream{}).first;
+        if (telemetry) it->second.link = telemetry->acquire(NetTelemetry::Kind::Udp, from.sin_addr.s_addr, ntohs(from.sin_port));
+    }
+    if (NetTelemetry::Link* link = it->second.link) {
+        link->onReceive(len, NetTelemetry::nowUs(), header.sendTimeUs);
+        link->onSequence(advanced, missedNow);
+        link->setSession(header.session); // a phone that logged in again keeps its UDP port
+    }
+    it->second.lastSeq = header.seq;
+    it->second.lastSeen = now;
+    ++accepted;
+
+    if (!messageHandler) return;
+    for (size_t i = fresh; i-- > 0;) {
+        Frame frame{ FrameType::ControllerState, states[i], from.sin_addr.s_addr, header.session };
+        messageHandler(udpSocket, WireMode::Binary, frame);
+    }
+}
+
+void UdpSocketClass::expireStreams() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = streams.begin(); it != streams.end();) {
+        if (now - it->second.lastSeen >= STREAM_TIMEOUT) {
+            if (telemetry) telemetry->release(it->second.link);
+            it = streams.erase(it);
+        }
+        else ++it;
+    }
+}
+
+bool UdpSocketClass::GetStatus() {
+    return running;
+}
+
+UdpSocketClass::Stats UdpSocketClass::GetStats() const {
+    Stats st;
+    st.received = received;
+    st.accepted = accepted;
+    st.outOfOrder = outOfOrder;
+    st.recovered = recovered;
+    st.lost = lost;
+    st.rejected = rejected;
+    return st;
+}
+
+void UdpSocketClass::CloseSocket() {
+    if (!running.exchange(false)) return;
+
+    loop.stop();
+    if (loopThread.joinable()) loopThread.join();
+
+    loop.remove(udpSocket);
+    s2uk_net::closeSocket(udpSocket);
+    udpSocket = INVALID_SOCKET;
+    if (telemetry) {
+        for (auto& [key, stream] : streams) telemetry->release(stream.link);
+    }
+    streams.clear();
+
+    s2uk_net::cleanup();
+}
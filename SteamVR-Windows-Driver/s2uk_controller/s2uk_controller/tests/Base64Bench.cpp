@@ -0,0 +1,72 @@
+#include "Base64.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Throughput of s2uk_base64 at the size of a controller packet and of a large buffer, next
+// to the scalar loop alone. Not a test: run Base64Bench by hand.
+namespace {
+    // The same quads s2uk_base64::decode falls back to, without the SIMD blocks in front.
+    size_t scalarDecode(const char* in, size_t len, uint8_t* out) {
+        size_t o = 0;
+        uint32_t acc = 0;
+        int n = 0;
+        for (size_t i = 0; i < len; ++i) {
+            const uint8_t v = s2uk_base64::detail::kDecodeTable[static_cast<uint8_t>(in[i])];
+            if (v >= 64) break;
+            acc = (acc << 6) | v;
+            if (++n == 4) {
+                out[o++] = static_cast<uint8_t>(acc >> 16);
+                out[o++] = static_cast<uint8_t>(acc >> 8);
+                out[o++] = static_cast<uint8_t>(acc);
+                acc = 0;
+                n = 0;
+            }
+        }
+        return o;
+    }
+
+    template<class Fn>
+    void run(const char* name, size_t bytes, Fn&& fn) {
+        const size_t rounds = std::max<size_t>(1, (size_t(256) << 20) / bytes);
+        size_t sink = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) sink += fn();
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-28s %8zu B  %8.0f MB/s  %7.1f ns/call  (%zu)\n", name, bytes, rounds * bytes / s / 1e6, s * 1e9 / rounds, sink & 1);
+    }
+}
+
+int main() {
+    std::mt19937 rng(16);
+#if defined(S2UK_BASE64_X86)
+    std::printf("kernels: ssse3 %d, avx2 %d\n", s2uk_base64::detail::cpu().ssse3, s2uk_base64::detail::cpu().avx2);
+#elif defined(S2UK_BASE64_NEON)
+    std::printf("kernels: neon\n");
+#else
+    std::printf("kernels: none\n");
+#endif
+
+    // A varint controller packet is about 30 bytes, a text line 40 characters.
+    for (size_t len : { size_t(30), size_t(64) << 10 }) {
+        std::vector<uint8_t> data(len);
+        for (uint8_t& b : data) b = static_cast<uint8_t>(rng());
+        std::string coded(s2uk_base64::encodedSize(len), '\0');
+        s2uk_base64::encode(data.data(), len, coded.data());
+        std::vector<uint8_t> out(s2uk_base64::maxDecodedSize(coded.size()));
+
+        run("encode", len, [&]() { return s2uk_base64::encode(data.data(), len, coded.data()); });
+        run("decode", coded.size(), [&]() {
+            size_t n = 0;
+            s2uk_base64::decode(coded.data(), coded.size(), out.data(), out.size(), n);
+            return n;
+        });
+        run("decode, scalar loop only", coded.size(), [&]() { return scalarDecode(coded.data(), coded.size(), out.data()); });
+    }
+    return 0;
+}
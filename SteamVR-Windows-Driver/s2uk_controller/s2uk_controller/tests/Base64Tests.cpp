@@ -0,0 +1,141 @@
+#include "Base64.h"
+#include "Crypto.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// The SIMD kernels and the scalar loop have to agree byte for byte, so everything is checked
+// against a plain reference at lengths around every block size, whichever kernel the CPU picks.
+namespace {
+    std::string referenceEncode(const std::vector<uint8_t>& in) {
+        static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for (size_t i = 0; i < in.size(); i += 3) {
+            uint32_t v = uint32_t(in[i]) << 16;
+            if (i + 1 < in.size()) v |= uint32_t(in[i + 1]) << 8;
+            if (i + 2 < in.size()) v |= in[i + 2];
+            out += alphabet[(v >> 18) & 0x3F];
+            out += alphabet[(v >> 12) & 0x3F];
+            out += i + 1 < in.size() ? alphabet[(v >> 6) & 0x3F] : '=';
+            out += i + 2 < in.size() ? alphabet[v & 0x3F] : '=';
+        }
+        return out;
+    }
+
+    s2uk_base64::Status decode(const std::string& in, std::vector<uint8_t>& out) {
+        out.assign(s2uk_base64::maxDecodedSize(in.size()), 0);
+        size_t n = 0;
+        const s2uk_base64::Status st = s2uk_base64::decode(in.data(), in.size(), out.data(), out.size(), n);
+        if (st == s2uk_base64::Status::Ok) out.resize(n);
+        return st;
+    }
+
+    void rfcVectors() {
+        const char* plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+        const char* coded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+        for (size_t i = 0; i < 7; ++i) {
+            CHECK(s2uk_crypto::base64_encode(plain[i]) == coded[i]);
+            std::vector<uint8_t> back;
+            CHECK(decode(coded[i], back) == s2uk_base64::Status::Ok);
+            CHECK(std::string(back.begin(), back.end()) == plain[i]);
+        }
+    }
+
+    void roundTrips() {
+        std::mt19937 rng(16);
+        for (size_t len = 0; len <= 300; ++len) {
+            std::vector<uint8_t> data(len);
+            for (uint8_t& b : data) b = static_cast<uint8_t>(rng());
+
+            std::string coded(s2uk_base64::encodedSize(len), '\0');
+            CHECK(s2uk_base64::encode(data.data(), len, coded.data()) == coded.size());
+            CHECK(coded == referenceEncode(data));
+
+            std::vector<uint8_t> back;
+            CHECK(decode(coded, back) == s2uk_base64::Status::Ok);
+            CHECK(back == data);
+        }
+    }
+
+    // Whitespace anywhere is skipped, also inside what would be a SIMD block.
+    void whitespace() {
+        std::mt19937 rng(17);
+        std::vector<uint8_t> data(200);
+        for (uint8_t& b : data) b = static_cast<uint8_t>(rng());
+        const std::string coded = referenceEncode(data);
+        for (size_t at = 0; at <= coded.size(); at += 7) {
+            std::string spaced = coded;
+            spaced.insert(at, at % 2 ? "\r\n" : " \t");
+            std::vector<uint8_t> back;
+            CHECK(decode(spaced, back) == s2uk_base64::Status::Ok);
+            CHECK(back == data);
+        }
+    }
+
+    // A bad byte at any position, in a block or the tail, is Invalid; so is a partial quad.
+    void invalid() {
+        const std::string coded = referenceEncode(std::vector<uint8_t>(96, 0x5A));
+        for (size_t at = 0; at < coded.size(); ++at) {
+            for (char bad : { '*', '\0', '\x80', '-', '_' }) {
+                std::string broken = coded;
+                broken[at] = bad;
+                std::vector<uint8_t> back;
+                CHECK(decode(broken, back) == s2uk_base64::Status::Invalid);
+                CHECK(!s2uk_crypto::isBase64(broken));
+            }
+        }
+        std::vector<uint8_t> back;
+        CHECK(decode("Zm9", back) == s2uk_base64::Status::Invalid);
+        CHECK(decode("Zm9vY", back) == s2uk_base64::Status::Invalid);
+    }
+
+    void badPadding() {
+        std::vector<uint8_t> back;
+        for (const char* s : { "Z===", "====", "Zm=v", "Zg==Zm8=", "Zm9v=" }) {
+            const s2uk_base64::Status st = decode(s, back);
+            CHECK(st == s2uk_base64::Status::BadPadding || st == s2uk_base64::Status::Invalid);
+            CHECK(st != s2uk_base64::Status::Ok);
+        }
+        CHECK(decode("Zg==Zm8=", back) == s2uk_base64::Status::BadPadding);
+        CHECK(decode("Zg== \n", back) == s2uk_base64::Status::Ok); // whitespace after padding is fine
+    }
+
+    void noSpace() {
+        const std::string coded = referenceEncode(std::vector<uint8_t>(100, 1));
+        std::vector<uint8_t> out(100);
+        size_t n = 0;
+        CHECK(s2uk_base64::decode(coded.data(), coded.size(), out.data(), 100, n) == s2uk_base64::Status::Ok);
+        CHECK(n == 100);
+        CHECK(s2uk_base64::decode(coded.data(), coded.size(), out.data(), 99, n) == s2uk_base64::Status::NoSpace);
+        CHECK(s2uk_base64::decode(coded.data(), coded.size(), out.data(), 0, n) == s2uk_base64::Status::NoSpace);
+    }
+
+    // The driver's wrapper: 0 for not-base64, exceptions for broken base64.
+    void cryptoWrapper() {
+        uint8_t out[16];
+        CHECK(s2uk_crypto::base64_decode("Zm9v", out, sizeof(out)) == 3);
+        CHECK(s2uk_crypto::base64_decode("s2uk_connection_init", out, sizeof(out)) == 0);
+        bool threw = false;
+        try { s2uk_crypto::base64_decode("Zg==Zm8=", out, sizeof(out)); }
+        catch (const std::invalid_argument&) { threw = true; }
+        CHECK(threw);
+        threw = false;
+        try { s2uk_crypto::base64_decode("Zm9vYmFy", out, 2); }
+        catch (const std::length_error&) { threw = true; }
+        CHECK(threw);
+    }
+}
+
+int main() {
+    rfcVectors();
+    roundTrips();
+    whitespace();
+    invalid();
+    badPadding();
+    noSpace();
+    cryptoWrapper();
+    return s2uk_test::result();
+}
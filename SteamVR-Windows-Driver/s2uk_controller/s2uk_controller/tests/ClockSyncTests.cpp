@@ -0,0 +1,97 @@
+#include "ClockSync.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+#include <random>
+
+// A simulated phone whose clock runs at (1 + skew) of the driver's from a fixed offset,
+// pinged four times a second over a network that adds random queueing to either leg.
+namespace {
+    constexpr uint64_t kStartUs = 1000000000;
+    constexpr uint64_t kPingUs = 250000;
+
+    struct Phone {
+        double offsetUs;
+        double skew;
+        uint64_t at(uint64_t localUs) const { return uint64_t(double(localUs) + offsetUs + skew * double(localUs - kStartUs)); }
+    };
+
+    // One exchange starting at t0 with the given one-way delays and a 300 us turnaround.
+    bool exchange(ClockSync& cs, const Phone& p, uint64_t t0, uint64_t up, uint64_t down) {
+        const uint64_t t1 = p.at(t0 + up);
+        const uint64_t t2 = p.at(t0 + up + 300);
+        return cs.addSample(t0, t1, t2, t0 + up + 300 + down);
+    }
+
+    void rejectsBackwards() {
+        ClockSync cs;
+        CHECK(!cs.addSample(100, 50, 60, 90));   // t3 before t0
+        CHECK(!cs.addSample(100, 60, 50, 200));  // t2 before t1
+        CHECK(!cs.addSample(100, 0, 150, 200));  // phone took longer than the round trip
+        CHECK(!cs.estimate().valid);
+    }
+
+    // Equal legs give the offset exactly, and the round trip without the turnaround.
+    void symmetric() {
+        ClockSync cs;
+        const Phone p{ 5000000.0, 0.0 };
+        CHECK(exchange(cs, p, kStartUs, 2000, 2000));
+        const auto& e = cs.estimate();
+        CHECK(e.valid);
+        CHECK(e.offsetUs == 5000000);
+        CHECK(e.delayUs == 4000);
+        CHECK(e.samples == 1);
+        CHECK(e.toLocal(p.at(kStartUs + 12345)) == kStartUs + 12345);
+    }
+
+    // A queued leg skews its sample by half the asymmetry; the filter keeps the fastest one.
+    void filterPicksFastest() {
+        ClockSync cs;
+        const Phone p{ -750000.0, 0.0 };
+        uint64_t t0 = kStartUs;
+        exchange(cs, p, t0, 20000, 1000);
+        exchange(cs, p, t0 += kPingUs, 1000, 1000);
+        exchange(cs, p, t0 += kPingUs, 1000, 30000);
+        const auto& e = cs.estimate();
+        CHECK(e.offsetUs == -750000);
+        CHECK(e.delayUs == 2000);
+    }
+
+    // 40 ppm of drift over half a minute of pings with LAN queueing: the fit finds the drift
+    // and maps phone timestamps to within half a millisecond, long after the last ping too.
+    void tracksDrift() {
+        ClockSync cs;
+        const Phone p{ 123456.0, 40e-6 };
+        std::mt19937 rng(10);
+        std::exponential_distribution<double> queue(1.0 / 500.0);
+        uint64_t t0 = kStartUs;
+        for (int i = 0; i < 120; ++i, t0 += kPingUs) {
+            CHECK(exchange(cs, p, t0, 1500 + uint64_t(queue(rng)), 1500 + uint64_t(queue(rng))));
+        }
+        const auto& e = cs.estimate();
+        CHECK(e.samples == 64);
+        CHECK_NEAR(e.skew, 40e-6, 8e-6);
+        for (uint64_t later : { uint64_t(0), uint64_t(2000000), uint64_t(10000000) }) {
+            const uint64_t local = t0 + later;
+            CHECK_NEAR(double(e.toLocal(p.at(local))), double(local), 500.0);
+        }
+    }
+
+    // A clock that drifts far more than a crystal can is clamped rather than followed.
+    void clampsSkew() {
+        ClockSync cs;
+        const Phone p{ 0.0, 2000e-6 };
+        uint64_t t0 = kStartUs;
+        for (int i = 0; i < 64; ++i, t0 += kPingUs) exchange(cs, p, t0, 1000, 1000);
+        CHECK_NEAR(cs.estimate().skew, 500e-6, 1e-9);
+    }
+}
+
+int main() {
+    rejectsBackwards();
+    symmetric();
+    filterPicksFastest();
+    tracksDrift();
+    clampsSkew();
+    return s2uk_test::result();
+}
@@ -0,0 +1,155 @@
+#include "FrameParser.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+    struct Sent {
+        FrameType type;
+        std::string payload;
+    };
+
+    std::vector<Sent> sampleFrames() {
+        return {
+            { FrameType::ControllerState, std::string("\x01\x02\x03", 3) },
+            { FrameType::Ping, std::string(8, '\xAB') },
+            { FrameType::Haptic, std::string() }, // empty payload
+            { FrameType::ControllerState, std::string(StreamFrameParser::kMaxPayload, 'z') },
+            { FrameType::HapticEnvelope, std::string("\0\n\r", 3) }, // binary payloads may hold anything
+        };
+    }
+
+    // Every frame comes back whole and in order, however the stream is cut up.
+    void binaryRoundTrip(size_t chunk) {
+        std::string stream;
+        const auto frames = sampleFrames();
+        for (const auto& f : frames) StreamFrameParser::appendFrame(stream, f.type, f.payload);
+
+        StreamFrameParser parser(WireMode::Binary);
+        size_t got = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+            CHECK(parser.append(stream.data() + pos, std::min<size_t>(chunk, stream.size() - pos)));
+            Frame frame;
+            StreamFrameParser::Status st;
+            while ((st = parser.next(frame)) == StreamFrameParser::Status::Ready) {
+                CHECK(got < frames.size());
+                if (got >= frames.size()) return;
+                CHECK(frame.type == frames[got].type);
+                CHECK(frame.payload == frames[got].payload);
+                ++got;
+            }
+            CHECK(st == StreamFrameParser::Status::NeedMore);
+        }
+        CHECK(got == frames.size());
+    }
+
+    void binaryOversized() {
+        StreamFrameParser parser(WireMode::Binary);
+        const uint16_t len = StreamFrameParser::kMaxPayload + 1;
+        const char header[] = { static_cast<char>(len & 0xFF), static_cast<char>(len >> 8), 0x01 };
+        CHECK(parser.append(header, sizeof(header)));
+        Frame frame;
+        CHECK(parser.next(frame) == StreamFrameParser::Status::Error);
+    }
+
+    void textLines() {
+        StreamFrameParser parser(WireMode::Text);
+        const std::string stream = "abc\r\n\n  \nde f \t\nrest";
+        CHECK(parser.append(stream.data(), stream.size()));
+
+        Frame frame;
+        CHECK(parser.next(frame) == StreamFrameParser::Status::Ready);
+        CHECK(frame.payload == "abc");
+        CHECK(parser.next(frame) == StreamFrameParser::Status::Ready); // blank lines skipped
+        CHECK(frame.payload == "de f");
+        CHECK(parser.next(frame) == StreamFrameParser::Status::NeedMore); // "rest" has no newline yet
+
+        CHECK(parser.append("\n", 1));
+        CHECK(parser.next(frame) == StreamFrameParser::Status::Ready);
+        CHECK(frame.payload == "rest");
+        CHECK(frame.type == FrameType::ControllerState);
+    }
+
+    void textTooLong() {
+        StreamFrameParser parser(WireMode::Text);
+        const std::string line(StreamFrameParser::kMaxPayload + 1, 'a');
+        CHECK(parser.append(line.data(), line.size()));
+        Frame frame;
+        CHECK(parser.next(frame) == StreamFrameParser::Status::Error);
+    }
+
+    // recv() writes into the slab and frames point into it, nothing is copied.
+    void zeroCopy() {
+        RecvSlabPool pool;
+        StreamFrameParser parser(WireMode::Binary, &pool);
+
+        std::string stream;
+        StreamFrameParser::appendFrame(stream, FrameType::ControllerState, "hello");
+        size_t room = 0;
+        char* dst = parser.prepare(room);
+        CHECK(dst != nullptr);
+        CHECK(room == StreamFrameParser::kMaxBuffered);
+        std::memcpy(dst, stream.data(), stream.size());
+        parser.commit(stream.size());
+
+        Frame frame;
+        CHECK(parser.next(frame) == StreamFrameParser::Status::Ready);
+        CHECK(frame.payload == "hello");
+        CHECK(frame.payload.data() == dst + StreamFrameParser::kHeaderSize);
+    }
+
+    // Slabs go back to the pool once a parser has nothing buffered.
+    void slabReuse() {
+        RecvSlabPool pool;
+        {
+            StreamFrameParser a(WireMode::Binary, &pool), b(WireMode::Binary, &pool);
+            std::string stream;
+            StreamFrameParser::appendFrame(stream, FrameType::Ping, "12345678");
+            CHECK(a.append(stream.data(), stream.size()));
+            CHECK(b.append(stream.data(), 2)); // partial header
+            CHECK(pool.allocated() == 2);
+            CHECK(pool.available() == 0);
+
+            Frame frame;
+            CHECK(a.next(frame) == StreamFrameParser::Status::Ready);
+            a.reclaim();
+            b.reclaim(); // still holds a partial frame, keeps its slab
+            CHECK(pool.available() == 1);
+
+            // The next receive takes the released slab instead of allocating.
+            StreamFrameParser c(WireMode::Binary, &pool);
+            CHECK(c.append(stream.data(), stream.size()));
+            CHECK(pool.allocated() == 2);
+            CHECK(pool.available() == 0);
+
+            CHECK(b.append(stream.data() + 2, stream.size() - 2));
+            CHECK(b.next(frame) == StreamFrameParser::Status::Ready);
+            CHECK(frame.payload == "12345678");
+        }
+        CHECK(pool.available() == pool.allocated()); // destructors give the slabs back
+    }
+
+    // A peer that never finishes a message runs out of buffer, it doesn't grow it.
+    void bufferLimit() {
+        StreamFrameParser parser(WireMode::Text);
+        const std::string junk(StreamFrameParser::kMaxBuffered, 'x');
+        CHECK(parser.append(junk.data(), junk.size()));
+        size_t room = 1;
+        CHECK(parser.prepare(room) == nullptr);
+        CHECK(room == 0);
+        CHECK(!parser.append("y", 1));
+    }
+}
+
+int main() {
+    for (size_t chunk : { size_t(1), size_t(2), size_t(7), size_t(100), size_t(1) << 16 }) binaryRoundTrip(chunk);
+    binaryOversized();
+    textLines();
+    textTooLong();
+    zeroCopy();
+    slabReuse();
+    bufferLimit();
+    return s2uk_test::result();
+}
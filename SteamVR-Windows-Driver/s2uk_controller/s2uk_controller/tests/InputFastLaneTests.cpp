@@ -0,0 +1,137 @@
+#include "InputFastLane.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+    using State = BufferCompression::ControllerState;
+
+    struct Submitted {
+        InputFastLane::Inputs now;
+        bool hadBefore;
+        InputFastLane::Inputs before;
+        float timeOffsetS;
+    };
+
+    struct Recorder {
+        std::vector<Submitted> calls;
+        bool onState(InputFastLane& lane, const State& s, uint64_t nowUs) {
+            return lane.onState(s, nowUs, [&](const InputFastLane::Inputs& now, const InputFastLane::Inputs* before, float offset) {
+                calls.push_back({ now, before != nullptr, before ? *before : InputFastLane::Inputs{}, offset });
+            });
+        }
+    };
+
+    void mapping() {
+        State s;
+        s.btn_system_or_menu_state = true;
+        s.btn_b_or_y_state = true;
+        s.trigger_state = 2;
+        s.grip_state = 1;
+        s.joy_state = 2;
+        const auto in = InputFastLane::Inputs::from(s);
+        CHECK(in.system && !in.a && in.b);
+        CHECK(in.trigger == 0.5f && in.grip == 1.0f);
+        CHECK(in.joyClick && !in.joyTouch && in.thumbrest);
+
+        s.joy_state = 1;
+        const auto touched = InputFastLane::Inputs::from(s);
+        CHECK(!touched.joyClick && touched.joyTouch && touched.thumbrest);
+    }
+
+    // The first state always goes out, then only changes of a discrete input; the stick
+    // and the gyro are not the lane's business.
+    void edgesOnly() {
+        InputFastLane lane;
+        Recorder rec;
+        State s;
+        CHECK(rec.onState(lane, s, 1000));
+        CHECK(rec.calls.size() == 1 && !rec.calls[0].hadBefore);
+
+        s.joy = Vec2(0.5, -0.5);
+        s.gyro = Vec3(1.0, 2.0, 3.0);
+        CHECK(!rec.onState(lane, s, 2000));
+
+        s.btn_a_or_x_state = true;
+        CHECK(rec.onState(lane, s, 3000));
+        CHECK(rec.calls.size() == 2);
+        CHECK(rec.calls[1].hadBefore && !rec.calls[1].before.a && rec.calls[1].now.a);
+
+        s.trigger_state = 1;
+        CHECK(rec.onState(lane, s, 4000));
+        CHECK(rec.calls.back().now.trigger == 1.0f && rec.calls.back().before.trigger == 0.0f);
+        CHECK(lane.getStats().edges == 3);
+    }
+
+    // A late datagram must not undo a newer press; one from seconds back is a new session.
+    void staleIgnored() {
+        InputFastLane lane;
+        Recorder rec;
+        State pressed;
+        pressed.btn_a_or_x_state = true;
+        pressed.senderTimeUs = 50000000;
+        CHECK(rec.onState(lane, pressed, 1000));
+
+        State released = pressed;
+        released.btn_a_or_x_state = false;
+        released.senderTimeUs = pressed.senderTimeUs - 20000;
+        CHECK(!rec.onState(lane, released, 2000));
+        CHECK(lane.getStats().stale == 1);
+        CHECK(rec.calls.size() == 1);
+
+        released.senderTimeUs = 1000; // rebooted phone
+        CHECK(rec.onState(lane, released, 3000));
+        CHECK(!rec.calls.back().now.a);
+
+        // Without sender times there is nothing to order by, every change goes through.
+        State untimed;
+        untimed.btn_b_or_y_state = true;
+        CHECK(rec.onState(lane, untimed, 4000));
+    }
+
+    // The offset is how long ago the sample was taken, capped, and 0 before clock sync.
+    void timeOffset() {
+        InputFastLane lane;
+        Recorder rec;
+        State s;
+        s.sampleTimeUs = 995000;
+        CHECK(rec.onState(lane, s, 1000000));
+        CHECK_NEAR(rec.calls.back().timeOffsetS, -0.005, 1e-6);
+
+        s.btn_system_or_menu_state = true;
+        s.sampleTimeUs = 1000000;
+        CHECK(rec.onState(lane, s, 2000000));
+        CHECK_NEAR(rec.calls.back().timeOffsetS, -0.1, 1e-6);
+
+        s.btn_system_or_menu_state = false;
+        s.sampleTimeUs = 0;
+        CHECK(rec.onState(lane, s, 3000000));
+        CHECK(rec.calls.back().timeOffsetS == 0.0f);
+    }
+
+    // frameWaitUs is from the first edge since the last frame to the frame that picks it up.
+    void frameWait() {
+        InputFastLane lane;
+        Recorder rec;
+        State s;
+        rec.onState(lane, s, 1000);
+        s.grip_state = 1;
+        rec.onState(lane, s, 3000);
+        lane.onFrame(9000);
+        lane.onFrame(20000); // nothing new
+        s.grip_state = 0;
+        rec.onState(lane, s, 21000);
+        lane.onFrame(25000);
+        CHECK(lane.getStats().frameWaitUs == (8000 + 4000) / 2);
+    }
+}
+
+int main() {
+    mapping();
+    edgesOnly();
+    staleIgnored();
+    timeOffset();
+    frameWait();
+    return s2uk_test::result();
+}
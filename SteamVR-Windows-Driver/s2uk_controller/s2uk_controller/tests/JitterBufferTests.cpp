@@ -0,0 +1,164 @@
+#include "JitterBuffer.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Samples are their own send time in us, so the output can be compared with where the
+// sender was, and interpolation of a ramp is exact.
+namespace {
+    using Buffer = JitterBuffer<double, 64>;
+
+    double lerp(double a, double b, double t) { return a + (b - a) * t; }
+
+    constexpr uint64_t kPeriodUs = 10000; // a 100 Hz phone
+    constexpr uint64_t kFrameUs = 11111;  // a 90 Hz headset
+    constexpr uint64_t kStartUs = 1000000;
+
+    struct Run {
+        uint64_t frames = 0;
+        uint64_t backwards = 0; // frames whose output went back in time
+        double worstLagUs = 0;  // how far behind the sender the output was, after warm-up
+        double worstLeadUs = 0; // ahead of the sender: extrapolating, which it never should
+    };
+
+    // Sends a sample every kPeriodUs for durationUs with arrival delays from delayUs(send),
+    // and samples the buffer every kFrameUs in between. Arrivals stay in order, like TCP and
+    // the UDP receiver's sequence check deliver them: a delayed sample holds up the next.
+    template<class Delay>
+    Run play(Buffer& jb, uint64_t durationUs, Delay&& delayUs) {
+        Run r;
+        uint64_t nextSend = kStartUs;
+        uint64_t lastArrival = 0;
+        std::vector<std::pair<uint64_t, double>> inFlight; // arrival, value
+        double last = 0;
+        bool have = false;
+        for (uint64_t now = kStartUs; now < kStartUs + durationUs; now += 500) {
+            while (nextSend <= now) {
+                lastArrival = std::max<uint64_t>(lastArrival, nextSend + delayUs(nextSend));
+                inFlight.emplace_back(lastArrival, double(nextSend));
+                nextSend += kPeriodUs;
+            }
+            for (size_t i = 0; i < inFlight.size();) {
+                if (inFlight[i].first <= now) {
+                    jb.push(inFlight[i].second, inFlight[i].first);
+                    inFlight.erase(inFlight.begin() + i);
+                }
+                else ++i;
+            }
+            if ((now - kStartUs) % kFrameUs >= 500) continue;
+
+            double out = 0;
+            if (!jb.sample(now, out, lerp)) continue;
+            ++r.frames;
+            if (have && out < last) ++r.backwards;
+            last = out;
+            have = true;
+            if (now > kStartUs + 500000) {
+                r.worstLagUs = std::max<double>(r.worstLagUs, double(now) - out);
+                r.worstLeadUs = std::max<double>(r.worstLeadUs, out - double(now));
+            }
+        }
+        return r;
+    }
+
+    void empty() {
+        Buffer jb;
+        double out = -1;
+        CHECK(!jb.sample(kStartUs, out, lerp));
+        CHECK(out == -1);
+    }
+
+    // A perfect network: one period of delay and a smooth ramp out.
+    void steady() {
+        Buffer jb;
+        const Run r = play(jb, 2000000, [](uint64_t) { return uint64_t(2000); });
+        const auto st = jb.getStats();
+        CHECK(r.frames > 150);
+        CHECK(r.backwards == 0);
+        CHECK(r.worstLeadUs <= 0);
+        CHECK(st.periodUs >= kPeriodUs - 100 && st.periodUs <= kPeriodUs + 100);
+        CHECK(st.delayUs >= kPeriodUs && st.delayUs <= kPeriodUs + 1000);
+        CHECK(st.late == 0);
+        CHECK(st.overflow == 0);
+        CHECK(r.worstLagUs < 2000 + kPeriodUs + 2000);
+    }
+
+    // Random delays up to 15 ms: the delay grows to cover them, the output stays monotonic
+    // and hardly anything is late once it has adapted.
+    void jitter() {
+        Buffer jb;
+        std::mt19937 rng(9);
+        std::uniform_int_distribution<uint64_t> d(1000, 16000);
+        const Run r = play(jb, 4000000, [&](uint64_t) { return d(rng); });
+        const auto st = jb.getStats();
+        CHECK(r.backwards == 0);
+        CHECK(r.worstLeadUs <= 0);
+        CHECK(st.delayUs >= 12000 && st.delayUs <= 40000);
+        CHECK(st.jitterUs > 0);
+        CHECK(st.late * 50 < st.pushed);
+        CHECK(r.worstLagUs <= 16000 + 40000);
+    }
+
+    // A network that sometimes stalls for 100 ms can't push the delay past the cap; the
+    // stalled samples are counted late instead.
+    void delayCap() {
+        Buffer jb;
+        jb.setMaxDelay(25000);
+        const Run r = play(jb, 3000000, [](uint64_t send) { return (send / kPeriodUs) % 50 == 0 ? uint64_t(100000) : uint64_t(1000); });
+        const auto st = jb.getStats();
+        CHECK(st.delayUs <= 25000);
+        CHECK(st.late > 0);
+        CHECK(r.worstLeadUs <= 0);
+    }
+
+    // Nothing arrives for half a second: the last sample is held and counted as underruns,
+    // then the grid starts over.
+    void pauseHolds() {
+        Buffer jb;
+        uint64_t now = kStartUs;
+        for (int i = 0; i < 50; ++i, now += kPeriodUs) jb.push(double(now), now);
+        double out = 0;
+        CHECK(jb.sample(now, out, lerp));
+        const double held = double(now - kPeriodUs);
+        for (int i = 0; i < 45; ++i) {
+            now += kFrameUs;
+            CHECK(jb.sample(now, out, lerp));
+            CHECK(out == held);
+        }
+        CHECK(jb.getStats().underruns > 0);
+
+        for (int i = 0; i < 20; ++i, now += kPeriodUs) jb.push(double(now), now);
+        CHECK(jb.sample(now, out, lerp));
+        CHECK(out > held);
+        CHECK(jb.getStats().delayUs <= 40000);
+    }
+
+    // A reader that stops draining loses the newest pushes, not the ring.
+    void overflow() {
+        JitterBuffer<double, 8> jb;
+        for (int i = 0; i < 13; ++i) jb.push(double(i), kStartUs + i * kPeriodUs);
+        auto st = jb.getStats();
+        CHECK(st.pushed == 8);
+        CHECK(st.overflow == 5);
+
+        double out = 0;
+        CHECK(jb.sample(kStartUs + 100 * kPeriodUs, out, lerp));
+        CHECK(out == 7.0);
+        jb.push(13.0, kStartUs + 101 * kPeriodUs);
+        CHECK(jb.getStats().pushed == 9);
+    }
+}
+
+int main() {
+    empty();
+    steady();
+    jitter();
+    delayCap();
+    pauseHolds();
+    overflow();
+    return s2uk_test::result();
+}
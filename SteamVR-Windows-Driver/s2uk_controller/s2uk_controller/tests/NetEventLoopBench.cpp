@@ -0,0 +1,293 @@
+#include "NetTelemetry.h"
+#include "TcpServer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// TcpSocketClass on its event loop next to the thread-per-client server it replaced, with 2,
+// 16 and 128 simulated phones on loopback. Every phone logs in with the binary login string
+// and sends ControllerState frames stamped with their send time; both servers parse them with
+// StreamFrameParser and pass them to the same handler, which records how long each took to
+// get there. Not a test: run NetEventLoopBench by hand (2>/dev/null hides the server's log).
+namespace {
+    const char kLogin[] = "s2uk_connection_init_bin\n";
+    constexpr int kPhoneHz = 100;
+    constexpr auto kPacedFor = std::chrono::seconds(2);
+    constexpr size_t kFloodFrames = 200000;
+    constexpr size_t kFloodBurst = 32; // frames per send()
+
+    struct Recorder {
+        std::mutex mutex;
+        std::vector<uint32_t> latencyUs;
+
+        void record(const Frame& frame) {
+            if (frame.type != FrameType::ControllerState || frame.payload.size() < sizeof(uint64_t)) return;
+            uint64_t sentUs = 0;
+            for (size_t i = 0; i < sizeof(uint64_t); ++i) sentUs |= uint64_t(uint8_t(frame.payload[i])) << (8 * i);
+            const uint64_t now = NetTelemetry::nowUs();
+            std::lock_guard<std::mutex> lock(mutex);
+            latencyUs.push_back(static_cast<uint32_t>(now > sentUs ? now - sentUs : 0));
+        }
+
+        size_t count() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return latencyUs.size();
+        }
+
+        void reset() {
+            std::lock_guard<std::mutex> lock(mutex);
+            latencyUs.clear();
+        }
+    };
+
+    // The old TcpSocketClass in miniature: a blocking accept thread and one blocking recv()
+    // thread per phone, frames handed on from every thread through the shared recorder.
+    class ThreadPerClientServer {
+    public:
+        explicit ThreadPerClientServer(Recorder& recorder) : recorder(recorder) {}
+
+        bool start() {
+            listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (listener == INVALID_SOCKET) return false;
+            s2uk_net::setReuseAddr(listener);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            if (bind(listener, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(listener, SOMAXCONN) == SOCKET_ERROR ||
+                getsockname(listener, (sockaddr*)&addr, &len) == SOCKET_ERROR) return false;
+            port = ntohs(addr.sin_port);
+            acceptThread = std::thread([this]() { acceptLoop(); });
+            return true;
+        }
+
+        // The phones have to be gone already, their threads only end on a closed connection.
+        void stop() {
+            running = false;
+            SOCKET wake = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            connect(wake, (sockaddr*)&addr, sizeof(addr));
+            acceptThread.join();
+            s2uk_net::closeSocket(wake);
+            s2uk_net::closeSocket(listener);
+            for (auto& t : clientThreads) t.join();
+        }
+
+        int getPort() const { return port; }
+
+    private:
+        void acceptLoop() {
+            while (true) {
+                SOCKET sock = accept(listener, nullptr, nullptr);
+                if (!running) {
+                    if (sock != INVALID_SOCKET) s2uk_net::closeSocket(sock);
+                    return;
+                }
+                if (sock == INVALID_SOCKET) continue;
+                s2uk_net::setNoDelay(sock);
+                clientThreads.emplace_back([this, sock]() { serve(sock); });
+            }
+        }
+
+        void serve(SOCKET sock) {
+            StreamFrameParser parser(WireMode::Text);
+            char buf[2048];
+            bool loggedIn = false;
+            while (true) {
+                const int n = s2uk_net::recvBytes(sock, buf, sizeof(buf));
+                if (n <= 0 || !parser.append(buf, static_cast<size_t>(n))) break;
+                Frame frame;
+                StreamFrameParser::Status st;
+                while ((st = parser.next(frame)) == StreamFrameParser::Status::Ready) {
+                    if (!loggedIn) {
+                        loggedIn = true;
+                        parser.setMode(WireMode::Binary);
+                        continue;
+                    }
+                    recorder.record(frame);
+                }
+                if (st == StreamFrameParser::Status::Error) break;
+            }
+            s2uk_net::closeSocket(sock);
+        }
+
+        Recorder& recorder;
+        SOCKET listener = INVALID_SOCKET;
+        int port = 0;
+        std::atomic<bool> running{ true };
+        std::thread acceptThread;
+        std::vector<std::thread> clientThreads; // accept thread only until stop()
+    };
+
+    void appendState(std::string& out, uint64_t stampUs) {
+        char payload[12] = {};
+        for (size_t i = 0; i < sizeof(uint64_t); ++i) payload[i] = static_cast<char>(stampUs >> (8 * i));
+        StreamFrameParser::appendFrame(out, FrameType::ControllerState, std::string_view(payload, sizeof(payload)));
+    }
+
+    bool sendAll(SOCKET sock, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            const int n = s2uk_net::sendBytes(sock, data.data() + done, static_cast<int>(data.size() - done));
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::vector<SOCKET> connectPhones(int port, size_t count) {
+        std::vector<SOCKET> phones;
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        for (size_t i = 0; i < count; ++i) {
+            SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (sock == INVALID_SOCKET || connect(sock, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+                std::fprintf(stderr, "connect() failed\n");
+                break;
+            }
+            s2uk_net::setNoDelay(sock);
+            sendAll(sock, kLogin);
+            phones.push_back(sock);
+        }
+        return phones;
+    }
+
+    bool waitFor(Recorder& recorder, size_t expected) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (recorder.count() < expected) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    struct Result {
+        uint32_t p50Us = 0;
+        uint32_t p99Us = 0;
+        uint32_t maxUs = 0;
+        double cpuS = 0;
+        double framesPerS = 0;
+        bool complete = true;
+    };
+
+    Result summarize(Recorder& recorder) {
+        Result r;
+        std::lock_guard<std::mutex> lock(recorder.mutex);
+        auto& v = recorder.latencyUs;
+        if (v.empty()) return r;
+        std::sort(v.begin(), v.end());
+        r.p50Us = v[v.size() / 2];
+        r.p99Us = v[v.size() * 99 / 100];
+        r.maxUs = v.back();
+        return r;
+    }
+
+    // Every phone sends at kPhoneHz, all of them on the same tick: how long a state waits
+    // for the server when a burst of them lands at once.
+    Result paced(Recorder& recorder, const std::vector<SOCKET>& phones) {
+        recorder.reset();
+        const auto period = std::chrono::microseconds(1000000 / kPhoneHz);
+        const auto start = std::chrono::steady_clock::now();
+        const std::clock_t cpu = std::clock();
+        size_t sent = 0;
+        for (auto tick = start; tick < start + kPacedFor; tick += period) {
+            std::this_thread::sleep_until(tick);
+            for (SOCKET sock : phones) {
+                std::string frame;
+                appendState(frame, NetTelemetry::nowUs());
+                sent += sendAll(sock, frame) ? 1 : 0;
+            }
+        }
+        const bool complete = waitFor(recorder, sent);
+        Result r = summarize(recorder);
+        r.cpuS = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+        r.complete = complete;
+        return r;
+    }
+
+    // The phones send kFloodFrames between them as fast as the server takes them.
+    Result flood(Recorder& recorder, const std::vector<SOCKET>& phones) {
+        recorder.reset();
+        const size_t perPhone = kFloodFrames / phones.size();
+        const auto start = std::chrono::steady_clock::now();
+        const std::clock_t cpu = std::clock();
+        size_t sent = 0;
+        for (size_t done = 0; done < perPhone; done += kFloodBurst) {
+            const size_t burst = std::min<size_t>(kFloodBurst, perPhone - done);
+            for (SOCKET sock : phones) {
+                std::string frames;
+                const uint64_t now = NetTelemetry::nowUs();
+                for (size_t i = 0; i < burst; ++i) appendState(frames, now);
+                if (sendAll(sock, frames)) sent += burst;
+            }
+        }
+        const bool complete = waitFor(recorder, sent);
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Result r = summarize(recorder);
+        r.cpuS = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+        r.framesPerS = double(sent) / s;
+        r.complete = complete;
+        return r;
+    }
+
+    void print(const char* server, const char* load, size_t phones, size_t threads, const Result& r) {
+        std::printf("%-18s %-6s %4zu phones %4zu threads  p50 %6u us  p99 %6u us  max %7u us  cpu %5.2f s",
+            server, load, phones, threads, r.p50Us, r.p99Us, r.maxUs, r.cpuS);
+        if (r.framesPerS > 0) std::printf("  %8.0f frames/s", r.framesPerS);
+        std::printf("%s\n", r.complete ? "" : "  (incomplete)");
+    }
+
+    void closePhones(std::vector<SOCKET>& phones) {
+        for (SOCKET sock : phones) s2uk_net::closeSocket(sock);
+        phones.clear();
+    }
+}
+
+int main() {
+    if (!s2uk_net::startup()) return 1;
+    std::printf("%u hardware threads, phones at %d Hz for the paced load\n", std::thread::hardware_concurrency(), kPhoneHz);
+
+    for (size_t count : { size_t(2), size_t(16), size_t(128) }) {
+        Recorder recorder;
+        {
+            SessionLimits limits;
+            limits.maxInboundBytesPerSec = 0;
+            limits.maxInboundMessagesPerSec = 0;
+            auto server = std::make_unique<TcpSocketClass>();
+            server->SetLimits(limits);
+            server->SetMessageHandler([&](SOCKET, WireMode, const Frame& frame) { recorder.record(frame); });
+            server->Connect(0);
+            if (!server->GetStatus()) return 1;
+            auto phones = connectPhones(server->GetPort(), count);
+            print("event loop", "paced", phones.size(), 1, paced(recorder, phones));
+            print("event loop", "flood", phones.size(), 1, flood(recorder, phones));
+            closePhones(phones);
+            server->CloseSocket();
+        }
+        {
+            ThreadPerClientServer server(recorder);
+            if (!server.start()) return 1;
+            auto phones = connectPhones(server.getPort(), count);
+            print("thread per client", "paced", phones.size(), phones.size() + 1, paced(recorder, phones));
+            print("thread per client", "flood", phones.size(), phones.size() + 1, flood(recorder, phones));
+            closePhones(phones);
+            server.stop();
+        }
+    }
+    s2uk_net::cleanup();
+    return 0;
+}
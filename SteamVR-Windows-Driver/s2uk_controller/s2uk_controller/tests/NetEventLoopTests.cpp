@@ -0,0 +1,109 @@
+#include "NetEventLoop.h"
+#include "TestCheck.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+    // A stop() before run() must not be lost, or run() would block until the next event.
+    void stopBeforeRun() {
+        NetEventLoop loop;
+        loop.stop(); // before init() too: there is no wakeup to send yet
+        CHECK(loop.init());
+        loop.run();
+
+        // The loop can run again after a stop.
+        NetEventLoop other;
+        CHECK(other.init());
+        std::thread t([&]() { other.stop(); });
+        t.join();
+        other.run();
+    }
+
+    void postRunsOnLoopThread() {
+        NetEventLoop loop;
+        CHECK(loop.init());
+        std::atomic<int> ran{ 0 };
+        std::atomic<bool> onLoop{ false };
+        std::thread runner([&]() { loop.run(); });
+
+        for (int i = 0; i < 100; ++i) loop.post([&]() { ++ran; });
+        loop.post([&]() { onLoop = loop.isLoopThread(); });
+        loop.post([&]() { loop.stop(); });
+        runner.join();
+
+        CHECK(ran == 100);
+        CHECK(onLoop);
+        CHECK(!loop.isLoopThread());
+    }
+
+    // Tasks posted around stop() still run before run() returns.
+    void stopRunsPosted() {
+        NetEventLoop loop;
+        CHECK(loop.init());
+        int ran = 0;
+        loop.post([&]() { ++ran; });
+        loop.stop();
+        loop.run();
+        CHECK(ran == 1);
+    }
+
+    void timersFire() {
+        NetEventLoop loop;
+        CHECK(loop.init());
+        int ticks = 0;
+        loop.addTimer(std::chrono::milliseconds(5), [&]() {
+            if (++ticks == 3) loop.stop();
+        });
+        const auto start = std::chrono::steady_clock::now();
+        loop.run();
+        CHECK(ticks == 3);
+        CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+    }
+
+    // A datagram to ourselves over loopback; the handler removes its own socket.
+    void socketReadable() {
+        CHECK(s2uk_net::startup());
+        SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        CHECK(sock != INVALID_SOCKET);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHECK(bind(sock, (sockaddr*)&addr, sizeof(addr)) == 0);
+        socklen_t len = sizeof(addr);
+        CHECK(getsockname(sock, (sockaddr*)&addr, &len) == 0);
+        s2uk_net::setNonBlocking(sock);
+
+        NetEventLoop loop;
+        CHECK(loop.init());
+        uint32_t seen = 0;
+        char got = 0;
+        CHECK(loop.add(sock, NetEventLoop::Readable, [&](SOCKET s, uint32_t events) {
+            seen = events;
+            CHECK(recv(s, &got, 1, 0) == 1);
+            loop.remove(s);
+            loop.stop();
+        }));
+        CHECK(loop.size() == 1);
+
+        const char byte = 'x';
+        CHECK(sendto(sock, &byte, 1, 0, (sockaddr*)&addr, sizeof(addr)) == 1);
+        loop.run();
+
+        CHECK((seen & NetEventLoop::Readable) != 0);
+        CHECK(got == 'x');
+        CHECK(loop.size() == 0);
+        s2uk_net::closeSocket(sock);
+        s2uk_net::cleanup();
+    }
+}
+
+int main() {
+    stopBeforeRun();
+    postRunsOnLoopThread();
+    stopRunsPosted();
+    timersFire();
+    socketReadable();
+    return s2uk_test::result();
+}
@@ -0,0 +1,132 @@
+#include "BufferCompression.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <span>
+#include <vector>
+
+// BufferCompression::decodeControllerStates next to decodeControllerState on each packet,
+// at 1, 8 and 64 packets per call. Phone packets are what the driver gets: a hand moving at
+// up to a few hundred deg/s in the default varint scales (varints of 1-3 bytes), every packet
+// timed. Wide packets carry values over the whole range, so most varints are long. Every
+// result is compared with the scalar one first. Not a test: run PacketBatchBench by hand.
+namespace {
+    using State = BufferCompression::ControllerState;
+    using Status = BufferCompression::DecodeStatus;
+
+    constexpr size_t kPackets = 4096;
+
+    struct Packets {
+        std::vector<std::vector<uint8_t>> bytes;
+        std::vector<std::span<const uint8_t>> spans;
+    };
+
+    Packets make(std::mt19937_64& rng, s2uk_packet::Codec codec, bool wide, bool quaternion) {
+        std::uniform_int_distribution<int64_t> gyro(wide ? INT32_MIN : -360 * int64_t(s2uk_packet::kDefaultGyroScale), wide ? INT32_MAX : 360 * int64_t(s2uk_packet::kDefaultGyroScale));
+        std::uniform_int_distribution<int64_t> joy(wide ? INT32_MIN : -int64_t(s2uk_packet::kDefaultJoyScale), wide ? INT32_MAX : int64_t(s2uk_packet::kDefaultJoyScale));
+        if (codec == s2uk_packet::Codec::Fixed) {
+            gyro = std::uniform_int_distribution<int64_t>(-364 * int64_t(s2uk_packet::kFixedGyroScale), 364 * int64_t(s2uk_packet::kFixedGyroScale));
+            joy = std::uniform_int_distribution<int64_t>(-int64_t(s2uk_packet::kFixedJoyScale), s2uk_packet::kFixedJoyScale);
+        }
+        Packets out;
+        uint64_t timeUs = 1700000000000000ull;
+        for (size_t i = 0; i < kPackets; ++i) {
+            s2uk_packet::ControllerPacket p;
+            p.flags = static_cast<uint8_t>((rng() & 0x3F) | (quaternion ? s2uk_packet::kFlagQuaternion : 0));
+            p.modes = static_cast<uint8_t>(rng() & 0x3F);
+            p.battery = static_cast<uint8_t>(rng() % (s2uk_packet::kMaxBattery + 1));
+            for (int64_t& g : p.gyro) g = gyro(rng);
+            for (uint8_t& q : p.quat) q = static_cast<uint8_t>(rng());
+            p.quat[s2uk_packet::kSmallestThreeBytes - 1] &= 0x7F;
+            for (int64_t& j : p.joy) j = joy(rng);
+            p.senderTimeUs = timeUs += 11000;
+            uint8_t buf[s2uk_packet::kMaxPacketSize];
+            const size_t n = s2uk_packet::encode(p, codec, buf);
+            out.bytes.emplace_back(buf, buf + n);
+        }
+        for (const auto& b : out.bytes) out.spans.emplace_back(b.data(), b.size());
+        return out;
+    }
+
+    bool same(const State& a, const State& b) {
+        return a.left_controller == b.left_controller && a.btn_system_or_menu_state == b.btn_system_or_menu_state &&
+            a.btn_a_or_x_state == b.btn_a_or_x_state && a.btn_b_or_y_state == b.btn_b_or_y_state &&
+            a.controller_battery_plugged == b.controller_battery_plugged && a.joy_in_dz == b.joy_in_dz &&
+            a.trigger_state == b.trigger_state && a.grip_state == b.grip_state && a.joy_state == b.joy_state &&
+            a.batteryPercentage == b.batteryPercentage && a.gyro.x == b.gyro.x && a.gyro.y == b.gyro.y && a.gyro.z == b.gyro.z &&
+            a.joy.x == b.joy.x && a.joy.y == b.joy.y && a.hasOrientation == b.hasOrientation &&
+            a.orientation.w == b.orientation.w && a.orientation.x == b.orientation.x && a.orientation.y == b.orientation.y &&
+            a.orientation.z == b.orientation.z && a.senderTimeUs == b.senderTimeUs;
+    }
+
+    size_t mismatches(const Packets& packets, const Handshake::WireFormat& format, size_t batch) {
+        std::vector<State> batched(kPackets);
+        std::vector<Status> status(kPackets);
+        for (size_t i = 0; i < kPackets; i += batch) {
+            BufferCompression::decodeControllerStates(&packets.spans[i], std::min<size_t>(batch, kPackets - i), &batched[i], &status[i], format);
+        }
+        size_t bad = 0;
+        for (size_t i = 0; i < kPackets; ++i) {
+            State one;
+            const Status s = BufferCompression::decodeControllerState(packets.spans[i], one, format);
+            bad += (s != status[i] || (s == Status::Ok && !same(one, batched[i]))) ? 1 : 0;
+        }
+        return bad;
+    }
+
+    // Best of a few runs over all packets, in ns per packet.
+    template<class Fn>
+    double bestNs(Fn&& fn) {
+        double best = 1e30;
+        for (int run = 0; run < 7; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < 50; ++r) fn();
+            best = std::min<double>(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (50.0 * kPackets));
+        }
+        return best;
+    }
+
+    void bench(const char* name, const Packets& packets, const Handshake::WireFormat& format) {
+        std::vector<State> out(kPackets);
+        std::vector<Status> status(kPackets);
+        double sink = 0;
+        for (size_t batch : { size_t(1), size_t(8), size_t(64) }) {
+            const size_t bad = mismatches(packets, format, batch);
+            const double scalar = bestNs([&]() {
+                for (size_t i = 0; i < kPackets; ++i) status[i] = BufferCompression::decodeControllerState(packets.spans[i], out[i], format);
+                sink += out[kPackets - 1].joy.x;
+            });
+            const double batched = bestNs([&]() {
+                for (size_t i = 0; i < kPackets; i += batch) {
+                    BufferCompression::decodeControllerStates(&packets.spans[i], std::min<size_t>(batch, kPackets - i), &out[i], &status[i], format);
+                }
+                sink += out[kPackets - 1].joy.x;
+            });
+            std::printf("%-20s %2zu per call  scalar %6.1f ns/packet  batch %6.1f ns/packet  %5.2fx  %zu mismatches  (%d)\n",
+                name, batch, scalar, batched, scalar / batched, bad, sink != 0);
+        }
+    }
+}
+
+int main() {
+#ifdef S2UK_PACKET_SSE2
+    std::printf("continuation masks: sse2\n");
+#else
+    std::printf("continuation masks: swar\n");
+#endif
+    std::mt19937_64 rng(21);
+    Handshake::WireFormat varint;
+    Handshake::WireFormat fixed;
+    fixed.codec = s2uk_packet::Codec::Fixed;
+    fixed.gyroScale = s2uk_packet::kFixedGyroScale;
+    fixed.joyScale = s2uk_packet::kFixedJoyScale;
+
+    bench("varint, phone", make(rng, s2uk_packet::Codec::Varint, false, false), varint);
+    bench("varint, phone, quat", make(rng, s2uk_packet::Codec::Varint, false, true), varint);
+    bench("varint, wide", make(rng, s2uk_packet::Codec::Varint, true, false), varint);
+    bench("fixed", make(rng, s2uk_packet::Codec::Fixed, false, false), fixed);
+    return 0;
+}
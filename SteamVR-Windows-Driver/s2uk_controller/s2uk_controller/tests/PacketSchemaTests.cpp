@@ -0,0 +1,355 @@
+#include "PacketSchema.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+// The layout is static_asserted in PacketSchema.h. The round-trip matrices below are
+// static_asserts too, but here, so every includer of the header doesn't pay for them at
+// compile time; the rest covers what the compiler can't: random values over the whole range,
+// malformed input, and the smallest-three quaternion, which needs sqrt.
+namespace {
+    using namespace s2uk_packet;
+
+    constexpr bool samePacket(const ControllerPacket& a, const ControllerPacket& b) {
+        if (a.flags != b.flags || a.modes != b.modes || a.battery != b.battery || a.senderTimeUs != b.senderTimeUs) return false;
+        if (a.flags & kFlagQuaternion) {
+            for (size_t i = 0; i < kSmallestThreeBytes; ++i) {
+                if (a.quat[i] != b.quat[i]) return false;
+            }
+        }
+        else {
+            for (size_t i = 0; i < 3; ++i) {
+                if (a.gyro[i] != b.gyro[i]) return false;
+            }
+        }
+        return a.joy[0] == b.joy[0] && a.joy[1] == b.joy[1];
+    }
+
+    // Encodes, decodes, and checks that every shorter prefix is rejected (or, for varint,
+    // that only the one without the optional time is accepted).
+    constexpr bool roundTrips(const ControllerPacket& p, Codec codec) {
+        uint8_t buf[kMaxPacketSize] = {};
+        const size_t n = encode(p, codec, buf);
+        ControllerPacket back;
+        if (decode(buf, n, codec, back) != Status::Ok || !samePacket(p, back)) return false;
+        for (size_t len = 0; len < n; ++len) {
+            ControllerPacket cut;
+            if (decode(buf, len, codec, cut) == Status::Ok) {
+                if (codec == Codec::Fixed || p.senderTimeUs == 0) return false;
+                uint8_t time[kMaxVarintBytes] = {};
+                if (len != n - static_cast<size_t>(detail::putVarint(time, p.senderTimeUs) - time)) return false;
+            }
+        }
+        return true;
+    }
+
+    constexpr ControllerPacket sample(uint8_t flags, int64_t g, int64_t j, uint64_t time) {
+        ControllerPacket p;
+        p.flags = flags;
+        p.modes = static_cast<uint8_t>(kModeTrigger.put(2) | kModeGrip.put(1) | kModeJoy.put(2));
+        p.battery = kMaxBattery;
+        p.gyro[0] = g; p.gyro[1] = -g; p.gyro[2] = g / 2;
+        for (size_t i = 0; i < kSmallestThreeBytes; ++i) p.quat[i] = static_cast<uint8_t>(0xA5 ^ (i * 37));
+        p.quat[kSmallestThreeBytes - 1] &= 0x7F; // bit 47
+        p.joy[0] = -j; p.joy[1] = j;
+        p.senderTimeUs = time;
+        return p;
+    }
+
+    // Codec x orientation x with and without time, at values every codec can hold.
+    constexpr bool roundTripMatrix() {
+        const Codec codecs[] = { Codec::Varint, Codec::Fixed, Codec::Delta };
+        const uint8_t flags[] = { 0, kFlagLeft | kFlagAOrX | kFlagJoyInDZ, kFlagQuaternion, 0x7F };
+        const uint64_t times[] = { 0, 1, 0x0123456789ABCDEFull };
+        for (Codec c : codecs) {
+            for (uint8_t f : flags) {
+                for (uint64_t t : times) {
+                    if (!roundTrips(sample(f, 0, 0, t), c)) return false;
+                    if (!roundTrips(sample(f, INT16_MAX, INT16_MIN + 1, t), c)) return false;
+                    if (!roundTrips(sample(f, 364 * kFixedGyroScale, kFixedJoyScale, t), c)) return false;
+                }
+            }
+        }
+        // Varint only: the legacy scales.
+        if (!roundTrips(sample(0, 180 * static_cast<int64_t>(kDefaultGyroScale), kDefaultJoyScale, 1), Codec::Varint)) return false;
+
+        HapticPacket h;
+        h.flags = kFlagLeft; h.amplitude = 1000; h.frequency = -32000; h.duration = 5;
+        uint8_t hb[kMaxHapticSize] = {};
+        HapticPacket hback;
+        if (decode(hb, encode(h, hb), hback) != Status::Ok) return false;
+        if (hback.flags != h.flags || hback.amplitude != h.amplitude || hback.frequency != h.frequency || hback.duration != h.duration) return false;
+
+        HapticEnvelopePacket e;
+        e.flags = kFlagLeft;
+        e.count = kMaxEnvelopePoints;
+        for (size_t i = 0; i < kMaxEnvelopePoints; ++i) {
+            e.points[i] = { static_cast<int64_t>(5 + i), i % 2 ? 0 : 1000 - static_cast<int64_t>(i), -static_cast<int64_t>(i) * 100 };
+        }
+        uint8_t eb[kMaxHapticEnvelopeSize] = {};
+        HapticEnvelopePacket eback;
+        const size_t en = encode(e, eb);
+        if (decode(eb, en, eback) != Status::Ok || eback.flags != e.flags || eback.count != e.count) return false;
+        for (size_t i = 0; i < kMaxEnvelopePoints; ++i) {
+            const HapticEnvelopePacket::Point &a = e.points[i], &b = eback.points[i];
+            if (a.duration != b.duration || a.amplitude != b.amplitude || a.frequency != b.frequency) return false;
+        }
+        if (decode(eb, en - 1, eback) != Status::Truncated) return false;
+        eb[1] = kMaxEnvelopePoints + 1;
+        if (decode(eb, en, eback) != Status::BadLayout) return false;
+
+        SendRatePacket r;
+        r.flags = kFlagLeft; r.hz = 250;
+        uint8_t rb[kMaxSendRateSize] = {};
+        SendRatePacket rback;
+        return decode(rb, encode(r, rb), rback) == Status::Ok && rback.flags == r.flags && rback.hz == r.hz;
+    }
+
+    // Packets of every codec with a full batch after them, in both orientation forms: the
+    // packet and the samples come back, and a small budget keeps the newest samples.
+    constexpr bool imuBatchRoundTrips(uint8_t flags) {
+        ImuBatch b;
+        b.count = kMaxImuSamples;
+        for (size_t i = 0; i < kMaxImuSamples; ++i) {
+            ImuSample& s = b.samples[i];
+            s.ageUs = static_cast<uint32_t>((kMaxImuSamples - i) * 2500);
+            s.gyro[0] = 90000 - static_cast<int64_t>(i) * 700; s.gyro[1] = -1; s.gyro[2] = INT32_MAX;
+            for (size_t k = 0; k < kSmallestThreeBytes; ++k) s.quat[k] = static_cast<uint8_t>(i * 31 + k);
+        }
+        const Codec codecs[] = { Codec::Varint, Codec::Fixed };
+        for (Codec c : codecs) {
+            const ControllerPacket p = sample(flags, 9000, 100, 123456789);
+            uint8_t buf[kMaxPacketSize + kMaxImuBatchSize] = {};
+            const size_t packetLen = encode(p, c, buf);
+            const size_t n = packetLen + encode(p, b, buf + packetLen);
+
+            size_t split = 0;
+            if (splitImuBatch(buf, n, split) != Status::Ok || split != packetLen) return false;
+            ControllerPacket back;
+            ImuBatch bback;
+            if (decode(buf, split, c, back) != Status::Ok || !samePacket(p, back)) return false;
+            if (decode(buf + split, n - 1 - split, back, bback) != Status::Ok || bback.count != b.count) return false;
+            for (size_t i = 0; i < b.count; ++i) {
+                const ImuSample &x = b.samples[i], &y = bback.samples[i];
+                if (x.ageUs != y.ageUs) return false;
+                for (size_t k = 0; k < kSmallestThreeBytes; ++k) {
+                    if ((flags & kFlagQuaternion) && x.quat[k] != y.quat[k]) return false;
+                }
+                for (size_t k = 0; k < 3; ++k) {
+                    if (!(flags & kFlagQuaternion) && x.gyro[k] != y.gyro[k]) return false;
+                }
+            }
+
+            uint8_t small[kMaxImuBatchSize] = {};
+            const size_t budget = n - packetLen - 1;
+            const size_t sn = encode(p, b, small, budget);
+            if (sn > budget || decode(small, sn - 1, p, bback) != Status::Ok || bback.count != b.count - 1) return false;
+            if (bback.samples[bback.count - 1].ageUs != b.samples[b.count - 1].ageUs) return false;
+            if (encode(p, b, small, 1) != 1 || small[0] != 0) return false;
+        }
+        return true;
+    }
+
+    // A slowly moving stream through DeltaEncoder and DeltaDecoder with every seventh packet
+    // lost, a keyframe among them: what arrives decodes to what was sent, except NoKeyframe
+    // for the deltas of the lost keyframe.
+    constexpr bool deltaStreamRoundTrips(uint8_t flags) {
+        DeltaEncoder enc;
+        DeltaDecoder dec;
+        bool keyLost = false, lostAKey = false;
+        for (uint32_t i = 0; i < 3 * kKeyframeInterval; ++i) {
+            ControllerPacket p = sample(flags, 1000 + i % 5, i / 10, 1000000 + 5000 * i);
+            p.quat[1] = static_cast<uint8_t>(p.quat[1] + i % 3);
+            if (i % 11 == 10) p.modes ^= kModeTrigger.put(1);
+
+            uint8_t buf[kMaxPacketSize] = {};
+            const size_t n = encode(p, enc, buf);
+            const bool keyframe = (buf[0] & kDeltaFrame) == 0;
+            if (keyframe != (enc.sinceKey == 0)) return false;
+            if (i % 7 == 4) {
+                keyLost = keyLost || keyframe;
+                lostAKey = lostAKey || keyframe;
+                continue;
+            }
+            if (keyframe) keyLost = false;
+
+            ControllerPacket back;
+            const Status s = decode(buf, n, dec, back);
+            if (keyLost ? s != Status::NoKeyframe : s != Status::Ok || !samePacket(p, back)) return false;
+        }
+        return lostAKey;
+    }
+
+    static_assert(imuBatchRoundTrips(0) && imuBatchRoundTrips(kFlagLeft | kFlagQuaternion), "IMU batches don't reproduce what was sent");
+    static_assert(deltaStreamRoundTrips(0) && deltaStreamRoundTrips(kFlagLeft | kFlagQuaternion), "delta streams don't reproduce what was sent");
+    static_assert(roundTripMatrix(), "packet encode and decode disagree");
+
+    ControllerPacket randomPacket(std::mt19937_64& rng, int64_t range) {
+        std::uniform_int_distribution<int64_t> value(-range, range);
+        ControllerPacket p;
+        p.flags = static_cast<uint8_t>(rng() & 0x7F);
+        p.modes = static_cast<uint8_t>(rng() & 0x3F);
+        p.battery = static_cast<uint8_t>(rng() % (kMaxBattery + 1));
+        for (int64_t& g : p.gyro) g = value(rng);
+        for (uint8_t& q : p.quat) q = static_cast<uint8_t>(rng());
+        p.quat[kSmallestThreeBytes - 1] &= 0x7F;
+        for (int64_t& j : p.joy) j = value(rng);
+        p.senderTimeUs = (rng() & 1) ? rng() : 0;
+        return p;
+    }
+
+    void randomRoundTrips() {
+        std::mt19937_64 rng(20);
+        for (int i = 0; i < 20000; ++i) {
+            // The varint codecs take any int64, the fixed one int16.
+            const bool wide = i % 2 == 0;
+            const ControllerPacket p = randomPacket(rng, wide ? INT64_MAX : INT16_MAX);
+            for (Codec c : { Codec::Varint, Codec::Fixed, Codec::Delta }) {
+                if (wide && c == Codec::Fixed) continue;
+                uint8_t buf[kMaxPacketSize] = {};
+                const size_t n = encode(p, c, buf);
+                CHECK(n <= kMaxPacketSize);
+                ControllerPacket back;
+                CHECK(decode(buf, n, c, back) == Status::Ok);
+                CHECK(samePacket(p, back));
+            }
+        }
+    }
+
+    void zigzagExtremes() {
+        for (int64_t v : { int64_t(0), int64_t(-1), int64_t(1), INT64_MIN, INT64_MAX, int64_t(INT32_MIN) }) {
+            CHECK(unzigzag(zigzag(v)) == v);
+        }
+        CHECK(zigzag(-1) == 1);
+        CHECK(zigzag(1) == 2);
+    }
+
+    // The fixed codec clamps instead of wrapping.
+    void fixedClamps() {
+        ControllerPacket p;
+        p.gyro[0] = 100000;
+        p.gyro[1] = -100000;
+        p.joy[0] = INT64_MAX;
+        uint8_t buf[kMaxPacketSize] = {};
+        ControllerPacket back;
+        CHECK(decode(buf, encode(p, Codec::Fixed, buf), Codec::Fixed, back) == Status::Ok);
+        CHECK(back.gyro[0] == INT16_MAX);
+        CHECK(back.gyro[1] == INT16_MIN);
+        CHECK(back.joy[0] == INT16_MAX);
+    }
+
+    void malformed() {
+        ControllerPacket out;
+        uint8_t buf[kMaxPacketSize + 8] = {};
+
+        CHECK(decode(buf, 2, Codec::Varint, out) == Status::TooShort);
+
+        // flags, modes, battery, then a varint that never ends.
+        for (size_t i = 3; i < 3 + kMaxVarintBytes + 1; ++i) buf[i] = 0x80;
+        CHECK(decode(buf, 3 + kMaxVarintBytes + 1, Codec::Varint, out) == Status::BadVarint);
+        CHECK(decode(buf, 3 + 4, Codec::Varint, out) == Status::Truncated);
+
+        // Quaternion packets need their six bytes.
+        buf[0] = kFlagQuaternion;
+        CHECK(decode(buf, 3 + kSmallestThreeBytes - 1, Codec::Varint, out) == Status::Truncated);
+
+        // A varint packet where a fixed one was agreed on.
+        ControllerPacket p;
+        p.gyro[0] = 5;
+        const size_t n = encode(p, Codec::Varint, buf);
+        CHECK(decode(buf, n, Codec::Fixed, out) == Status::TooShort);
+        std::fill(buf + n, buf + kFixedPacketSize, uint8_t(0));
+        CHECK(decode(buf, kFixedPacketSize, Codec::Fixed, out) == Status::BadLayout);
+
+        // Longer fixed packets are fine, fields may be appended later.
+        CHECK(encode(p, Codec::Fixed, buf) == kFixedPacketSize);
+        CHECK(decode(buf, kFixedPacketSize + 8, Codec::Fixed, out) == Status::Ok);
+
+        SendRatePacket rate;
+        CHECK(decode(buf, 1, rate) == Status::TooShort);
+
+        size_t split = 0;
+        const uint8_t batch[] = { 1, 2, 5 }; // claims five bytes of samples
+        CHECK(splitImuBatch(batch, sizeof(batch), split) == Status::Truncated);
+        CHECK(splitImuBatch(batch, 0, split) == Status::TooShort);
+    }
+
+    // A decoder that lost its keyframe (or a reconnect) rejects deltas until the next one.
+    void deltaWithoutKeyframe() {
+        DeltaEncoder enc;
+        ControllerPacket p;
+        p.gyro[0] = 1000;
+        uint8_t key[kMaxPacketSize] = {}, delta[kMaxPacketSize] = {};
+        const size_t kn = encode(p, enc, key);
+        p.gyro[0] = 1001;
+        const size_t dn = encode(p, enc, delta);
+        CHECK((delta[0] & kDeltaFrame) != 0);
+        CHECK(dn < kn);
+
+        DeltaDecoder fresh;
+        ControllerPacket out;
+        CHECK(decode(delta, dn, fresh, out) == Status::NoKeyframe);
+        CHECK(decode(key, kn, fresh, out) == Status::Ok);
+        CHECK(decode(delta, dn, fresh, out) == Status::Ok);
+        CHECK(out.gyro[0] == 1001);
+        // Codec::Delta on its own only reads keyframes.
+        CHECK(decode(delta, dn, Codec::Delta, out) == Status::NoKeyframe);
+    }
+
+    double angleDeg(const double a[4], const double b[4]) {
+        const double dot = std::fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+        return 2.0 * std::acos(std::min<double>(1.0, dot)) * 180.0 / 3.14159265358979323846;
+    }
+
+    void smallestThree() {
+        std::mt19937_64 rng(19);
+        std::normal_distribution<double> n(0.0, 1.0);
+        double worst = 0.0;
+        for (int i = 0; i < 100000; ++i) {
+            double q[4] = { n(rng), n(rng), n(rng), n(rng) };
+            const double len = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            for (double& v : q) v /= len;
+
+            uint8_t packed[kSmallestThreeBytes] = {};
+            packSmallestThree(q, packed);
+            CHECK((packed[kSmallestThreeBytes - 1] & 0x80) == 0);
+            double back[4] = {};
+            unpackSmallestThree(packed, back);
+            worst = std::max<double>(worst, angleDeg(q, back));
+
+            // q and -q are the same rotation and pack the same.
+            double neg[4] = { -q[0], -q[1], -q[2], -q[3] };
+            uint8_t packedNeg[kSmallestThreeBytes] = {};
+            packSmallestThree(neg, packedNeg);
+            CHECK(std::equal(packed, packed + kSmallestThreeBytes, packedNeg));
+        }
+        CHECK(worst < 0.01);
+
+        // Unnormalized input gets normalized, a zero one packs as the identity.
+        const double scaled[4] = { 0.0, 3.0, 0.0, -3.0 };
+        const double rotation[4] = { 0.0, std::sqrt(0.5), 0.0, -std::sqrt(0.5) };
+        const double zero[4] = { 0.0, 0.0, 0.0, 0.0 };
+        const double identity[4] = { 1.0, 0.0, 0.0, 0.0 };
+        uint8_t packed[kSmallestThreeBytes] = {};
+        double back[4] = {};
+        packSmallestThree(scaled, packed);
+        unpackSmallestThree(packed, back);
+        CHECK(angleDeg(rotation, back) < 0.01);
+        packSmallestThree(zero, packed);
+        unpackSmallestThree(packed, back);
+        CHECK(angleDeg(identity, back) < 0.01);
+    }
+}
+
+int main() {
+    randomRoundTrips();
+    zigzagExtremes();
+    fixedClamps();
+    malformed();
+    deltaWithoutKeyframe();
+    smallestThree();
+    return s2uk_test::result();
+}
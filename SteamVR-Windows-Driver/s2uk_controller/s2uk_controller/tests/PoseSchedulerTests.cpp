@@ -0,0 +1,106 @@
+#include "PoseScheduler.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+
+namespace {
+    constexpr uint64_t kStartUs = 1000000;
+    constexpr uint64_t kPeriodUs = 11111;  // 90 Hz
+    constexpr uint64_t kToPhotonsUs = 8000;
+
+    // A hand turning about the world Y axis at a steady rate.
+    constexpr double kRadPerS = 2.0;
+    Quaternion turned(uint64_t us) { return Quaternion::fromAxisAngle(0.0, 1.0, 0.0, kRadPerS * double(us - kStartUs) * 1e-6); }
+
+    void modes() {
+        for (auto m : { PoseScheduler::Mode::PerFrame, PoseScheduler::Mode::OnArrival, PoseScheduler::Mode::VsyncPredicted }) {
+            CHECK(PoseScheduler::parseMode(PoseScheduler::modeName(m)) == m);
+        }
+        CHECK(PoseScheduler::parseMode("bogus") == PoseScheduler::Mode::PerFrame);
+    }
+
+    void photonTime() {
+        PoseScheduler ps;
+        CHECK(ps.photonTimeUs(kStartUs) == kStartUs);
+        ps.setDisplayTiming(0, kPeriodUs, kToPhotonsUs);
+        CHECK(ps.photonTimeUs(kStartUs) == kStartUs + kPeriodUs / 2 + kToPhotonsUs);
+        ps.setDisplayTiming(kStartUs, kPeriodUs, kToPhotonsUs);
+        CHECK(ps.photonTimeUs(kStartUs + 3000) == kStartUs + kPeriodUs + kToPhotonsUs);
+        CHECK(ps.photonTimeUs(kStartUs + kPeriodUs + 1) == kStartUs + 2 * kPeriodUs + kToPhotonsUs);
+        // A vsync from the future (clocks just resynced) falls back to the estimate.
+        CHECK(ps.photonTimeUs(kStartUs - 1) == kStartUs - 1 + kPeriodUs / 2 + kToPhotonsUs);
+    }
+
+    // A steady turn is carried forward to the photon time and lands where the hand will be.
+    void predictsSteadyTurn() {
+        PoseScheduler ps;
+        ps.setDisplayTiming(kStartUs, kPeriodUs, kToPhotonsUs);
+        uint64_t t = kStartUs;
+        for (int i = 0; i < 20; ++i, t += 10000) ps.observe(turned(t), t);
+        const uint64_t sampleUs = t - 10000;
+
+        Quaternion q = turned(sampleUs);
+        const uint64_t now = sampleUs + 2000;
+        const uint64_t poseUs = ps.predict(now, q, sampleUs);
+        CHECK(poseUs == ps.photonTimeUs(now));
+        CHECK(s2uk_vecMath::angleBetweenDeg(q, turned(poseUs)) < 0.01);
+        CHECK(ps.getStats().predictUs == poseUs - sampleUs);
+    }
+
+    // However far off the photon time is, prediction stops at kMaxPredictUs.
+    void capsHorizon() {
+        PoseScheduler ps;
+        ps.setDisplayTiming(kStartUs, kPeriodUs, kToPhotonsUs);
+        uint64_t t = kStartUs;
+        for (int i = 0; i < 5; ++i, t += 10000) ps.observe(turned(t), t);
+        const uint64_t sampleUs = t - 10000;
+
+        Quaternion q = turned(sampleUs);
+        CHECK(ps.predict(sampleUs + 80000, q, sampleUs) == sampleUs + 50000);
+        CHECK(s2uk_vecMath::angleBetweenDeg(q, turned(sampleUs + 50000)) < 0.01);
+    }
+
+    // Nothing to go on: no clock, a single sample, or a gap that is too long.
+    void leavesPoseAlone() {
+        PoseScheduler ps;
+        ps.setDisplayTiming(kStartUs, kPeriodUs, kToPhotonsUs);
+        const Quaternion start = turned(kStartUs + 300000);
+
+        Quaternion q = start;
+        CHECK(ps.predict(kStartUs, q, 0) == 0);
+
+        ps.observe(turned(kStartUs), kStartUs);
+        CHECK(ps.predict(kStartUs + 1000, q, kStartUs) == kStartUs);
+
+        ps.observe(turned(kStartUs + 10000), kStartUs + 10000);
+        ps.observe(turned(kStartUs + 300000), kStartUs + 300000);
+        CHECK(ps.predict(kStartUs + 301000, q, kStartUs + 300000) == kStartUs + 300000);
+        CHECK(s2uk_vecMath::angleBetweenDeg(q, start) < 1e-9);
+    }
+
+    void accounting() {
+        PoseScheduler ps;
+        ps.setDisplayTiming(kStartUs, kPeriodUs, kToPhotonsUs);
+        ps.account(kStartUs + 1000, 0, 0, false);
+        CHECK(!ps.takeArrived());
+        ps.account(kStartUs + 2000, kStartUs - 3000, kStartUs - 3000, true);
+        CHECK(ps.takeArrived());
+        CHECK(!ps.takeArrived());
+
+        const auto st = ps.getStats();
+        CHECK(st.submitted == 2);
+        CHECK(st.arrivals == 1);
+        CHECK(st.sampleAgeUs == 5000);
+        CHECK(st.photonAgeUs == kPeriodUs + kToPhotonsUs + 3000);
+    }
+}
+
+int main() {
+    modes();
+    photonTime();
+    predictsSteadyTurn();
+    capsHorizon();
+    leavesPoseAlone();
+    accounting();
+    return s2uk_test::result();
+}
@@ -0,0 +1,170 @@
+#include "SendRateController.h"
+#include "TestCheck.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace {
+    using State = BufferCompression::ControllerState;
+    using Link = SendRateController::LinkQuality;
+
+    constexpr uint64_t kStartUs = 1000000;
+    constexpr uint64_t kFrameUs = 11111; // RunFrame at 90 Hz
+
+    struct Sent {
+        uint64_t atUs;
+        uint32_t hz;
+    };
+
+    // One hand: RunFrame calling update() with the latest state, the phone turning about Y at
+    // degS (quaternion states, so the speed is exact).
+    struct Hand {
+        SendRateController rc;
+        State state;
+        double angleDeg = 0.0;
+        uint64_t nowUs = kStartUs;
+        std::vector<Sent> sent;
+
+        Hand() {
+            state.joy_in_dz = true;
+            state.hasOrientation = true;
+        }
+
+        // Returns the rate the phone was last told, 0 if none.
+        uint32_t run(uint64_t forUs, float displayHz, double degS, const Link& link = {}) {
+            for (const uint64_t end = nowUs + forUs; nowUs < end; nowUs += kFrameUs) {
+                angleDeg += degS * double(kFrameUs) * 1e-6;
+                state.orientation = Quaternion::fromAxisAngle(0.0, 1.0, 0.0, angleDeg * M_PI / 180.0);
+                uint32_t hz = 0;
+                if (rc.update(nowUs, displayHz, &state, link, hz)) sent.push_back({ nowUs, hz });
+            }
+            return sent.empty() ? 0 : sent.back().hz;
+        }
+    };
+
+    // Until the controller proves it is still it asks for the display rate, clamped.
+    void startsAtDisplayRate() {
+        for (auto [display, expected] : { std::pair<float, uint32_t>{ 90.0f, 90 }, { 120.0f, 120 }, { 0.0f, 90 }, { 500.0f, 250 }, { 144.4f, 144 } }) {
+            Hand hand;
+            CHECK(hand.run(kFrameUs, display, 0.0) == expected);
+            CHECK(hand.rc.getStats().displayHz == expected);
+        }
+    }
+
+    // A still controller bleeds off to the idle rate, but only after the lower target has
+    // held for a second; every rate sent on the way is lower than the one before.
+    void stillFallsToIdle() {
+        Hand hand;
+        CHECK(hand.run(3000000, 90.0f, 0.0) == 20);
+        CHECK(hand.sent.size() >= 2);
+        CHECK(hand.sent[1].atUs - hand.sent[0].atUs >= 1000000);
+        for (size_t i = 1; i < hand.sent.size(); ++i) CHECK(hand.sent[i].hz <= hand.sent[i - 1].hz);
+
+        Hand slower;
+        slower.rc.setIdleRate(30);
+        CHECK(slower.run(3000000, 90.0f, 0.0) == 30);
+        Hand floor;
+        floor.rc.setIdleRate(1);
+        CHECK(floor.run(3000000, 90.0f, 0.0) == 10);
+    }
+
+    // Motion maps onto idle..display linearly between 5 and 90 deg/s, and a rise goes out at once.
+    void motionRaises() {
+        Hand hand;
+        CHECK(hand.run(3000000, 120.0f, 0.0) == 20);
+        // Half way: 20 + 100 * 0.5, less a frame of release, to 10 Hz.
+        CHECK(hand.run(1000000, 120.0f, 5.0 + 85.0 * 0.5) == 70);
+
+        const uint64_t turnAt = hand.nowUs;
+        CHECK(hand.run(100000, 120.0f, 180.0) == 120);
+        CHECK(hand.sent.back().atUs - turnAt <= 100000);
+        CHECK(hand.rc.getStats().motionDegS >= 170);
+
+        // Sensor noise is stillness.
+        Hand noisy;
+        CHECK(noisy.run(3000000, 90.0f, 4.0) == 20);
+    }
+
+    // A button, trigger or stick change is full motion however still the hand is.
+    void inputIsMotion() {
+        Hand hand;
+        CHECK(hand.run(3000000, 90.0f, 0.0) == 20);
+        hand.state.btn_a_or_x_state = true;
+        CHECK(hand.run(kFrameUs, 90.0f, 0.0) == 90);
+
+        Hand stick;
+        CHECK(stick.run(3000000, 90.0f, 0.0) == 20);
+        stick.state.joy_in_dz = false; // held off center
+        CHECK(stick.run(3000000, 90.0f, 0.0) == 90);
+    }
+
+    // A lossy, slow or backed-up link holds the rate at half the display rate (30 Hz at least),
+    // whatever the motion; an unknown link doesn't.
+    void linkCaps() {
+        Link lossy;
+        lossy.known = true;
+        lossy.loss = 0.1;
+        Link slow;
+        slow.known = true;
+        slow.rttUs = 70000;
+        Link backedUp;
+        backedUp.known = true;
+        backedUp.queueDepth = 17;
+        for (const Link& link : { lossy, slow, backedUp }) {
+            Hand hand;
+            CHECK(hand.run(2000000, 120.0f, 180.0, link) == 60);
+            CHECK(hand.run(2000000, 120.0f, 180.0) == 120);
+        }
+
+        Hand fine;
+        Link good;
+        good.known = true;
+        good.loss = 0.01;
+        good.rttUs = 20000;
+        good.queueDepth = 4;
+        CHECK(fine.run(2000000, 120.0f, 180.0, good) == 120);
+        Link unknown = lossy;
+        unknown.known = false;
+        CHECK(fine.run(2000000, 120.0f, 180.0, unknown) == 120);
+
+        Hand lowDisplay;
+        CHECK(lowDisplay.run(2000000, 40.0f, 180.0, lossy) == 30);
+    }
+
+    // A steady rate is repeated every two seconds for phones that reconnect, and that is not a change.
+    void refreshes() {
+        Hand hand;
+        hand.run(10000000, 90.0f, 180.0);
+        CHECK(hand.sent.size() == 5);
+        for (const Sent& s : hand.sent) CHECK(s.hz == 90);
+        CHECK(hand.rc.getStats().rateChanges == 1);
+    }
+
+    // Savings are measured against the phones' old fixed cadence, per one-second window.
+    void savings() {
+        Hand hand;
+        hand.run(kFrameUs, 90.0f, 0.0);
+        for (int i = 0; i < 30; ++i) hand.rc.onPacket(20, 4000);
+        hand.run(1000000 + kFrameUs, 90.0f, 0.0); // the window closes on the first frame past a second
+
+        const auto st = hand.rc.getStats();
+        CHECK(st.achievedHz == 30);
+        CHECK_NEAR(st.bytesPerSec, 600, 10);
+        CHECK(st.decodeNs == 4000);
+        CHECK(st.savedPerSec == SendRateController::kBaselineHz - 30);
+        CHECK(st.bytesSavedPerSec == st.savedPerSec * st.bytesPerSec / 30);
+        CHECK(st.decodeUsSavedPerSec == st.savedPerSec * 4);
+    }
+}
+
+int main() {
+    startsAtDisplayRate();
+    stillFallsToIdle();
+    motionRaises();
+    inputIsMotion();
+    linkCaps();
+    refreshes();
+    savings();
+    return s2uk_test::result();
+}
@@ -0,0 +1,95 @@
+#include "StateMailbox.h"
+#include "TestCheck.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Not a multiple of 8 bytes, so the last slot word is partial.
+    struct Odd {
+        uint8_t tag;
+        uint32_t value;
+        uint8_t bytes[7];
+    };
+
+    // Every field derives from value, so a torn read shows.
+    struct Checked {
+        uint64_t writer;
+        uint64_t value;
+        uint64_t copy[6];
+        bool consistent() const {
+            for (uint64_t c : copy) {
+                if (c != (value ^ (writer << 56))) return false;
+            }
+            return true;
+        }
+    };
+
+    void latestWins() {
+        StateMailbox<Odd> box;
+        Odd out{};
+        CHECK(!box.consume(out));
+
+        Odd a{ 1, 100, { 1, 2, 3, 4, 5, 6, 7 } };
+        box.publish(a);
+        CHECK(box.consume(out));
+        CHECK(out.tag == 1 && out.value == 100 && out.bytes[6] == 7);
+        CHECK(!box.consume(out)); // nothing new
+
+        for (uint8_t i = 2; i <= 4; ++i) box.publish(Odd{ i, 100u * i, {} });
+        CHECK(box.consume(out));
+        CHECK(out.tag == 4 && out.value == 400);
+
+        const auto st = box.getStats();
+        CHECK(st.published == 4);
+        CHECK(st.consumed == 2);
+        CHECK(st.dropped == 2);
+    }
+
+    // Two writers and a reader at full speed: no torn state, every writer's values only go
+    // up, and every publish is either consumed or counted as dropped.
+    void concurrent() {
+        StateMailbox<Checked> box;
+        constexpr uint64_t kPerWriter = 200000;
+        std::atomic<int> writing{ 2 };
+
+        auto writer = [&](uint64_t id) {
+            for (uint64_t v = 1; v <= kPerWriter; ++v) {
+                Checked c{ id, v, {} };
+                for (uint64_t& x : c.copy) x = v ^ (id << 56);
+                box.publish(c);
+            }
+            --writing;
+        };
+        std::thread w0(writer, 0), w1(writer, 1);
+
+        uint64_t last[2] = {};
+        bool torn = false, backwards = false;
+        Checked c{};
+        while (writing > 0) {
+            if (!box.consume(c)) continue;
+            torn = torn || c.writer > 1 || !c.consistent();
+            if (c.writer <= 1) {
+                backwards = backwards || c.value <= last[c.writer];
+                last[c.writer] = c.value;
+            }
+        }
+        w0.join();
+        w1.join();
+        box.consume(c);
+
+        CHECK(!torn);
+        CHECK(!backwards);
+        const auto st = box.getStats();
+        CHECK(st.published == 2 * kPerWriter);
+        CHECK(st.consumed + st.dropped == st.published);
+    }
+}
+
+int main() {
+    latestWins();
+    concurrent();
+    return s2uk_test::result();
+}
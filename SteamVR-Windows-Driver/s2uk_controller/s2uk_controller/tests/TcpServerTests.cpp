@@ -0,0 +1,462 @@
+#include "TcpServer.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// TcpSocketClass over loopback, against phones that misbehave: one that never reads what
+// the driver sends and one that floods the driver with junk. Whatever they do, the session's
+// queue and budgets have to hold and every enforcement has to show in the stats. Then phones
+// that drop and reconnect, which have to get their session back.
+namespace {
+    using namespace std::chrono_literals;
+
+    const char kLoginBinary[] = "s2uk_connection_init_bin\n";
+
+    bool waitUntil(const std::function<bool()>& done, std::chrono::milliseconds timeout = 5000ms) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(1ms);
+        }
+        return true;
+    }
+
+    struct Server {
+        TcpSocketClass tcp;
+        std::atomic<uint64_t> handled{ 0 };
+
+        explicit Server(const SessionLimits& limits) {
+            tcp.SetLimits(limits);
+            tcp.SetMessageHandler([this](SOCKET, WireMode, const Frame&) { ++handled; });
+            tcp.Connect(0);
+        }
+        ~Server() { tcp.CloseSocket(); }
+    };
+
+    // A phone on the other end of a loopback connection. rcvBuf shrinks its receive window,
+    // so a phone that doesn't read backs up into the driver's queue sooner.
+    struct Phone {
+        SOCKET sock = INVALID_SOCKET;
+        StreamFrameParser parser{ WireMode::Binary };
+
+        Phone(int port, int rcvBuf = 0) {
+            sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (rcvBuf) setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&rcvBuf), sizeof(rcvBuf));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(static_cast<uint16_t>(port));
+            CHECK(connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0);
+            s2uk_net::setNoDelay(sock);
+        }
+        ~Phone() { s2uk_net::closeSocket(sock); }
+
+        bool send(std::string_view data) {
+            size_t done = 0;
+            while (done < data.size()) {
+                const int n = s2uk_net::sendBytes(sock, data.data() + done, static_cast<int>(data.size() - done));
+                if (n <= 0) return false;
+                done += static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        // Reads frames until onFrame returns true, the driver closes the connection or the
+        // time is up. Returns whether onFrame was satisfied.
+        bool readUntil(const std::function<bool(const Frame&)>& onFrame, std::chrono::milliseconds timeout = 5000ms) {
+            const auto deadline = std::chrono::steady_clock::now() + timeout;
+            s2uk_net::setNonBlocking(sock);
+            while (std::chrono::steady_clock::now() < deadline) {
+                size_t room = 0;
+                char* dst = parser.prepare(room);
+                const int n = s2uk_net::recvBytes(sock, dst, static_cast<int>(room));
+                if (n == 0) return false;
+                if (n == SOCKET_ERROR) {
+                    if (!s2uk_net::wouldBlock(s2uk_net::lastError())) return false;
+                    std::this_thread::sleep_for(1ms);
+                    continue;
+                }
+                parser.commit(static_cast<size_t>(n));
+                Frame frame;
+                while (parser.next(frame) == StreamFrameParser::Status::Ready) {
+                    if (onFrame(frame)) return true;
+                }
+            }
+            return false;
+        }
+
+        // True once the driver has closed the connection (everything it sent is skipped).
+        bool closedByDriver(std::chrono::milliseconds timeout = 5000ms) {
+            const auto deadline = std::chrono::steady_clock::now() + timeout;
+            s2uk_net::setNonBlocking(sock);
+            char buf[4096];
+            while (std::chrono::steady_clock::now() < deadline) {
+                const int n = s2uk_net::recvBytes(sock, buf, sizeof(buf));
+                if (n == 0) return true;
+                if (n == SOCKET_ERROR) {
+                    if (!s2uk_net::wouldBlock(s2uk_net::lastError())) return true; // reset
+                    std::this_thread::sleep_for(1ms);
+                }
+            }
+            return false;
+        }
+    };
+
+    std::string sendRate(bool left, uint64_t hz) {
+        s2uk_packet::SendRatePacket p;
+        p.flags = left ? s2uk_packet::kFlagLeft : 0;
+        p.hz = hz;
+        uint8_t buf[s2uk_packet::kMaxSendRateSize];
+        return std::string(reinterpret_cast<const char*>(buf), s2uk_packet::encode(p, buf));
+    }
+
+    // A right hand haptic packet padded out, so the queue fills in a few hundred broadcasts.
+    std::string bigHaptic() {
+        return std::string(4000, '\0');
+    }
+
+    SessionLimits outboundLimits(SessionLimits::OutboundPolicy policy) {
+        SessionLimits limits;
+        limits.maxQueuedMessages = 8;
+        limits.maxQueuedBytes = 16 * 1024;
+        limits.outboundPolicy = policy;
+        return limits;
+    }
+
+    // A big haptic plus a send rate for each hand, the rates numbered by round.
+    void broadcastRound(Server& server, uint64_t round) {
+        server.tcp.broadcastMessage(FrameType::Haptic, bigHaptic());
+        server.tcp.broadcastMessage(FrameType::SendRate, sendRate(true, round));
+        server.tcp.broadcastMessage(FrameType::SendRate, sendRate(false, 1000 + round));
+    }
+
+    // Broadcasts rounds until the phone's queue has overflowed for a while. Returns the
+    // rounds sent.
+    uint64_t floodBroadcasts(Server& server, const std::function<uint64_t()>& overflowed) {
+        uint64_t rounds = 0;
+        while (rounds < 20000 && (rounds < 500 || overflowed() < 200)) {
+            broadcastRound(server, rounds);
+            ++rounds;
+            if (rounds % 64 == 0) std::this_thread::sleep_for(1ms); // let the loop keep up
+        }
+        return rounds;
+    }
+
+    void checkPeaks(const TcpSocketClass::LimitStats& st, const SessionLimits& limits) {
+        CHECK(st.peakQueuedMessages > 0);
+        CHECK(st.peakQueuedMessages <= limits.maxQueuedMessages);
+        CHECK(st.peakQueuedBytes <= limits.maxQueuedBytes);
+    }
+
+    // The phone stops reading. Its queue stays within the limits; the newest frame of each
+    // type and hand replaces the queued one, so once it reads again it gets the latest send
+    // rate for both hands, not just for whichever hand was broadcast last.
+    void slowReaderCoalesces() {
+        const SessionLimits limits = outboundLimits(SessionLimits::OutboundPolicy::Coalesce);
+        Server server(limits);
+        CHECK(server.tcp.GetStatus());
+        Phone phone(server.tcp.GetPort(), 4096);
+        CHECK(phone.send(kLoginBinary));
+        CHECK(waitUntil([&]() { return server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)); }));
+
+        uint64_t rounds = floodBroadcasts(server, [&]() { return server.tcp.GetLimitStats().coalesced; });
+        // The driver's send buffer keeps growing while the loop writes into it (up to a few MB
+        // on Linux). Keep going until it is full for good: once the loop has caught up, a round
+        // meets a full queue and all three of its frames replace queued ones.
+        bool full = false;
+        for (int tries = 0; tries < 50 && !full; ++tries) {
+            for (int i = 0; i < 100; ++i) {
+                broadcastRound(server, rounds++);
+                std::this_thread::sleep_for(100us);
+            }
+            uint64_t seen = ~uint64_t(0);
+            waitUntil([&]() {
+                std::this_thread::sleep_for(50ms);
+                const uint64_t now = server.tcp.GetLimitStats().coalesced;
+                return std::exchange(seen, now) == now;
+            });
+            broadcastRound(server, rounds++);
+            full = waitUntil([&]() { return server.tcp.GetLimitStats().coalesced >= seen + 3; }, 200ms);
+        }
+        CHECK(full);
+        const auto st = server.tcp.GetLimitStats();
+        CHECK(st.coalesced >= 200);
+        CHECK(st.queueDisconnects == 0);
+        checkPeaks(st, limits);
+
+        uint64_t lastLeft = 0, lastRight = 0;
+        const bool gotBoth = phone.readUntil([&](const Frame& frame) {
+            s2uk_packet::SendRatePacket p;
+            if (frame.type != FrameType::SendRate ||
+                s2uk_packet::decode(reinterpret_cast<const uint8_t*>(frame.payload.data()), frame.payload.size(), p) != s2uk_packet::Status::Ok) return false;
+            ((p.flags & s2uk_packet::kFlagLeft) ? lastLeft : lastRight) = p.hz;
+            return lastLeft == rounds - 1 && lastRight == 1000 + rounds - 1;
+        });
+        CHECK(gotBoth);
+        CHECK(lastLeft == rounds - 1);
+        CHECK(lastRight == 1000 + rounds - 1);
+    }
+
+    void slowReaderDropsOldest() {
+        const SessionLimits limits = outboundLimits(SessionLimits::OutboundPolicy::DropOldest);
+        Server server(limits);
+        Phone phone(server.tcp.GetPort(), 4096);
+        CHECK(phone.send(kLoginBinary));
+        CHECK(waitUntil([&]() { return server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)); }));
+
+        floodBroadcasts(server, [&]() { return server.tcp.GetLimitStats().droppedOldest; });
+        const auto st = server.tcp.GetLimitStats();
+        CHECK(st.droppedOldest >= 200);
+        CHECK(st.coalesced == 0);
+        checkPeaks(st, limits);
+    }
+
+    void slowReaderDisconnected() {
+        const SessionLimits limits = outboundLimits(SessionLimits::OutboundPolicy::Disconnect);
+        Server server(limits);
+        Phone phone(server.tcp.GetPort(), 4096);
+        CHECK(phone.send(kLoginBinary));
+        CHECK(waitUntil([&]() { return server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)); }));
+
+        floodBroadcasts(server, [&]() { return server.tcp.GetLimitStats().queueDisconnects * 1000; });
+        const auto st = server.tcp.GetLimitStats();
+        CHECK(st.queueDisconnects == 1);
+        CHECK(!server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)));
+        checkPeaks(st, limits);
+        CHECK(phone.closedByDriver());
+    }
+
+    SessionLimits inboundLimits(SessionLimits::InboundPolicy policy) {
+        SessionLimits limits;
+        limits.maxInboundMessagesPerSec = 200;
+        limits.maxInboundBytesPerSec = 16 * 1024;
+        limits.inboundPolicy = policy;
+        return limits;
+    }
+
+    // Frames of a type nobody knows, as fast as the socket takes them, for about a second.
+    // Returns the frames that went out.
+    uint64_t floodJunk(Phone& phone, const std::function<bool()>& stop) {
+        std::string burst;
+        for (int i = 0; i < 64; ++i) StreamFrameParser::appendFrame(burst, static_cast<FrameType>(0x7F), std::string(60, char(i)));
+        s2uk_net::setNonBlocking(phone.sock);
+        uint64_t frames = 0;
+        const auto end = std::chrono::steady_clock::now() + 1000ms;
+        size_t offset = 0;
+        while (std::chrono::steady_clock::now() < end && !stop()) {
+            const int n = s2uk_net::sendBytes(phone.sock, burst.data() + offset, static_cast<int>(burst.size() - offset));
+            if (n == SOCKET_ERROR) {
+                if (!s2uk_net::wouldBlock(s2uk_net::lastError())) break;
+                std::this_thread::sleep_for(1ms); // the driver stopped reading us
+                continue;
+            }
+            offset += static_cast<size_t>(n);
+            if (offset == burst.size()) { offset = 0; frames += 64; }
+        }
+        return frames;
+    }
+
+    // The flood is metered: most of it is dropped, reading pauses, and the phone next to it
+    // still gets through.
+    void junkFlooderThrottled() {
+        const SessionLimits limits = inboundLimits(SessionLimits::InboundPolicy::Throttle);
+        Server server(limits);
+        Phone flooder(server.tcp.GetPort());
+        Phone good(server.tcp.GetPort());
+        CHECK(flooder.send(kLoginBinary));
+        CHECK(good.send(kLoginBinary));
+        CHECK(waitUntil([&]() { return server.tcp.HasSession(2, htonl(INADDR_LOOPBACK)); }));
+
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t sent = floodJunk(flooder, []() { return false; });
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const auto st = server.tcp.GetLimitStats();
+        CHECK(sent > 1000);
+        CHECK(st.droppedInbound > 0);
+        CHECK(st.throttleEvents > 0);
+        CHECK(st.rateDisconnects == 0);
+        // One second of budget up front, then the refill.
+        CHECK(double(server.handled) <= limits.maxInboundMessagesPerSec * (1.0 + seconds) + 64);
+
+        const uint64_t before = server.handled;
+        std::string frame;
+        StreamFrameParser::appendFrame(frame, FrameType::ControllerState, "state");
+        CHECK(good.send(frame));
+        CHECK(waitUntil([&]() { return server.handled > before; }));
+        CHECK(server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)) && server.tcp.HasSession(2, htonl(INADDR_LOOPBACK)));
+    }
+
+    void junkFlooderDisconnected() {
+        const SessionLimits limits = inboundLimits(SessionLimits::InboundPolicy::Disconnect);
+        Server server(limits);
+        Phone flooder(server.tcp.GetPort());
+        CHECK(flooder.send(kLoginBinary));
+        CHECK(waitUntil([&]() { return server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)); }));
+
+        floodJunk(flooder, [&]() { return server.tcp.GetLimitStats().rateDisconnects > 0; });
+        CHECK(waitUntil([&]() { return server.tcp.GetLimitStats().rateDisconnects == 1; }));
+        CHECK(!server.tcp.HasSession(1, htonl(INADDR_LOOPBACK)));
+        CHECK(flooder.closedByDriver());
+    }
+
+    // Bytes that never make a line can't pile up past the receive buffer.
+    void unframedJunkClosed() {
+        Server server(SessionLimits{});
+        Phone phone(server.tcp.GetPort());
+        const std::string junk(StreamFrameParser::kMaxPayload + 100, 'x');
+        CHECK(phone.send(junk));
+        CHECK(phone.closedByDriver());
+        CHECK(server.handled == 0);
+    }
+
+    // Not what TcpClient offers: every value off the defaults, so a default can't pass for
+    // a restored one.
+    const char kHello[] = "s2uk_hello proto=1 framing=binary codec=fixed gyro_scale=50 joy_scale=20000 orientation=quat rate=60 role=left haptics=envelope\n";
+
+    struct Login {
+        std::string welcome; // or whatever other line came back
+        uint64_t token = 0;
+        bool resumed = false;
+    };
+
+    // Sends a login line and reads the driver's answer the way TcpClient does: a text line,
+    // then the first Session frame, which is when the phone starts sending.
+    bool logIn(Phone& phone, std::string_view line, Login& out) {
+        out = {};
+        phone.parser.setMode(WireMode::Text);
+        if (!phone.send(line)) return false;
+        return phone.readUntil([&](const Frame& frame) {
+            if (phone.parser.getMode() == WireMode::Text) {
+                out.welcome.assign(frame.payload);
+                phone.parser.setMode(WireMode::Binary);
+                return out.welcome.rfind(Handshake::kWelcome, 0) != 0; // no Session frame after anything else
+            }
+            if (frame.type != FrameType::Session || frame.payload.size() < 13) return false;
+            for (size_t i = 0; i < sizeof(uint64_t); ++i) out.token |= uint64_t(uint8_t(frame.payload[i])) << (8 * i);
+            out.resumed = (frame.payload[8] & 1) != 0;
+            return true;
+        });
+    }
+
+    uint32_t welcomedSession(const std::string& welcome) {
+        const size_t at = welcome.find(" session=");
+        return at == std::string::npos ? 0 : static_cast<uint32_t>(std::stoul(welcome.substr(at + 9)));
+    }
+
+    bool sendState(Phone& phone) {
+        std::string frame;
+        StreamFrameParser::appendFrame(frame, FrameType::ControllerState, std::string(12, '\0'));
+        return phone.send(frame);
+    }
+
+    // A resume line in place of the hello brings back the parked agreement and session id,
+    // so the phone's datagrams keep their session; the welcome is the first one again.
+    void resumeLineRestoresTheAgreement() {
+        Server server(SessionLimits{});
+        const uint32_t loopback = htonl(INADDR_LOOPBACK);
+        Login first;
+        {
+            Phone phone(server.tcp.GetPort());
+            CHECK(logIn(phone, kHello, first));
+        }
+        const uint32_t id = welcomedSession(first.welcome);
+        CHECK(id != 0 && first.token != 0 && !first.resumed);
+        CHECK(waitUntil([&]() { return !server.tcp.HasSession(id, loopback); }));
+
+        Phone phone(server.tcp.GetPort());
+        Login again;
+        CHECK(logIn(phone, Handshake::resumeLine(first.token) + "\n", again));
+        CHECK(again.welcome == first.welcome);
+        CHECK(again.resumed);
+        CHECK(again.token == first.token);
+        CHECK(server.tcp.GetSessionStats().resumed == 1);
+        CHECK(server.tcp.HasSession(id, loopback));
+
+        const Handshake::WireFormat format = server.tcp.PeerFormat(id);
+        CHECK(format.codec == Handshake::Codec::Fixed);
+        CHECK(format.gyroScale == 50 && format.joyScale == 20000);
+        CHECK(format.orientation == Handshake::Orientation::Quaternion);
+        CHECK(format.role == Handshake::Role::Left);
+        CHECK(server.tcp.WantsHapticEnvelopes());
+
+        CHECK(sendState(phone));
+        CHECK(waitUntil([&]() { return server.handled == 1; }));
+    }
+
+    // A token the driver doesn't have gets an answer rather than the connection closed, and
+    // the hello after it logs in as usual.
+    void unknownResumeTokenWaitsForHello() {
+        Server server(SessionLimits{});
+        Phone phone(server.tcp.GetPort());
+        Login login;
+        CHECK(logIn(phone, Handshake::resumeLine(0x1234) + "\n", login));
+        CHECK(login.welcome == Handshake::kResumeUnknown);
+        CHECK(logIn(phone, kHello, login));
+        CHECK(welcomedSession(login.welcome) != 0);
+        CHECK(login.token != 0 && !login.resumed);
+        CHECK(server.tcp.GetSessionStats().resumed == 0);
+    }
+
+    // From connect() to the driver handing on the phone's first state, for a new hello, a
+    // hello followed by a Resume frame and a resume line, each reconnecting after a drop.
+    // Returns the median in us.
+    uint64_t reconnectToFirstPoseUs(bool resumeLine, bool resumeFrame) {
+        Server server(SessionLimits{});
+        constexpr int kReconnects = 30;
+        std::vector<uint64_t> us;
+        uint64_t token = 0;
+        for (int i = 0; i < kReconnects; ++i) {
+            const uint64_t before = server.handled;
+            const auto start = std::chrono::steady_clock::now();
+            Phone phone(server.tcp.GetPort());
+            std::string line = resumeLine && token ? Handshake::resumeLine(token) + "\n" : std::string(kHello);
+            if (resumeFrame && token) {
+                std::string payload;
+                for (size_t b = 0; b < sizeof(uint64_t); ++b) payload.push_back(static_cast<char>(token >> (8 * b)));
+                StreamFrameParser::appendFrame(line, FrameType::Resume, payload);
+            }
+            Login login;
+            CHECK(logIn(phone, line, login));
+            CHECK(sendState(phone));
+            CHECK(waitUntil([&]() { return server.handled > before; }));
+            if (i > 0) us.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()));
+            if (!token) token = login.token; // a Resume frame's session keeps the first token too
+        }
+        CHECK(server.tcp.GetSessionStats().resumed == (resumeLine || resumeFrame ? kReconnects - 1 : 0));
+        std::sort(us.begin(), us.end());
+        return us.empty() ? 0 : us[us.size() / 2];
+    }
+
+    void reconnectToFirstPose() {
+        const uint64_t hello = reconnectToFirstPoseUs(false, false);
+        const uint64_t frame = reconnectToFirstPoseUs(false, true);
+        const uint64_t line = reconnectToFirstPoseUs(true, false);
+        std::printf("reconnect to first pose, median: hello %llu us, hello + Resume frame %llu us, resume line %llu us\n",
+            (unsigned long long)hello, (unsigned long long)frame, (unsigned long long)line);
+    }
+}
+
+int main() {
+    if (!s2uk_net::startup()) return 1;
+    slowReaderCoalesces();
+    slowReaderDropsOldest();
+    slowReaderDisconnected();
+    junkFlooderThrottled();
+    junkFlooderDisconnected();
+    unframedJunkClosed();
+    resumeLineRestoresTheAgreement();
+    unknownResumeTokenWaitsForHello();
+    reconnectToFirstPose();
+    s2uk_net::cleanup();
+    return s2uk_test::result();
+}
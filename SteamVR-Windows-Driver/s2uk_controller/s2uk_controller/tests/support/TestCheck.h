@@ -0,0 +1,41 @@
+#pragma once
+#ifndef S2UK_TestCheck
+#define S2UK_TestCheck
+
+#include <cmath>
+#include <cstdio>
+
+/**
+Just enough of a test framework for the driver tests. A failed CHECK prints where it
+failed and the test carries on; main returns s2uk_test::result(), so ctest sees it.
+**/
+namespace s2uk_test {
+    inline int& failures() {
+        static int n = 0;
+        return n;
+    }
+
+    inline int result() {
+        if (failures()) std::fprintf(stderr, "%d check(s) failed\n", failures());
+        return failures() ? 1 : 0;
+    }
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            ++s2uk_test::failures(); \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(a, b, eps) \
+    do { \
+        const double s2uk_a = (a), s2uk_b = (b); \
+        if (!(std::fabs(s2uk_a - s2uk_b) <= (eps))) { \
+            ++s2uk_test::failures(); \
+            std::fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %g vs %g\n", __FILE__, __LINE__, #a, #b, s2uk_a, s2uk_b); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+// The tests' VRLog.h: there is no SteamVR to log to, so LOG goes to stderr.
+
+#include <cstdio>
+
+#ifndef LOG
+#define LOG(...) (std::fprintf(stderr, __VA_ARGS__), std::fputc('\n', stderr))
+#endif